@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <squash/squash.h>
+
+/* Measures how many callback invocations (and how much time) it
+ * takes to push a buffer through squash_splice_custom_with_options
+ * with different buffer sizes.  A buffer size of 0 lets Squash pick
+ * (and grow) the buffer size on its own. */
+
+struct BenchmarkData {
+  const uint8_t* input;
+  size_t input_size;
+  size_t input_pos;
+
+  size_t output_size;
+
+  unsigned long reads;
+  unsigned long writes;
+};
+
+static SquashStatus
+benchmark_read (size_t* data_size, uint8_t data[], void* user_data) {
+  struct BenchmarkData* bench = (struct BenchmarkData*) user_data;
+  const size_t remaining = bench->input_size - bench->input_pos;
+
+  bench->reads++;
+
+  if (*data_size > remaining)
+    *data_size = remaining;
+
+  if (*data_size == 0)
+    return SQUASH_END_OF_STREAM;
+
+  memcpy (data, bench->input + bench->input_pos, *data_size);
+  bench->input_pos += *data_size;
+
+  return SQUASH_OK;
+}
+
+static SquashStatus
+benchmark_write (size_t* data_size, const uint8_t data[], void* user_data) {
+  struct BenchmarkData* bench = (struct BenchmarkData*) user_data;
+
+  (void) data;
+
+  bench->writes++;
+  bench->output_size += *data_size;
+
+  return SQUASH_OK;
+}
+
+static int
+benchmark_run (SquashCodec* codec, const uint8_t* input, size_t input_size, SquashOptions* options, size_t buffer_size) {
+  struct BenchmarkData bench = { input, input_size, 0, 0, 0, 0 };
+
+  if (options != NULL)
+    squash_options_set_buffer_size (options, buffer_size);
+
+  const clock_t start = clock ();
+  SquashStatus res = squash_splice_custom_with_options (codec, SQUASH_STREAM_COMPRESS,
+                                                        benchmark_write, benchmark_read, &bench,
+                                                        0, options);
+  const clock_t end = clock ();
+
+  if (res != SQUASH_OK) {
+    fprintf (stderr, "Splicing failed: %s (%d)\n", squash_status_to_string (res), res);
+    return -1;
+  }
+
+  if (buffer_size == 0)
+    fprintf (stdout, "%12s", "adaptive");
+  else
+    fprintf (stdout, "%12lu", (unsigned long) buffer_size);
+
+  fprintf (stdout, " %10lu %10lu %12lu %10.3f\n",
+           bench.reads, bench.writes,
+           (unsigned long) bench.output_size,
+           ((double) (end - start)) / CLOCKS_PER_SEC);
+
+  return 0;
+}
+
+int main (int argc, char** argv) {
+  static const size_t buffer_sizes[] = { 512, 4096, 65536, 1024 * 1024, 0 };
+  int retval = EXIT_SUCCESS;
+
+  if (argc < 2 || argc > 3) {
+    fprintf (stderr, "USAGE: %s CODEC [MEGABYTES]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  SquashCodec* codec = squash_get_codec (argv[1]);
+  if (codec == NULL) {
+    fprintf (stderr, "Unable to find codec '%s'\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+
+  const size_t input_size = ((argc == 3) ? (size_t) strtoul (argv[2], NULL, 0) : 64) * 1024 * 1024;
+  uint8_t* input = malloc (input_size);
+  if (input == NULL) {
+    fprintf (stderr, "Failed to allocate memory.\n");
+    return EXIT_FAILURE;
+  }
+
+  /* Something vaguely log-like, so it is actually compressible. */
+  {
+    size_t pos = 0;
+    unsigned long line = 0;
+    while (pos < input_size) {
+      char tmp[128];
+      int len = snprintf (tmp, sizeof (tmp), "%lu INFO request %lu served in %lu ms\n", line, line * 7919, line % 97);
+      if ((size_t) len > input_size - pos)
+        len = (int) (input_size - pos);
+      memcpy (input + pos, tmp, (size_t) len);
+      pos += (size_t) len;
+      line++;
+    }
+  }
+
+  SquashOptions* options = squash_options_new (codec, NULL);
+  if (options != NULL)
+    squash_object_ref (options);
+  else
+    fprintf (stderr, "Codec '%s' has no options; only testing the automatic buffer size.\n", argv[1]);
+
+  fprintf (stdout, "%12s %10s %10s %12s %10s\n", "buffer size", "reads", "writes", "output", "seconds");
+
+  for (size_t i = 0 ; i < sizeof (buffer_sizes) / sizeof (buffer_sizes[0]) ; i++) {
+    if (options == NULL && buffer_sizes[i] != 0)
+      continue;
+
+    if (benchmark_run (codec, input, input_size, options, buffer_sizes[i]) != 0) {
+      retval = EXIT_FAILURE;
+      break;
+    }
+  }
+
+  squash_object_unref (options);
+  free (input);
+
+  return retval;
+}
@@ -142,7 +142,7 @@ squash_plugin_init_codec (SquashCodec* codec, SquashCodecImpl* impl) {
   const char* name = squash_codec_get_name (codec);
 
   if (HEDLEY_LIKELY(strcmp ("copy", name) == 0)) {
-    impl->info = SQUASH_CODEC_INFO_CAN_FLUSH;
+    impl->info = SQUASH_CODEC_INFO_CAN_FLUSH | SQUASH_CODEC_INFO_PASSTHROUGH;
     impl->get_uncompressed_size = squash_copy_get_uncompressed_size;
     impl->get_max_compressed_size = squash_copy_get_max_compressed_size;
     impl->decompress_buffer = squash_copy_decompress_buffer;
@@ -37,6 +37,8 @@
 #if LZ4_VERSION_NUMBER < 10700
 #define LZ4_compress_default LZ4_compress_limitedOutput
 #define LZ4_compress_HC LZ4_compressHC2_limitedOutput
+#else
+#define SQUASH_LZ4_EXT_STATE
 #endif
 
 enum SquashLZ4OptIndex {
@@ -63,6 +65,26 @@ squash_lz4_get_max_compressed_size (SquashCodec* codec, size_t uncompressed_size
   return LZ4_COMPRESSBOUND(uncompressed_size);
 }
 
+#if defined(SQUASH_LZ4_EXT_STATE)
+/* LZ4 can only refer back 64 KiB, so anything before that in the
+ * dictionary is ignored. */
+#define SQUASH_LZ4_MAX_DICTIONARY_SIZE (64 * 1024)
+
+static const char*
+squash_lz4_get_dictionary_window (SquashDictionary* dictionary, int* window_size) {
+  const uint8_t* data = squash_dictionary_get_data (dictionary);
+  size_t size = squash_dictionary_get_size (dictionary);
+
+  if (size > SQUASH_LZ4_MAX_DICTIONARY_SIZE) {
+    data += size - SQUASH_LZ4_MAX_DICTIONARY_SIZE;
+    size = SQUASH_LZ4_MAX_DICTIONARY_SIZE;
+  }
+
+  *window_size = (int) size;
+  return (const char*) data;
+}
+#endif
+
 static SquashStatus
 squash_lz4_decompress_buffer (SquashCodec* codec,
                               size_t* decompressed_size,
@@ -76,10 +98,26 @@ squash_lz4_decompress_buffer (SquashCodec* codec,
     return squash_error (SQUASH_RANGE);
 #endif
 
-  int lz4_e = LZ4_decompress_safe ((char*) compressed,
-                                   (char*) decompressed,
-                                   (int) compressed_size,
-                                   (int) *decompressed_size);
+  int lz4_e;
+
+#if defined(SQUASH_LZ4_EXT_STATE)
+  SquashDictionary* dictionary = squash_options_get_dictionary (options);
+  if (dictionary != NULL) {
+    int dictionary_size;
+    const char* dictionary_data = squash_lz4_get_dictionary_window (dictionary, &dictionary_size);
+
+    lz4_e = LZ4_decompress_safe_usingDict ((const char*) compressed,
+                                           (char*) decompressed,
+                                           (int) compressed_size,
+                                           (int) *decompressed_size,
+                                           dictionary_data,
+                                           dictionary_size);
+  } else
+#endif
+  lz4_e = LZ4_decompress_safe ((char*) compressed,
+                               (char*) decompressed,
+                               (int) compressed_size,
+                               (int) *decompressed_size);
 
   if (lz4_e < 0) {
     return SQUASH_FAILED;
@@ -135,6 +173,110 @@ squash_lz4_level_to_hc_level (const int level) {
   }
 }
 
+#if defined(SQUASH_LZ4_EXT_STATE)
+static size_t
+squash_lz4_state_size (void) {
+  const int state_size = LZ4_sizeofState ();
+  const int hc_state_size = LZ4_sizeofStateHC ();
+
+  return (size_t) ((state_size > hc_state_size) ? state_size : hc_state_size);
+}
+
+/* A single state, large enough for both the fast and HC compressors,
+ * is shared by all compression levels. */
+static void*
+squash_lz4_create_context (SquashCodec* codec, SquashStreamType stream_type) {
+  if (stream_type != SQUASH_STREAM_COMPRESS)
+    return NULL;
+
+  return squash_malloc (squash_lz4_state_size ());
+}
+
+static void
+squash_lz4_destroy_context (SquashCodec* codec, SquashStreamType stream_type, void* context) {
+  squash_free (context);
+}
+
+/* Loading a dictionary means hashing all of it, so it is done once
+ * per dictionary (and HC level) and the loaded state is cached in the
+ * SquashDictionary.  Each compression starts from a copy of that
+ * state, which is the way LZ4 suggests reusing a dictionary without
+ * the experimental LZ4_attach_dictionary; the copy only reads from
+ * the cached state, so it can be shared between threads.  The fast
+ * compressor's state doesn't depend on the acceleration, so all the
+ * fast levels share variant 0. */
+static void*
+squash_lz4_create_dictionary_state (SquashDictionary* dictionary, SquashCodec* codec, SquashStreamType stream_type, int level) {
+  int dictionary_size;
+  const char* dictionary_data = squash_lz4_get_dictionary_window (dictionary, &dictionary_size);
+
+  if (level == 0) {
+    LZ4_stream_t* state = squash_malloc (sizeof (LZ4_stream_t));
+    if (HEDLEY_UNLIKELY(state == NULL))
+      return NULL;
+
+    LZ4_resetStream (state);
+    LZ4_loadDict (state, dictionary_data, dictionary_size);
+    return state;
+  } else {
+    LZ4_streamHC_t* state = squash_malloc (sizeof (LZ4_streamHC_t));
+    if (HEDLEY_UNLIKELY(state == NULL))
+      return NULL;
+
+    LZ4_resetStreamHC (state, squash_lz4_level_to_hc_level (level));
+    LZ4_loadDictHC (state, dictionary_data, dictionary_size);
+    return state;
+  }
+}
+
+static SquashStatus
+squash_lz4_compress_buffer_with_dictionary (SquashCodec* codec,
+                                            size_t* compressed_size,
+                                            uint8_t compressed[HEDLEY_ARRAY_PARAM(*compressed_size)],
+                                            size_t uncompressed_size,
+                                            const uint8_t uncompressed[HEDLEY_ARRAY_PARAM(uncompressed_size)],
+                                            int level,
+                                            SquashDictionary* dictionary) {
+  const void* loaded = squash_dictionary_get_digest (dictionary, codec, SQUASH_STREAM_COMPRESS, (level < 8) ? 0 : level,
+                                                     squash_lz4_create_dictionary_state, squash_free);
+  if (HEDLEY_UNLIKELY(loaded == NULL))
+    return squash_error (SQUASH_MEMORY);
+
+  void* state = squash_codec_acquire_context (codec, SQUASH_STREAM_COMPRESS);
+  if (HEDLEY_UNLIKELY(state == NULL))
+    return squash_error (SQUASH_MEMORY);
+
+  int lz4_r;
+  if (level < 8) {
+    memcpy (state, loaded, sizeof (LZ4_stream_t));
+    lz4_r = LZ4_compress_fast_continue ((LZ4_stream_t*) state,
+                                        (const char*) uncompressed,
+                                        (char*) compressed,
+                                        (int) uncompressed_size,
+                                        (int) *compressed_size,
+                                        (level == 7) ? 1 : squash_lz4_level_to_fast_mode (level));
+  } else {
+    memcpy (state, loaded, sizeof (LZ4_streamHC_t));
+    lz4_r = LZ4_compress_HC_continue ((LZ4_streamHC_t*) state,
+                                      (const char*) uncompressed,
+                                      (char*) compressed,
+                                      (int) uncompressed_size,
+                                      (int) *compressed_size);
+  }
+
+  squash_codec_release_context (codec, SQUASH_STREAM_COMPRESS, state, squash_lz4_state_size ());
+
+#if SIZE_MAX < INT_MAX
+  if (HEDLEY_UNLIKELY(SIZE_MAX < lz4_r))
+    return squash_error (SQUASH_RANGE);
+#endif
+
+  *compressed_size = lz4_r;
+
+  return HEDLEY_UNLIKELY(lz4_r == 0) ? squash_error (SQUASH_BUFFER_FULL) : SQUASH_OK;
+}
+#endif
+
 static SquashStatus
 squash_lz4_compress_buffer (SquashCodec* codec,
                             size_t* compressed_size,
@@ -152,6 +294,32 @@ squash_lz4_compress_buffer (SquashCodec* codec,
 
   int lz4_r;
 
+#if defined(SQUASH_LZ4_EXT_STATE)
+  SquashDictionary* dictionary = squash_options_get_dictionary (options);
+  if (dictionary != NULL)
+    return squash_lz4_compress_buffer_with_dictionary (codec, compressed_size, compressed, uncompressed_size, uncompressed, level, dictionary);
+
+  void* state = squash_codec_acquire_context (codec, SQUASH_STREAM_COMPRESS);
+  if (HEDLEY_LIKELY(state != NULL)) {
+    if (level < 8) {
+      lz4_r = LZ4_compress_fast_extState (state,
+                                          (const char*) uncompressed,
+                                          (char*) compressed,
+                                          (int) uncompressed_size,
+                                          (int) *compressed_size,
+                                          (level == 7) ? 1 : squash_lz4_level_to_fast_mode (level));
+    } else {
+      lz4_r = LZ4_compress_HC_extStateHC (state,
+                                          (const char*) uncompressed,
+                                          (char*) compressed,
+                                          (int) uncompressed_size,
+                                          (int) *compressed_size,
+                                          squash_lz4_level_to_hc_level (level));
+    }
+
+    squash_codec_release_context (codec, SQUASH_STREAM_COMPRESS, state, squash_lz4_state_size ());
+  } else
+#endif
   if (level == 7) {
     lz4_r = LZ4_compress_default ((char*) uncompressed,
                                   (char*) compressed,
@@ -242,6 +410,11 @@ squash_plugin_init_codec (SquashCodec* codec, SquashCodecImpl* impl) {
     impl->compress_buffer = squash_lz4_compress_buffer;
 #if LZ4_VERSION_NUMBER < 10700
     impl->compress_buffer_unsafe = squash_lz4_compress_buffer_unsafe;
+#endif
+#if defined(SQUASH_LZ4_EXT_STATE)
+    impl->info = SQUASH_CODEC_INFO_DICTIONARY;
+    impl->create_context = squash_lz4_create_context;
+    impl->destroy_context = squash_lz4_destroy_context;
 #endif
   } else {
     return squash_plugin_init_lz4f (codec, impl);
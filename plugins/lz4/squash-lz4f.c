@@ -475,7 +475,7 @@ squash_plugin_init_lz4f (SquashCodec* codec, SquashCodecImpl* impl) {
   const char* name = squash_codec_get_name (codec);
 
   if (HEDLEY_LIKELY(strcmp ("lz4", name) == 0)) {
-    impl->info = SQUASH_CODEC_INFO_CAN_FLUSH;
+    impl->info = SQUASH_CODEC_INFO_CAN_FLUSH | SQUASH_CODEC_INFO_CONCATENABLE;
     impl->options = squash_lz4f_options;
     impl->get_max_compressed_size = squash_lz4f_get_max_compressed_size;
     impl->create_stream = squash_lz4f_create_stream;
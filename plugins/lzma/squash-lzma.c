@@ -281,18 +281,18 @@ squash_lzma_stream_destroy (void* stream) {
   squash_stream_destroy (stream);
 }
 
-static SquashLZMAStream*
-squash_lzma_stream_new (SquashCodec* codec, SquashStreamType stream_type, SquashOptions* options) {
+/* Initialize (or, if it has already been initialized, re-initialize)
+   the encoder or decoder.  liblzma reuses the existing coder's memory
+   where possible, which is what makes resetting streams cheap. */
+static lzma_ret
+squash_lzma_stream_setup (SquashLZMAStream* stream) {
   lzma_ret lzma_e;
-  SquashLZMAStream* stream;
-  SquashLZMAType lzma_type;
+  SquashCodec* codec = ((SquashStream*) stream)->codec;
+  SquashOptions* options = ((SquashStream*) stream)->options;
+  SquashLZMAType lzma_type = stream->type;
   lzma_options_lzma lzma_options = { 0, };
   lzma_filter filters[2];
 
-  assert (codec != NULL);
-
-  lzma_type = squash_lzma_codec_to_type (codec);
-
   lzma_lzma_preset (&lzma_options, (uint32_t) squash_options_get_int_at (options, codec, SQUASH_LZMA_OPT_LEVEL));
   lzma_options.dict_size = squash_options_get_size_at (options, codec, SQUASH_LZMA_OPT_DICT_SIZE);
   lzma_options.lc = squash_options_get_int_at (options, codec, SQUASH_LZMA_OPT_LC);
@@ -305,6 +305,24 @@ squash_lzma_stream_new (SquashCodec* codec, SquashStreamType stream_type, Squash
       lzma_options.mf = (lzma_match_finder) mf;
   }
 
+  /* Only the raw formats can use a preset dictionary; neither .xz
+     nor .lzma has anywhere to say that one is needed.  liblzma copies
+     it into the coder's window during initialization, and there is no
+     way to share that work between coders, so it isn't cached. */
+  if (lzma_type == SQUASH_LZMA_TYPE_LZMA1 || lzma_type == SQUASH_LZMA_TYPE_LZMA2) {
+    SquashDictionary* dictionary = squash_options_get_dictionary (options);
+    if (dictionary != NULL) {
+      const size_t dictionary_size = squash_dictionary_get_size (dictionary);
+#if UINT32_MAX < SIZE_MAX
+      if (HEDLEY_UNLIKELY(UINT32_MAX < dictionary_size))
+        return LZMA_OPTIONS_ERROR;
+#endif
+
+      lzma_options.preset_dict = squash_dictionary_get_data (dictionary);
+      lzma_options.preset_dict_size = (uint32_t) dictionary_size;
+    }
+  }
+
   filters[0].options = &(lzma_options);
 
   switch (lzma_type) {
@@ -321,10 +339,7 @@ squash_lzma_stream_new (SquashCodec* codec, SquashStreamType stream_type, Squash
   filters[1].id = LZMA_VLI_UNKNOWN;
   filters[1].options = NULL;
 
-  stream = (SquashLZMAStream*) squash_malloc (sizeof (SquashLZMAStream));
-  squash_lzma_stream_init (stream, codec, lzma_type, stream_type, options, squash_lzma_stream_destroy);
-
-  if (stream_type == SQUASH_STREAM_COMPRESS) {
+  if (((SquashStream*) stream)->stream_type == SQUASH_STREAM_COMPRESS) {
     if (lzma_type == SQUASH_LZMA_TYPE_XZ) {
       lzma_e = lzma_stream_encoder (&(stream->stream), filters, (lzma_check) squash_options_get_int_at (options, codec, SQUASH_LZMA_OPT_CHECK));
     } else if (lzma_type == SQUASH_LZMA_TYPE_LZMA) {
@@ -335,7 +350,7 @@ squash_lzma_stream_new (SquashCodec* codec, SquashStreamType stream_type, Squash
     } else {
       HEDLEY_UNREACHABLE();
     }
-  } else if (stream_type == SQUASH_STREAM_DECOMPRESS) {
+  } else if (((SquashStream*) stream)->stream_type == SQUASH_STREAM_DECOMPRESS) {
     if (lzma_type == SQUASH_LZMA_TYPE_XZ) {
       const uint64_t memlimit = squash_options_get_size_at (options, codec, SQUASH_LZMA_OPT_MEM_LIMIT);
       lzma_e = lzma_stream_decoder(&(stream->stream), memlimit, 0);
@@ -353,7 +368,19 @@ squash_lzma_stream_new (SquashCodec* codec, SquashStreamType stream_type, Squash
     HEDLEY_UNREACHABLE();
   }
 
-  if (lzma_e != LZMA_OK) {
+  return lzma_e;
+}
+
+static SquashLZMAStream*
+squash_lzma_stream_new (SquashCodec* codec, SquashStreamType stream_type, SquashOptions* options) {
+  SquashLZMAStream* stream;
+
+  assert (codec != NULL);
+
+  stream = (SquashLZMAStream*) squash_malloc (sizeof (SquashLZMAStream));
+  squash_lzma_stream_init (stream, codec, squash_lzma_codec_to_type (codec), stream_type, options, squash_lzma_stream_destroy);
+
+  if (squash_lzma_stream_setup (stream) != LZMA_OK) {
     stream = squash_object_unref (stream);
   }
 
@@ -365,6 +392,14 @@ squash_lzma_create_stream (SquashCodec* codec, SquashStreamType stream_type, Squ
   return (SquashStream*) squash_lzma_stream_new (codec, stream_type, options);
 }
 
+static SquashStatus
+squash_lzma_reset_stream (SquashStream* stream) {
+  if (HEDLEY_UNLIKELY(squash_lzma_stream_setup ((SquashLZMAStream*) stream) != LZMA_OK))
+    return squash_error (SQUASH_FAILED);
+
+  return SQUASH_OK;
+}
+
 #define SQUASH_LZMA_STREAM_COPY_TO_LZMA_STREAM(stream,lzma_stream)  \
   lzma_stream->next_in =  stream->next_in;                          \
   lzma_stream->avail_in = stream->avail_in;                         \
@@ -453,19 +488,21 @@ squash_plugin_init_codec (SquashCodec* codec, SquashCodecImpl* impl) {
       impl->options = squash_lzma_xz_options;
       break;
     case SQUASH_LZMA_TYPE_LZMA2:
-      impl->info = SQUASH_CODEC_INFO_CAN_FLUSH;
+      impl->info = SQUASH_CODEC_INFO_CAN_FLUSH | SQUASH_CODEC_INFO_DICTIONARY;
       impl->options = squash_lzma12_options;
       break;
     case SQUASH_LZMA_TYPE_LZMA:
       impl->options = squash_lzma_options;
       break;
     case SQUASH_LZMA_TYPE_LZMA1:
+      impl->info = SQUASH_CODEC_INFO_DICTIONARY;
       impl->options = squash_lzma12_options;
       break;
   }
 
   impl->create_stream = squash_lzma_create_stream;
   impl->process_stream = squash_lzma_process_stream;
+  impl->reset_stream = squash_lzma_reset_stream;
   impl->get_max_compressed_size = squash_lzma_get_max_compressed_size;
 
   return SQUASH_OK;
@@ -243,6 +243,26 @@ squash_lzo_codec_from_name (const char* name) {
   return NULL;
 }
 
+/* Work memory is cached between calls (see
+ * squash_codec_acquire_context), so for compression allocate enough
+ * for any level and the same context can be used for all of them. */
+static size_t
+squash_lzo_codec_get_work_mem (const SquashLZOCodec* codec, SquashStreamType stream_type) {
+  if (stream_type == SQUASH_STREAM_DECOMPRESS)
+    return codec->work_mem;
+
+  size_t work_mem = 0;
+  const SquashLZOCompressor* compressor;
+  for ( compressor = codec->compressors ;
+        compressor->level != 0 ;
+        compressor++ ) {
+    if (compressor->work_mem > work_mem)
+      work_mem = compressor->work_mem;
+  }
+
+  return work_mem;
+}
+
 static SquashStatus
 squash_lzo_status_to_squash_status (int lzo_e) {
   SquashStatus res;
@@ -285,6 +305,21 @@ squash_lzo_get_max_compressed_size (SquashCodec* codec, size_t uncompressed_size
   return uncompressed_size + uncompressed_size / 16 + 64 + 3;
 }
 
+static void*
+squash_lzo_create_context (SquashCodec* codec, SquashStreamType stream_type) {
+  const SquashLZOCodec* lzo_codec = squash_lzo_codec_from_name (squash_codec_get_name (codec));
+  assert (lzo_codec != NULL);
+
+  const size_t work_mem = squash_lzo_codec_get_work_mem (lzo_codec, stream_type);
+
+  return (work_mem > 0) ? squash_malloc (work_mem) : NULL;
+}
+
+static void
+squash_lzo_destroy_context (SquashCodec* codec, SquashStreamType stream_type, void* context) {
+  squash_free (context);
+}
+
 static SquashStatus
 squash_lzo_decompress_buffer (SquashCodec* codec,
                               size_t* decompressed_size,
@@ -312,7 +347,7 @@ squash_lzo_decompress_buffer (SquashCodec* codec,
   decompressed_len = (lzo_uint) *decompressed_size;
 
   if (lzo_codec->work_mem > 0) {
-    work_mem = squash_malloc (lzo_codec->work_mem);
+    work_mem = squash_codec_acquire_context (codec, SQUASH_STREAM_DECOMPRESS);
     if (HEDLEY_UNLIKELY(work_mem == NULL)) {
       return squash_error (SQUASH_MEMORY);
     }
@@ -321,7 +356,7 @@ squash_lzo_decompress_buffer (SquashCodec* codec,
   lzo_e = lzo_codec->decompress (compressed, compressed_len,
                                  decompressed, &decompressed_len,
                                  work_mem);
-  squash_free (work_mem);
+  squash_codec_release_context (codec, SQUASH_STREAM_DECOMPRESS, work_mem, lzo_codec->work_mem);
 
   if (lzo_e != LZO_E_OK)
     return squash_lzo_status_to_squash_status (lzo_e);
@@ -367,7 +402,7 @@ squash_lzo_compress_buffer (SquashCodec* codec,
   compressed_len = (lzo_uint) (*compressed_size);
 
   if (compressor->work_mem > 0) {
-    work_mem = squash_malloc (compressor->work_mem);
+    work_mem = squash_codec_acquire_context (codec, SQUASH_STREAM_COMPRESS);
     if (HEDLEY_UNLIKELY(work_mem == NULL)) {
       return squash_error (SQUASH_MEMORY);
     }
@@ -377,7 +412,7 @@ squash_lzo_compress_buffer (SquashCodec* codec,
                                 compressed, &compressed_len,
                                 work_mem);
 
-  squash_free (work_mem);
+  squash_codec_release_context (codec, SQUASH_STREAM_COMPRESS, work_mem, squash_lzo_codec_get_work_mem (lzo_codec, SQUASH_STREAM_COMPRESS));
 
   if (lzo_e != LZO_E_OK)
     return squash_lzo_status_to_squash_status (lzo_e);
@@ -436,6 +471,8 @@ squash_plugin_init_codec (SquashCodec* codec, SquashCodecImpl* impl) {
   impl->get_max_compressed_size = squash_lzo_get_max_compressed_size;
   impl->decompress_buffer = squash_lzo_decompress_buffer;
   impl->compress_buffer_unsafe = squash_lzo_compress_buffer;
+  impl->create_context = squash_lzo_create_context;
+  impl->destroy_context = squash_lzo_destroy_context;
 
   return SQUASH_OK;
 }
@@ -87,6 +87,23 @@ squash_quicklz_get_uncompressed_size (SquashCodec* codec,
   return decompressed_l;
 }
 
+/* QuickLZ resets its tables for every buffer (we don't use the
+ * streaming buffer), so a state can safely be reused between calls;
+ * keeping them around saves allocating (or putting on the stack)
+ * several hundred kilobytes per call. */
+static void*
+squash_quicklz_create_context (SquashCodec* codec, SquashStreamType stream_type) {
+  if (stream_type == SQUASH_STREAM_COMPRESS)
+    return squash_malloc (sizeof (qlz_state_compress));
+  else
+    return squash_malloc (sizeof (qlz_state_decompress));
+}
+
+static void
+squash_quicklz_destroy_context (SquashCodec* codec, SquashStreamType stream_type, void* context) {
+  squash_free (context);
+}
+
 static SquashStatus
 squash_quicklz_decompress_buffer (SquashCodec* codec,
                                   size_t* decompressed_size,
@@ -95,7 +112,7 @@ squash_quicklz_decompress_buffer (SquashCodec* codec,
                                   const uint8_t compressed[HEDLEY_ARRAY_PARAM(compressed_size)],
                                   SquashOptions* options) {
   size_t decompressed_l, compressed_l;
-  qlz_state_decompress qlz_s;
+  qlz_state_decompress* qlz_s;
 
   if (!HEDLEY_LIKELY(squash_qlz_sizes(compressed_size, compressed, &decompressed_l, &compressed_l)))
     return squash_error (SQUASH_BUFFER_EMPTY);
@@ -105,9 +122,15 @@ squash_quicklz_decompress_buffer (SquashCodec* codec,
   if (HEDLEY_UNLIKELY(*decompressed_size < decompressed_l))
     return squash_error (SQUASH_BUFFER_FULL);
 
+  qlz_s = squash_codec_acquire_context (codec, SQUASH_STREAM_DECOMPRESS);
+  if (HEDLEY_UNLIKELY(qlz_s == NULL))
+    return squash_error (SQUASH_MEMORY);
+
   *decompressed_size = qlz_decompress ((const char*) compressed,
                                        (void*) decompressed,
-                                       &qlz_s);
+                                       qlz_s);
+
+  squash_codec_release_context (codec, SQUASH_STREAM_DECOMPRESS, qlz_s, sizeof (qlz_state_decompress));
 
   return HEDLEY_LIKELY(decompressed_l == *decompressed_size) ? SQUASH_OK : squash_error (SQUASH_FAILED);
 }
@@ -119,16 +142,22 @@ squash_quicklz_compress_buffer (SquashCodec* codec,
                                 size_t uncompressed_size,
                                 const uint8_t uncompressed[HEDLEY_ARRAY_PARAM(uncompressed_size)],
                                 SquashOptions* options) {
-  qlz_state_compress qlz_s;
+  qlz_state_compress* qlz_s;
 
   if (HEDLEY_UNLIKELY(*compressed_size < squash_quicklz_get_max_compressed_size (codec, uncompressed_size))) {
     return squash_error (SQUASH_BUFFER_FULL);
   }
 
+  qlz_s = squash_codec_acquire_context (codec, SQUASH_STREAM_COMPRESS);
+  if (HEDLEY_UNLIKELY(qlz_s == NULL))
+    return squash_error (SQUASH_MEMORY);
+
   *compressed_size = qlz_compress ((const void*) uncompressed,
                                      (char*) compressed,
                                      uncompressed_size,
-                                     &qlz_s);
+                                     qlz_s);
+
+  squash_codec_release_context (codec, SQUASH_STREAM_COMPRESS, qlz_s, sizeof (qlz_state_compress));
 
   return HEDLEY_UNLIKELY(*compressed_size == 0) ? squash_error (SQUASH_FAILED) : SQUASH_OK;
 }
@@ -142,6 +171,8 @@ squash_plugin_init_codec (SquashCodec* codec, SquashCodecImpl* impl) {
     impl->get_max_compressed_size = squash_quicklz_get_max_compressed_size;
     impl->decompress_buffer = squash_quicklz_decompress_buffer;
     impl->compress_buffer = squash_quicklz_compress_buffer;
+    impl->create_context = squash_quicklz_create_context;
+    impl->destroy_context = squash_quicklz_destroy_context;
   } else {
     return squash_error (SQUASH_UNABLE_TO_LOAD);
   }
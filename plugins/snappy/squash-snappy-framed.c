@@ -586,7 +586,7 @@ squash_plugin_init_snappy_framed_codec (SquashCodec* codec, SquashCodecImpl* imp
   const char* name = squash_codec_get_name (codec);
 
   if (strcmp ("snappy-framed", name) == 0) {
-    impl->info = SQUASH_CODEC_INFO_CAN_FLUSH;
+    impl->info = SQUASH_CODEC_INFO_CAN_FLUSH | SQUASH_CODEC_INFO_CONCATENABLE;
     impl->get_max_compressed_size = squash_snappy_framed_get_max_compressed_size;
     impl->create_stream = squash_snappy_framed_create_stream;
     impl->process_stream = squash_snappy_framed_process_stream;
@@ -155,11 +155,123 @@ squash_zlib_stream_destroy (void* stream) {
   squash_stream_destroy (stream);
 }
 
+static int
+squash_zlib_window_bits (SquashZlibType type, int window_bits) {
+  if (type == SQUASH_ZLIB_TYPE_DEFLATE) {
+    return -window_bits;
+  } else if (type == SQUASH_ZLIB_TYPE_GZIP) {
+    return window_bits + 16;
+  } else {
+    return window_bits;
+  }
+}
+
+/* With a dictionary, compression streams are copied from a deflate
+ * state which has already been primed with it, which saves hashing
+ * the whole dictionary again for every stream.  The primed state
+ * depends on every option, so they are all packed into the digest
+ * variant. */
+#define SQUASH_ZLIB_VARIANT(level,window_bits,mem_level,strategy) \
+  ((level) | ((window_bits) << 4) | ((mem_level) << 8) | ((strategy) << 12))
+
+static void*
+squash_zlib_create_deflate_digest (SquashDictionary* dictionary, SquashCodec* codec, SquashStreamType stream_type, int variant) {
+  z_stream* primed = squash_malloc (sizeof (z_stream));
+  if (HEDLEY_UNLIKELY(primed == NULL))
+    return NULL;
+
+  z_stream tmp = { 0, };
+  *primed = tmp;
+  primed->zalloc = squash_zlib_malloc;
+  primed->zfree = squash_zlib_free;
+
+  int zlib_e = deflateInit2 (primed,
+                             variant & 0xf,
+                             Z_DEFLATED,
+                             squash_zlib_window_bits (squash_zlib_codec_to_type (codec), (variant >> 4) & 0xf),
+                             (variant >> 8) & 0xf,
+                             (variant >> 12) & 0xf);
+  if (HEDLEY_UNLIKELY(zlib_e != Z_OK)) {
+    squash_free (primed);
+    return NULL;
+  }
+
+  zlib_e = deflateSetDictionary (primed, squash_dictionary_get_data (dictionary), (uInt) squash_dictionary_get_size (dictionary));
+  if (HEDLEY_UNLIKELY(zlib_e != Z_OK)) {
+    deflateEnd (primed);
+    squash_free (primed);
+    return NULL;
+  }
+
+  return primed;
+}
+
+static void
+squash_zlib_free_deflate_digest (void* digest) {
+  deflateEnd ((z_stream*) digest);
+  squash_free (digest);
+}
+
+/* Initialize (or re-initialize) the z_stream, with the dictionary if
+   there is one. */
+static int
+squash_zlib_stream_init_zlib (SquashZlibStream* stream, bool reset) {
+  SquashStream* s = (SquashStream*) stream;
+  SquashCodec* codec = s->codec;
+  SquashOptions* options = s->options;
+  SquashDictionary* dictionary = squash_options_get_dictionary (options);
+  int zlib_e;
+
+  const int window_bits = squash_options_get_int_at (options, codec, SQUASH_ZLIB_OPT_WINDOW_BITS);
+
+  if (s->stream_type == SQUASH_STREAM_COMPRESS) {
+    const int level = squash_options_get_int_at (options, codec, SQUASH_ZLIB_OPT_LEVEL);
+    const int mem_level = squash_options_get_int_at (options, codec, SQUASH_ZLIB_OPT_MEM_LEVEL);
+    const int strategy = squash_options_get_int_at (options, codec, SQUASH_ZLIB_OPT_STRATEGY);
+
+    if (dictionary == NULL) {
+      if (reset)
+        return deflateReset (&(stream->stream));
+
+      return deflateInit2 (&(stream->stream),
+                           level,
+                           Z_DEFLATED,
+                           squash_zlib_window_bits (stream->type, window_bits),
+                           mem_level,
+                           strategy);
+    }
+
+    z_stream* primed = squash_dictionary_get_digest (dictionary, codec, SQUASH_STREAM_COMPRESS,
+                                                     SQUASH_ZLIB_VARIANT(level, window_bits, mem_level, strategy),
+                                                     squash_zlib_create_deflate_digest,
+                                                     squash_zlib_free_deflate_digest);
+    if (HEDLEY_UNLIKELY(primed == NULL))
+      return Z_MEM_ERROR;
+
+    if (reset)
+      deflateEnd (&(stream->stream));
+    /* deflateCopy only reads from the primed state, so it can be
+       shared between threads. */
+    zlib_e = deflateCopy (&(stream->stream), primed);
+  } else {
+    zlib_e = reset ?
+      inflateReset (&(stream->stream)) :
+      inflateInit2 (&(stream->stream), squash_zlib_window_bits (stream->type, window_bits));
+
+    /* Raw deflate has no header to ask for the dictionary, so it
+       has to be set up front; zlib streams ask for it (see
+       squash_zlib_process_stream). */
+    if (zlib_e == Z_OK && dictionary != NULL && stream->type == SQUASH_ZLIB_TYPE_DEFLATE)
+      zlib_e = inflateSetDictionary (&(stream->stream), squash_dictionary_get_data (dictionary), (uInt) squash_dictionary_get_size (dictionary));
+  }
+
+  return zlib_e;
+}
+
 static SquashZlibStream*
 squash_zlib_stream_new (SquashCodec* codec, SquashStreamType stream_type, SquashOptions* options) {
   int zlib_e = 0;
   SquashZlibStream* stream;
-  int window_bits;
 
   assert (codec != NULL);
   assert (stream_type == SQUASH_STREAM_COMPRESS || stream_type == SQUASH_STREAM_DECOMPRESS);
@@ -169,25 +281,7 @@ squash_zlib_stream_new (SquashCodec* codec, SquashStreamType stream_type, Squash
 
   stream->type = squash_zlib_codec_to_type (codec);
 
-  window_bits = squash_options_get_int_at (options, codec, SQUASH_ZLIB_OPT_WINDOW_BITS);
-  if (stream->type == SQUASH_ZLIB_TYPE_DEFLATE) {
-    window_bits = -window_bits;
-  } else if (stream->type == SQUASH_ZLIB_TYPE_GZIP) {
-    window_bits += 16;
-  }
-
-  if (stream_type == SQUASH_STREAM_COMPRESS) {
-    zlib_e = deflateInit2 (&(stream->stream),
-                           squash_options_get_int_at (options, codec, SQUASH_ZLIB_OPT_LEVEL),
-                           Z_DEFLATED,
-                           window_bits,
-                           squash_options_get_int_at (options, codec, SQUASH_ZLIB_OPT_MEM_LEVEL),
-                           squash_options_get_int_at (options, codec, SQUASH_ZLIB_OPT_STRATEGY));
-  } else if (stream_type == SQUASH_STREAM_DECOMPRESS) {
-    zlib_e = inflateInit2 (&(stream->stream), window_bits);
-  } else {
-    HEDLEY_UNREACHABLE();
-  }
+  zlib_e = squash_zlib_stream_init_zlib (stream, false);
 
   if (zlib_e != Z_OK) {
     stream = squash_object_unref (stream);
@@ -201,6 +295,16 @@ squash_zlib_create_stream (SquashCodec* codec, SquashStreamType stream_type, Squ
   return (SquashStream*) squash_zlib_stream_new (codec, stream_type, options);
 }
 
+static SquashStatus
+squash_zlib_reset_stream (SquashStream* stream) {
+  const int zlib_e = squash_zlib_stream_init_zlib ((SquashZlibStream*) stream, true);
+
+  if (HEDLEY_UNLIKELY(zlib_e != Z_OK))
+    return squash_error (SQUASH_FAILED);
+
+  return SQUASH_OK;
+}
+
 #define SQUASH_ZLIB_STREAM_COPY_TO_ZLIB_STREAM(stream,zlib_stream) \
   zlib_stream->next_in = (Bytef*) stream->next_in; \
   zlib_stream->avail_in = (uInt) stream->avail_in; \
@@ -251,6 +355,13 @@ squash_zlib_process_stream (SquashStream* stream, SquashOperation operation) {
     zlib_e = deflate (zlib_stream, squash_operation_to_zlib (operation));
   } else {
     zlib_e = inflate (zlib_stream, squash_operation_to_zlib (operation));
+    if (zlib_e == Z_NEED_DICT) {
+      SquashDictionary* dictionary = squash_options_get_dictionary (stream->options);
+      if (dictionary != NULL)
+        zlib_e = inflateSetDictionary (zlib_stream, squash_dictionary_get_data (dictionary), (uInt) squash_dictionary_get_size (dictionary));
+      if (zlib_e == Z_OK)
+        zlib_e = inflate (zlib_stream, squash_operation_to_zlib (operation));
+    }
   }
 
 #if SIZE_MAX < UINT_MAX
@@ -362,9 +473,13 @@ squash_plugin_init_codec (SquashCodec* codec, SquashCodecImpl* impl) {
       strcmp ("zlib", name) == 0 ||
       strcmp ("deflate", name) == 0) {
     impl->info = SQUASH_CODEC_INFO_CAN_FLUSH;
+    /* gzip has no way to refer to a dictionary */
+    if (strcmp ("gzip", name) != 0)
+      impl->info |= SQUASH_CODEC_INFO_DICTIONARY;
     impl->options = squash_zlib_options;
     impl->create_stream = squash_zlib_create_stream;
     impl->process_stream = squash_zlib_process_stream;
+    impl->reset_stream = squash_zlib_reset_stream;
     impl->get_max_compressed_size = squash_zlib_get_max_compressed_size;
   } else {
     return SQUASH_UNABLE_TO_LOAD;
@@ -54,22 +54,46 @@ static SquashOptionInfo squash_zpaq_options[] = {
 
 typedef struct _SquashZpaqStream SquashZpaqStream;
 
+/* libzpaq reads and writes a single byte at a time, so if the
+   callbacks can lend us their buffers we use those instead of
+   invoking a callback for every byte. */
+#define SQUASH_ZPAQ_BORROW_SIZE ((size_t) (64 * 1024))
+
 class SquashZpaqIO: public libzpaq::Reader, public libzpaq::Writer {
 public:
   void* user_data_;
   SquashReadFunc reader_;
   SquashWriteFunc writer_;
 
+  SquashReadBorrowFunc read_borrow_;
+  SquashWriteBorrowFunc write_borrow_;
+  const uint8_t* in_;
+  size_t in_avail_;
+  uint8_t* out_;
+  size_t out_avail_;
+  size_t out_used_;
+
   int get ();
   void put (int c);
 
   int read (char* buf, int n);
   void write (const char* buf, int n);
 
+  bool fill ();
+  void next_output ();
+  void commit ();
+
   SquashZpaqIO(void* user_data, SquashReadFunc reader, SquashWriteFunc writer) :
     user_data_ (user_data),
     reader_ (reader),
-    writer_ (writer) { }
+    writer_ (writer),
+    read_borrow_ (squash_splice_get_read_borrow (reader)),
+    write_borrow_ (squash_splice_get_write_borrow (writer)),
+    in_ (NULL),
+    in_avail_ (0),
+    out_ (NULL),
+    out_avail_ (0),
+    out_used_ (0) { }
 };
 
 extern "C" SQUASH_PLUGIN_EXPORT
@@ -88,23 +112,104 @@ libzpaq::error (const char* msg) {
     throw squash_error (SQUASH_FAILED);
 }
 
+bool SquashZpaqIO::fill () {
+  /* Borrowed output has to be committed before reading. */
+  this->commit ();
+
+  size_t size = SQUASH_ZPAQ_BORROW_SIZE;
+  SquashStatus res = this->read_borrow_ (&size, &(this->in_), this->user_data_);
+  if (res < 0)
+    throw res;
+
+  this->in_avail_ = size;
+  return size != 0;
+}
+
+void SquashZpaqIO::next_output () {
+  size_t size = SQUASH_ZPAQ_BORROW_SIZE;
+  SquashStatus res = this->write_borrow_ (this->out_used_, &size, &(this->out_), this->user_data_);
+  if (res < 0)
+    throw res;
+  else if (HEDLEY_UNLIKELY(size == 0))
+    throw squash_error (SQUASH_BUFFER_FULL);
+
+  this->out_avail_ = size;
+  this->out_used_ = 0;
+}
+
+void SquashZpaqIO::commit () {
+  if (this->out_ == NULL)
+    return;
+
+  SquashStatus res = this->write_borrow_ (this->out_used_, NULL, NULL, this->user_data_);
+  this->out_ = NULL;
+  this->out_avail_ = 0;
+  this->out_used_ = 0;
+
+  if (res < 0)
+    throw res;
+}
+
 int SquashZpaqIO::get () {
-  char v;
-  return (this->read(&v, 1)) ? (int) v : -1;
+  if (this->read_borrow_ != NULL) {
+    if (this->in_avail_ == 0 && !this->fill ())
+      return -1;
+
+    this->in_avail_--;
+    return *(this->in_++);
+  }
+
+  uint8_t v;
+  return (this->read ((char*) &v, 1)) ? (int) v : -1;
 }
 
 int SquashZpaqIO::read (char* buf, int size) {
+  if (this->read_borrow_ != NULL) {
+    size_t pos = 0;
+    while (pos < (size_t) size && (this->in_avail_ != 0 || this->fill ())) {
+      const size_t cp_size = (this->in_avail_ < (size_t) size - pos) ? this->in_avail_ : (size_t) size - pos;
+      memcpy (buf + pos, this->in_, cp_size);
+      this->in_ += cp_size;
+      this->in_avail_ -= cp_size;
+      pos += cp_size;
+    }
+    return (int) pos;
+  }
+
   size_t l = (size_t) size;
   this->reader_ (&l, (uint8_t*) buf, this->user_data_);
   return l;
 }
 
 void SquashZpaqIO::put (int c) {
+  if (this->write_borrow_ != NULL) {
+    if (this->out_used_ == this->out_avail_)
+      this->next_output ();
+
+    this->out_[this->out_used_++] = (uint8_t) c;
+    return;
+  }
+
   uint8_t v = (uint8_t) c;
   this->write ((const char*) &v, 1);
 }
 
 void SquashZpaqIO::write (const char* buf, int n) {
+  if (this->write_borrow_ != NULL) {
+    size_t pos = 0;
+    while (pos < (size_t) n) {
+      if (this->out_used_ == this->out_avail_)
+        this->next_output ();
+
+      const size_t available = this->out_avail_ - this->out_used_;
+      const size_t cp_size = (available < (size_t) n - pos) ? available : (size_t) n - pos;
+      memcpy (this->out_ + this->out_used_, buf + pos, cp_size);
+      this->out_used_ += cp_size;
+      pos += cp_size;
+    }
+    return;
+  }
+
   size_t s = (size_t) n;
   SquashStatus res = this->writer_ (&s, (const uint8_t*) buf, this->user_data_);
   if (res != SQUASH_OK)
@@ -128,6 +233,8 @@ squash_zpaq_splice (SquashCodec* codec,
     } else {
       decompress (&stream, &stream);
     }
+
+    stream.commit ();
   } catch (const std::bad_alloc& e) {
     (void) e;
     return squash_error (SQUASH_MEMORY);
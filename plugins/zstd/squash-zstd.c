@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 
 #include <squash/squash.h>
 
@@ -39,11 +40,18 @@
 #  include "zstd/lib/common/error_public.h"
 #endif
 
+/* The multi-threaded trainer (fastCover) was added in 1.3.6. */
+#if ZSTD_VERSION_NUMBER >= 10306
+#  define ZDICT_STATIC_LINKING_ONLY
+#endif
+#include <zdict.h>
+
 
 typedef struct SquashZstdStream_s {
   SquashStream base_object;
   ZSTD_CStream* cstream;
   ZSTD_DStream* dstream;
+  SquashDictionary* dictionary;
   size_t last_res;
 } SquashZstdStream;
 
@@ -131,6 +139,79 @@ squash_zstd_status_from_zstd_error (size_t res) {
 #endif
 }
 
+static void*
+squash_zstd_create_context (SquashCodec* codec, SquashStreamType stream_type) {
+#if defined(ZSTD_STATIC_LINKING_ONLY)
+  ZSTD_customMem cMem = { squash_zstd_malloc, squash_zstd_free, NULL };
+
+  if (stream_type == SQUASH_STREAM_COMPRESS)
+    return ZSTD_createCCtx_advanced (cMem);
+  else
+    return ZSTD_createDCtx_advanced (cMem);
+#else
+  if (stream_type == SQUASH_STREAM_COMPRESS)
+    return ZSTD_createCCtx ();
+  else
+    return ZSTD_createDCtx ();
+#endif
+}
+
+static void
+squash_zstd_destroy_context (SquashCodec* codec, SquashStreamType stream_type, void* context) {
+  if (stream_type == SQUASH_STREAM_COMPRESS)
+    ZSTD_freeCCtx ((ZSTD_CCtx*) context);
+  else
+    ZSTD_freeDCtx ((ZSTD_DCtx*) context);
+}
+
+static size_t
+squash_zstd_sizeof_context (SquashStreamType stream_type, void* context) {
+#if defined(ZSTD_STATIC_LINKING_ONLY)
+  if (stream_type == SQUASH_STREAM_COMPRESS)
+    return ZSTD_sizeof_CCtx ((ZSTD_CCtx*) context);
+  else
+    return ZSTD_sizeof_DCtx ((ZSTD_DCtx*) context);
+#else
+  /* Unknown; the context will only count against the entry limit. */
+  return 0;
+#endif
+}
+
+/* Digested dictionaries are cached in the SquashDictionary, so they
+   are only created once per level no matter how many buffers or
+   streams use them. */
+static void*
+squash_zstd_create_cdict (SquashDictionary* dictionary, SquashCodec* codec, SquashStreamType stream_type, int level) {
+  return ZSTD_createCDict (squash_dictionary_get_data (dictionary), squash_dictionary_get_size (dictionary), level);
+}
+
+static void
+squash_zstd_free_cdict (void* cdict) {
+  ZSTD_freeCDict ((ZSTD_CDict*) cdict);
+}
+
+static void*
+squash_zstd_create_ddict (SquashDictionary* dictionary, SquashCodec* codec, SquashStreamType stream_type, int variant) {
+  return ZSTD_createDDict (squash_dictionary_get_data (dictionary), squash_dictionary_get_size (dictionary));
+}
+
+static void
+squash_zstd_free_ddict (void* ddict) {
+  ZSTD_freeDDict ((ZSTD_DDict*) ddict);
+}
+
+static const ZSTD_CDict*
+squash_zstd_get_cdict (SquashCodec* codec, SquashDictionary* dictionary, int level) {
+  return squash_dictionary_get_digest (dictionary, codec, SQUASH_STREAM_COMPRESS, level,
+                                       squash_zstd_create_cdict, squash_zstd_free_cdict);
+}
+
+static const ZSTD_DDict*
+squash_zstd_get_ddict (SquashCodec* codec, SquashDictionary* dictionary) {
+  return squash_dictionary_get_digest (dictionary, codec, SQUASH_STREAM_DECOMPRESS, 0,
+                                       squash_zstd_create_ddict, squash_zstd_free_ddict);
+}
+
 static SquashStatus
 squash_zstd_decompress_buffer (SquashCodec* codec,
                                size_t* decompressed_size,
@@ -138,7 +219,23 @@ squash_zstd_decompress_buffer (SquashCodec* codec,
                                size_t compressed_size,
                                const uint8_t compressed[HEDLEY_ARRAY_PARAM(compressed_size)],
                                SquashOptions* options) {
-  *decompressed_size = ZSTD_decompress (decompressed, *decompressed_size, compressed, compressed_size);
+  ZSTD_DCtx* dctx = squash_codec_acquire_context (codec, SQUASH_STREAM_DECOMPRESS);
+  if (HEDLEY_UNLIKELY(dctx == NULL))
+    return squash_error (SQUASH_MEMORY);
+
+  SquashDictionary* dictionary = squash_options_get_dictionary (options);
+  if (dictionary != NULL) {
+    const ZSTD_DDict* ddict = squash_zstd_get_ddict (codec, dictionary);
+    if (HEDLEY_UNLIKELY(ddict == NULL)) {
+      squash_codec_release_context (codec, SQUASH_STREAM_DECOMPRESS, dctx, squash_zstd_sizeof_context (SQUASH_STREAM_DECOMPRESS, dctx));
+      return squash_error (SQUASH_MEMORY);
+    }
+    *decompressed_size = ZSTD_decompress_usingDDict (dctx, decompressed, *decompressed_size, compressed, compressed_size, ddict);
+  } else {
+    *decompressed_size = ZSTD_decompressDCtx (dctx, decompressed, *decompressed_size, compressed, compressed_size);
+  }
+
+  squash_codec_release_context (codec, SQUASH_STREAM_DECOMPRESS, dctx, squash_zstd_sizeof_context (SQUASH_STREAM_DECOMPRESS, dctx));
 
   return squash_zstd_status_from_zstd_error (*decompressed_size);
 }
@@ -152,7 +249,23 @@ squash_zstd_compress_buffer (SquashCodec* codec,
                              SquashOptions* options) {
   const int level = squash_options_get_int_at (options, codec, SQUASH_ZSTD_OPT_LEVEL);
 
-  *compressed_size = ZSTD_compress (compressed, *compressed_size, uncompressed, uncompressed_size, level);
+  ZSTD_CCtx* cctx = squash_codec_acquire_context (codec, SQUASH_STREAM_COMPRESS);
+  if (HEDLEY_UNLIKELY(cctx == NULL))
+    return squash_error (SQUASH_MEMORY);
+
+  SquashDictionary* dictionary = squash_options_get_dictionary (options);
+  if (dictionary != NULL) {
+    const ZSTD_CDict* cdict = squash_zstd_get_cdict (codec, dictionary, level);
+    if (HEDLEY_UNLIKELY(cdict == NULL)) {
+      squash_codec_release_context (codec, SQUASH_STREAM_COMPRESS, cctx, squash_zstd_sizeof_context (SQUASH_STREAM_COMPRESS, cctx));
+      return squash_error (SQUASH_MEMORY);
+    }
+    *compressed_size = ZSTD_compress_usingCDict (cctx, compressed, *compressed_size, uncompressed, uncompressed_size, cdict);
+  } else {
+    *compressed_size = ZSTD_compressCCtx (cctx, compressed, *compressed_size, uncompressed, uncompressed_size, level);
+  }
+
+  squash_codec_release_context (codec, SQUASH_STREAM_COMPRESS, cctx, squash_zstd_sizeof_context (SQUASH_STREAM_COMPRESS, cctx));
 
   return squash_zstd_status_from_zstd_error (*compressed_size);
 }
@@ -167,10 +280,121 @@ squash_zstd_stream_destroy (void* s) {
     ZSTD_freeDStream(stream->dstream);
   }
 
+  /* Released only after the context which references it. */
+  squash_object_unref (stream->dictionary);
+
   squash_stream_destroy (stream);
 }
 
 
+/* ZSTD_CCtx_refCDict and ZSTD_DCtx_refDDict don't copy the digested
+   dictionary, so the stream keeps the SquashDictionary which owns it
+   alive instead of relying on the options not being changed. */
+static void
+squash_zstd_stream_set_dictionary (SquashZstdStream* stream, SquashDictionary* dictionary) {
+  if (dictionary != NULL)
+    squash_object_ref (dictionary);
+  squash_object_unref (stream->dictionary);
+  stream->dictionary = dictionary;
+}
+
+static SquashStatus
+squash_zstd_init_cstream (SquashZstdStream* stream, SquashCodec* codec, SquashOptions* options) {
+  ZSTD_CStream* cstream = stream->cstream;
+  const int level = squash_options_get_int_at (options, codec, SQUASH_ZSTD_OPT_LEVEL);
+  SquashDictionary* dictionary = squash_options_get_dictionary (options);
+  size_t res;
+
+  if (dictionary == NULL) {
+    res = ZSTD_initCStream (cstream, level);
+  } else {
+    const ZSTD_CDict* cdict = squash_zstd_get_cdict (codec, dictionary, level);
+    if (HEDLEY_UNLIKELY(cdict == NULL))
+      return squash_error (SQUASH_MEMORY);
+
+#if defined(ZSTD_VERSION_NUMBER) && (ZSTD_VERSION_NUMBER >= 10400)
+    res = ZSTD_initCStream (cstream, level);
+    if (!ZSTD_isError (res))
+      res = ZSTD_CCtx_refCDict (cstream, cdict);
+#elif defined(ZSTD_STATIC_LINKING_ONLY)
+    res = ZSTD_initCStream_usingCDict (cstream, cdict);
+#else
+    /* Older versions only offer this in the static API. */
+    return squash_error (SQUASH_BAD_PARAM);
+#endif
+  }
+
+  squash_zstd_stream_set_dictionary (stream, dictionary);
+
+  return squash_zstd_status_from_zstd_error (res);
+}
+
+static SquashStatus
+squash_zstd_init_dstream (SquashZstdStream* stream, SquashCodec* codec, SquashOptions* options) {
+  ZSTD_DStream* dstream = stream->dstream;
+  SquashDictionary* dictionary = squash_options_get_dictionary (options);
+  size_t res;
+
+  if (dictionary == NULL) {
+    res = ZSTD_initDStream (dstream);
+  } else {
+    const ZSTD_DDict* ddict = squash_zstd_get_ddict (codec, dictionary);
+    if (HEDLEY_UNLIKELY(ddict == NULL))
+      return squash_error (SQUASH_MEMORY);
+
+#if defined(ZSTD_VERSION_NUMBER) && (ZSTD_VERSION_NUMBER >= 10400)
+    res = ZSTD_initDStream (dstream);
+    if (!ZSTD_isError (res))
+      res = ZSTD_DCtx_refDDict (dstream, ddict);
+#elif defined(ZSTD_STATIC_LINKING_ONLY)
+    res = ZSTD_initDStream_usingDDict (dstream, ddict);
+#else
+    return squash_error (SQUASH_BAD_PARAM);
+#endif
+  }
+
+  squash_zstd_stream_set_dictionary (stream, dictionary);
+
+  return squash_zstd_status_from_zstd_error (res);
+}
+
+static SquashStatus
+squash_zstd_train_dictionary (SquashCodec* codec,
+                              size_t* dictionary_size,
+                              uint8_t dictionary[HEDLEY_ARRAY_PARAM(*dictionary_size)],
+                              size_t n_samples,
+                              const uint8_t samples[],
+                              const size_t sample_sizes[HEDLEY_ARRAY_PARAM(n_samples)],
+                              unsigned int threads,
+                              SquashOptions* options) {
+  if (HEDLEY_UNLIKELY(n_samples > UINT_MAX))
+    return squash_error (SQUASH_RANGE);
+
+#if defined(ZDICT_STATIC_LINKING_ONLY)
+  /* Same defaults as the zstd CLI's --train. */
+  ZDICT_fastCover_params_t params;
+  memset (&params, 0, sizeof (params));
+  params.d = 8;
+  params.steps = 4;
+  params.nbThreads = threads;
+  params.zParams.compressionLevel = squash_options_get_int_at (options, codec, SQUASH_ZSTD_OPT_LEVEL);
+
+  const size_t res = ZDICT_optimizeTrainFromBuffer_fastCover (dictionary, *dictionary_size,
+                                                              samples, sample_sizes, (unsigned) n_samples,
+                                                              &params);
+#else
+  const size_t res = ZDICT_trainFromBuffer (dictionary, *dictionary_size,
+                                            samples, sample_sizes, (unsigned) n_samples);
+#endif
+
+  if (HEDLEY_UNLIKELY(ZDICT_isError (res)))
+    return squash_error (SQUASH_FAILED);
+
+  *dictionary_size = res;
+
+  return SQUASH_OK;
+}
+
 static SquashStream*
 squash_zstd_create_stream (SquashCodec* codec, SquashStreamType stream_type, SquashOptions* options) {
   assert (stream_type == SQUASH_STREAM_COMPRESS || stream_type == SQUASH_STREAM_DECOMPRESS);
@@ -181,6 +405,7 @@ squash_zstd_create_stream (SquashCodec* codec, SquashStreamType stream_type, Squ
 
   SquashZstdStream* stream = squash_malloc(sizeof (SquashZstdStream));
   squash_stream_init ((SquashStream*)stream, codec, stream_type, options, squash_zstd_stream_destroy);
+  stream->dictionary = NULL;
 
   if(stream_type == SQUASH_STREAM_COMPRESS) {
 #if defined(ZSTD_STATIC_LINKING_ONLY)
@@ -196,11 +421,8 @@ squash_zstd_create_stream (SquashCodec* codec, SquashStreamType stream_type, Squ
       return NULL;
     }
 
-    const int level = squash_options_get_int_at (options, codec, SQUASH_ZSTD_OPT_LEVEL);
-    size_t const initResult = ZSTD_initCStream(stream->cstream, level);
-    if (ZSTD_isError(initResult)) {
-      ZSTD_freeCStream(stream->cstream);
-      squash_free(stream);
+    if (squash_zstd_init_cstream (stream, codec, options) != SQUASH_OK) {
+      squash_object_unref (stream);
       return NULL;
     }
 
@@ -211,22 +433,43 @@ squash_zstd_create_stream (SquashCodec* codec, SquashStreamType stream_type, Squ
     stream->dstream = ZSTD_createDStream();
 #endif
     stream->cstream = NULL;
+    stream->last_res = 0;
 
     if(stream->dstream == NULL) {
       squash_free(stream);
       return NULL;
     }
 
-    size_t const initResult = ZSTD_initDStream(stream->dstream);
-    if (ZSTD_isError(initResult)) {
-      ZSTD_freeDStream(stream->dstream);
-      squash_free(stream);
+    if (squash_zstd_init_dstream (stream, codec, options) != SQUASH_OK) {
+      squash_object_unref (stream);
       return NULL;
     }
   }
 
   return (SquashStream*) stream;
 }
+
+static SquashStatus
+squash_zstd_reset_stream (SquashStream* ss) {
+  SquashZstdStream* stream = (SquashZstdStream*) ss;
+  SquashStatus res;
+
+  /* Re-initializing keeps the memory allocated by the existing
+     context. */
+  if (ss->stream_type == SQUASH_STREAM_COMPRESS) {
+    res = squash_zstd_init_cstream (stream, ss->codec, ss->options);
+  } else {
+    res = squash_zstd_init_dstream (stream, ss->codec, ss->options);
+  }
+
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+    return res;
+
+  stream->last_res = 0;
+
+  return SQUASH_OK;
+}
+
 static SquashStatus
 squash_zstd_process_stream (SquashStream* ss, SquashOperation operation) {
   SquashZstdStream* stream = (SquashZstdStream*)ss;
@@ -305,12 +548,17 @@ squash_plugin_init_codec (SquashCodec* codec, SquashCodecImpl* impl) {
   const char* name = squash_codec_get_name (codec);
 
   if (HEDLEY_LIKELY(strcmp ("zstd", name) == 0)) {
+    impl->info = SQUASH_CODEC_INFO_CONCATENABLE | SQUASH_CODEC_INFO_DICTIONARY;
     impl->options = squash_zstd_options;
     impl->get_max_compressed_size = squash_zstd_get_max_compressed_size;
     impl->decompress_buffer = squash_zstd_decompress_buffer;
-    impl->compress_buffer_unsafe = squash_zstd_compress_buffer;
+    impl->compress_buffer = squash_zstd_compress_buffer;
     impl->create_stream = squash_zstd_create_stream;
     impl->process_stream = squash_zstd_process_stream;
+    impl->reset_stream = squash_zstd_reset_stream;
+    impl->train_dictionary = squash_zstd_train_dictionary;
+    impl->create_context = squash_zstd_create_context;
+    impl->destroy_context = squash_zstd_destroy_context;
   } else {
     return squash_error (SQUASH_UNABLE_TO_LOAD);
   }
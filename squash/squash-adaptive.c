@@ -0,0 +1,324 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The "adaptive:<codec>" meta-codec.
+ *
+ * Input which doesn't look compressible (see
+ * squash_probe_compressibility), or which the wrapped codec fails to
+ * shrink, is stored as-is.  The format is a single tag byte followed
+ * by either the raw input or the output of the wrapped codec. */
+
+/**
+ * @brief Estimated ratio above which adaptive codecs store data raw
+ */
+#if !defined(SQUASH_ADAPTIVE_THRESHOLD)
+#  define SQUASH_ADAPTIVE_THRESHOLD 0.95
+#endif
+
+/* Inputs up to this size are probed in full; larger ones are sampled
+   in SQUASH_PROBE_BLOCKS evenly spaced blocks of SQUASH_PROBE_BLOCK_SIZE
+   bytes. */
+#define SQUASH_PROBE_BLOCK_SIZE 1024
+#define SQUASH_PROBE_BLOCKS 16
+#define SQUASH_PROBE_HASH_BITS 12
+
+enum {
+  SQUASH_ADAPTIVE_TAG_RAW = 0,
+  SQUASH_ADAPTIVE_TAG_COMPRESSED = 1
+};
+
+typedef struct SquashProbe_ {
+  /* Four interleaved histograms, so consecutive bytes with the same
+     value don't serialize on a single counter. */
+  uint32_t histogram[4][256];
+  size_t n_bytes;
+
+  /* Last position of each hashed 4-byte sequence, plus one, counting
+     from the start of the first block probed */
+  uint32_t last[1 << SQUASH_PROBE_HASH_BITS];
+  size_t n_repeats;
+} SquashProbe;
+
+static void
+squash_probe_block (SquashProbe* probe, const uint8_t* data, size_t data_size) {
+  size_t i = 0;
+
+  for ( ; i + 4 <= data_size ; i += 4) {
+    probe->histogram[0][data[i    ]]++;
+    probe->histogram[1][data[i + 1]]++;
+    probe->histogram[2][data[i + 2]]++;
+    probe->histogram[3][data[i + 3]]++;
+  }
+  for ( ; i < data_size ; i++)
+    probe->histogram[0][data[i]]++;
+
+  /* Count positions whose next four bytes already occurred earlier in
+     the block, which order-0 entropy alone can't see.  Entries from
+     previous blocks are before base, so there is no need to clear the
+     table. */
+  const size_t base = probe->n_bytes;
+  for (i = 0 ; i + 4 <= data_size ; i++) {
+    const uint32_t v =
+      ((uint32_t) data[i]) | ((uint32_t) data[i + 1] << 8) |
+      ((uint32_t) data[i + 2] << 16) | ((uint32_t) data[i + 3] << 24);
+    const size_t h = (size_t) ((v * UINT32_C(2654435761)) >> (32 - SQUASH_PROBE_HASH_BITS));
+    const uint32_t prev = probe->last[h];
+
+    if (prev > base && memcmp (data + (prev - 1 - base), data + i, 4) == 0)
+      probe->n_repeats++;
+    probe->last[h] = (uint32_t) (base + i + 1);
+  }
+
+  probe->n_bytes += data_size;
+}
+
+/* log2 (x) for x >= 1, without needing libm. */
+static double
+squash_probe_log2 (double x) {
+  double result = 0.0;
+
+  while (x >= 2.0) {
+    x /= 2.0;
+    result += 1.0;
+  }
+
+  double bit = 0.5;
+  for (int i = 0 ; i < 16 ; i++) {
+    x *= x;
+    if (x >= 2.0) {
+      x /= 2.0;
+      result += bit;
+    }
+    bit /= 2.0;
+  }
+
+  return result;
+}
+
+/**
+ * @brief Estimate how well a buffer will compress
+ *
+ * This is a quick heuristic, meant to avoid spending time trying to
+ * compress data which is already compressed (or encrypted, or
+ * otherwise random).  Large buffers are sampled rather than read in
+ * full, so the cost is bounded regardless of @a data_size.
+ *
+ * The estimate combines the order-0 entropy of the bytes with how
+ * often short sequences repeat.  It says nothing about any particular
+ * codec, and isn't precise; but a result close to 1.0 means that
+ * compressing the data is very unlikely to be worthwhile.
+ *
+ * @param data_size Size of @a data, in bytes
+ * @param data The data to probe
+ * @return Estimated compressed size as a fraction of @a data_size,
+ *   between 0.0 and 1.0
+ */
+double
+squash_probe_compressibility (size_t data_size, const uint8_t data[HEDLEY_ARRAY_PARAM(data_size)]) {
+  assert (data != NULL || data_size == 0);
+
+  if (data_size == 0)
+    return 1.0;
+
+  SquashProbe* probe = squash_calloc (1, sizeof (SquashProbe));
+  if (HEDLEY_UNLIKELY(probe == NULL))
+    return 1.0;
+
+  if (data_size <= SQUASH_PROBE_BLOCK_SIZE * SQUASH_PROBE_BLOCKS) {
+    squash_probe_block (probe, data, data_size);
+  } else {
+    const size_t stride = (data_size - SQUASH_PROBE_BLOCK_SIZE) / (SQUASH_PROBE_BLOCKS - 1);
+    for (size_t i = 0 ; i < SQUASH_PROBE_BLOCKS ; i++)
+      squash_probe_block (probe, data + (i * stride), SQUASH_PROBE_BLOCK_SIZE);
+  }
+
+  /* H = log2 (n) - (1 / n) * sum (c * log2 (c)) */
+  const double n = (double) probe->n_bytes;
+  double sum = 0.0;
+  for (size_t b = 0 ; b < 256 ; b++) {
+    const uint32_t c =
+      probe->histogram[0][b] + probe->histogram[1][b] +
+      probe->histogram[2][b] + probe->histogram[3][b];
+    if (c > 1)
+      sum += (double) c * squash_probe_log2 ((double) c);
+  }
+  const double entropy_ratio = (squash_probe_log2 (n) - (sum / n)) / 8.0;
+
+  /* Repeated sequences cost next to nothing. */
+  const double repeat_ratio = 1.0 - (0.9 * ((double) probe->n_repeats / n));
+
+  squash_free (probe);
+
+  double estimate = (entropy_ratio < repeat_ratio) ? entropy_ratio : repeat_ratio;
+  if (estimate < 0.0)
+    estimate = 0.0;
+  else if (estimate > 1.0)
+    estimate = 1.0;
+
+  return estimate;
+}
+
+static SquashCodec*
+squash_adaptive_inner (SquashCodec* codec) {
+  return squash_codec_get_wrapper_inner (codec);
+}
+
+static size_t
+squash_adaptive_get_max_compressed_size (SquashCodec* codec, size_t uncompressed_size) {
+  const size_t inner_max = squash_codec_get_max_compressed_size (squash_adaptive_inner (codec), uncompressed_size);
+
+  return 1 + ((inner_max > uncompressed_size) ? inner_max : uncompressed_size);
+}
+
+static size_t
+squash_adaptive_get_uncompressed_size (SquashCodec* codec,
+                                       size_t compressed_size,
+                                       const uint8_t compressed[HEDLEY_ARRAY_PARAM(compressed_size)]) {
+  if (HEDLEY_UNLIKELY(compressed_size < 1))
+    return 0;
+
+  switch (compressed[0]) {
+    case SQUASH_ADAPTIVE_TAG_RAW:
+      return compressed_size - 1;
+    case SQUASH_ADAPTIVE_TAG_COMPRESSED:
+      if (HEDLEY_UNLIKELY(compressed_size < 2))
+        return 0;
+      return squash_codec_get_uncompressed_size (squash_adaptive_inner (codec), compressed_size - 1, compressed + 1);
+    default:
+      return 0;
+  }
+}
+
+static SquashStatus
+squash_adaptive_compress_buffer (SquashCodec* codec,
+                                 size_t* compressed_size,
+                                 uint8_t compressed[HEDLEY_ARRAY_PARAM(*compressed_size)],
+                                 size_t uncompressed_size,
+                                 const uint8_t uncompressed[HEDLEY_ARRAY_PARAM(uncompressed_size)],
+                                 SquashOptions* options) {
+  if (HEDLEY_UNLIKELY(*compressed_size < 1))
+    return squash_error (SQUASH_BUFFER_FULL);
+
+  if (uncompressed_size > 1 &&
+      squash_probe_compressibility (uncompressed_size, uncompressed) < SQUASH_ADAPTIVE_THRESHOLD) {
+    /* Anything which isn't smaller than the input is useless, so
+       don't let the codec write more than that.  Not every codec
+       reports running out of room as SQUASH_BUFFER_FULL, so once the
+       buffer has been capped any failure means storing it raw. */
+    size_t inner_size = *compressed_size - 1;
+    bool capped = false;
+    if (inner_size > uncompressed_size - 1) {
+      inner_size = uncompressed_size - 1;
+      capped = true;
+    }
+
+    SquashStatus res =
+      squash_codec_compress_with_options (squash_adaptive_inner (codec),
+                                          &inner_size, compressed + 1,
+                                          uncompressed_size, uncompressed,
+                                          options);
+    if (HEDLEY_LIKELY(res == SQUASH_OK)) {
+      compressed[0] = SQUASH_ADAPTIVE_TAG_COMPRESSED;
+      *compressed_size = inner_size + 1;
+      return SQUASH_OK;
+    } else if (res != SQUASH_BUFFER_FULL && !capped) {
+      return res;
+    }
+  }
+
+  if (HEDLEY_UNLIKELY(*compressed_size - 1 < uncompressed_size))
+    return squash_error (SQUASH_BUFFER_FULL);
+
+  compressed[0] = SQUASH_ADAPTIVE_TAG_RAW;
+  memcpy (compressed + 1, uncompressed, uncompressed_size);
+  *compressed_size = uncompressed_size + 1;
+
+  return SQUASH_OK;
+}
+
+static SquashStatus
+squash_adaptive_decompress_buffer (SquashCodec* codec,
+                                   size_t* decompressed_size,
+                                   uint8_t decompressed[HEDLEY_ARRAY_PARAM(*decompressed_size)],
+                                   size_t compressed_size,
+                                   const uint8_t compressed[HEDLEY_ARRAY_PARAM(compressed_size)],
+                                   SquashOptions* options) {
+  if (HEDLEY_UNLIKELY(compressed_size < 1))
+    return squash_error (SQUASH_INVALID_BUFFER);
+
+  switch (compressed[0]) {
+    case SQUASH_ADAPTIVE_TAG_RAW:
+      if (HEDLEY_UNLIKELY(*decompressed_size < compressed_size - 1))
+        return squash_error (SQUASH_BUFFER_FULL);
+      memcpy (decompressed, compressed + 1, compressed_size - 1);
+      *decompressed_size = compressed_size - 1;
+      return SQUASH_OK;
+    case SQUASH_ADAPTIVE_TAG_COMPRESSED:
+      if (HEDLEY_UNLIKELY(compressed_size < 2))
+        return squash_error (SQUASH_INVALID_BUFFER);
+      return squash_codec_decompress_with_options (squash_adaptive_inner (codec),
+                                                   decompressed_size, decompressed,
+                                                   compressed_size - 1, compressed + 1,
+                                                   options);
+    default:
+      return squash_error (SQUASH_INVALID_BUFFER);
+  }
+}
+
+/**
+ * @brief Get the adaptive version of a codec
+ * @private
+ *
+ * Adaptive codecs are created on demand, and (like regular codecs)
+ * live for the lifetime of the process.  They are normally accessed
+ * by prefixing the name of a codec with "adaptive:", e.g.,
+ * "adaptive:lzma".
+ *
+ * @param codec The codec to wrap
+ * @return The adaptive codec, or *NULL* on failure
+ */
+SquashCodec*
+squash_codec_get_adaptive (SquashCodec* codec) {
+  SquashCodecImpl impl = { 0, };
+
+  assert (codec != NULL);
+
+  impl.info = squash_codec_get_info (codec) & SQUASH_CODEC_INFO_KNOWS_UNCOMPRESSED_SIZE;
+  impl.get_max_compressed_size = squash_adaptive_get_max_compressed_size;
+  impl.get_uncompressed_size = squash_adaptive_get_uncompressed_size;
+  impl.compress_buffer = squash_adaptive_compress_buffer;
+  impl.decompress_buffer = squash_adaptive_decompress_buffer;
+
+  return squash_codec_get_wrapper (codec, "adaptive", &impl, codec->block_size);
+}
@@ -38,6 +38,9 @@ HEDLEY_BEGIN_C_DECLS
 #  define SQUASH_BUFFER_STREAM_BUFFER_SIZE (4096 - sizeof (SquashSList))
 #endif
 
+/* Two varuint64s: the uncompressed and compressed sizes. */
+#define SQUASH_BUFFER_STREAM_FRAME_HEADER_MAX_SIZE 18
+
 typedef struct SquashBufferStreamSList_ {
   SquashSList base;
   uint8_t data[SQUASH_BUFFER_STREAM_BUFFER_SIZE];
@@ -49,6 +52,19 @@ typedef struct SquashBufferStream_ {
   SquashBuffer* input;
   SquashBuffer* output;
   size_t output_pos;
+
+  /* Unframed mode */
+  SquashRope input_rope;
+  SquashRope output_rope;
+  bool have_output_rope;
+
+  /* Framed mode (see squash_options_set_chunk_size) */
+  size_t chunk_size;
+  uint8_t header[SQUASH_BUFFER_STREAM_FRAME_HEADER_MAX_SIZE];
+  size_t header_size;
+  bool have_frame;
+  size_t frame_uncompressed_size;
+  size_t frame_compressed_size;
 } SquashBufferStream;
 
 HEDLEY_NON_NULL(1) SQUASH_INTERNAL
@@ -57,6 +73,8 @@ HEDLEY_NON_NULL(1) SQUASH_INTERNAL
 SquashStatus        squash_buffer_stream_process (SquashBufferStream* stream);
 HEDLEY_NON_NULL(1) SQUASH_INTERNAL
 SquashStatus        squash_buffer_stream_finish  (SquashBufferStream* stream);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+void                squash_buffer_stream_reset   (SquashBufferStream* stream);
 
 HEDLEY_END_C_DECLS
 
@@ -28,6 +28,7 @@
 #include "squash-internal.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -42,9 +43,26 @@ squash_buffer_stream_init (void* stream,
 
   squash_stream_init (stream, codec, stream_type, options, destroy_notify);
 
-  s->input = squash_buffer_new (0);
-  s->output = NULL;
+  s->chunk_size = squash_options_get_chunk_size (options);
+  s->header_size = 0;
+  s->have_frame = false;
+  s->frame_uncompressed_size = 0;
+  s->frame_compressed_size = 0;
+
+  if (s->chunk_size == 0) {
+    s->input = NULL;
+    s->output = NULL;
+  } else {
+    s->input = squash_buffer_new (stream_type == SQUASH_STREAM_COMPRESS ? s->chunk_size : 0);
+    s->output = squash_buffer_new (0);
+  }
   s->output_pos = 0;
+
+  /* Unframed mode buffers everything, so use ropes rather than
+     buffers which would have to be reallocated as they grow. */
+  squash_rope_init (&(s->input_rope), 0);
+  squash_rope_init (&(s->output_rope), 0);
+  s->have_output_rope = false;
 }
 
 static void
@@ -53,6 +71,8 @@ squash_buffer_stream_destroy (void* stream) {
 
   squash_buffer_free (s->input);
   squash_buffer_free (s->output);
+  squash_rope_destroy (&(s->input_rope));
+  squash_rope_destroy (&(s->output_rope));
 
   squash_stream_destroy (stream);
 }
@@ -67,16 +87,298 @@ squash_buffer_stream_new (SquashCodec* codec, SquashStreamType stream_type, Squa
   return stream;
 }
 
+/* Discard any buffered data, but keep an input allocation around for
+   the next stream. */
+void
+squash_buffer_stream_reset (SquashBufferStream* stream) {
+  stream->output_pos = 0;
+
+  if (stream->chunk_size == 0) {
+    squash_rope_reset (&(stream->input_rope));
+    squash_rope_destroy (&(stream->output_rope));
+    stream->have_output_rope = false;
+    /* finish uses the presence of the output buffer to tell whether
+       the input has already been processed. */
+    squash_buffer_free (stream->output);
+    stream->output = NULL;
+  } else {
+    stream->input->size = 0;
+    stream->output->size = 0;
+  }
+
+  stream->header_size = 0;
+  stream->have_frame = false;
+  stream->frame_uncompressed_size = 0;
+  stream->frame_compressed_size = 0;
+}
+
 #ifndef MIN
 #  define MIN(a,b) (((a) < (b)) ? (a) : (b))
 #endif
 
+/* Framed mode
+ *
+ * Instead of buffering the whole input, the input is split into
+ * chunks of chunk_size bytes, each of which is compressed
+ * independently and written out as a frame:
+ *
+ *   varuint64 uncompressed size
+ *   varuint64 compressed size
+ *   compressed data
+ *
+ * At most one chunk of input and one frame of output are buffered at
+ * any given time. */
+
+/* Copy as much pending output as possible to next_out.  Returns true
+   if there is no more pending output. */
+static bool
+squash_buffer_stream_drain (SquashBufferStream* stream) {
+  SquashStream* s = (SquashStream*) stream;
+  SquashBuffer* output = stream->output;
+
+  const size_t remaining = output->size - stream->output_pos;
+  const size_t cp_size = MIN(remaining, s->avail_out);
+  if (cp_size != 0) {
+    memcpy (s->next_out, output->data + stream->output_pos, cp_size);
+    s->next_out += cp_size;
+    s->avail_out -= cp_size;
+    stream->output_pos += cp_size;
+  }
+
+  if (stream->output_pos != output->size)
+    return false;
+
+  output->size = 0;
+  stream->output_pos = 0;
+  return true;
+}
+
+/* Compress the buffered chunk into a frame, directly into next_out if
+   it is guaranteed to fit, otherwise into the output buffer. */
+static SquashStatus
+squash_buffer_stream_write_frame (SquashBufferStream* stream) {
+  SquashStream* s = (SquashStream*) stream;
+  SquashBuffer* input = stream->input;
+  SquashStatus res;
+
+  const size_t max_compressed_size = squash_codec_get_max_compressed_size (s->codec, input->size);
+  const size_t header_size = squash_size_varuint64 (input->size) + squash_size_varuint64 (max_compressed_size);
+  const bool direct = (s->avail_out >= header_size + max_compressed_size);
+
+  uint8_t* frame;
+  size_t frame_size;
+  if (direct) {
+    frame = s->next_out;
+    frame_size = s->avail_out;
+  } else {
+    assert (stream->output->size == 0);
+    if (HEDLEY_UNLIKELY(!squash_buffer_set_size (stream->output, header_size + max_compressed_size)))
+      return squash_error (SQUASH_MEMORY);
+    frame = stream->output->data;
+    frame_size = stream->output->size;
+  }
+
+  /* The compressed size isn't known until after compression, so
+     leave room for the largest possible header and move the data
+     down afterwards if the header turns out to be smaller. */
+  size_t compressed_size = max_compressed_size;
+  res = squash_codec_compress_with_options (s->codec, &compressed_size, frame + header_size, input->size, input->data, s->options);
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+    return res;
+
+  size_t pos = squash_write_varuint64 (frame, frame_size, input->size);
+  pos += squash_write_varuint64 (frame + pos, frame_size - pos, compressed_size);
+  assert (pos <= header_size);
+  if (pos != header_size)
+    memmove (frame + pos, frame + header_size, compressed_size);
+  frame_size = pos + compressed_size;
+
+  if (direct) {
+    s->next_out += frame_size;
+    s->avail_out -= frame_size;
+  } else {
+    stream->output->size = frame_size;
+  }
+
+  input->size = 0;
+
+  return SQUASH_OK;
+}
+
+/* Decompress the buffered frame, directly into next_out if there is
+   room, otherwise into the output buffer. */
+static SquashStatus
+squash_buffer_stream_read_frame (SquashBufferStream* stream) {
+  SquashStream* s = (SquashStream*) stream;
+  SquashBuffer* input = stream->input;
+  SquashStatus res;
+
+  const bool direct = (s->avail_out >= stream->frame_uncompressed_size);
+
+  uint8_t* decompressed;
+  size_t decompressed_size = stream->frame_uncompressed_size;
+  if (direct) {
+    decompressed = s->next_out;
+  } else {
+    assert (stream->output->size == 0);
+    if (HEDLEY_UNLIKELY(!squash_buffer_set_size (stream->output, decompressed_size)))
+      return squash_error (SQUASH_MEMORY);
+    decompressed = stream->output->data;
+  }
+
+  res = squash_codec_decompress_with_options (s->codec, &decompressed_size, decompressed, input->size, input->data, s->options);
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK)) {
+    stream->output->size = 0;
+    return res;
+  } else if (HEDLEY_UNLIKELY(decompressed_size != stream->frame_uncompressed_size)) {
+    stream->output->size = 0;
+    return squash_error (SQUASH_FAILED);
+  }
+
+  if (direct) {
+    s->next_out += decompressed_size;
+    s->avail_out -= decompressed_size;
+  }
+
+  input->size = 0;
+  stream->have_frame = false;
+
+  return SQUASH_OK;
+}
+
+/* Consume frame header bytes from next_in.  Any bytes which turn out
+   to belong to the frame's data are handed back to next_in. */
+static SquashStatus
+squash_buffer_stream_read_header (SquashBufferStream* stream) {
+  SquashStream* s = (SquashStream*) stream;
+
+  const size_t cp_size = MIN(s->avail_in, sizeof (stream->header) - stream->header_size);
+  memcpy (stream->header + stream->header_size, s->next_in, cp_size);
+  stream->header_size += cp_size;
+  s->next_in += cp_size;
+  s->avail_in -= cp_size;
+
+  uint64_t uncompressed_size, compressed_size;
+  size_t pos = squash_read_varuint64 (stream->header, stream->header_size, &uncompressed_size);
+  if (pos != 0) {
+    const size_t l = squash_read_varuint64 (stream->header + pos, stream->header_size - pos, &compressed_size);
+    pos = (l != 0) ? pos + l : 0;
+  }
+
+  if (pos == 0) {
+    return HEDLEY_UNLIKELY(stream->header_size == sizeof (stream->header)) ?
+      squash_error (SQUASH_FAILED) : SQUASH_OK;
+  }
+
+  if (HEDLEY_UNLIKELY(uncompressed_size == 0 || compressed_size == 0))
+    return squash_error (SQUASH_FAILED);
+#if SIZE_MAX < UINT64_MAX
+  if (HEDLEY_UNLIKELY(SIZE_MAX < uncompressed_size || SIZE_MAX < compressed_size))
+    return squash_error (SQUASH_FAILED);
+#endif
+
+  /* The sizes come straight from the input, so don't let a corrupt
+     frame make us buffer more than a chunk's worth of data. */
+  if (HEDLEY_UNLIKELY(uncompressed_size > stream->chunk_size ||
+                      compressed_size > squash_codec_get_max_compressed_size (s->codec, stream->chunk_size)))
+    return squash_error (SQUASH_INVALID_BUFFER);
+
+  const size_t unused = stream->header_size - pos;
+  assert (unused <= cp_size);
+  s->next_in -= unused;
+  s->avail_in += unused;
+
+  stream->header_size = 0;
+  stream->have_frame = true;
+  stream->frame_uncompressed_size = (size_t) uncompressed_size;
+  stream->frame_compressed_size = (size_t) compressed_size;
+
+  return SQUASH_OK;
+}
+
+static SquashStatus
+squash_buffer_stream_process_framed (SquashBufferStream* stream) {
+  SquashStream* s = (SquashStream*) stream;
+  SquashBuffer* input = stream->input;
+  SquashStatus res;
+
+  for (;;) {
+    const bool drained = squash_buffer_stream_drain (stream);
+
+    /* Is there a complete chunk (or frame) waiting to be processed? */
+    const bool complete = (s->stream_type == SQUASH_STREAM_COMPRESS) ?
+      (input->size == stream->chunk_size) :
+      (stream->have_frame && input->size == stream->frame_compressed_size);
+
+    if (complete) {
+      if (!drained)
+        return SQUASH_PROCESSING;
+
+      res = (s->stream_type == SQUASH_STREAM_COMPRESS) ?
+        squash_buffer_stream_write_frame (stream) :
+        squash_buffer_stream_read_frame (stream);
+      if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+        return res;
+
+      continue;
+    }
+
+    if (s->avail_in == 0)
+      return drained ? SQUASH_OK : SQUASH_PROCESSING;
+
+    if (s->stream_type == SQUASH_STREAM_DECOMPRESS && !stream->have_frame) {
+      res = squash_buffer_stream_read_header (stream);
+      if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+        return res;
+    } else {
+      const size_t wanted = (s->stream_type == SQUASH_STREAM_COMPRESS) ?
+        stream->chunk_size : stream->frame_compressed_size;
+      const size_t cp_size = MIN(s->avail_in, wanted - input->size);
+      if (HEDLEY_UNLIKELY(!squash_buffer_append (input, cp_size, s->next_in)))
+        return squash_error (SQUASH_MEMORY);
+      s->next_in += cp_size;
+      s->avail_in -= cp_size;
+    }
+  }
+}
+
+static SquashStatus
+squash_buffer_stream_finish_framed (SquashBufferStream* stream) {
+  SquashStream* s = (SquashStream*) stream;
+  SquashStatus res;
+
+  assert (s->avail_in == 0);
+
+  if (!squash_buffer_stream_drain (stream))
+    return SQUASH_PROCESSING;
+
+  if (s->stream_type == SQUASH_STREAM_DECOMPRESS) {
+    /* Complete frames are handled by process, so anything left over
+       is a truncated frame. */
+    if (HEDLEY_UNLIKELY(stream->have_frame || stream->header_size != 0))
+      return squash_error (SQUASH_FAILED);
+    return SQUASH_OK;
+  }
+
+  if (stream->input->size == 0)
+    return SQUASH_OK;
+
+  res = squash_buffer_stream_write_frame (stream);
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+    return res;
+
+  return squash_buffer_stream_drain (stream) ? SQUASH_OK : SQUASH_PROCESSING;
+}
+
 SquashStatus
 squash_buffer_stream_process (SquashBufferStream* stream) {
+  if (stream->chunk_size != 0)
+    return squash_buffer_stream_process_framed (stream);
+
   if (stream->base_object.avail_in == 0)
     return SQUASH_OK;
 
-  const bool s = squash_buffer_append (stream->input, stream->base_object.avail_in, stream->base_object.next_in);
+  const bool s = squash_rope_append (&(stream->input_rope), stream->base_object.avail_in, stream->base_object.next_in);
   if (HEDLEY_LIKELY(s)) {
     stream->base_object.next_in += stream->base_object.avail_in;
     stream->base_object.avail_in = 0;
@@ -92,10 +394,21 @@ squash_buffer_stream_finish (SquashBufferStream* stream) {
   SquashStream* s = (SquashStream*) stream;
   SquashCodec* codec = s->codec;
 
-  SquashBuffer* input = stream->input;
   SquashBuffer* output = stream->output;
 
-  if (HEDLEY_UNLIKELY(input->size == 0))
+  if (stream->chunk_size != 0)
+    return squash_buffer_stream_finish_framed (stream);
+
+  if (stream->have_output_rope) {
+    const size_t cp_size = squash_rope_shift (&(stream->output_rope), s->avail_out, s->next_out);
+    s->next_out += cp_size;
+    s->avail_out -= cp_size;
+
+    return (stream->output_rope.size == 0) ? SQUASH_OK : SQUASH_PROCESSING;
+  }
+
+  const size_t input_size = stream->input_rope.size;
+  if (HEDLEY_UNLIKELY(input_size == 0))
     return squash_error (SQUASH_FAILED);
 
   /* Squash should handle making sure process is called until the
@@ -107,13 +420,20 @@ squash_buffer_stream_finish (SquashBufferStream* stream) {
      output buffer to the stream. */
   if (output == NULL) {
     SquashStatus res;
+
+    /* The codec needs all of the input in one piece; this is the only
+       time it gets copied. */
+    uint8_t* input_data = squash_rope_linearize (&(stream->input_rope));
+    if (HEDLEY_UNLIKELY(input_data == NULL))
+      return squash_error (SQUASH_MEMORY);
+
     if (s->stream_type == SQUASH_STREAM_COMPRESS) {
-      size_t compressed_size = squash_codec_get_max_compressed_size (codec, input->size);
+      size_t compressed_size = squash_codec_get_max_compressed_size (codec, input_size);
       if (s->avail_out >= compressed_size) {
         /* There is enough room available in next_out to hold the full
            contents of the compressed data, so write directly to
            it. */
-        res = squash_codec_compress_with_options(codec, &compressed_size, s->next_out, input->size, input->data, s->options);
+        res = squash_codec_compress_with_options(codec, &compressed_size, s->next_out, input_size, input_data, s->options);
         if (HEDLEY_UNLIKELY(res != SQUASH_OK))
           return res;
 
@@ -127,19 +447,19 @@ squash_buffer_stream_finish (SquashBufferStream* stream) {
         if (HEDLEY_UNLIKELY(output == NULL))
           return squash_error (SQUASH_MEMORY);
 
-        res = squash_codec_compress_with_options (codec, &compressed_size, output->data, input->size, input->data, s->options);
+        res = squash_codec_compress_with_options (codec, &compressed_size, output->data, input_size, input_data, s->options);
         if (HEDLEY_UNLIKELY(res != SQUASH_OK))
           return res;
 
         output->size = compressed_size;
       }
     } else {
-      size_t decompressed_size = squash_codec_get_uncompressed_size (codec, input->size, input->data);
+      size_t decompressed_size = squash_codec_get_uncompressed_size (codec, input_size, input_data);
       if (decompressed_size != 0) {
         /* We know the decompressed size. */
         if (s->avail_out >= decompressed_size) {
           /* And there is enough room in next_out to hold it, so write directly to next_out */
-          res = squash_codec_decompress_with_options (codec, &decompressed_size, s->next_out, input->size, input->data, s->options);
+          res = squash_codec_decompress_with_options (codec, &decompressed_size, s->next_out, input_size, input_data, s->options);
           if (HEDLEY_UNLIKELY(res != SQUASH_OK))
             return res;
 
@@ -153,7 +473,7 @@ squash_buffer_stream_finish (SquashBufferStream* stream) {
           if (HEDLEY_UNLIKELY(output == NULL))
             return squash_error (SQUASH_MEMORY);
 
-          res = squash_codec_decompress_with_options (codec, &decompressed_size, output->data, input->size, input->data, s->options);
+          res = squash_codec_decompress_with_options (codec, &decompressed_size, output->data, input_size, input_data, s->options);
           if (HEDLEY_UNLIKELY(res != SQUASH_OK))
             return res;
 
@@ -163,10 +483,10 @@ squash_buffer_stream_finish (SquashBufferStream* stream) {
         /* If we have >= npot(compressed_size) << 3 bytes in next_out,
            first attempt to decompress directly to next_out.  If it
            works, it saves us a squash_malloc and a memcpy. */
-        decompressed_size = squash_npot (input->size) << 3;
+        decompressed_size = squash_npot (input_size) << 3;
         if (decompressed_size <= s->avail_out) {
           decompressed_size = s->avail_out;
-          res = squash_codec_decompress_with_options (codec, &decompressed_size, s->next_out, input->size, input->data, s->options);
+          res = squash_codec_decompress_with_options (codec, &decompressed_size, s->next_out, input_size, input_data, s->options);
           if (res == SQUASH_OK) {
             s->next_out += decompressed_size;
             s->avail_out -= decompressed_size;
@@ -175,13 +495,16 @@ squash_buffer_stream_finish (SquashBufferStream* stream) {
           }
         }
 
-        stream->output = output = squash_buffer_new (0);
-        if (HEDLEY_UNLIKELY(output == NULL))
-          return squash_error (SQUASH_MEMORY);
-
-        res = squash_codec_decompress_to_buffer(codec, output, input->size, input->data, s->options);
+        /* Decompress to a rope, and hand it out from there, to avoid
+           copying everything into one big buffer first. */
+        squash_rope_destroy (&(stream->output_rope));
+        squash_rope_init (&(stream->output_rope), decompressed_size);
+        res = squash_codec_decompress_to_rope (codec, &(stream->output_rope), input_size, input_data, s->options);
         if (HEDLEY_UNLIKELY(res != SQUASH_OK))
           return res;
+
+        stream->have_output_rope = true;
+        return squash_buffer_stream_finish (stream);
       }
     }
   }
@@ -0,0 +1,242 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#include "squash/tinycthread/source/tinycthread.h"
+
+/**
+ * @defgroup SquashCodecContext Codec contexts
+ * @brief Per-thread cache of codec contexts
+ *
+ * Many libraries need a significant amount of state (hash tables,
+ * work memory, library-level context objects) to compress or
+ * decompress a buffer.  Allocating and initializing that state for
+ * every call can easily dominate the cost of compressing small
+ * buffers, so codecs which implement @ref
+ * SquashCodecImpl_::create_context can ask Squash to keep contexts
+ * around between calls.
+ *
+ * Each thread has its own cache, so a context is never shared
+ * between threads and no locking is required.  The cache is bounded
+ * both by number of entries and by the total size of the cached
+ * contexts; the least recently used contexts are evicted first.  The
+ * size limit defaults to @ref SQUASH_CODEC_CONTEXT_CACHE_SIZE bytes
+ * per thread and can be changed at runtime with the
+ * `SQUASH_CONTEXT_CACHE_SIZE` environment variable (a value of 0
+ * disables caching entirely).
+ *
+ * @{
+ */
+
+/**
+ * @brief Maximum number of contexts cached per thread
+ */
+#if !defined(SQUASH_CODEC_CONTEXT_CACHE_ENTRIES)
+#  define SQUASH_CODEC_CONTEXT_CACHE_ENTRIES 8
+#endif
+
+/**
+ * @brief Default maximum total size of the contexts cached per thread
+ */
+#if !defined(SQUASH_CODEC_CONTEXT_CACHE_SIZE)
+#  define SQUASH_CODEC_CONTEXT_CACHE_SIZE ((size_t) (32 * 1024 * 1024))
+#endif
+
+typedef struct SquashCodecContextEntry_ {
+  SquashCodec* codec;
+  SquashStreamType stream_type;
+  void* context;
+  size_t size;
+} SquashCodecContextEntry;
+
+typedef struct SquashCodecContextCache_ {
+  /* Most recently used first. */
+  SquashCodecContextEntry entries[SQUASH_CODEC_CONTEXT_CACHE_ENTRIES];
+  size_t length;
+  size_t size;
+} SquashCodecContextCache;
+
+static once_flag squash_codec_context_cache_once = ONCE_FLAG_INIT;
+static tss_t squash_codec_context_cache_key;
+static bool squash_codec_context_cache_key_valid = false;
+static size_t squash_codec_context_cache_limit = SQUASH_CODEC_CONTEXT_CACHE_SIZE;
+
+static void
+squash_codec_context_entry_destroy (SquashCodecContextEntry* entry) {
+  entry->codec->impl.destroy_context (entry->codec, entry->stream_type, entry->context);
+}
+
+static void
+squash_codec_context_cache_destroy (void* data) {
+  SquashCodecContextCache* cache = (SquashCodecContextCache*) data;
+
+  if (cache == NULL)
+    return;
+
+  for (size_t i = 0 ; i < cache->length ; i++)
+    squash_codec_context_entry_destroy (&(cache->entries[i]));
+
+  squash_free (cache);
+}
+
+static void
+squash_codec_context_cache_init (void) {
+  const char* ev = getenv ("SQUASH_CONTEXT_CACHE_SIZE");
+  if (ev != NULL) {
+    char* endptr = NULL;
+    const unsigned long long limit = strtoull (ev, &endptr, 0);
+    if (*endptr == '\0')
+      squash_codec_context_cache_limit = (size_t) limit;
+  }
+
+  if (squash_codec_context_cache_limit != 0)
+    squash_codec_context_cache_key_valid = (tss_create (&squash_codec_context_cache_key, squash_codec_context_cache_destroy) == thrd_success);
+}
+
+static SquashCodecContextCache*
+squash_codec_context_cache_get (bool create) {
+  call_once (&squash_codec_context_cache_once, squash_codec_context_cache_init);
+
+  if (HEDLEY_UNLIKELY(!squash_codec_context_cache_key_valid))
+    return NULL;
+
+  SquashCodecContextCache* cache = (SquashCodecContextCache*) tss_get (squash_codec_context_cache_key);
+  if (cache == NULL && create) {
+    cache = squash_malloc (sizeof (SquashCodecContextCache));
+    if (HEDLEY_UNLIKELY(cache == NULL))
+      return NULL;
+
+    cache->length = 0;
+    cache->size = 0;
+
+    if (HEDLEY_UNLIKELY(tss_set (squash_codec_context_cache_key, cache) != thrd_success)) {
+      squash_free (cache);
+      return NULL;
+    }
+  }
+
+  return cache;
+}
+
+/**
+ * @brief Acquire a context for the codec
+ *
+ * This is intended to be called by plugins from within their @ref
+ * SquashCodecImpl_::compress_buffer, @ref
+ * SquashCodecImpl_::compress_buffer_unsafe, and @ref
+ * SquashCodecImpl_::decompress_buffer callbacks.  If the calling
+ * thread has a cached context for @a codec and @a stream_type it is
+ * removed from the cache and returned, otherwise a new one is created
+ * with @ref SquashCodecImpl_::create_context.
+ *
+ * The caller has exclusive use of the context until it passes it to
+ * @ref squash_codec_release_context.
+ *
+ * @param codec The codec
+ * @param stream_type Whether the context will be used for compression
+ *   or decompression
+ * @return A context, or *NULL* if the codec does not support contexts
+ *   or one could not be created
+ */
+void*
+squash_codec_acquire_context (SquashCodec* codec, SquashStreamType stream_type) {
+  assert (codec != NULL);
+
+  if (codec->impl.create_context == NULL)
+    return NULL;
+
+  SquashCodecContextCache* cache = squash_codec_context_cache_get (false);
+  if (cache != NULL) {
+    for (size_t i = 0 ; i < cache->length ; i++) {
+      SquashCodecContextEntry* entry = &(cache->entries[i]);
+      if (entry->codec == codec && entry->stream_type == stream_type) {
+        void* context = entry->context;
+
+        cache->size -= entry->size;
+        cache->length--;
+        memmove (entry, entry + 1, (cache->length - i) * sizeof (SquashCodecContextEntry));
+
+        return context;
+      }
+    }
+  }
+
+  return codec->impl.create_context (codec, stream_type);
+}
+
+/**
+ * @brief Return a context to the calling thread's cache
+ *
+ * If the context does not fit within the cache limits it (or older
+ * contexts) will be destroyed with @ref
+ * SquashCodecImpl_::destroy_context.
+ *
+ * @param codec The codec
+ * @param stream_type The stream type passed to @ref
+ *   squash_codec_acquire_context
+ * @param context The context; *NULL* is ignored
+ * @param context_size Approximate number of bytes of memory used by
+ *   the context, or 0 if unknown
+ */
+void
+squash_codec_release_context (SquashCodec* codec, SquashStreamType stream_type, void* context, size_t context_size) {
+  assert (codec != NULL);
+
+  if (context == NULL)
+    return;
+
+  assert (codec->impl.destroy_context != NULL);
+
+  SquashCodecContextCache* cache = squash_codec_context_cache_get (true);
+  if (cache == NULL || context_size > squash_codec_context_cache_limit) {
+    codec->impl.destroy_context (codec, stream_type, context);
+    return;
+  }
+
+  while (cache->length != 0 &&
+         (cache->length == SQUASH_CODEC_CONTEXT_CACHE_ENTRIES ||
+          cache->size + context_size > squash_codec_context_cache_limit)) {
+    SquashCodecContextEntry* lru = &(cache->entries[--cache->length]);
+    cache->size -= lru->size;
+    squash_codec_context_entry_destroy (lru);
+  }
+
+  memmove (&(cache->entries[1]), &(cache->entries[0]), cache->length * sizeof (SquashCodecContextEntry));
+  cache->entries[0].codec = codec;
+  cache->entries[0].stream_type = stream_type;
+  cache->entries[0].context = context;
+  cache->entries[0].size = context_size;
+  cache->length++;
+  cache->size += context_size;
+}
+
+/**
+ * @}
+ */
@@ -40,18 +40,47 @@ HEDLEY_NON_NULL(1) SQUASH_INTERNAL
 void                    squash_codec_set_extension           (SquashCodec* codec, const char* extension);
 HEDLEY_NON_NULL(1) SQUASH_INTERNAL
 void                    squash_codec_set_priority            (SquashCodec* codec, unsigned int priority);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+void                    squash_codec_set_block_size          (SquashCodec* codec, size_t block_size);
 HEDLEY_NON_NULL(1, 2) SQUASH_INTERNAL
 int                     squash_codec_compare                 (SquashCodec* a, SquashCodec* b);
 HEDLEY_NON_NULL(1, 2) SQUASH_INTERNAL
 int                     squash_codec_extension_compare       (SquashCodec* a, SquashCodec* b);
 HEDLEY_NON_NULL(1) SQUASH_INTERNAL
 SquashCodecImpl*        squash_codec_get_impl                (SquashCodec* codec);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+void                    squash_codec_index_options           (SquashCodec* codec);
 HEDLEY_NON_NULL(1, 2, 4) SQUASH_INTERNAL
-SquashStatus            squash_codec_decompress_to_buffer    (SquashCodec* codec,
-                                                              SquashBuffer* decompressed,
+SquashStatus            squash_codec_decompress_to_rope      (SquashCodec* codec,
+                                                              SquashRope* decompressed,
                                                               size_t compressed_size,
                                                               uint8_t compressed[HEDLEY_ARRAY_PARAM(compressed_size)],
                                                               SquashOptions* options);
+HEDLEY_NON_NULL(1, 2, 3) SQUASH_INTERNAL
+SquashCodec*            squash_codec_get_wrapper             (SquashCodec* inner,
+                                                              const char* prefix,
+                                                              const SquashCodecImpl* impl,
+                                                              size_t block_size);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+SquashCodec*            squash_codec_get_wrapper_inner       (SquashCodec* codec);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+SquashCodec*            squash_codec_get_parallel            (SquashCodec* codec);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+SquashCodec*            squash_codec_get_seekable            (SquashCodec* codec);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+SquashCodec*            squash_codec_get_adaptive            (SquashCodec* codec);
+
+SQUASH_INTERNAL
+size_t                  squash_read_varuint64                (const uint8_t *p, size_t p_size, uint64_t *v);
+SQUASH_INTERNAL
+size_t                  squash_write_varuint64               (uint8_t *p, size_t p_size, uint64_t v);
+SQUASH_INTERNAL
+size_t                  squash_size_varuint64                (const uint64_t value);
+
+SQUASH_INTERNAL
+SquashReadBorrowFunc    squash_buffer_splice_get_read_borrow  (SquashReadFunc read_cb);
+SQUASH_INTERNAL
+SquashWriteBorrowFunc   squash_buffer_splice_get_write_borrow (SquashWriteFunc write_cb);
 
 SQUASH_TREE_PROTOTYPES(SquashCodec_, tree)
 SQUASH_TREE_DEFINE(SquashCodec_, tree)
@@ -0,0 +1,151 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stdio.h>
+#include <string.h>
+
+#include "tinycthread/source/tinycthread.h"
+
+/* Meta-codecs such as "parallel:<codec>" wrap another codec.  They
+   are created the first time they are asked for and, like regular
+   codecs, live for the lifetime of the process; this is the registry
+   of every one created so far, keyed by prefix and wrapped codec. */
+
+typedef struct SquashCodecWrapper_ {
+  SquashCodec codec;
+  SquashCodec* inner;
+  const char* prefix;
+  struct SquashCodecWrapper_* next;
+} SquashCodecWrapper;
+
+SQUASH_MTX_DEFINE(codec_wrappers)
+static SquashCodecWrapper* squash_codec_wrappers = NULL;
+
+static SquashCodecWrapper*
+squash_codec_wrapper_new (SquashCodec* inner,
+                          const char* prefix,
+                          const SquashCodecImpl* impl,
+                          size_t block_size) {
+  SquashCodecImpl* inner_impl = squash_codec_get_impl (inner);
+  if (HEDLEY_UNLIKELY(inner_impl == NULL))
+    return NULL;
+
+  const char* inner_name = squash_codec_get_name (inner);
+  const size_t name_length = strlen (prefix) + 1 + strlen (inner_name);
+
+  SquashCodecWrapper* wrapper = squash_calloc (1, sizeof (SquashCodecWrapper));
+  char* name = squash_malloc (name_length + 1);
+  if (HEDLEY_UNLIKELY(wrapper == NULL || name == NULL)) {
+    squash_free (wrapper);
+    squash_free (name);
+    return NULL;
+  }
+
+  snprintf (name, name_length + 1, "%s:%s", prefix, inner_name);
+
+  wrapper->inner = inner;
+  wrapper->prefix = prefix;
+
+  SquashCodec* codec = &(wrapper->codec);
+  codec->plugin = inner->plugin;
+  codec->name = name;
+  codec->priority = inner->priority;
+  codec->extension = NULL;
+  codec->block_size = block_size;
+  SQUASH_TREE_ENTRY_INIT(codec->tree);
+
+  /* Options are passed straight through to the wrapped codec, so the
+     wrapper accepts exactly the same ones. */
+  codec->impl = *impl;
+  codec->impl.options = inner_impl->options;
+  squash_codec_index_options (codec);
+  codec->initialized = 1;
+
+  return wrapper;
+}
+
+/**
+ * @brief Get a codec which wraps another codec
+ * @private
+ *
+ * The first call for a given @a prefix and @a inner creates the
+ * wrapper, named "<prefix>:<inner name>", from @a impl and @a
+ * block_size; later calls return the same codec and ignore them.
+ *
+ * @param inner The codec to wrap
+ * @param prefix Prefix identifying the kind of wrapper; must remain
+ *   valid for the lifetime of the process
+ * @param impl Function table for the wrapper.  The options are taken
+ *   from @a inner.
+ * @param block_size Preferred block size for the wrapper
+ * @return The wrapper, or *NULL* on failure
+ */
+SquashCodec*
+squash_codec_get_wrapper (SquashCodec* inner,
+                          const char* prefix,
+                          const SquashCodecImpl* impl,
+                          size_t block_size) {
+  SquashCodecWrapper* wrapper;
+
+  assert (inner != NULL);
+  assert (prefix != NULL);
+  assert (impl != NULL);
+
+  SQUASH_MTX_LOCK(codec_wrappers);
+
+  for (wrapper = squash_codec_wrappers ; wrapper != NULL ; wrapper = wrapper->next)
+    if (wrapper->inner == inner && strcmp (wrapper->prefix, prefix) == 0)
+      break;
+
+  if (wrapper == NULL) {
+    wrapper = squash_codec_wrapper_new (inner, prefix, impl, block_size);
+    if (HEDLEY_LIKELY(wrapper != NULL)) {
+      wrapper->next = squash_codec_wrappers;
+      squash_codec_wrappers = wrapper;
+    }
+  }
+
+  SQUASH_MTX_UNLOCK(codec_wrappers);
+
+  return (wrapper != NULL) ? &(wrapper->codec) : NULL;
+}
+
+/**
+ * @brief Get the codec wrapped by a wrapper
+ * @private
+ *
+ * @param codec A codec returned by ::squash_codec_get_wrapper
+ * @return The codec @a codec wraps
+ */
+SquashCodec*
+squash_codec_get_wrapper_inner (SquashCodec* codec) {
+  assert (codec != NULL);
+
+  return ((SquashCodecWrapper*) codec)->inner;
+}
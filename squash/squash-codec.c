@@ -181,23 +181,71 @@
  */
 
 /**
- * @var SquashCodecImpl_::_reserved1
- * @brief Reserved for future use.
+ * @var SquashCodecImpl_::create_context
+ * @brief Create a context for one-shot compression or decompression
+ *
+ * A context is whatever state (work memory, a library-level context
+ * object, etc.) the codec needs in order to process a buffer.  Plugins
+ * do not call this directly; they call @ref
+ * squash_codec_acquire_context, which will only invoke this callback
+ * if there is no suitable context in the calling thread's cache.
+ *
+ * @param codec The codec
+ * @param stream_type Whether the context will be used for compression
+ *   or decompression
+ * @return A new context, or *NULL* on failure
+ * @see squash_codec_acquire_context
  */
 
 /**
- * @var SquashCodecImpl_::_reserved2
- * @brief Reserved for future use.
+ * @var SquashCodecImpl_::destroy_context
+ * @brief Destroy a context created by @ref
+ *   SquashCodecImpl_::create_context
+ *
+ * This is invoked when a context is evicted from the cache, or when
+ * the thread which owns the cache exits.  Must be provided if
+ * create_context is.
+ *
+ * @param codec The codec
+ * @param stream_type The stream type the context was created for
+ * @param context The context
  */
 
 /**
- * @var SquashCodecImpl_::_reserved3
- * @brief Reserved for future use.
+ * @var SquashCodecImpl_::reset_stream
+ * @brief Return a stream to its initial state
+ *
+ * Called by @ref squash_stream_reset so that a stream can be reused
+ * for a new compressed stream without destroying and re-creating the
+ * underlying library's state.  Squash takes care of resetting the
+ * fields of the @ref SquashStream itself; the plugin only needs to
+ * reset its own state.  Optional; streams from codecs which provide
+ * @ref SquashCodecImpl_::process_stream but not this callback cannot
+ * be reset.
+ *
+ * @param stream The stream
+ * @return A status code
+ *
+ * @see squash_stream_reset
  */
 
 /**
- * @var SquashCodecImpl_::_reserved4
- * @brief Reserved for future use.
+ * @var SquashCodecImpl_::train_dictionary
+ * @brief Train a dictionary from sample data
+ *
+ * Called by ::squash_dictionary_train.  Optional; if it is not
+ * provided a generic trainer is used.
+ *
+ * @param codec The codec
+ * @param dictionary_size Size of @a dictionary; on success, should be
+ *   set to the size of the dictionary produced
+ * @param dictionary Buffer to write the dictionary to
+ * @param n_samples Number of samples
+ * @param samples The samples, concatenated
+ * @param sample_sizes Size of each sample
+ * @param threads Number of threads the plugin may use
+ * @param options Options for the codec, or *NULL*
+ * @return A status code
  */
 
 /**
@@ -297,6 +345,32 @@ squash_codec_extension_compare (SquashCodec* a, SquashCodec* b) {
  * Squash plugins separately from Squash.
  */
 
+/**
+ * @var SquashCodecInfo::SQUASH_CODEC_INFO_CONCATENABLE
+ * @brief Compressed data can be concatenated
+ *
+ * Compressing several buffers independently and concatenating the
+ * results produces valid compressed data which decompresses (with
+ * both the buffer and streaming APIs) to the concatenation of the
+ * original buffers.  This is what allows compression streams to be
+ * multi-threaded; see ::squash_options_set_threads.
+ */
+
+/**
+ * @var SquashCodecInfo::SQUASH_CODEC_INFO_PASSTHROUGH
+ * @brief Compressed data is identical to the uncompressed data
+ *
+ * Neither compressing nor decompressing changes the data, so Squash
+ * may move it without ever looking at it; see ::squash_splice_fd.
+ */
+
+/**
+ * @var SquashCodecInfo::SQUASH_CODEC_INFO_DICTIONARY
+ * @brief The codec supports preset dictionaries
+ *
+ * See ::squash_options_set_dictionary.
+ */
+
 /**
  * @var SquashCodecInfo::SQUASH_CODEC_INFO_AUTO_MASK
  * @brief Mask of flags which are automatically set based on which
@@ -405,7 +479,7 @@ squash_codec_init (SquashCodec* codec) {
  */
 SquashCodecImpl*
 squash_codec_get_impl (SquashCodec* codec) {
-  if (codec->initialized != 1) {
+  if (squash_atomic_load_uint (&(codec->initialized)) != 1) {
     SquashStatus res = squash_plugin_init_codec (codec->plugin, codec, &(codec->impl));
     if (res != SQUASH_OK) {
       return NULL;
@@ -415,7 +489,7 @@ squash_codec_get_impl (SquashCodec* codec) {
   return &(codec->impl);
 }
 
-static size_t
+size_t
 squash_read_varuint64 (const uint8_t *p, size_t p_size, uint64_t *v) {
   uint64_t n = 0;
   size_t i;
@@ -439,7 +513,7 @@ squash_read_varuint64 (const uint8_t *p, size_t p_size, uint64_t *v) {
   return i + 1;
 }
 
-static size_t
+size_t
 squash_write_varuint64 (uint8_t *p, size_t p_size, uint64_t v) {
   uint8_t buf[10];
   size_t i;
@@ -484,7 +558,7 @@ squash_write_varuint64 (uint8_t *p, size_t p_size, uint64_t v) {
   return i;
 }
 
-static size_t
+size_t
 squash_size_varuint64 (const uint64_t value) {
   if (value & 0xFF00000000000000ULL)
     return 9;
@@ -572,6 +646,22 @@ squash_codec_get_max_compressed_size (SquashCodec* codec, size_t uncompressed_si
     return impl->get_max_compressed_size (codec, uncompressed_size);
 }
 
+/* Like squash_codec_create_stream_with_options, but always creates a
+   single-threaded stream.  Used when compressing a buffer with a
+   stream, which may itself happen on behalf of a threaded stream. */
+static SquashStream*
+squash_codec_create_stream_with_impl (SquashCodec* codec, SquashCodecImpl* impl, SquashStreamType stream_type, SquashOptions* options) {
+  if (impl->create_stream != NULL) {
+    return impl->create_stream (codec, stream_type, options);
+  } else {
+    if (impl->process_stream == NULL) {
+      return (SquashStream*) squash_buffer_stream_new (codec, stream_type, options);
+    } else {
+      return NULL;
+    }
+  }
+}
+
 /**
  * @brief Create a new stream with existing @ref SquashOptions
  *
@@ -593,15 +683,13 @@ squash_codec_create_stream_with_options (SquashCodec* codec, SquashStreamType st
     return NULL;
   }
 
-  if (impl->create_stream != NULL) {
-    return impl->create_stream (codec, stream_type, options);
-  } else {
-    if (impl->process_stream == NULL) {
-      return (SquashStream*) squash_buffer_stream_new (codec, stream_type, options);
-    } else {
-      return NULL;
-    }
+  if (stream_type == SQUASH_STREAM_COMPRESS &&
+      (impl->info & SQUASH_CODEC_INFO_CONCATENABLE) != 0 &&
+      squash_options_get_threads (options) > 1) {
+    return (SquashStream*) squash_threaded_stream_new (codec, options);
   }
+
+  return squash_codec_create_stream_with_impl (codec, impl, stream_type, options);
 }
 
 /**
@@ -687,6 +775,71 @@ squash_buffer_splice_write (size_t* data_size,
   return SQUASH_OK;
 }
 
+static SquashStatus
+squash_buffer_splice_read_borrow (size_t* data_size,
+                                  const uint8_t** data,
+                                  void* user_data) {
+  struct SquashBufferSpliceData* ctx = (struct SquashBufferSpliceData*) user_data;
+
+  const size_t available = ctx->input_size - ctx->input_pos;
+  if (*data_size > available)
+    *data_size = available;
+
+  *data = ctx->input + ctx->input_pos;
+  ctx->input_pos += *data_size;
+
+  return (*data_size != 0) ? SQUASH_OK : SQUASH_END_OF_STREAM;
+}
+
+static SquashStatus
+squash_buffer_splice_write_borrow (size_t written,
+                                   size_t* data_size,
+                                   uint8_t** data,
+                                   void* user_data) {
+  struct SquashBufferSpliceData* ctx = (struct SquashBufferSpliceData*) user_data;
+
+  if (HEDLEY_UNLIKELY(written > ctx->output_size - ctx->output_pos))
+    return squash_error (SQUASH_STATE);
+  ctx->output_pos += written;
+
+  if (data_size == NULL)
+    return SQUASH_OK;
+
+  if (HEDLEY_UNLIKELY(ctx->output_pos == ctx->output_size))
+    return squash_error (SQUASH_BUFFER_FULL);
+
+  *data = ctx->output + ctx->output_pos;
+  *data_size = ctx->output_size - ctx->output_pos;
+
+  return SQUASH_OK;
+}
+
+/**
+ * @brief Get the borrowing version of a buffer splice read callback
+ * @private
+ *
+ * @param read_cb Read callback
+ * @return The borrowing version of @a read_cb, or *NULL* if it isn't
+ *   the callback used to splice buffers
+ */
+SquashReadBorrowFunc
+squash_buffer_splice_get_read_borrow (SquashReadFunc read_cb) {
+  return (read_cb == squash_buffer_splice_read) ? squash_buffer_splice_read_borrow : NULL;
+}
+
+/**
+ * @brief Get the borrowing version of a buffer splice write callback
+ * @private
+ *
+ * @param write_cb Write callback
+ * @return The borrowing version of @a write_cb, or *NULL* if it
+ *   isn't the callback used to splice buffers
+ */
+SquashWriteBorrowFunc
+squash_buffer_splice_get_write_borrow (SquashWriteFunc write_cb) {
+  return (write_cb == squash_buffer_splice_write) ? squash_buffer_splice_write_borrow : NULL;
+}
+
 static SquashStatus
 squash_buffer_splice (SquashCodec* codec,
                       SquashStreamType stream_type,
@@ -713,42 +866,22 @@ squash_buffer_splice (SquashCodec* codec,
   return res;
 }
 
-/**
- * @brief Compress a buffer with an existing @ref SquashOptions
- *
- * @param codec The codec to use
- * @param[out] compressed Location to store the compressed data
- * @param[in,out] compressed_size Location storing the size of the
- *   @a compressed buffer on input, replaced with the actual size of
- *   the compressed data
- * @param uncompressed The uncompressed data
- * @param uncompressed_size Size of the uncompressed data (in bytes)
- * @param options Compression options
- * @return A status code
- */
-SquashStatus
-squash_codec_compress_with_options (SquashCodec* codec,
-                                    size_t* compressed_size,
-                                    uint8_t compressed[HEDLEY_ARRAY_PARAM(*compressed_size)],
-                                    size_t uncompressed_size,
-                                    const uint8_t uncompressed[HEDLEY_ARRAY_PARAM(uncompressed_size)],
-                                    SquashOptions* options) {
+static SquashStatus
+squash_codec_compress_with_impl (SquashCodec* codec,
+                                 SquashCodecImpl* impl,
+                                 size_t* compressed_size,
+                                 uint8_t compressed[HEDLEY_ARRAY_PARAM(*compressed_size)],
+                                 size_t uncompressed_size,
+                                 const uint8_t uncompressed[HEDLEY_ARRAY_PARAM(uncompressed_size)],
+                                 SquashOptions* options) {
   SquashStatus res = SQUASH_OK;
-  SquashCodecImpl* impl = NULL;
 
   assert (codec != NULL);
+  assert (impl != NULL);
 
   assert (compressed != NULL);
   assert (uncompressed != NULL);
 
-  squash_object_ref (options);
-
-  impl = squash_codec_get_impl (codec);
-  if (HEDLEY_UNLIKELY(impl == NULL)) {
-    res = squash_error (SQUASH_UNABLE_TO_LOAD);
-    goto cleanup;
-  }
-
   if (HEDLEY_UNLIKELY(compressed == uncompressed)) {
     res = squash_error (SQUASH_INVALID_BUFFER);
     goto cleanup;
@@ -792,7 +925,7 @@ squash_codec_compress_with_options (SquashCodec* codec,
                                    uncompressed_size, uncompressed,
                                    options);
     } else {
-      uint8_t* tmp_buf = squash_malloc (internal_max_compressed_size);
+      uint8_t* tmp_buf = squash_scratch_acquire (internal_max_compressed_size);
       if (HEDLEY_UNLIKELY(tmp_buf == NULL)) {
         res = squash_error (SQUASH_MEMORY);
       } else {
@@ -812,7 +945,7 @@ squash_codec_compress_with_options (SquashCodec* codec,
           }
         }
 
-        squash_free (tmp_buf);
+        squash_scratch_release (tmp_buf);
       }
     }
 
@@ -824,7 +957,7 @@ squash_codec_compress_with_options (SquashCodec* codec,
   } else {
     SquashStream* stream;
 
-    stream = squash_codec_create_stream_with_options (codec, SQUASH_STREAM_COMPRESS, options);
+    stream = squash_codec_create_stream_with_impl (codec, impl, SQUASH_STREAM_COMPRESS, options);
     if (HEDLEY_UNLIKELY(stream == NULL)) {
       res = squash_error (SQUASH_FAILED);
       goto cleanup;
@@ -860,7 +993,46 @@ squash_codec_compress_with_options (SquashCodec* codec,
 
  cleanup:
 
-  squash_object_unref (options);
+  return res;
+}
+
+/**
+ * @brief Compress a buffer with an existing @ref SquashOptions
+ *
+ * @param codec The codec to use
+ * @param[out] compressed Location to store the compressed data
+ * @param[in,out] compressed_size Location storing the size of the
+ *   @a compressed buffer on input, replaced with the actual size of
+ *   the compressed data
+ * @param uncompressed The uncompressed data
+ * @param uncompressed_size Size of the uncompressed data (in bytes)
+ * @param options Compression options
+ * @return A status code
+ */
+SquashStatus
+squash_codec_compress_with_options (SquashCodec* codec,
+                                    size_t* compressed_size,
+                                    uint8_t compressed[HEDLEY_ARRAY_PARAM(*compressed_size)],
+                                    size_t uncompressed_size,
+                                    const uint8_t uncompressed[HEDLEY_ARRAY_PARAM(uncompressed_size)],
+                                    SquashOptions* options) {
+  SquashStatus res;
+
+  assert (codec != NULL);
+
+  squash_options_hold (options);
+
+  SquashCodecImpl* impl = squash_codec_get_impl (codec);
+  if (HEDLEY_UNLIKELY(impl == NULL)) {
+    res = squash_error (SQUASH_UNABLE_TO_LOAD);
+  } else {
+    res = squash_codec_compress_with_impl (codec, impl,
+                                           compressed_size, compressed,
+                                           uncompressed_size, uncompressed,
+                                           options);
+  }
+
+  squash_options_release (options);
   return res;
 }
 
@@ -890,7 +1062,7 @@ SquashStatus squash_codec_compress (SquashCodec* codec,
   assert (codec != NULL);
 
   va_start (ap, uncompressed);
-  options = squash_options_newv (codec, ap);
+  options = squash_options_cached_newv (codec, ap);
   va_end (ap);
 
   return squash_codec_compress_with_options (codec,
@@ -899,33 +1071,16 @@ SquashStatus squash_codec_compress (SquashCodec* codec,
                                              options);
 }
 
-/**
- * @brief Decompress a buffer with an existing @ref SquashOptions
- *
- * @param codec The codec to use
- * @param[out] decompressed Location to store the decompressed data
- * @param[in,out] decompressed_size Location storing the size of the
- *   @a decompressed buffer on input, replaced with the actual size of
- *   the decompressed data
- * @param compressed The compressed data
- * @param compressed_size Size of the compressed data (in bytes)
- * @param options Compression options
- * @return A status code
- */
-SquashStatus
-squash_codec_decompress_with_options (SquashCodec* codec,
-                                      size_t* decompressed_size,
-                                      uint8_t decompressed[HEDLEY_ARRAY_PARAM(*decompressed_size)],
-                                      size_t compressed_size,
-                                      const uint8_t compressed[HEDLEY_ARRAY_PARAM(compressed_size)],
-                                      SquashOptions* options) {
-  SquashCodecImpl* impl = NULL;
-
+static SquashStatus
+squash_codec_decompress_with_impl (SquashCodec* codec,
+                                   SquashCodecImpl* impl,
+                                   size_t* decompressed_size,
+                                   uint8_t decompressed[HEDLEY_ARRAY_PARAM(*decompressed_size)],
+                                   size_t compressed_size,
+                                   const uint8_t compressed[HEDLEY_ARRAY_PARAM(compressed_size)],
+                                   SquashOptions* options) {
   assert (codec != NULL);
-
-  impl = squash_codec_get_impl (codec);
-  if (HEDLEY_UNLIKELY(impl == NULL))
-    return squash_error (SQUASH_UNABLE_TO_LOAD);
+  assert (impl != NULL);
 
   if (HEDLEY_UNLIKELY(decompressed == compressed))
     return squash_error (SQUASH_INVALID_BUFFER);
@@ -959,8 +1114,8 @@ squash_codec_decompress_with_options (SquashCodec* codec,
       res = impl->decompress_buffer (codec,
                                      &internal_decompressed_size, decompressed,
                                      internal_compressed_size, internal_compressed,
-                                     squash_object_ref (options));
-      squash_object_unref (options);
+                                     squash_options_hold (options));
+      squash_options_release (options);
 
       if (HEDLEY_LIKELY(res == SQUASH_OK) &&
           HEDLEY_UNLIKELY(internal_decompressed_size != encoded_decompressed_size)) {
@@ -970,8 +1125,8 @@ squash_codec_decompress_with_options (SquashCodec* codec,
       res = impl->decompress_buffer (codec,
                                      decompressed_size, decompressed,
                                      compressed_size, compressed,
-                                     squash_object_ref (options));
-      squash_object_unref (options);
+                                     squash_options_hold (options));
+      squash_options_release (options);
     }
 
     return res;
@@ -979,7 +1134,7 @@ squash_codec_decompress_with_options (SquashCodec* codec,
     SquashStatus status;
     SquashStream* stream;
 
-    stream = squash_codec_create_stream_with_options (codec, SQUASH_STREAM_DECOMPRESS, options);
+    stream = squash_codec_create_stream_with_impl (codec, impl, SQUASH_STREAM_DECOMPRESS, options);
     if (stream == NULL)
       exit(EXIT_FAILURE);
     if (HEDLEY_UNLIKELY(stream == NULL))
@@ -1013,6 +1168,40 @@ squash_codec_decompress_with_options (SquashCodec* codec,
   }
 }
 
+/**
+ * @brief Decompress a buffer with an existing @ref SquashOptions
+ *
+ * @param codec The codec to use
+ * @param[out] decompressed Location to store the decompressed data
+ * @param[in,out] decompressed_size Location storing the size of the
+ *   @a decompressed buffer on input, replaced with the actual size of
+ *   the decompressed data
+ * @param compressed The compressed data
+ * @param compressed_size Size of the compressed data (in bytes)
+ * @param options Compression options
+ * @return A status code
+ */
+SquashStatus
+squash_codec_decompress_with_options (SquashCodec* codec,
+                                      size_t* decompressed_size,
+                                      uint8_t decompressed[HEDLEY_ARRAY_PARAM(*decompressed_size)],
+                                      size_t compressed_size,
+                                      const uint8_t compressed[HEDLEY_ARRAY_PARAM(compressed_size)],
+                                      SquashOptions* options) {
+  SquashCodecImpl* impl = NULL;
+
+  assert (codec != NULL);
+
+  impl = squash_codec_get_impl (codec);
+  if (HEDLEY_UNLIKELY(impl == NULL))
+    return squash_error (SQUASH_UNABLE_TO_LOAD);
+
+  return squash_codec_decompress_with_impl (codec, impl,
+                                            decompressed_size, decompressed,
+                                            compressed_size, compressed,
+                                            options);
+}
+
 /**
  * @brief Decompress a buffer
  *
@@ -1041,7 +1230,7 @@ squash_codec_decompress (SquashCodec* codec,
   assert (codec != NULL);
 
   va_start (ap, compressed);
-  options = squash_options_newv (codec, ap);
+  options = squash_options_cached_newv (codec, ap);
   va_end (ap);
 
   res = squash_codec_decompress_with_options (codec,
@@ -1052,6 +1241,434 @@ squash_codec_decompress (SquashCodec* codec,
   return res;
 }
 
+/**
+ * @struct SquashBatchItem_
+ * @brief A single buffer to be processed by ::squash_codec_compress_batch
+ *   or ::squash_codec_decompress_batch
+ *
+ * @var SquashBatchItem_::input_size
+ * @brief Size of the input buffer (in bytes)
+ *
+ * @var SquashBatchItem_::input
+ * @brief The input buffer
+ *
+ * @var SquashBatchItem_::output_size
+ * @brief Size of the output buffer on input, replaced with the amount
+ *   of data written on success
+ *
+ * @var SquashBatchItem_::output
+ * @brief The output buffer
+ *
+ * @var SquashBatchItem_::status
+ * @brief Result of processing this item
+ */
+
+struct SquashCodecBatch {
+  SquashCodec* codec;
+  SquashCodecImpl* impl;
+  SquashStreamType stream_type;
+  SquashBatchItem* items;
+  SquashOptions* options;
+};
+
+static void
+squash_codec_batch_process_item (size_t index, void* user_data) {
+  struct SquashCodecBatch* batch = (struct SquashCodecBatch*) user_data;
+  SquashBatchItem* item = &(batch->items[index]);
+
+  if (batch->stream_type == SQUASH_STREAM_COMPRESS) {
+    item->status = squash_codec_compress_with_impl (batch->codec, batch->impl,
+                                                    &(item->output_size), item->output,
+                                                    item->input_size, item->input,
+                                                    batch->options);
+  } else {
+    item->status = squash_codec_decompress_with_impl (batch->codec, batch->impl,
+                                                      &(item->output_size), item->output,
+                                                      item->input_size, item->input,
+                                                      batch->options);
+  }
+}
+
+static SquashStatus
+squash_codec_process_batch (SquashCodec* codec,
+                            SquashStreamType stream_type,
+                            size_t n_items,
+                            SquashBatchItem items[HEDLEY_ARRAY_PARAM(n_items)],
+                            SquashOptions* options) {
+  SquashStatus res = SQUASH_OK;
+
+  assert (codec != NULL);
+  assert (n_items == 0 || items != NULL);
+
+  squash_options_hold (options);
+
+  SquashCodecImpl* impl = squash_codec_get_impl (codec);
+  if (HEDLEY_UNLIKELY(impl == NULL)) {
+    res = squash_error (SQUASH_UNABLE_TO_LOAD);
+    for (size_t i = 0 ; i < n_items ; i++)
+      items[i].status = res;
+    goto cleanup;
+  }
+
+  struct SquashCodecBatch batch = { codec, impl, stream_type, items, options };
+  squash_pool_run (n_items, squash_codec_batch_process_item, &batch);
+
+  for (size_t i = 0 ; i < n_items ; i++) {
+    if (items[i].status != SQUASH_OK) {
+      res = items[i].status;
+      break;
+    }
+  }
+
+ cleanup:
+
+  squash_options_release (options);
+  return res;
+}
+
+/**
+ * @brief Compress several buffers in parallel
+ *
+ * The items are independent; each is compressed exactly as if it
+ * were passed to ::squash_codec_compress_with_options, but the work
+ * is spread across a pool of threads managed by Squash.  The size of
+ * the pool defaults to the number of CPUs, and can be changed with
+ * the `SQUASH_THREADS` environment variable.
+ *
+ * The status of each item is stored in SquashBatchItem_::status, and
+ * the compressed size in SquashBatchItem_::output_size.
+ *
+ * @param codec The codec to use
+ * @param n_items Number of items in @a items
+ * @param[in,out] items The buffers to compress
+ * @param options Compression options
+ * @return @ref SQUASH_OK if every item was compressed successfully,
+ *   otherwise the status of the first item which failed
+ */
+SquashStatus
+squash_codec_compress_batch (SquashCodec* codec,
+                             size_t n_items,
+                             SquashBatchItem items[HEDLEY_ARRAY_PARAM(n_items)],
+                             SquashOptions* options) {
+  return squash_codec_process_batch (codec, SQUASH_STREAM_COMPRESS, n_items, items, options);
+}
+
+/**
+ * @brief Decompress several buffers in parallel
+ *
+ * The decompression counterpart to ::squash_codec_compress_batch.
+ *
+ * @param codec The codec to use
+ * @param n_items Number of items in @a items
+ * @param[in,out] items The buffers to decompress
+ * @param options Decompression options
+ * @return @ref SQUASH_OK if every item was decompressed successfully,
+ *   otherwise the status of the first item which failed
+ */
+SquashStatus
+squash_codec_decompress_batch (SquashCodec* codec,
+                               size_t n_items,
+                               SquashBatchItem items[HEDLEY_ARRAY_PARAM(n_items)],
+                               SquashOptions* options) {
+  return squash_codec_process_batch (codec, SQUASH_STREAM_DECOMPRESS, n_items, items, options);
+}
+
+/**
+ * @typedef SquashIOVec
+ * @brief A segment of a scattered buffer
+ *
+ * On POSIX systems this is `struct iovec`, so arrays prepared for
+ * readv/writev can be used directly.
+ */
+
+static size_t
+squash_iov_total (size_t iov_len, const SquashIOVec iov[HEDLEY_ARRAY_PARAM(iov_len)]) {
+  size_t total = 0;
+  for (size_t i = 0 ; i < iov_len ; i++) {
+    if (HEDLEY_UNLIKELY(SIZE_MAX - total < iov[i].iov_len))
+      return SIZE_MAX;
+    total += iov[i].iov_len;
+  }
+  return total;
+}
+
+/* Gather a scattered buffer into one allocation, unless it is only
+   one segment anyway.  *allocated is set if the caller must free the
+   result. */
+static const uint8_t*
+squash_iov_gather (size_t iov_len, const SquashIOVec iov[HEDLEY_ARRAY_PARAM(iov_len)], size_t* size, uint8_t** allocated) {
+  *allocated = NULL;
+  *size = squash_iov_total (iov_len, iov);
+
+  size_t first = 0;
+  while (first < iov_len && iov[first].iov_len == 0)
+    first++;
+  if (first == iov_len)
+    return (const uint8_t*) "";
+  if (iov[first].iov_len == *size)
+    return (const uint8_t*) iov[first].iov_base;
+
+  if (HEDLEY_UNLIKELY(*size == SIZE_MAX))
+    return NULL;
+  *allocated = squash_malloc (*size);
+  if (HEDLEY_UNLIKELY(*allocated == NULL))
+    return NULL;
+
+  size_t pos = 0;
+  for (size_t i = first ; i < iov_len ; i++) {
+    memcpy (*allocated + pos, iov[i].iov_base, iov[i].iov_len);
+    pos += iov[i].iov_len;
+  }
+
+  return *allocated;
+}
+
+static void
+squash_iov_scatter (size_t iov_len, const SquashIOVec iov[HEDLEY_ARRAY_PARAM(iov_len)], size_t data_size, const uint8_t* data) {
+  for (size_t i = 0 ; i < iov_len && data_size != 0 ; i++) {
+    const size_t cp_size = (data_size < iov[i].iov_len) ? data_size : iov[i].iov_len;
+    memcpy (iov[i].iov_base, data, cp_size);
+    data += cp_size;
+    data_size -= cp_size;
+  }
+}
+
+/* Feed each input segment to a stream in turn, moving on to the next
+   output segment whenever one fills up. */
+static SquashStatus
+squash_codec_process_iov_stream (SquashCodec* codec,
+                                 SquashStreamType stream_type,
+                                 size_t* output_size,
+                                 size_t output_iov_len,
+                                 const SquashIOVec output_iov[HEDLEY_ARRAY_PARAM(output_iov_len)],
+                                 size_t input_iov_len,
+                                 const SquashIOVec input_iov[HEDLEY_ARRAY_PARAM(input_iov_len)],
+                                 SquashOptions* options) {
+  SquashStatus res = SQUASH_OK;
+
+  SquashStream* stream = squash_codec_create_stream_with_options (codec, stream_type, options);
+  if (HEDLEY_UNLIKELY(stream == NULL))
+    return squash_error (SQUASH_FAILED);
+
+  /* Once the output segments are exhausted the stream is given this
+     instead; the data may well be complete already, and that is the
+     only way to find out without writing past the end. */
+  uint8_t overflow;
+
+  size_t out = 0;
+  size_t written = 0;
+  while (out < output_iov_len && output_iov[out].iov_len == 0)
+    out++;
+  if (out < output_iov_len) {
+    stream->next_out = (uint8_t*) output_iov[out].iov_base;
+    stream->avail_out = output_iov[out].iov_len;
+  } else {
+    stream->next_out = &overflow;
+    stream->avail_out = 1;
+  }
+
+  for (size_t in = 0 ; in <= input_iov_len ; in++) {
+    const bool finishing = (in == input_iov_len);
+    if (!finishing) {
+      if (input_iov[in].iov_len == 0)
+        continue;
+      stream->next_in = (const uint8_t*) input_iov[in].iov_base;
+      stream->avail_in = input_iov[in].iov_len;
+    }
+
+    do {
+      if (stream->avail_out == 0) {
+        if (out == output_iov_len) {
+          res = squash_error (SQUASH_BUFFER_FULL);
+          goto cleanup;
+        }
+        written += output_iov[out++].iov_len;
+        while (out < output_iov_len && output_iov[out].iov_len == 0)
+          out++;
+        if (out < output_iov_len) {
+          stream->next_out = (uint8_t*) output_iov[out].iov_base;
+          stream->avail_out = output_iov[out].iov_len;
+        } else {
+          stream->next_out = &overflow;
+          stream->avail_out = 1;
+        }
+      }
+
+      res = finishing ? squash_stream_finish (stream) : squash_stream_process (stream);
+    } while (res == SQUASH_PROCESSING);
+
+    if (res == SQUASH_END_OF_STREAM) {
+      res = SQUASH_OK;
+      if (!finishing)
+        break;
+    }
+    if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+      goto cleanup;
+  }
+
+  if (out < output_iov_len) {
+    written += output_iov[out].iov_len - stream->avail_out;
+  } else if (stream->avail_out == 0) {
+    res = squash_error (SQUASH_BUFFER_FULL);
+    goto cleanup;
+  }
+  *output_size = written;
+
+ cleanup:
+  squash_object_unref (stream);
+
+  return res;
+}
+
+static SquashStatus
+squash_codec_process_iov (SquashCodec* codec,
+                          SquashStreamType stream_type,
+                          size_t* output_size,
+                          size_t output_iov_len,
+                          const SquashIOVec output_iov[HEDLEY_ARRAY_PARAM(output_iov_len)],
+                          size_t input_iov_len,
+                          const SquashIOVec input_iov[HEDLEY_ARRAY_PARAM(input_iov_len)],
+                          SquashOptions* options) {
+  SquashStatus res;
+
+  assert (codec != NULL);
+  assert (output_size != NULL);
+  assert (output_iov_len == 0 || output_iov != NULL);
+  assert (input_iov_len == 0 || input_iov != NULL);
+
+  SquashCodecImpl* impl = squash_codec_get_impl (codec);
+  if (HEDLEY_UNLIKELY(impl == NULL))
+    return squash_error (SQUASH_UNABLE_TO_LOAD);
+
+  if (HEDLEY_UNLIKELY(squash_iov_total (output_iov_len, output_iov) == 0))
+    return squash_error (SQUASH_BUFFER_FULL);
+
+  squash_options_hold (options);
+
+  /* A single segment on each side is just a regular buffer. */
+  if (!(input_iov_len == 1 && output_iov_len == 1) && (impl->info & SQUASH_CODEC_INFO_NATIVE_STREAMING) != 0) {
+    res = squash_codec_process_iov_stream (codec, stream_type, output_size, output_iov_len, output_iov, input_iov_len, input_iov, options);
+    goto cleanup;
+  }
+
+  size_t input_size;
+  uint8_t* input_gathered;
+  const uint8_t* input = squash_iov_gather (input_iov_len, input_iov, &input_size, &input_gathered);
+  if (HEDLEY_UNLIKELY(input == NULL)) {
+    res = squash_error (SQUASH_MEMORY);
+    goto cleanup;
+  }
+
+  uint8_t* output_buffer = NULL;
+  uint8_t* output;
+  size_t output_capacity = squash_iov_total (output_iov_len, output_iov);
+  if (output_iov_len == 1) {
+    output = (uint8_t*) output_iov[0].iov_base;
+  } else {
+    /* Compressing into a buffer which is too small can fail in codec
+       specific ways, so make sure there is enough room. */
+    if (stream_type == SQUASH_STREAM_COMPRESS)
+      output_capacity = squash_codec_get_max_compressed_size (codec, input_size);
+    output = output_buffer = squash_malloc (output_capacity);
+    if (HEDLEY_UNLIKELY(output_buffer == NULL)) {
+      squash_free (input_gathered);
+      res = squash_error (SQUASH_MEMORY);
+      goto cleanup;
+    }
+  }
+
+  *output_size = output_capacity;
+  if (stream_type == SQUASH_STREAM_COMPRESS)
+    res = squash_codec_compress_with_options (codec, output_size, output, input_size, input, options);
+  else
+    res = squash_codec_decompress_with_options (codec, output_size, output, input_size, input, options);
+
+  if (output_buffer != NULL) {
+    if (res == SQUASH_OK) {
+      if (*output_size > squash_iov_total (output_iov_len, output_iov))
+        res = squash_error (SQUASH_BUFFER_FULL);
+      else
+        squash_iov_scatter (output_iov_len, output_iov, *output_size, output_buffer);
+    }
+    squash_free (output_buffer);
+  }
+  squash_free (input_gathered);
+
+ cleanup:
+  squash_options_release (options);
+
+  return res;
+}
+
+/**
+ * @brief Compress a scattered buffer into another scattered buffer
+ *
+ * Both the input and the output are described as lists of segments,
+ * so data held in a chain of buffers (for example, a network message)
+ * doesn't have to be copied into one contiguous buffer first, or
+ * split up again afterwards.
+ *
+ * Codecs which support streaming consume the segments directly.  For
+ * other codecs the input is gathered into a single buffer (unless it
+ * is only one segment), and if there is more than one output segment
+ * the output is compressed into a temporary buffer and then copied
+ * into them.
+ *
+ * @param codec The codec to use
+ * @param[out] compressed_size Location to store the number of bytes
+ *   written to @a compressed_iov, which are filled in order
+ * @param compressed_iov_len Number of segments in @a compressed_iov
+ * @param compressed_iov Segments to write the compressed data to
+ * @param uncompressed_iov_len Number of segments in @a uncompressed_iov
+ * @param uncompressed_iov Segments containing the data to compress
+ * @param options Compression options
+ * @return A status code
+ * @retval SQUASH_BUFFER_FULL The output segments are too small
+ */
+SquashStatus
+squash_codec_compress_iov (SquashCodec* codec,
+                           size_t* compressed_size,
+                           size_t compressed_iov_len,
+                           const SquashIOVec compressed_iov[HEDLEY_ARRAY_PARAM(compressed_iov_len)],
+                           size_t uncompressed_iov_len,
+                           const SquashIOVec uncompressed_iov[HEDLEY_ARRAY_PARAM(uncompressed_iov_len)],
+                           SquashOptions* options) {
+  return squash_codec_process_iov (codec, SQUASH_STREAM_COMPRESS,
+                                   compressed_size, compressed_iov_len, compressed_iov,
+                                   uncompressed_iov_len, uncompressed_iov,
+                                   options);
+}
+
+/**
+ * @brief Decompress a scattered buffer into another scattered buffer
+ *
+ * The decompression counterpart to ::squash_codec_compress_iov.
+ *
+ * @param codec The codec to use
+ * @param[out] decompressed_size Location to store the number of bytes
+ *   written to @a decompressed_iov, which are filled in order
+ * @param decompressed_iov_len Number of segments in @a decompressed_iov
+ * @param decompressed_iov Segments to write the decompressed data to
+ * @param compressed_iov_len Number of segments in @a compressed_iov
+ * @param compressed_iov Segments containing the data to decompress
+ * @param options Decompression options
+ * @return A status code
+ * @retval SQUASH_BUFFER_FULL The output segments are too small
+ */
+SquashStatus
+squash_codec_decompress_iov (SquashCodec* codec,
+                             size_t* decompressed_size,
+                             size_t decompressed_iov_len,
+                             const SquashIOVec decompressed_iov[HEDLEY_ARRAY_PARAM(decompressed_iov_len)],
+                             size_t compressed_iov_len,
+                             const SquashIOVec compressed_iov[HEDLEY_ARRAY_PARAM(compressed_iov_len)],
+                             SquashOptions* options) {
+  return squash_codec_process_iov (codec, SQUASH_STREAM_DECOMPRESS,
+                                   decompressed_size, decompressed_iov_len, decompressed_iov,
+                                   compressed_iov_len, compressed_iov,
+                                   options);
+}
+
 /**
  * @brief Create a new codec
  * @private
@@ -1114,6 +1731,38 @@ squash_codec_set_priority (SquashCodec* codec, unsigned int priority) {
   codec->priority = priority;
 }
 
+/**
+ * @brief Set the codec's preferred block size
+ * @private
+ *
+ * @param codec The codec
+ * @param block_size Preferred block size, or 0 if the codec has no
+ *   preference
+ */
+void
+squash_codec_set_block_size (SquashCodec* codec, size_t block_size) {
+  codec->block_size = block_size;
+}
+
+/**
+ * @brief Get the codec's preferred block size
+ *
+ * This is the amount of data the codec prefers to receive at once
+ * when streaming, as declared in the plugin's squash.ini.  Squash
+ * uses it as a starting point when choosing buffer sizes for
+ * operations like @ref squash_splice_custom_with_options.
+ *
+ * @param codec The codec
+ * @return The preferred block size, or 0 if the codec has no
+ *   preference
+ */
+size_t
+squash_codec_get_block_size (SquashCodec* codec) {
+  assert (codec != NULL);
+
+  return codec->block_size;
+}
+
 /**
  * @brief Get a bitmask of information about the codec
  *
@@ -1137,18 +1786,165 @@ squash_codec_get_option_info (SquashCodec* codec) {
   return HEDLEY_LIKELY(impl != NULL) ? impl->options : NULL;
 }
 
+/* Case-insensitive (for ASCII, like strcasecmp in the C locale)
+   FNV-1a hash of an option name. */
+static uint32_t
+squash_codec_option_hash (const char* name) {
+  uint32_t hash = UINT32_C(2166136261);
+  for (; *name != '\0' ; name++) {
+    unsigned char c = (unsigned char) *name;
+    if (c >= 'A' && c <= 'Z')
+      c += 'a' - 'A';
+    hash = (hash ^ c) * UINT32_C(16777619);
+  }
+  return hash;
+}
+
+/**
+ * @brief Build the option name index for a codec
+ * @private
+ *
+ * Must be called whenever the codec's option info is set, before the
+ * codec is made available to other threads.  Codecs with too many
+ * options to fit are looked up linearly instead.
+ *
+ * @param codec The codec
+ */
+void
+squash_codec_index_options (SquashCodec* codec) {
+  const SquashOptionInfo* info = codec->impl.options;
+  const size_t mask = SQUASH_CODEC_OPTION_SLOTS - 1;
+
+  codec->options_indexed = false;
+  memset (codec->option_slots, 0, sizeof (codec->option_slots));
+
+  if (info == NULL)
+    return;
+
+  size_t n_options;
+  for (n_options = 0 ; info[n_options].name != NULL ; n_options++) { }
+  if (n_options > (SQUASH_CODEC_OPTION_SLOTS / 2))
+    return;
+
+  for (size_t i = 0 ; i < n_options ; i++) {
+    size_t slot = squash_codec_option_hash (info[i].name) & mask;
+    while (codec->option_slots[slot] != 0)
+      slot = (slot + 1) & mask;
+    codec->option_slots[slot] = (uint8_t) (i + 1);
+  }
+
+  codec->options_indexed = true;
+}
+
+/**
+ * @brief Get the index of an option
+ *
+ * The index can be used with the `_at` variants of the option
+ * accessors (such as ::squash_options_set_int_at) to avoid looking
+ * the name up every time.  Names are case-insensitive.
+ *
+ * @param codec The codec
+ * @param name Name of the option
+ * @return The index of the option, or -1 if the codec has no such
+ *   option
+ */
+ptrdiff_t
+squash_codec_get_option_index (SquashCodec* codec, const char* name) {
+  assert (codec != NULL);
+  assert (name != NULL);
+
+  const SquashOptionInfo* info = squash_codec_get_option_info (codec);
+  if (info == NULL)
+    return -1;
+
+  if (HEDLEY_LIKELY(codec->options_indexed)) {
+    const size_t mask = SQUASH_CODEC_OPTION_SLOTS - 1;
+    for (size_t slot = squash_codec_option_hash (name) & mask ;
+         codec->option_slots[slot] != 0 ;
+         slot = (slot + 1) & mask) {
+      const ptrdiff_t option_n = (ptrdiff_t) codec->option_slots[slot] - 1;
+      if (strcasecmp (name, info[option_n].name) == 0)
+        return option_n;
+    }
+    return -1;
+  }
+
+  for (ptrdiff_t option_n = 0 ; info[option_n].name != NULL ; option_n++)
+    if (strcasecmp (name, info[option_n].name) == 0)
+      return option_n;
+
+  return -1;
+}
+
+/* Stream the decompressed data into the rope one segment at a time,
+   so nothing is ever copied or decompressed twice. */
+static SquashStatus
+squash_codec_decompress_to_rope_stream (SquashCodec* codec,
+                                        SquashRope* decompressed,
+                                        size_t compressed_size,
+                                        uint8_t compressed[HEDLEY_ARRAY_PARAM(compressed_size)],
+                                        SquashOptions* options) {
+  SquashStatus res;
+
+  SquashStream* stream = squash_codec_create_stream_with_options (codec, SQUASH_STREAM_DECOMPRESS, options);
+  if (HEDLEY_UNLIKELY(stream == NULL))
+    return squash_error (SQUASH_FAILED);
+
+  stream->next_in = compressed;
+  stream->avail_in = compressed_size;
+
+  do {
+    size_t avail;
+    stream->next_out = squash_rope_reserve (decompressed, &avail);
+    if (HEDLEY_UNLIKELY(stream->next_out == NULL)) {
+      res = squash_error (SQUASH_MEMORY);
+      break;
+    }
+    stream->avail_out = avail;
+
+    res = squash_stream_finish (stream);
+    squash_rope_commit (decompressed, avail - stream->avail_out);
+  } while (res == SQUASH_PROCESSING);
+
+  if (res == SQUASH_END_OF_STREAM)
+    res = SQUASH_OK;
+
+  squash_object_unref (stream);
+
+  return res;
+}
+
+/**
+ * @brief Decompress a buffer of unknown decompressed size
+ * @private
+ *
+ * Codecs which support streaming decompress directly into the rope;
+ * for other codecs the decompression is retried with larger buffers
+ * until the data fits, and the result is added to the rope as a
+ * single segment.
+ *
+ * @param codec The codec
+ * @param decompressed Rope to append the decompressed data to
+ * @param compressed_size Size of @a compressed, in bytes
+ * @param compressed The compressed data
+ * @param options Options to use, or *NULL*
+ * @return A status code
+ */
 SquashStatus
-squash_codec_decompress_to_buffer (SquashCodec* codec,
-                                   SquashBuffer* decompressed,
-                                   size_t compressed_size,
-                                   uint8_t compressed[HEDLEY_ARRAY_PARAM(compressed_size)],
-                                   SquashOptions* options) {
+squash_codec_decompress_to_rope (SquashCodec* codec,
+                                 SquashRope* decompressed,
+                                 size_t compressed_size,
+                                 uint8_t compressed[HEDLEY_ARRAY_PARAM(compressed_size)],
+                                 SquashOptions* options) {
   SquashStatus res;
 
   assert (codec != NULL);
   assert (decompressed != NULL);
   assert (compressed != NULL);
 
+  if ((codec->impl.info & SQUASH_CODEC_INFO_NATIVE_STREAMING) != 0)
+    return squash_codec_decompress_to_rope_stream (codec, decompressed, compressed_size, compressed, options);
+
   uint8_t* decompressed_data = NULL;
   const size_t compressed_npot_size = squash_npot (compressed_size);
   size_t decompressed_alloc = compressed_npot_size << 3;
@@ -1187,9 +1983,11 @@ squash_codec_decompress_to_buffer (SquashCodec* codec,
     }
   } while (res == SQUASH_BUFFER_FULL);
 
-  if (HEDLEY_LIKELY(res == SQUASH_OK))
-    squash_buffer_steal (decompressed, decompressed_size, decompressed_alloc, decompressed_data);
-  else
+  if (HEDLEY_LIKELY(res == SQUASH_OK)) {
+    if (HEDLEY_UNLIKELY(!squash_rope_adopt (decompressed, decompressed_size, decompressed_alloc, decompressed_data)))
+      res = squash_error (SQUASH_MEMORY);
+  }
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK))
     squash_free (decompressed_data);
 
   return res;
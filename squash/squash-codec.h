@@ -35,6 +35,9 @@
 #if !defined (SQUASH_H_INSIDE) && !defined (SQUASH_COMPILATION)
 #error "Only <squash.h> can be included directly."
 #endif
+#if !defined(_WIN32)
+#  include <sys/uio.h>
+#endif
 
 HEDLEY_BEGIN_C_DECLS
 
@@ -42,6 +45,9 @@ typedef enum {
   SQUASH_CODEC_INFO_CAN_FLUSH               = 1 <<  0,
   SQUASH_CODEC_INFO_DECOMPRESS_UNSAFE       = 1 <<  1,
   SQUASH_CODEC_INFO_WRAP_SIZE               = 1 <<  2,
+  SQUASH_CODEC_INFO_CONCATENABLE            = 1 <<  3,
+  SQUASH_CODEC_INFO_PASSTHROUGH             = 1 <<  4,
+  SQUASH_CODEC_INFO_DICTIONARY              = 1 <<  5,
 
   SQUASH_CODEC_INFO_AUTO_MASK               = 0x00ff0000,
   SQUASH_CODEC_INFO_VALID                   = 1 << 16,
@@ -59,6 +65,13 @@ typedef SquashStatus (*SquashReadFunc)  (size_t* data_size,
 typedef SquashStatus (*SquashWriteFunc) (size_t* data_size,
                                          const uint8_t data[HEDLEY_ARRAY_PARAM(*data_size)],
                                          void* user_data);
+typedef SquashStatus (*SquashReadBorrowFunc)  (size_t* data_size,
+                                               const uint8_t** data,
+                                               void* user_data);
+typedef SquashStatus (*SquashWriteBorrowFunc) (size_t written,
+                                               size_t* data_size,
+                                               uint8_t** data,
+                                               void* user_data);
 
 struct SquashCodecImpl_ {
   SquashCodecInfo           info;
@@ -103,17 +116,47 @@ struct SquashCodecImpl_ {
                                                         const uint8_t compressed[HEDLEY_ARRAY_PARAM(compressed_size)]);
   size_t                  (* get_max_compressed_size)  (SquashCodec* codec, size_t uncompressed_size);
 
+  /* Contexts */
+  void*                   (* create_context)           (SquashCodec* codec, SquashStreamType stream_type);
+  void                    (* destroy_context)          (SquashCodec* codec, SquashStreamType stream_type, void* context);
+
+  /* Streams */
+  SquashStatus            (* reset_stream)             (SquashStream* stream);
+
+  /* Dictionaries */
+  SquashStatus            (* train_dictionary)         (SquashCodec* codec,
+                                                        size_t* dictionary_size,
+                                                        uint8_t dictionary[HEDLEY_ARRAY_PARAM(*dictionary_size)],
+                                                        size_t n_samples,
+                                                        const uint8_t samples[],
+                                                        const size_t sample_sizes[HEDLEY_ARRAY_PARAM(n_samples)],
+                                                        unsigned int threads,
+                                                        SquashOptions* options);
+
   /* Reserved */
-  void                    (* _reserved1)               (void);
-  void                    (* _reserved2)               (void);
-  void                    (* _reserved3)               (void);
-  void                    (* _reserved4)               (void);
   void                    (* _reserved5)               (void);
   void                    (* _reserved6)               (void);
   void                    (* _reserved7)               (void);
   void                    (* _reserved8)               (void);
 };
 
+typedef struct SquashBatchItem_ {
+  size_t          input_size;
+  const uint8_t*  input;
+  size_t          output_size;
+  uint8_t*        output;
+  SquashStatus    status;
+} SquashBatchItem;
+
+#if !defined(_WIN32)
+typedef struct iovec SquashIOVec;
+#else
+typedef struct SquashIOVec_ {
+  void*           iov_base;
+  size_t          iov_len;
+} SquashIOVec;
+#endif
+
 typedef void (*SquashCodecForeachFunc) (SquashCodec* codec, void* data);
 
 HEDLEY_NON_NULL(1)
@@ -128,6 +171,8 @@ HEDLEY_NON_NULL(1)
 SQUASH_API SquashContext*          squash_codec_get_context                  (SquashCodec* codec);
 HEDLEY_NON_NULL(1)
 SQUASH_API const char*             squash_codec_get_extension                (SquashCodec* codec);
+HEDLEY_NON_NULL(1)
+SQUASH_API size_t                  squash_codec_get_block_size               (SquashCodec* codec);
 
 HEDLEY_NON_NULL(1, 3)
 SQUASH_API size_t                  squash_codec_get_uncompressed_size        (SquashCodec* codec,
@@ -136,6 +181,14 @@ SQUASH_API size_t                  squash_codec_get_uncompressed_size        (Sq
 HEDLEY_NON_NULL(1)
 SQUASH_API size_t                  squash_codec_get_max_compressed_size      (SquashCodec* codec, size_t uncompressed_size);
 
+HEDLEY_NON_NULL(1)
+SQUASH_API void*                   squash_codec_acquire_context              (SquashCodec* codec, SquashStreamType stream_type);
+HEDLEY_NON_NULL(1)
+SQUASH_API void                    squash_codec_release_context              (SquashCodec* codec,
+                                                                              SquashStreamType stream_type,
+                                                                              void* context,
+                                                                              size_t context_size);
+
 HEDLEY_SENTINEL(0)
 HEDLEY_NON_NULL(1)
 SQUASH_API SquashStream*           squash_codec_create_stream                (SquashCodec* codec, SquashStreamType stream_type, ...);
@@ -173,9 +226,40 @@ SQUASH_API SquashStatus            squash_codec_decompress_with_options      (Sq
                                                                               const uint8_t compressed[HEDLEY_ARRAY_PARAM(compressed_size)],
                                                                               SquashOptions* options);
 HEDLEY_NON_NULL(1)
+SQUASH_API SquashStatus            squash_codec_compress_batch               (SquashCodec* codec,
+                                                                              size_t n_items,
+                                                                              SquashBatchItem items[HEDLEY_ARRAY_PARAM(n_items)],
+                                                                              SquashOptions* options);
+HEDLEY_NON_NULL(1)
+SQUASH_API SquashStatus            squash_codec_decompress_batch             (SquashCodec* codec,
+                                                                              size_t n_items,
+                                                                              SquashBatchItem items[HEDLEY_ARRAY_PARAM(n_items)],
+                                                                              SquashOptions* options);
+HEDLEY_NON_NULL(1, 2)
+SQUASH_API SquashStatus            squash_codec_compress_iov                 (SquashCodec* codec,
+                                                                              size_t* compressed_size,
+                                                                              size_t compressed_iov_len,
+                                                                              const SquashIOVec compressed_iov[HEDLEY_ARRAY_PARAM(compressed_iov_len)],
+                                                                              size_t uncompressed_iov_len,
+                                                                              const SquashIOVec uncompressed_iov[HEDLEY_ARRAY_PARAM(uncompressed_iov_len)],
+                                                                              SquashOptions* options);
+HEDLEY_NON_NULL(1, 2)
+SQUASH_API SquashStatus            squash_codec_decompress_iov               (SquashCodec* codec,
+                                                                              size_t* decompressed_size,
+                                                                              size_t decompressed_iov_len,
+                                                                              const SquashIOVec decompressed_iov[HEDLEY_ARRAY_PARAM(decompressed_iov_len)],
+                                                                              size_t compressed_iov_len,
+                                                                              const SquashIOVec compressed_iov[HEDLEY_ARRAY_PARAM(compressed_iov_len)],
+                                                                              SquashOptions* options);
+HEDLEY_NON_NULL(1)
 SQUASH_API SquashCodecInfo         squash_codec_get_info                     (SquashCodec* codec);
 HEDLEY_NON_NULL(1)
 SQUASH_API const SquashOptionInfo* squash_codec_get_option_info              (SquashCodec* codec);
+HEDLEY_NON_NULL(1, 2)
+SQUASH_API ptrdiff_t               squash_codec_get_option_index             (SquashCodec* codec, const char* name);
+
+SQUASH_API double                  squash_probe_compressibility              (size_t data_size,
+                                                                              const uint8_t data[HEDLEY_ARRAY_PARAM(data_size)]);
 
 HEDLEY_END_C_DECLS
 
@@ -102,6 +102,17 @@ squash_context_get_codec_ref_from_extension (SquashContext* context, const char*
   return SQUASH_TREE_FIND (&(context->extensions), SquashCodecRef_, tree, &key);
 }
 
+/* Meta-codecs which wrap the codec named after the prefix, e.g.,
+   "parallel:zstd". */
+static const struct {
+  const char* prefix;
+  SquashCodec* (* get_wrapper) (SquashCodec* inner);
+} squash_context_wrappers[] = {
+  { "parallel", squash_codec_get_parallel },
+  { "seekable", squash_codec_get_seekable },
+  { "adaptive", squash_codec_get_adaptive }
+};
+
 /**
  * @brief Retrieve a @ref SquashCodec from a @ref SquashContext.
  *
@@ -114,6 +125,15 @@ SquashCodec*
 squash_context_get_codec (SquashContext* context, const char* codec) {
   const char* sep_pos = strchr (codec, ':');
   if (sep_pos != NULL) {
+    const size_t prefix_length = (size_t) (sep_pos - codec);
+    for (size_t i = 0 ; i < (sizeof (squash_context_wrappers) / sizeof (squash_context_wrappers[0])) ; i++) {
+      const char* prefix = squash_context_wrappers[i].prefix;
+      if (strlen (prefix) == prefix_length && strncmp (codec, prefix, prefix_length) == 0) {
+        SquashCodec* inner = squash_context_get_codec (context, sep_pos + 1);
+        return (inner != NULL) ? squash_context_wrappers[i].get_wrapper (inner) : NULL;
+      }
+    }
+
     char* plugin_name = (char*) squash_malloc ((sep_pos - codec) + 1);
 
     strncpy (plugin_name, codec, sep_pos - codec);
@@ -356,6 +376,12 @@ squash_codecs_file_parser_callback (const char* section,
       }
     } else if (strcasecmp (key, "extension") == 0) {
       squash_codec_set_extension (parser->codec, value);
+    } else if (strcasecmp (key, "block-size") == 0) {
+      char* endptr = NULL;
+      unsigned long block_size = strtoul (value, &endptr, 0);
+      if (*endptr == '\0') {
+        squash_codec_set_block_size (parser->codec, (size_t) block_size);
+      }
     }
   }
 
@@ -35,6 +35,11 @@
 
 HEDLEY_BEGIN_C_DECLS
 
+typedef enum {
+  SQUASH_SELECT_TARGET_SPEED = 1,
+  SQUASH_SELECT_TARGET_RATIO = 2
+} SquashSelectTarget;
+
 SQUASH_API void           squash_set_default_search_path          (const char* search_path);
 SQUASH_API SquashContext* squash_context_get_default              (void);
 HEDLEY_NON_NULL(1, 2)
@@ -58,6 +63,12 @@ HEDLEY_NON_NULL(1)
 SQUASH_API void           squash_foreach_codec                    (SquashCodecForeachFunc func, void* data);
 HEDLEY_NON_NULL(1)
 SQUASH_API SquashCodec*   squash_get_codec_from_extension         (const char* extension);
+HEDLEY_NON_NULL(2)
+SQUASH_API SquashCodec*   squash_select_codec                     (size_t sample_size,
+                                                                   const uint8_t sample[HEDLEY_ARRAY_PARAM(sample_size)],
+                                                                   SquashSelectTarget target,
+                                                                   double value,
+                                                                   SquashOptions** options);
 
 HEDLEY_END_C_DECLS
 
@@ -0,0 +1,668 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @defgroup SquashDictionary SquashDictionary
+ * @brief Preset dictionaries.
+ *
+ * A dictionary is a sample of data similar to what will be
+ * compressed.  Codecs which support them (indicated by the @ref
+ * SQUASH_CODEC_INFO_DICTIONARY flag) can refer back to it as if it
+ * were part of the input, which dramatically improves the ratio (and
+ * usually the speed) when compressing small messages.  The same
+ * dictionary must be used for decompression.
+ *
+ * Dictionaries are attached to a @ref SquashOptions instance with
+ * ::squash_options_set_dictionary.  They are immutable, so a single
+ * dictionary can be shared by any number of threads.
+ *
+ * @section DictionaryDigests Digests
+ *
+ * Many libraries can pre-process a dictionary into a form which is
+ * much cheaper to start compressing (or decompressing) with than the
+ * raw bytes.  Plugins should use ::squash_dictionary_get_digest to
+ * create these lazily; the digest is created once, cached in the
+ * dictionary, and shared (read-only) by every user until the
+ * dictionary is destroyed.
+ *
+ * @{
+ */
+
+/**
+ * @typedef SquashDictionaryDigestFunc
+ * @brief Callback used to create a digested dictionary
+ *
+ * @param dictionary The dictionary to digest
+ * @param codec The codec the digest is for
+ * @param stream_type Whether the digest is for compression or
+ *   decompression
+ * @param variant Plugin-defined value (for example, the compression
+ *   level) which was passed to ::squash_dictionary_get_digest
+ * @return The digest, or *NULL* on failure
+ */
+
+typedef struct SquashDictionaryDigest_ {
+  struct SquashDictionaryDigest_* next;
+
+  SquashCodec* codec;
+  SquashStreamType stream_type;
+  int variant;
+
+  void* digest;
+  SquashDestroyNotify destroy;
+} SquashDictionaryDigest;
+
+struct SquashDictionary_ {
+  SquashObject base_object;
+
+  uint8_t* data;
+  size_t size;
+
+  mtx_t digests_mtx;
+  SquashDictionaryDigest* digests;
+};
+
+static void
+squash_dictionary_destroy (void* obj) {
+  SquashDictionary* dictionary = (SquashDictionary*) obj;
+
+  SquashDictionaryDigest* next;
+  for (SquashDictionaryDigest* d = dictionary->digests ; d != NULL ; d = next) {
+    next = d->next;
+    d->destroy (d->digest);
+    squash_free (d);
+  }
+
+  mtx_destroy (&(dictionary->digests_mtx));
+  squash_free (dictionary->data);
+
+  squash_object_destroy (obj);
+}
+
+/* Like squash_dictionary_new, but takes ownership of data (which must
+   have been allocated with squash_malloc) instead of copying it.  The
+   data is freed on failure. */
+static SquashDictionary*
+squash_dictionary_new_take (size_t data_size, uint8_t* data) {
+  SquashDictionary* dictionary = squash_malloc (sizeof (SquashDictionary));
+  if (HEDLEY_UNLIKELY(dictionary == NULL)) {
+    squash_free (data);
+    return NULL;
+  }
+
+  if (HEDLEY_UNLIKELY(mtx_init (&(dictionary->digests_mtx), mtx_plain) != thrd_success)) {
+    squash_free (data);
+    squash_free (dictionary);
+    return NULL;
+  }
+
+  dictionary->data = data;
+  dictionary->size = data_size;
+  dictionary->digests = NULL;
+
+  squash_object_init (dictionary, true, squash_dictionary_destroy);
+
+  return dictionary;
+}
+
+/**
+ * @brief Create a new dictionary
+ *
+ * This function returns a floating reference; if you need to keep a
+ * local reference you must ref the dictionary before passing it to
+ * another function.
+ *
+ * @param data_size Size of @a data, in bytes
+ * @param data Contents of the dictionary, which are copied
+ * @return A new dictionary, or *NULL* on failure
+ */
+SquashDictionary*
+squash_dictionary_new (size_t data_size, const uint8_t data[HEDLEY_ARRAY_PARAM(data_size)]) {
+  assert (data != NULL);
+
+  if (HEDLEY_UNLIKELY(data_size == 0)) {
+    squash_error (SQUASH_BAD_VALUE);
+    return NULL;
+  }
+
+  uint8_t* copy = squash_malloc (data_size);
+  if (HEDLEY_UNLIKELY(copy == NULL))
+    return NULL;
+  memcpy (copy, data, data_size);
+
+  return squash_dictionary_new_take (data_size, copy);
+}
+
+/**
+ * @brief Get the contents of a dictionary
+ *
+ * @param dictionary The dictionary
+ * @return The contents of the dictionary
+ */
+const uint8_t*
+squash_dictionary_get_data (SquashDictionary* dictionary) {
+  assert (dictionary != NULL);
+
+  return dictionary->data;
+}
+
+/**
+ * @brief Get the size of a dictionary
+ *
+ * @param dictionary The dictionary
+ * @return The size of the dictionary, in bytes
+ */
+size_t
+squash_dictionary_get_size (SquashDictionary* dictionary) {
+  assert (dictionary != NULL);
+
+  return dictionary->size;
+}
+
+/**
+ * @brief Get a digested form of a dictionary
+ *
+ * This is intended for plugins.  The first call for a given
+ * combination of @a codec, @a stream_type and @a variant invokes @a
+ * create; the result is cached in the dictionary and returned by
+ * every later call, from any thread.
+ *
+ * The digest remains owned by the dictionary, and will be passed to
+ * @a destroy when the dictionary is destroyed.  Since it may be in use
+ * by several threads at once, it must not be modified.
+ *
+ * @param dictionary The dictionary
+ * @param codec The codec the digest is for
+ * @param stream_type Whether the digest is for compression or
+ *   decompression
+ * @param variant Plugin-defined value for anything else the digest
+ *   depends on, such as the compression level
+ * @param create Function to create the digest if it isn't cached
+ * @param destroy Function to destroy the digest
+ * @return The digest, or *NULL* if @a create failed
+ */
+void*
+squash_dictionary_get_digest (SquashDictionary* dictionary,
+                              SquashCodec* codec,
+                              SquashStreamType stream_type,
+                              int variant,
+                              SquashDictionaryDigestFunc create,
+                              SquashDestroyNotify destroy) {
+  assert (dictionary != NULL);
+  assert (codec != NULL);
+  assert (create != NULL);
+  assert (destroy != NULL);
+
+  void* digest = NULL;
+
+  /* Creating a digest can be expensive, but holding the lock while
+     doing so means it only ever happens once. */
+  mtx_lock (&(dictionary->digests_mtx));
+
+  for (SquashDictionaryDigest* d = dictionary->digests ; d != NULL ; d = d->next) {
+    if (d->codec == codec && d->stream_type == stream_type && d->variant == variant) {
+      digest = d->digest;
+      goto unlock;
+    }
+  }
+
+  SquashDictionaryDigest* entry = squash_malloc (sizeof (SquashDictionaryDigest));
+  if (HEDLEY_UNLIKELY(entry == NULL))
+    goto unlock;
+
+  digest = create (dictionary, codec, stream_type, variant);
+  if (HEDLEY_UNLIKELY(digest == NULL)) {
+    squash_free (entry);
+    goto unlock;
+  }
+
+  entry->codec = codec;
+  entry->stream_type = stream_type;
+  entry->variant = variant;
+  entry->digest = digest;
+  entry->destroy = destroy;
+  entry->next = dictionary->digests;
+  dictionary->digests = entry;
+
+ unlock:
+  mtx_unlock (&(dictionary->digests_mtx));
+
+  return digest;
+}
+
+/* Generic dictionary training.
+ *
+ * This is a simplified version of the COVER algorithm used by zstd:
+ * every k-mer (K-byte substring) is hashed into a table which counts
+ * how many samples it occurs in, the samples are divided into epochs,
+ * and the segment with the highest total count is chosen from each
+ * epoch.  The best segments are then added to the dictionary, skipping
+ * ones which mostly repeat content already chosen.  K-mers which made
+ * it into the dictionary no longer count, so the search is repeated
+ * to find other content until the dictionary is full.  Segments are
+ * added from the end backwards, so the most valuable ones end up
+ * closest to the data (where they are cheapest to refer to).
+ *
+ * Counting occurrences per sample rather than in total means that
+ * content which is repeated within a single sample (which the codec
+ * will find on its own) doesn't crowd out content common to many
+ * samples, which is what a dictionary is for.
+ *
+ * Counting is split across the thread pool by sample, and each epoch
+ * is searched independently, so training scales with the number of
+ * cores. */
+
+#define SQUASH_DICTIONARY_TRAIN_K 8
+#define SQUASH_DICTIONARY_TRAIN_SEGMENT_SIZE 128
+#define SQUASH_DICTIONARY_TRAIN_TABLE_BITS 19
+#define SQUASH_DICTIONARY_TRAIN_TABLE_SIZE (((size_t) 1) << SQUASH_DICTIONARY_TRAIN_TABLE_BITS)
+#define SQUASH_DICTIONARY_TRAIN_MAX_SHARDS 8
+#define SQUASH_DICTIONARY_TRAIN_MAX_ROUNDS 16
+
+typedef struct SquashDictionaryTrainSegment_ {
+  uint64_t score;
+  size_t sample;
+  size_t offset;
+  size_t length;
+} SquashDictionaryTrainSegment;
+
+typedef struct SquashDictionaryTrainer_ {
+  size_t n_samples;
+  const uint8_t* const* samples;
+  const size_t* sample_sizes;
+  /* Offset of each sample if they were concatenated */
+  size_t* sample_offsets;
+  size_t total_size;
+
+  size_t n_shards;
+  uint32_t* counts[SQUASH_DICTIONARY_TRAIN_MAX_SHARDS];
+  uint32_t* last_seen[SQUASH_DICTIONARY_TRAIN_MAX_SHARDS];
+  uint32_t min_count;
+  /* K-mers already in the dictionary */
+  uint8_t* used;
+
+  size_t n_epochs;
+  size_t epoch_size;
+  SquashDictionaryTrainSegment* segments;
+} SquashDictionaryTrainer;
+
+static size_t
+squash_dictionary_train_hash (const uint8_t* kmer) {
+  uint64_t v;
+  memcpy (&v, kmer, sizeof (v));
+  return (size_t) ((v * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - SQUASH_DICTIONARY_TRAIN_TABLE_BITS));
+}
+
+static void
+squash_dictionary_train_count (size_t shard, void* user_data) {
+  SquashDictionaryTrainer* trainer = (SquashDictionaryTrainer*) user_data;
+  uint32_t* counts = trainer->counts[shard];
+  uint32_t* last_seen = trainer->last_seen[shard];
+
+  for (size_t sample = shard ; sample < trainer->n_samples ; sample += trainer->n_shards) {
+    const uint8_t* data = trainer->samples[sample];
+    const size_t size = trainer->sample_sizes[sample];
+    const uint32_t tag = (uint32_t) sample + 1;
+
+    for (size_t pos = 0 ; pos + SQUASH_DICTIONARY_TRAIN_K <= size ; pos++) {
+      const size_t h = squash_dictionary_train_hash (data + pos);
+      if (last_seen[h] != tag) {
+        last_seen[h] = tag;
+        counts[h]++;
+      }
+    }
+  }
+}
+
+/* Each shard sums one slice of the table into the first shard's. */
+static void
+squash_dictionary_train_merge (size_t slice, void* user_data) {
+  SquashDictionaryTrainer* trainer = (SquashDictionaryTrainer*) user_data;
+  const size_t slice_size = SQUASH_DICTIONARY_TRAIN_TABLE_SIZE / trainer->n_shards;
+  const size_t begin = slice * slice_size;
+  const size_t end = (slice == trainer->n_shards - 1) ? SQUASH_DICTIONARY_TRAIN_TABLE_SIZE : begin + slice_size;
+  uint32_t* dest = trainer->counts[0];
+
+  for (size_t shard = 1 ; shard < trainer->n_shards ; shard++) {
+    const uint32_t* src = trainer->counts[shard];
+    for (size_t h = begin ; h < end ; h++)
+      dest[h] += src[h];
+  }
+}
+
+static uint32_t
+squash_dictionary_train_kmer_score (const SquashDictionaryTrainer* trainer, const uint8_t* kmer) {
+  const size_t h = squash_dictionary_train_hash (kmer);
+  const uint32_t count = trainer->counts[0][h];
+  return (count >= trainer->min_count && !trainer->used[h]) ? count : 0;
+}
+
+/* Find the best segment which starts within the epoch. */
+static void
+squash_dictionary_train_search (size_t epoch, void* user_data) {
+  SquashDictionaryTrainer* trainer = (SquashDictionaryTrainer*) user_data;
+  SquashDictionaryTrainSegment* best = &(trainer->segments[epoch]);
+  const size_t begin = epoch * trainer->epoch_size;
+  const size_t end = (epoch == trainer->n_epochs - 1) ? trainer->total_size : begin + trainer->epoch_size;
+
+  best->score = 0;
+
+  /* Find the sample containing the start of the epoch. */
+  size_t lo = 0, hi = trainer->n_samples;
+  while (hi - lo > 1) {
+    const size_t mid = lo + ((hi - lo) / 2);
+    if (trainer->sample_offsets[mid] <= begin)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  for (size_t sample = lo ; sample < trainer->n_samples && trainer->sample_offsets[sample] < end ; sample++) {
+    const uint8_t* data = trainer->samples[sample];
+    const size_t size = trainer->sample_sizes[sample];
+    if (size < SQUASH_DICTIONARY_TRAIN_K)
+      continue;
+
+    const size_t length = (size < SQUASH_DICTIONARY_TRAIN_SEGMENT_SIZE) ? size : SQUASH_DICTIONARY_TRAIN_SEGMENT_SIZE;
+    const size_t n_kmers = length - SQUASH_DICTIONARY_TRAIN_K + 1;
+    const size_t sample_begin = trainer->sample_offsets[sample];
+    const size_t first = (begin > sample_begin) ? begin - sample_begin : 0;
+    size_t last = end - sample_begin;
+    if (last > size - length + 1)
+      last = size - length + 1;
+    if (first >= last)
+      continue;
+
+    /* Sliding window over the k-mers in [offset, offset + length). */
+    uint64_t score = 0;
+    for (size_t i = 0 ; i < n_kmers ; i++)
+      score += squash_dictionary_train_kmer_score (trainer, data + first + i);
+
+    for (size_t offset = first ; ; offset++) {
+      if (score > best->score) {
+        best->score = score;
+        best->sample = sample;
+        best->offset = offset;
+        best->length = length;
+      }
+
+      if (offset + 1 >= last)
+        break;
+
+      score -= squash_dictionary_train_kmer_score (trainer, data + offset);
+      score += squash_dictionary_train_kmer_score (trainer, data + offset + n_kmers);
+    }
+  }
+}
+
+static int
+squash_dictionary_train_segment_compare (const void* a, const void* b) {
+  const SquashDictionaryTrainSegment* sa = (const SquashDictionaryTrainSegment*) a;
+  const SquashDictionaryTrainSegment* sb = (const SquashDictionaryTrainSegment*) b;
+
+  if (sa->score != sb->score)
+    return (sa->score > sb->score) ? -1 : 1;
+  else if (sa->sample != sb->sample)
+    return (sa->sample < sb->sample) ? -1 : 1;
+  else
+    return (sa->offset < sb->offset) ? -1 : (sa->offset > sb->offset);
+}
+
+static SquashStatus
+squash_dictionary_train_generic (size_t* dictionary_size,
+                                 uint8_t dictionary[HEDLEY_ARRAY_PARAM(*dictionary_size)],
+                                 size_t n_samples,
+                                 const uint8_t* const samples[HEDLEY_ARRAY_PARAM(n_samples)],
+                                 const size_t sample_sizes[HEDLEY_ARRAY_PARAM(n_samples)],
+                                 unsigned int threads) {
+  SquashStatus res = SQUASH_OK;
+  SquashDictionaryTrainer trainer = { 0, };
+
+  trainer.n_samples = n_samples;
+  trainer.samples = samples;
+  trainer.sample_sizes = sample_sizes;
+  trainer.min_count = (n_samples > 1) ? 2 : 1;
+
+  trainer.sample_offsets = squash_malloc (sizeof (size_t) * n_samples);
+  if (HEDLEY_UNLIKELY(trainer.sample_offsets == NULL))
+    return squash_error (SQUASH_MEMORY);
+  for (size_t i = 0 ; i < n_samples ; i++) {
+    trainer.sample_offsets[i] = trainer.total_size;
+    trainer.total_size += sample_sizes[i];
+  }
+
+  /* Sample indexes are used as tags in last_seen. */
+  if (HEDLEY_UNLIKELY(n_samples >= UINT32_MAX)) {
+    res = squash_error (SQUASH_RANGE);
+    goto cleanup;
+  }
+
+  trainer.n_shards = threads;
+  if (trainer.n_shards > SQUASH_DICTIONARY_TRAIN_MAX_SHARDS)
+    trainer.n_shards = SQUASH_DICTIONARY_TRAIN_MAX_SHARDS;
+  if (trainer.n_shards > n_samples)
+    trainer.n_shards = n_samples;
+  if (trainer.n_shards == 0)
+    trainer.n_shards = 1;
+
+  for (size_t shard = 0 ; shard < trainer.n_shards ; shard++) {
+    trainer.counts[shard] = squash_calloc (SQUASH_DICTIONARY_TRAIN_TABLE_SIZE, sizeof (uint32_t));
+    trainer.last_seen[shard] = squash_calloc (SQUASH_DICTIONARY_TRAIN_TABLE_SIZE, sizeof (uint32_t));
+    if (HEDLEY_UNLIKELY(trainer.counts[shard] == NULL || trainer.last_seen[shard] == NULL)) {
+      res = squash_error (SQUASH_MEMORY);
+      goto cleanup;
+    }
+  }
+
+  squash_pool_run (trainer.n_shards, squash_dictionary_train_count, &trainer);
+  if (trainer.n_shards > 1)
+    squash_pool_run (trainer.n_shards, squash_dictionary_train_merge, &trainer);
+
+  /* Twice as many epochs as would fit in the dictionary, so there are
+     still enough candidates after skipping the redundant ones. */
+  trainer.n_epochs = (*dictionary_size / SQUASH_DICTIONARY_TRAIN_SEGMENT_SIZE) * 2;
+  if (trainer.n_epochs > trainer.total_size / SQUASH_DICTIONARY_TRAIN_SEGMENT_SIZE)
+    trainer.n_epochs = trainer.total_size / SQUASH_DICTIONARY_TRAIN_SEGMENT_SIZE;
+  if (trainer.n_epochs == 0)
+    trainer.n_epochs = 1;
+  trainer.epoch_size = trainer.total_size / trainer.n_epochs;
+
+  trainer.segments = squash_malloc (sizeof (SquashDictionaryTrainSegment) * trainer.n_epochs);
+  if (HEDLEY_UNLIKELY(trainer.segments == NULL)) {
+    res = squash_error (SQUASH_MEMORY);
+    goto cleanup;
+  }
+
+  /* The per-sample tags aren't needed any more, so reuse one of the
+     tables to remember which k-mers are already in the dictionary. */
+  trainer.used = (uint8_t*) trainer.last_seen[0];
+  memset (trainer.used, 0, SQUASH_DICTIONARY_TRAIN_TABLE_SIZE);
+
+  size_t remaining = *dictionary_size;
+  for (unsigned int round = 0 ; round < SQUASH_DICTIONARY_TRAIN_MAX_ROUNDS && remaining > 0 ; round++) {
+    squash_pool_run (trainer.n_epochs, squash_dictionary_train_search, &trainer);
+
+    qsort (trainer.segments, trainer.n_epochs, sizeof (SquashDictionaryTrainSegment), squash_dictionary_train_segment_compare);
+
+    const size_t remaining_at_start = remaining;
+    for (size_t i = 0 ; i < trainer.n_epochs && remaining > 0 ; i++) {
+      const SquashDictionaryTrainSegment* segment = &(trainer.segments[i]);
+      if (segment->score == 0)
+        break;
+
+      const uint8_t* data = trainer.samples[segment->sample] + segment->offset;
+      const size_t n_kmers = segment->length - SQUASH_DICTIONARY_TRAIN_K + 1;
+
+      /* Earlier segments from this round may already cover it; also
+         trim k-mers which are worthless from either end. */
+      uint64_t novel = 0;
+      size_t first_kmer = n_kmers, last_kmer = 0;
+      for (size_t k = 0 ; k < n_kmers ; k++) {
+        const uint32_t score = squash_dictionary_train_kmer_score (&trainer, data + k);
+        if (score != 0) {
+          novel += score;
+          if (first_kmer == n_kmers)
+            first_kmer = k;
+          last_kmer = k;
+        }
+      }
+      if (novel == 0 || novel * 2 < segment->score)
+        continue;
+
+      for (size_t k = first_kmer ; k <= last_kmer ; k++)
+        trainer.used[squash_dictionary_train_hash (data + k)] = 1;
+
+      size_t length = (last_kmer - first_kmer) + SQUASH_DICTIONARY_TRAIN_K;
+      if (length > remaining)
+        length = remaining;
+      remaining -= length;
+      memcpy (dictionary + remaining, data + first_kmer, length);
+    }
+
+    if (remaining == remaining_at_start)
+      break;
+  }
+
+  if (HEDLEY_UNLIKELY(remaining == *dictionary_size)) {
+    res = squash_error (SQUASH_FAILED);
+    goto cleanup;
+  }
+
+  if (remaining != 0) {
+    memmove (dictionary, dictionary + remaining, *dictionary_size - remaining);
+    *dictionary_size -= remaining;
+  }
+
+ cleanup:
+
+  for (size_t shard = 0 ; shard < trainer.n_shards ; shard++) {
+    squash_free (trainer.counts[shard]);
+    squash_free (trainer.last_seen[shard]);
+  }
+  squash_free (trainer.segments);
+  squash_free (trainer.sample_offsets);
+
+  return res;
+}
+
+/**
+ * @brief Train a dictionary from sample data
+ *
+ * Builds a dictionary of up to @a dictionary_size bytes for @a codec
+ * from a set of samples, each of which should be representative of an
+ * individual message you will later compress with the dictionary.
+ * Plugins may provide their own trainer (zstd does); otherwise a
+ * generic one which collects the substrings common to the most
+ * samples is used.
+ *
+ * Training runs on the thread pool; the number of threads is taken
+ * from @a options (see ::squash_options_set_threads) or, if that is
+ * 0, defaults to one per CPU.
+ *
+ * This function returns a floating reference.
+ *
+ * @param codec The codec the dictionary is for
+ * @param dictionary_size Maximum size of the dictionary, in bytes
+ * @param n_samples Number of samples
+ * @param samples The samples
+ * @param sample_sizes Size of each sample, in bytes
+ * @param options Options for the codec, or *NULL*
+ * @return A new dictionary, or *NULL* on failure
+ */
+SquashDictionary*
+squash_dictionary_train (SquashCodec* codec,
+                         size_t dictionary_size,
+                         size_t n_samples,
+                         const uint8_t* const samples[HEDLEY_ARRAY_PARAM(n_samples)],
+                         const size_t sample_sizes[HEDLEY_ARRAY_PARAM(n_samples)],
+                         SquashOptions* options) {
+  assert (codec != NULL);
+  assert (samples != NULL);
+  assert (sample_sizes != NULL);
+
+  SquashCodecImpl* impl = squash_codec_get_impl (codec);
+  if (HEDLEY_UNLIKELY(impl == NULL))
+    return (squash_error (SQUASH_UNABLE_TO_LOAD), NULL);
+
+  if (HEDLEY_UNLIKELY((impl->info & SQUASH_CODEC_INFO_DICTIONARY) == 0))
+    return (squash_error (SQUASH_BAD_PARAM), NULL);
+
+  size_t total_size = 0;
+  for (size_t i = 0 ; i < n_samples ; i++)
+    total_size += sample_sizes[i];
+
+  if (HEDLEY_UNLIKELY(dictionary_size == 0 || total_size == 0))
+    return (squash_error (SQUASH_BAD_VALUE), NULL);
+
+  unsigned int threads = squash_options_get_threads (options);
+  if (threads == 0)
+    threads = squash_pool_get_threads ();
+
+  uint8_t* dictionary = squash_malloc (dictionary_size);
+  if (HEDLEY_UNLIKELY(dictionary == NULL))
+    return (squash_error (SQUASH_MEMORY), NULL);
+
+  SquashStatus res;
+  if (impl->train_dictionary != NULL) {
+    /* Plugins get the samples concatenated, which is what most
+       libraries expect. */
+    uint8_t* concatenated = squash_malloc (total_size);
+    if (HEDLEY_UNLIKELY(concatenated == NULL)) {
+      squash_free (dictionary);
+      return (squash_error (SQUASH_MEMORY), NULL);
+    }
+
+    size_t pos = 0;
+    for (size_t i = 0 ; i < n_samples ; i++) {
+      memcpy (concatenated + pos, samples[i], sample_sizes[i]);
+      pos += sample_sizes[i];
+    }
+
+    res = impl->train_dictionary (codec, &dictionary_size, dictionary, n_samples, concatenated, sample_sizes, threads, options);
+    squash_free (concatenated);
+  } else {
+    res = squash_dictionary_train_generic (&dictionary_size, dictionary, n_samples, samples, sample_sizes, threads);
+  }
+
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK)) {
+    squash_free (dictionary);
+    return (squash_error (res), NULL);
+  }
+
+  return squash_dictionary_new_take (dictionary_size, dictionary);
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,69 @@
+/* Copyright (c) 2013-2017 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+/* IWYU pragma: private, include <squash.h> */
+
+#ifndef SQUASH_DICTIONARY_H
+#define SQUASH_DICTIONARY_H
+
+#if !defined (SQUASH_H_INSIDE) && !defined (SQUASH_COMPILATION)
+#error "Only <squash.h> can be included directly."
+#endif
+
+#include <squash.h>
+#include <stddef.h>
+#include <stdint.h>
+
+HEDLEY_BEGIN_C_DECLS
+
+typedef void* (*SquashDictionaryDigestFunc) (SquashDictionary* dictionary,
+                                             SquashCodec* codec,
+                                             SquashStreamType stream_type,
+                                             int variant);
+
+HEDLEY_NON_NULL(2)
+SQUASH_API SquashDictionary* squash_dictionary_new        (size_t data_size, const uint8_t data[HEDLEY_ARRAY_PARAM(data_size)]);
+HEDLEY_NON_NULL(1)
+SQUASH_API const uint8_t*    squash_dictionary_get_data   (SquashDictionary* dictionary);
+HEDLEY_NON_NULL(1)
+SQUASH_API size_t            squash_dictionary_get_size   (SquashDictionary* dictionary);
+HEDLEY_NON_NULL(1, 2, 5, 6)
+SQUASH_API void*             squash_dictionary_get_digest (SquashDictionary* dictionary,
+                                                           SquashCodec* codec,
+                                                           SquashStreamType stream_type,
+                                                           int variant,
+                                                           SquashDictionaryDigestFunc create,
+                                                           SquashDestroyNotify destroy);
+HEDLEY_NON_NULL(1, 4, 5)
+SQUASH_API SquashDictionary* squash_dictionary_train      (SquashCodec* codec,
+                                                           size_t dictionary_size,
+                                                           size_t n_samples,
+                                                           const uint8_t* const samples[HEDLEY_ARRAY_PARAM(n_samples)],
+                                                           const size_t sample_sizes[HEDLEY_ARRAY_PARAM(n_samples)],
+                                                           SquashOptions* options);
+
+HEDLEY_END_C_DECLS
+
+#endif /* SQUASH_DICTIONARY_H */
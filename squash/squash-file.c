@@ -43,23 +43,100 @@
 
 #include "squash/tinycthread/source/tinycthread.h"
 
-/* #define SQUASH_MMAP_IO */
+#if defined(_WIN32)
+#  define squash_off_t __int64
+#  define squash_fseeko _fseeki64
+#  define squash_ftello _ftelli64
+#else
+#  define squash_off_t off_t
+#  define squash_fseeko fseeko
+#  define squash_ftello ftello
+#endif
 
 /**
  * @cond INTERNAL
  */
 
+/* Read-ahead state for asynchronous readers.  The worker thread owns
+ * the file's stream, FILE, and buffer; it decompresses into whichever
+ * slot the reader isn't using.  A slot belongs to the worker while
+ * full is false and to the reader while it is true. */
+
+typedef struct SquashFileReadAheadSlot_ {
+  uint8_t* data;
+  size_t size;
+  size_t pos;
+  SquashStatus status;
+  bool full;
+  bool last;
+} SquashFileReadAheadSlot;
+
+typedef struct SquashFileReadAhead_ {
+  thrd_t thread;
+  mtx_t mtx;
+  cnd_t cnd;
+  bool stop;
+  bool eof;
+  SquashStatus status;
+  unsigned int current;
+  SquashFileReadAheadSlot slots[2];
+} SquashFileReadAhead;
+
+/* Write-behind state for asynchronous writers.  The caller copies data
+ * into a ring of buffers and the worker compresses and writes them in
+ * order.  Entries [head, head + count) are queued for the worker; the
+ * entry after them is the one the caller is currently filling. */
+
+#if !defined(SQUASH_FILE_WRITE_BEHIND_BUFFERS)
+#  define SQUASH_FILE_WRITE_BEHIND_BUFFERS 4
+#endif
+
+typedef struct SquashFileWriteBehindEntry_ {
+  uint8_t* data;
+  size_t size;
+  SquashOperation operation;
+} SquashFileWriteBehindEntry;
+
+typedef struct SquashFileWriteBehind_ {
+  thrd_t thread;
+  mtx_t mtx;
+  cnd_t cnd;
+  SquashStatus status;
+  unsigned int head;
+  unsigned int count;
+  SquashFileWriteBehindEntry entries[SQUASH_FILE_WRITE_BEHIND_BUFFERS];
+} SquashFileWriteBehind;
+
+/* Random access to files compressed with a "seekable:" codec.  Once
+ * squash_file_seek has been called, reads are served from the index
+ * instead of the stream. */
+
+typedef struct SquashFileSeekable_ {
+  SquashSeekableIndex index;
+  squash_off_t base;
+  bool positioned;
+  uint64_t position;
+  size_t cached_block;
+  SquashBuffer* compressed;
+  SquashBuffer* decompressed;
+} SquashFileSeekable;
+
 struct SquashFile_ {
   FILE* fp;
   mtx_t mtx;
   bool eof;
+  bool async;
+  bool map_input;
   SquashStream* stream;
   SquashStatus last_status;
   SquashCodec* codec;
   SquashOptions* options;
+  SquashFileReadAhead* read_ahead;
+  SquashFileWriteBehind* write_behind;
+  SquashFileSeekable* seekable;
   uint8_t buf[SQUASH_FILE_BUF_SIZE];
-#if defined(SQUASH_MMAP_IO)
-  SquashMappedFile map;
+#if !defined(_WIN32)
+  SquashMappedWindow map;
 #endif
 };
 
@@ -81,8 +158,8 @@ struct SquashFile_ {
  * @brief Open a file
  *
  * The @a mode parameter will be passed through to @a fopen, so the
- * value must valid.  Note that Squash may attempt to use @a mmap
- * regardless of whether the *m* flag is passed.
+ * value must valid.  The *m* flag is not needed for Squash to use
+ * @a mmap; see @ref squash_file_set_mmap.
  *
  * The file is always assumed to be compressed—calling @ref
  * squash_file_write will always compress, and calling @ref
@@ -276,12 +353,17 @@ squash_file_steal_with_options (SquashCodec* codec, FILE* fp, SquashOptions* opt
 
   file->fp = fp;
   file->eof = false;
+  file->async = false;
+  file->map_input = false;
   file->stream = NULL;
   file->last_status = SQUASH_OK;
   file->codec = codec;
   file->options = (options != NULL) ? squash_object_ref (options) : NULL;
-#if defined(SQUASH_MMAP_IO)
-  file->map = squash_mapped_file_empty;
+  file->read_ahead = NULL;
+  file->write_behind = NULL;
+  file->seekable = NULL;
+#if !defined(_WIN32)
+  file->map = squash_mapped_window_empty;
 #endif
 
   mtx_init (&(file->mtx), mtx_recursive);
@@ -291,6 +373,89 @@ squash_file_steal_with_options (SquashCodec* codec, FILE* fp, SquashOptions* opt
   return file;
 }
 
+/**
+ * @brief Enable or disable asynchronous I/O for a file
+ *
+ * When enabled, a file which is being read from will use a background
+ * thread to read and decompress the next chunk of data while the
+ * caller is consuming the current one, overlapping I/O with
+ * decompression.  For a file which is being written to, data passed
+ * to @ref squash_file_write is copied into a small ring of buffers
+ * which a background thread compresses and writes, so the caller only
+ * blocks when the ring is full.  @ref squash_file_flush, @ref
+ * squash_file_close, and @ref squash_file_free wait for everything
+ * written so far to be processed; errors encountered by the
+ * background thread are reported by the next call on the file.
+ *
+ * Locking works exactly as it does for synchronous files; the
+ * background thread never touches anything the caller can.
+ *
+ * This must be called before the first read from (or write to) the
+ * file.  If the thread cannot be started Squash silently falls back
+ * on synchronous I/O.
+ *
+ * @param file the file
+ * @param async whether to use asynchronous I/O
+ * @return @ref SQUASH_OK on success, or @ref
+ *   SQUASH_INVALID_OPERATION if I/O on the file has already begun
+ */
+SquashStatus
+squash_file_set_async (SquashFile* file, bool async) {
+  assert (file != NULL);
+
+  squash_file_lock (file);
+
+  SquashStatus res = SQUASH_OK;
+  if (HEDLEY_UNLIKELY(file->stream != NULL || file->read_ahead != NULL || file->write_behind != NULL))
+    res = squash_error (SQUASH_INVALID_OPERATION);
+  else
+    file->async = async;
+
+  squash_file_unlock (file);
+
+  return res;
+}
+
+/**
+ * @brief Enable or disable memory-mapped input for a file
+ *
+ * When enabled, a file which is being read from will map the
+ * compressed data instead of copying it into a buffer with *fread*.
+ * Large regions are mapped at once and the kernel is told the data
+ * will be read sequentially, so it can read ahead of the decompressor
+ * and drop pages which have already been consumed.  This works with
+ * @ref squash_file_set_async, and has no effect on files which are
+ * written to.
+ *
+ * The compressed file must not be truncated or modified while it is
+ * being read.  If the file cannot be mapped (for example, because it
+ * is a pipe, or mmap is not available on this platform) Squash
+ * silently falls back on stdio.
+ *
+ * This must be called before the first read from the file.
+ *
+ * @param file the file
+ * @param mapped whether to memory-map input
+ * @return @ref SQUASH_OK on success, or @ref
+ *   SQUASH_INVALID_OPERATION if I/O on the file has already begun
+ */
+SquashStatus
+squash_file_set_mmap (SquashFile* file, bool mapped) {
+  assert (file != NULL);
+
+  squash_file_lock (file);
+
+  SquashStatus res = SQUASH_OK;
+  if (HEDLEY_UNLIKELY(file->stream != NULL || file->read_ahead != NULL || file->write_behind != NULL))
+    res = squash_error (SQUASH_INVALID_OPERATION);
+  else
+    file->map_input = mapped;
+
+  squash_file_unlock (file);
+
+  return res;
+}
+
 /**
  * @brief Read from a compressed file
  *
@@ -333,30 +498,20 @@ squash_file_read (SquashFile* file,
   return res;
 }
 
-/**
- * @brief Read from a compressed file
- *
- * This function is the same as @ref squash_file_read, except it will
- * not acquire a lock on the @ref SquashFile instance.  It should be
- * used only when there is no possibility of other threads accessing
- * the file, or if you have already acquired the lock with @ref
- * squash_file_lock.
- *
- * @param file the file to read from
- * @param decompressed_size number of bytes to attempt to write to @a decompressed
- * @param decompressed buffer to write the decompressed data to
- * @return the result of the operation
- * @retval SQUASH_OK successfully read some data
- * @retval SQUASH_END_OF_STREAM the end of the file was reached
- */
-SquashStatus
-squash_file_read_unlocked (SquashFile* file,
-                           size_t* decompressed_size,
-                           uint8_t decompressed[HEDLEY_ARRAY_PARAM(*decompressed_size)]) {
-  assert (file != NULL);
-  assert (decompressed_size != NULL);
-  assert (decompressed != NULL);
+static bool
+squash_file_input_eof (SquashFile* file) {
+#if !defined(_WIN32)
+  if (file->map.fp != NULL)
+    return squash_mapped_window_eof (&(file->map));
+#endif
 
+  return feof (file->fp);
+}
+
+static SquashStatus
+squash_file_read_sync (SquashFile* file,
+                       size_t* decompressed_size,
+                       uint8_t decompressed[HEDLEY_ARRAY_PARAM(*decompressed_size)]) {
   if (HEDLEY_UNLIKELY(file->last_status < 0))
     return file->last_status;
 
@@ -365,6 +520,13 @@ squash_file_read_unlocked (SquashFile* file,
     if (HEDLEY_UNLIKELY(file->stream == NULL)) {
       return file->last_status = squash_error (SQUASH_FAILED);
     }
+
+#if !defined(_WIN32)
+    /* Anything which can't be mapped (pipes, empty files, etc.) is
+       simply read with stdio. */
+    if (file->map_input)
+      squash_mapped_window_init (&(file->map), file->fp);
+#endif
   }
   SquashStream* stream = file->stream;
 
@@ -399,14 +561,22 @@ squash_file_read_unlocked (SquashFile* file,
 
     assert (file->last_status == SQUASH_OK);
 
-#if defined(SQUASH_MMAP_IO)
-    if (file->map.data != MAP_FAILED)
-      squash_mapped_file_destroy (&(file->map), true);
+#if !defined(_WIN32)
+    if (file->map.fp != NULL) {
+      stream->avail_in = SQUASH_FILE_BUF_SIZE;
+      stream->next_in = squash_mapped_window_next (&(file->map), &(stream->avail_in));
+
+      /* If the next region can't be mapped just carry on with stdio
+         from the same position. */
+      if (HEDLEY_UNLIKELY(stream->avail_in == 0 && !squash_mapped_window_eof (&(file->map)))) {
+        if (HEDLEY_UNLIKELY(!squash_mapped_window_destroy (&(file->map), true))) {
+          file->last_status = squash_error (SQUASH_IO);
+          break;
+        }
+      }
+    }
 
-    if (squash_mapped_file_init_full(&(file->map), file->fp, SQUASH_FILE_BUF_SIZE, true, false)) {
-      stream->next_in = file->map.data;
-      stream->avail_in = file->map.size;
-    } else
+    if (file->map.fp == NULL)
 #endif
     {
       stream->next_in = file->buf;
@@ -414,7 +584,7 @@ squash_file_read_unlocked (SquashFile* file,
     }
 
     if (stream->avail_in == 0) {
-      if (feof (file->fp)) {
+      if (squash_file_input_eof (file)) {
         file->last_status = squash_stream_finish (stream);
       } else {
         file->last_status = squash_error (SQUASH_IO);
@@ -433,6 +603,515 @@ squash_file_read_unlocked (SquashFile* file,
   return file->last_status;
 }
 
+static int
+squash_file_read_ahead_worker (void* user_data) {
+  SquashFile* file = (SquashFile*) user_data;
+  SquashFileReadAhead* ra = file->read_ahead;
+  unsigned int idx = 0;
+
+  SQUASH_FLOCKFILE(file->fp);
+
+  for (;;) {
+    SquashFileReadAheadSlot* slot = &(ra->slots[idx]);
+
+    mtx_lock (&(ra->mtx));
+    while (slot->full && !ra->stop)
+      cnd_wait (&(ra->cnd), &(ra->mtx));
+    const bool stop = ra->stop;
+    mtx_unlock (&(ra->mtx));
+
+    if (stop)
+      break;
+
+    size_t size = SQUASH_FILE_BUF_SIZE;
+    const SquashStatus res = squash_file_read_sync (file, &size, slot->data);
+    const bool last = (res < 0 || res == SQUASH_END_OF_STREAM ||
+                       file->stream->state == SQUASH_STREAM_STATE_FINISHED);
+
+    mtx_lock (&(ra->mtx));
+    slot->size = size;
+    slot->pos = 0;
+    slot->status = res;
+    slot->last = last;
+    slot->full = true;
+    cnd_broadcast (&(ra->cnd));
+    mtx_unlock (&(ra->mtx));
+
+    if (last)
+      break;
+
+    idx ^= 1;
+  }
+
+  SQUASH_FUNLOCKFILE(file->fp);
+
+  return 0;
+}
+
+static void
+squash_file_read_ahead_free (SquashFileReadAhead* ra) {
+  for (unsigned int i = 0 ; i < 2 ; i++)
+    squash_free (ra->slots[i].data);
+  squash_free (ra);
+}
+
+static void
+squash_file_read_ahead_start (SquashFile* file) {
+  SquashFileReadAhead* ra = squash_calloc (1, sizeof (SquashFileReadAhead));
+  if (HEDLEY_UNLIKELY(ra == NULL))
+    return;
+
+  for (unsigned int i = 0 ; i < 2 ; i++) {
+    ra->slots[i].data = squash_malloc (SQUASH_FILE_BUF_SIZE);
+    if (HEDLEY_UNLIKELY(ra->slots[i].data == NULL)) {
+      squash_file_read_ahead_free (ra);
+      return;
+    }
+  }
+  ra->status = SQUASH_OK;
+
+  if (HEDLEY_UNLIKELY(mtx_init (&(ra->mtx), mtx_plain) != thrd_success)) {
+    squash_file_read_ahead_free (ra);
+    return;
+  }
+  if (HEDLEY_UNLIKELY(cnd_init (&(ra->cnd)) != thrd_success)) {
+    mtx_destroy (&(ra->mtx));
+    squash_file_read_ahead_free (ra);
+    return;
+  }
+
+  /* The FILE lock is per-thread, so the worker holds it for as long
+     as it is running. */
+  file->read_ahead = ra;
+  SQUASH_FUNLOCKFILE(file->fp);
+  if (HEDLEY_UNLIKELY(thrd_create (&(ra->thread), squash_file_read_ahead_worker, file) != thrd_success)) {
+    /* Fall back on reading synchronously. */
+    SQUASH_FLOCKFILE(file->fp);
+    file->read_ahead = NULL;
+    cnd_destroy (&(ra->cnd));
+    mtx_destroy (&(ra->mtx));
+    squash_file_read_ahead_free (ra);
+  }
+}
+
+static void
+squash_file_read_ahead_stop (SquashFile* file) {
+  SquashFileReadAhead* ra = file->read_ahead;
+
+  mtx_lock (&(ra->mtx));
+  ra->stop = true;
+  cnd_broadcast (&(ra->cnd));
+  mtx_unlock (&(ra->mtx));
+
+  thrd_join (ra->thread, NULL);
+  SQUASH_FLOCKFILE(file->fp);
+
+  cnd_destroy (&(ra->cnd));
+  mtx_destroy (&(ra->mtx));
+  squash_file_read_ahead_free (ra);
+  file->read_ahead = NULL;
+}
+
+/* Copy data out of the slots filled by the worker.  The copy happens
+ * without holding the read-ahead lock; the worker won't touch a slot
+ * until we mark it as empty. */
+static SquashStatus
+squash_file_read_ahead_read (SquashFile* file,
+                             size_t* decompressed_size,
+                             uint8_t decompressed[HEDLEY_ARRAY_PARAM(*decompressed_size)]) {
+  SquashFileReadAhead* ra = file->read_ahead;
+  SquashStatus res = SQUASH_OK;
+  size_t total = 0;
+
+  if (HEDLEY_UNLIKELY(ra->status < 0)) {
+    *decompressed_size = 0;
+    return ra->status;
+  }
+
+  while (total < *decompressed_size) {
+    SquashFileReadAheadSlot* slot = &(ra->slots[ra->current]);
+
+    mtx_lock (&(ra->mtx));
+    while (!slot->full)
+      cnd_wait (&(ra->cnd), &(ra->mtx));
+
+    if (slot->pos == slot->size) {
+      if (slot->last) {
+        mtx_unlock (&(ra->mtx));
+        if (slot->status < 0) {
+          res = slot->status;
+        } else {
+          ra->eof = true;
+          res = (total == 0) ? SQUASH_END_OF_STREAM : SQUASH_OK;
+        }
+        break;
+      }
+
+      slot->full = false;
+      ra->current ^= 1;
+      cnd_broadcast (&(ra->cnd));
+      mtx_unlock (&(ra->mtx));
+      continue;
+    }
+    mtx_unlock (&(ra->mtx));
+
+    size_t n = slot->size - slot->pos;
+    if (n > *decompressed_size - total)
+      n = *decompressed_size - total;
+    memcpy (decompressed + total, slot->data + slot->pos, n);
+    slot->pos += n;
+    total += n;
+
+    /* Let the caller see the tail of the stream as EOF without
+       needing another call. */
+    if (slot->pos == slot->size && slot->last && slot->status >= 0)
+      ra->eof = true;
+  }
+
+  *decompressed_size = total;
+
+  return ra->status = res;
+}
+
+static void
+squash_file_seekable_free (SquashFileSeekable* seekable) {
+  squash_seekable_index_destroy (&(seekable->index));
+  squash_buffer_free (seekable->compressed);
+  squash_buffer_free (seekable->decompressed);
+  squash_free (seekable);
+}
+
+static SquashStatus
+squash_file_read_at (SquashFile* file, squash_off_t offset, size_t size, uint8_t data[HEDLEY_ARRAY_PARAM(size)]) {
+  if (HEDLEY_UNLIKELY(squash_fseeko (file->fp, offset, SEEK_SET) != 0))
+    return squash_error (SQUASH_IO);
+
+  if (HEDLEY_UNLIKELY(SQUASH_FREAD_UNLOCKED(data, 1, size, file->fp) != size))
+    return squash_error (feof (file->fp) ? SQUASH_INVALID_BUFFER : SQUASH_IO);
+
+  return SQUASH_OK;
+}
+
+/* Read the index from the end of the file.  The data is assumed to
+ * extend to the end of the file, but it doesn't have to start at the
+ * beginning. */
+static SquashStatus
+squash_file_seekable_load (SquashFile* file) {
+  if (file->seekable != NULL)
+    return SQUASH_OK;
+
+  if (HEDLEY_UNLIKELY(squash_codec_get_seekable_inner (file->codec) == NULL))
+    return squash_error (SQUASH_INVALID_OPERATION);
+  if (HEDLEY_UNLIKELY(file->read_ahead != NULL || file->write_behind != NULL ||
+                      (file->stream != NULL && file->stream->stream_type != SQUASH_STREAM_DECOMPRESS)))
+    return squash_error (SQUASH_INVALID_OPERATION);
+
+  SquashFileSeekable* seekable = squash_calloc (1, sizeof (SquashFileSeekable));
+  if (HEDLEY_UNLIKELY(seekable == NULL))
+    return squash_error (SQUASH_MEMORY);
+  seekable->cached_block = SIZE_MAX;
+  seekable->compressed = squash_buffer_new (0);
+  seekable->decompressed = squash_buffer_new (0);
+  if (HEDLEY_UNLIKELY(seekable->compressed == NULL || seekable->decompressed == NULL)) {
+    squash_file_seekable_free (seekable);
+    return squash_error (SQUASH_MEMORY);
+  }
+
+  SquashStatus res = SQUASH_OK;
+  uint8_t footer[SQUASH_SEEKABLE_FOOTER_SIZE];
+  size_t index_size;
+
+  if (HEDLEY_UNLIKELY(squash_fseeko (file->fp, 0, SEEK_END) != 0)) {
+    res = squash_error (SQUASH_IO);
+    goto cleanup;
+  }
+  const squash_off_t end = squash_ftello (file->fp);
+  if (HEDLEY_UNLIKELY(end < (squash_off_t) SQUASH_SEEKABLE_FOOTER_SIZE)) {
+    res = squash_error (SQUASH_INVALID_BUFFER);
+    goto cleanup;
+  }
+
+  res = squash_file_read_at (file, end - SQUASH_SEEKABLE_FOOTER_SIZE, sizeof (footer), footer);
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+    goto cleanup;
+  res = squash_seekable_read_footer (footer, &index_size);
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+    goto cleanup;
+  if (HEDLEY_UNLIKELY((squash_off_t) index_size > end - (squash_off_t) SQUASH_SEEKABLE_FOOTER_SIZE)) {
+    res = squash_error (SQUASH_INVALID_BUFFER);
+    goto cleanup;
+  }
+
+  if (HEDLEY_UNLIKELY(!squash_buffer_set_size (seekable->compressed, index_size))) {
+    res = squash_error (SQUASH_MEMORY);
+    goto cleanup;
+  }
+  const squash_off_t index_offset = end - SQUASH_SEEKABLE_FOOTER_SIZE - index_size;
+  res = squash_file_read_at (file, index_offset, index_size, seekable->compressed->data);
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+    goto cleanup;
+  res = squash_seekable_index_init (&(seekable->index), squash_codec_get_block_size (file->codec), (uint64_t) index_offset, index_size, seekable->compressed->data);
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+    goto cleanup;
+
+  seekable->base = index_offset - (squash_off_t) seekable->index.data_size;
+
+ cleanup:
+
+  if (HEDLEY_LIKELY(res == SQUASH_OK))
+    file->seekable = seekable;
+  else
+    squash_file_seekable_free (seekable);
+
+  return res;
+}
+
+static SquashStatus
+squash_file_seekable_decompress_block (SquashFile* file, size_t block, size_t size, uint8_t decompressed[HEDLEY_ARRAY_PARAM(size)]) {
+  SquashFileSeekable* seekable = file->seekable;
+  const size_t compressed_size = seekable->index.compressed_sizes[block];
+
+  seekable->cached_block = SIZE_MAX;
+
+  if (HEDLEY_UNLIKELY(!squash_buffer_set_size (seekable->compressed, compressed_size)))
+    return squash_error (SQUASH_MEMORY);
+
+  SquashStatus res = squash_file_read_at (file,
+                                          seekable->base + (squash_off_t) seekable->index.compressed_offsets[block],
+                                          compressed_size, seekable->compressed->data);
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+    return res;
+
+  size_t decompressed_size = size;
+  res = squash_codec_decompress_with_options (squash_codec_get_seekable_inner (file->codec),
+                                              &decompressed_size, decompressed,
+                                              compressed_size, seekable->compressed->data,
+                                              file->options);
+  if (HEDLEY_LIKELY(res == SQUASH_OK) && HEDLEY_UNLIKELY(decompressed_size != size))
+    res = squash_error (SQUASH_INVALID_BUFFER);
+
+  return res;
+}
+
+/* Decompress only the blocks covering the requested range.  Blocks
+ * which are entirely covered are decompressed directly into the
+ * caller's buffer; partial blocks go through a one-block cache, so
+ * small sequential reads don't decompress the same block repeatedly. */
+static SquashStatus
+squash_file_seekable_read (SquashFile* file,
+                           uint64_t offset,
+                           size_t* decompressed_size,
+                           uint8_t decompressed[HEDLEY_ARRAY_PARAM(*decompressed_size)]) {
+  SquashFileSeekable* seekable = file->seekable;
+  SquashSeekableIndex* index = &(seekable->index);
+  SquashStatus res = SQUASH_OK;
+  size_t total = 0;
+
+  while (total < *decompressed_size) {
+    const uint64_t position = offset + total;
+    const size_t block = squash_seekable_index_find (index, position);
+    if (block == index->n_blocks)
+      break;
+
+    const size_t block_size = (size_t) (index->uncompressed_offsets[block + 1] - index->uncompressed_offsets[block]);
+    const size_t block_pos = (size_t) (position - index->uncompressed_offsets[block]);
+    const size_t wanted = *decompressed_size - total;
+
+    if (block_pos == 0 && wanted >= block_size && seekable->cached_block != block) {
+      res = squash_file_seekable_decompress_block (file, block, block_size, decompressed + total);
+      if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+        break;
+      total += block_size;
+      continue;
+    }
+
+    if (seekable->cached_block != block) {
+      if (HEDLEY_UNLIKELY(!squash_buffer_set_size (seekable->decompressed, block_size))) {
+        res = squash_error (SQUASH_MEMORY);
+        break;
+      }
+      res = squash_file_seekable_decompress_block (file, block, block_size, seekable->decompressed->data);
+      if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+        break;
+      seekable->cached_block = block;
+    }
+
+    const size_t cp_size = (block_size - block_pos < wanted) ? block_size - block_pos : wanted;
+    memcpy (decompressed + total, seekable->decompressed->data + block_pos, cp_size);
+    total += cp_size;
+  }
+
+  const bool requested = (*decompressed_size != 0);
+  *decompressed_size = total;
+
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+    return res;
+
+  return (total == 0 && requested) ? SQUASH_END_OF_STREAM : SQUASH_OK;
+}
+
+static SquashStatus
+squash_file_seekable_read_position (SquashFile* file,
+                                    size_t* decompressed_size,
+                                    uint8_t decompressed[HEDLEY_ARRAY_PARAM(*decompressed_size)]) {
+  SquashFileSeekable* seekable = file->seekable;
+
+  const SquashStatus res = squash_file_seekable_read (file, seekable->position, decompressed_size, decompressed);
+  seekable->position += *decompressed_size;
+
+  return res;
+}
+
+/**
+ * @brief Set the read position of a compressed file
+ *
+ * This is only possible for files compressed with a seekable codec
+ * (i.e., one whose name is prefixed with "seekable:", such as
+ * "seekable:zstd"), which store an index of independently compressed
+ * blocks at the end of the data.  Subsequent calls to @ref
+ * squash_file_read only decompress the blocks they need.
+ *
+ * The compressed data must extend to the end of the underlying file.
+ * Seeking past the end of the data is not an error, but reading will
+ * return @ref SQUASH_END_OF_STREAM.
+ *
+ * @param file the file
+ * @param offset offset in the decompressed data, relative to @a whence
+ * @param whence `SEEK_SET`, `SEEK_CUR`, or `SEEK_END`
+ * @return A status code
+ * @retval SQUASH_OK the position was set
+ * @retval SQUASH_INVALID_OPERATION the file was not opened with a
+ *   seekable codec, is being written to, or is using asynchronous I/O
+ * @retval SQUASH_RANGE the resulting position would be negative
+ * @see squash_file_pread
+ */
+SquashStatus
+squash_file_seek (SquashFile* file, int64_t offset, int whence) {
+  assert (file != NULL);
+
+  squash_file_lock (file);
+
+  SquashStatus res = squash_file_seekable_load (file);
+  if (HEDLEY_LIKELY(res == SQUASH_OK)) {
+    SquashFileSeekable* seekable = file->seekable;
+    uint64_t origin = 0;
+
+    switch (whence) {
+      case SEEK_SET:
+        origin = 0;
+        break;
+      case SEEK_CUR:
+        if (seekable->positioned)
+          origin = seekable->position;
+        else if (file->stream != NULL)
+          origin = file->stream->total_out;
+        break;
+      case SEEK_END:
+        origin = seekable->index.uncompressed_offsets[seekable->index.n_blocks];
+        break;
+      default:
+        res = squash_error (SQUASH_BAD_PARAM);
+        break;
+    }
+
+    if (HEDLEY_LIKELY(res == SQUASH_OK)) {
+      if (HEDLEY_UNLIKELY(offset < 0 && (((uint64_t) 0) - (uint64_t) offset) > origin)) {
+        res = squash_error (SQUASH_RANGE);
+      } else {
+        seekable->position = origin + (uint64_t) offset;
+        seekable->positioned = true;
+      }
+    }
+  }
+
+  squash_file_unlock (file);
+
+  return res;
+}
+
+/**
+ * @brief Read from a specific position in a compressed file
+ *
+ * Like @ref squash_file_read, but reads from @a offset in the
+ * decompressed data and does not change the file's position.  Only
+ * the blocks covering the requested range are read and decompressed;
+ * see @ref squash_file_seek for the requirements.
+ *
+ * @param file the file to read from
+ * @param decompressed_size number of bytes to attempt to write to @a
+ *   decompressed; on return, the number of bytes actually written
+ * @param decompressed buffer to write the decompressed data to
+ * @param offset offset in the decompressed data to read from
+ * @return the result of the operation
+ * @retval SQUASH_OK successfully read some data
+ * @retval SQUASH_END_OF_STREAM @a offset is at or past the end of the
+ *   data
+ */
+SquashStatus
+squash_file_pread (SquashFile* file,
+                   size_t* decompressed_size,
+                   uint8_t decompressed[HEDLEY_ARRAY_PARAM(*decompressed_size)],
+                   uint64_t offset) {
+  assert (file != NULL);
+  assert (decompressed_size != NULL);
+  assert (decompressed != NULL);
+
+  squash_file_lock (file);
+
+  /* Sequential reads may be in progress, so put the FILE back where
+     we found it. */
+  const squash_off_t fp_position = squash_ftello (file->fp);
+
+  SquashStatus res = squash_file_seekable_load (file);
+  if (HEDLEY_LIKELY(res == SQUASH_OK))
+    res = squash_file_seekable_read (file, offset, decompressed_size, decompressed);
+  else
+    *decompressed_size = 0;
+
+  if (HEDLEY_LIKELY(fp_position >= 0) && HEDLEY_UNLIKELY(squash_fseeko (file->fp, fp_position, SEEK_SET) != 0) && res >= 0)
+    res = squash_error (SQUASH_IO);
+
+  squash_file_unlock (file);
+
+  return res;
+}
+
+/**
+ * @brief Read from a compressed file
+ *
+ * This function is the same as @ref squash_file_read, except it will
+ * not acquire a lock on the @ref SquashFile instance.  It should be
+ * used only when there is no possibility of other threads accessing
+ * the file, or if you have already acquired the lock with @ref
+ * squash_file_lock.
+ *
+ * @param file the file to read from
+ * @param decompressed_size number of bytes to attempt to write to @a decompressed
+ * @param decompressed buffer to write the decompressed data to
+ * @return the result of the operation
+ * @retval SQUASH_OK successfully read some data
+ * @retval SQUASH_END_OF_STREAM the end of the file was reached
+ */
+SquashStatus
+squash_file_read_unlocked (SquashFile* file,
+                           size_t* decompressed_size,
+                           uint8_t decompressed[HEDLEY_ARRAY_PARAM(*decompressed_size)]) {
+  assert (file != NULL);
+  assert (decompressed_size != NULL);
+  assert (decompressed != NULL);
+
+  if (file->seekable != NULL && file->seekable->positioned)
+    return squash_file_seekable_read_position (file, decompressed_size, decompressed);
+
+  if (file->async && file->read_ahead == NULL && file->stream == NULL)
+    squash_file_read_ahead_start (file);
+
+  if (file->read_ahead != NULL)
+    return squash_file_read_ahead_read (file, decompressed_size, decompressed);
+
+  return squash_file_read_sync (file, decompressed_size, decompressed);
+}
+
 static SquashStatus
 squash_file_write_internal (SquashFile* file,
                             size_t uncompressed_size,
@@ -501,6 +1180,175 @@ squash_file_write_internal (SquashFile* file,
   return file->last_status = res;
 }
 
+static int
+squash_file_write_behind_worker (void* user_data) {
+  SquashFile* file = (SquashFile*) user_data;
+  SquashFileWriteBehind* wb = file->write_behind;
+  bool finished = false;
+
+  SQUASH_FLOCKFILE(file->fp);
+
+  while (!finished) {
+    mtx_lock (&(wb->mtx));
+    while (wb->count == 0)
+      cnd_wait (&(wb->cnd), &(wb->mtx));
+    SquashFileWriteBehindEntry* entry = &(wb->entries[wb->head]);
+    mtx_unlock (&(wb->mtx));
+
+    /* Once something has failed the remaining data is discarded, but
+       the entries still need to be consumed so the caller doesn't
+       block. */
+    SquashStatus res = file->last_status;
+    if (res >= 0) {
+      if (entry->size != 0)
+        res = squash_file_write_internal (file, entry->size, entry->data, SQUASH_OPERATION_PROCESS);
+      if (res >= 0 && entry->operation != SQUASH_OPERATION_PROCESS)
+        res = squash_file_write_internal (file, 0, NULL, entry->operation);
+      if (res >= 0 && entry->operation == SQUASH_OPERATION_FLUSH)
+        SQUASH_FFLUSH_UNLOCKED(file->fp);
+    }
+    finished = (entry->operation == SQUASH_OPERATION_FINISH);
+
+    mtx_lock (&(wb->mtx));
+    entry->size = 0;
+    entry->operation = SQUASH_OPERATION_PROCESS;
+    wb->head = (wb->head + 1) % SQUASH_FILE_WRITE_BEHIND_BUFFERS;
+    wb->count--;
+    wb->status = res;
+    cnd_broadcast (&(wb->cnd));
+    mtx_unlock (&(wb->mtx));
+  }
+
+  SQUASH_FUNLOCKFILE(file->fp);
+
+  return 0;
+}
+
+static void
+squash_file_write_behind_free (SquashFileWriteBehind* wb) {
+  for (unsigned int i = 0 ; i < SQUASH_FILE_WRITE_BEHIND_BUFFERS ; i++)
+    squash_free (wb->entries[i].data);
+  squash_free (wb);
+}
+
+static void
+squash_file_write_behind_start (SquashFile* file) {
+  SquashFileWriteBehind* wb = squash_calloc (1, sizeof (SquashFileWriteBehind));
+  if (HEDLEY_UNLIKELY(wb == NULL))
+    return;
+
+  for (unsigned int i = 0 ; i < SQUASH_FILE_WRITE_BEHIND_BUFFERS ; i++) {
+    wb->entries[i].data = squash_malloc (SQUASH_FILE_BUF_SIZE);
+    if (HEDLEY_UNLIKELY(wb->entries[i].data == NULL)) {
+      squash_file_write_behind_free (wb);
+      return;
+    }
+    wb->entries[i].operation = SQUASH_OPERATION_PROCESS;
+  }
+  wb->status = SQUASH_OK;
+
+  if (HEDLEY_UNLIKELY(mtx_init (&(wb->mtx), mtx_plain) != thrd_success)) {
+    squash_file_write_behind_free (wb);
+    return;
+  }
+  if (HEDLEY_UNLIKELY(cnd_init (&(wb->cnd)) != thrd_success)) {
+    mtx_destroy (&(wb->mtx));
+    squash_file_write_behind_free (wb);
+    return;
+  }
+
+  file->write_behind = wb;
+  SQUASH_FUNLOCKFILE(file->fp);
+  if (HEDLEY_UNLIKELY(thrd_create (&(wb->thread), squash_file_write_behind_worker, file) != thrd_success)) {
+    /* Fall back on writing synchronously. */
+    SQUASH_FLOCKFILE(file->fp);
+    file->write_behind = NULL;
+    cnd_destroy (&(wb->cnd));
+    mtx_destroy (&(wb->mtx));
+    squash_file_write_behind_free (wb);
+  }
+}
+
+/* Must be called with the write-behind lock held.  Waits for room in
+ * the ring, then returns the entry the caller should fill. */
+static SquashFileWriteBehindEntry*
+squash_file_write_behind_current (SquashFileWriteBehind* wb) {
+  while (wb->count == SQUASH_FILE_WRITE_BEHIND_BUFFERS)
+    cnd_wait (&(wb->cnd), &(wb->mtx));
+
+  return &(wb->entries[(wb->head + wb->count) % SQUASH_FILE_WRITE_BEHIND_BUFFERS]);
+}
+
+static SquashStatus
+squash_file_write_behind_write (SquashFile* file,
+                                size_t uncompressed_size,
+                                const uint8_t uncompressed[HEDLEY_ARRAY_PARAM(uncompressed_size)]) {
+  SquashFileWriteBehind* wb = file->write_behind;
+
+  mtx_lock (&(wb->mtx));
+  while (uncompressed_size != 0 && wb->status >= 0) {
+    SquashFileWriteBehindEntry* entry = squash_file_write_behind_current (wb);
+
+    /* The entry being filled is never touched by the worker, so the
+       copy doesn't need the lock. */
+    mtx_unlock (&(wb->mtx));
+    size_t n = SQUASH_FILE_BUF_SIZE - entry->size;
+    if (n > uncompressed_size)
+      n = uncompressed_size;
+    memcpy (entry->data + entry->size, uncompressed, n);
+    entry->size += n;
+    uncompressed += n;
+    uncompressed_size -= n;
+    mtx_lock (&(wb->mtx));
+
+    if (entry->size == SQUASH_FILE_BUF_SIZE) {
+      wb->count++;
+      cnd_broadcast (&(wb->cnd));
+    }
+  }
+  const SquashStatus res = (wb->status < 0) ? wb->status : SQUASH_OK;
+  mtx_unlock (&(wb->mtx));
+
+  return res;
+}
+
+/* Queue any buffered data along with @a operation, then wait for the
+ * worker to catch up. */
+static SquashStatus
+squash_file_write_behind_sync (SquashFile* file, SquashOperation operation) {
+  SquashFileWriteBehind* wb = file->write_behind;
+
+  mtx_lock (&(wb->mtx));
+  SquashFileWriteBehindEntry* entry = squash_file_write_behind_current (wb);
+  entry->operation = operation;
+  wb->count++;
+  cnd_broadcast (&(wb->cnd));
+
+  while (wb->count != 0)
+    cnd_wait (&(wb->cnd), &(wb->mtx));
+  const SquashStatus res = wb->status;
+  mtx_unlock (&(wb->mtx));
+
+  return res;
+}
+
+static SquashStatus
+squash_file_write_behind_stop (SquashFile* file) {
+  SquashFileWriteBehind* wb = file->write_behind;
+
+  const SquashStatus res = squash_file_write_behind_sync (file, SQUASH_OPERATION_FINISH);
+
+  thrd_join (wb->thread, NULL);
+  SQUASH_FLOCKFILE(file->fp);
+
+  cnd_destroy (&(wb->cnd));
+  mtx_destroy (&(wb->mtx));
+  squash_file_write_behind_free (wb);
+  file->write_behind = NULL;
+
+  return res;
+}
+
 /**
  * @brief Write data to a compressed file
  *
@@ -729,6 +1577,12 @@ SquashStatus
 squash_file_write_unlocked (SquashFile* file,
                             size_t uncompressed_size,
                             const uint8_t uncompressed[HEDLEY_ARRAY_PARAM(uncompressed_size)]) {
+  if (file->async && file->write_behind == NULL && file->stream == NULL && file->read_ahead == NULL)
+    squash_file_write_behind_start (file);
+
+  if (file->write_behind != NULL)
+    return squash_file_write_behind_write (file, uncompressed_size, uncompressed);
+
   return squash_file_write_internal (file, uncompressed_size, uncompressed, SQUASH_OPERATION_PROCESS);
 }
 
@@ -771,6 +1625,9 @@ squash_file_flush (SquashFile* file) {
  */
 SquashStatus
 squash_file_flush_unlocked (SquashFile* file) {
+  if (file->write_behind != NULL)
+    return squash_file_write_behind_sync (file, SQUASH_OPERATION_FLUSH);
+
   SquashStatus res = squash_file_write_internal (file, 0, NULL, SQUASH_OPERATION_FLUSH);
   SQUASH_FFLUSH_UNLOCKED(file->fp);
   return res;
@@ -784,7 +1641,12 @@ squash_file_flush_unlocked (SquashFile* file) {
  */
 bool
 squash_file_eof (SquashFile* file) {
-  return (file->stream->state == SQUASH_STREAM_STATE_FINISHED) && (feof (file->fp));
+  if (file->seekable != NULL && file->seekable->positioned)
+    return file->seekable->position >= file->seekable->index.uncompressed_offsets[file->seekable->index.n_blocks];
+  if (file->read_ahead != NULL)
+    return file->read_ahead->eof;
+
+  return (file->stream->state == SQUASH_STREAM_STATE_FINISHED) && squash_file_input_eof (file);
 }
 
 /**
@@ -798,6 +1660,15 @@ squash_file_eof (SquashFile* file) {
  */
 SquashStatus
 squash_file_error (SquashFile* file) {
+  if (file->read_ahead != NULL)
+    return file->read_ahead->status;
+  if (file->write_behind != NULL) {
+    mtx_lock (&(file->write_behind->mtx));
+    const SquashStatus res = file->write_behind->status;
+    mtx_unlock (&(file->write_behind->mtx));
+    return res;
+  }
+
   return file->last_status;
 }
 
@@ -867,11 +1738,20 @@ squash_file_free (SquashFile* file, FILE** fp) {
 
   squash_file_lock (file);
 
-  if (file->stream != NULL && file->stream->stream_type == SQUASH_STREAM_COMPRESS)
+  if (file->read_ahead != NULL)
+    squash_file_read_ahead_stop (file);
+
+  if (file->seekable != NULL)
+    squash_file_seekable_free (file->seekable);
+
+  if (file->write_behind != NULL)
+    res = squash_file_write_behind_stop (file);
+  else if (file->stream != NULL && file->stream->stream_type == SQUASH_STREAM_COMPRESS)
     res = squash_file_write_internal (file, 0, NULL, SQUASH_OPERATION_FINISH);
 
-#if defined(SQUASH_MMAP_IO)
-  squash_mapped_file_destroy (&(file->map), false);
+#if !defined(_WIN32)
+  if (!squash_mapped_window_destroy (&(file->map), true) && res == SQUASH_OK)
+    res = squash_error (SQUASH_IO);
 #endif
 
   if (fp != NULL)
@@ -62,10 +62,26 @@ SQUASH_API SquashFile*  squash_file_steal_with_options       (SquashCodec* codec
                                                               FILE* fp,
                                                               SquashOptions* options);
 
+HEDLEY_NON_NULL(1)
+SQUASH_API SquashStatus squash_file_set_async                (SquashFile* file,
+                                                              bool async);
+HEDLEY_NON_NULL(1)
+SQUASH_API SquashStatus squash_file_set_mmap                 (SquashFile* file,
+                                                              bool mapped);
+
 HEDLEY_NON_NULL(1, 2, 3)
 SQUASH_API SquashStatus squash_file_read                     (SquashFile* file,
                                                               size_t* decompressed_size,
                                                               uint8_t decompressed[HEDLEY_ARRAY_PARAM(*decompressed_size)]);
+HEDLEY_NON_NULL(1)
+SQUASH_API SquashStatus squash_file_seek                     (SquashFile* file,
+                                                              int64_t offset,
+                                                              int whence);
+HEDLEY_NON_NULL(1, 2, 3)
+SQUASH_API SquashStatus squash_file_pread                    (SquashFile* file,
+                                                              size_t* decompressed_size,
+                                                              uint8_t decompressed[HEDLEY_ARRAY_PARAM(*decompressed_size)],
+                                                              uint64_t offset);
 HEDLEY_NON_NULL(1, 3)
 SQUASH_API SquashStatus squash_file_write                    (SquashFile* file,
                                                               size_t uncompressed_size,
@@ -50,7 +50,9 @@
 #include <squash/squash-charset-internal.h>
 #include <squash/squash-tree-internal.h>
 #include <squash/squash-types-internal.h>
+#include <squash/squash-rope-internal.h>
 #include <squash/squash-memory-internal.h>
+#include <squash/squash-options-internal.h>
 #include <squash/squash-context-internal.h>
 #include <squash/squash-plugin-internal.h>
 #include <squash/squash-codec-internal.h>
@@ -61,6 +63,9 @@
 #include <squash/squash-mtx-internal.h>
 #include <squash/squash-stream-internal.h>
 #include <squash/squash-util-internal.h>
+#include <squash/squash-pool-internal.h>
+#include <squash/squash-threaded-stream-internal.h>
+#include <squash/squash-seekable-internal.h>
 #if !defined(_WIN32)
 #  include <squash/squash-mapped-file-internal.h>
 #endif
@@ -47,6 +47,19 @@ typedef struct SquashMappedFile_s {
 
 static const SquashMappedFile squash_mapped_file_empty = { MAP_FAILED, 0 };
 
+typedef struct SquashMappedWindow_s {
+  uint8_t* data;
+  size_t size;
+  size_t released;
+  uint64_t offset;
+  uint64_t position;
+  uint64_t file_size;
+  size_t pending;
+  FILE* fp;
+} SquashMappedWindow;
+
+static const SquashMappedWindow squash_mapped_window_empty = { MAP_FAILED, 0 };
+
 HEDLEY_NON_NULL(1, 2) SQUASH_INTERNAL
 bool squash_mapped_file_init_full (SquashMappedFile* mapped,
                                    FILE* fp,
@@ -59,9 +72,24 @@ bool squash_mapped_file_init      (SquashMappedFile* mapped,
                                    size_t size,
                                    bool writable);
 HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+bool squash_mapped_file_grow      (SquashMappedFile* mapped,
+                                   size_t size);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
 bool squash_mapped_file_destroy   (SquashMappedFile* mapped,
                                    bool success);
 
+HEDLEY_NON_NULL(1, 2) SQUASH_INTERNAL
+bool           squash_mapped_window_init    (SquashMappedWindow* window,
+                                             FILE* fp);
+HEDLEY_NON_NULL(1, 2) SQUASH_INTERNAL
+const uint8_t* squash_mapped_window_next    (SquashMappedWindow* window,
+                                             size_t* size);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+bool           squash_mapped_window_eof     (SquashMappedWindow* window);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+bool           squash_mapped_window_destroy (SquashMappedWindow* window,
+                                             bool success);
+
 HEDLEY_END_C_DECLS
 
 #endif /* SQUASH_FILE_INTERNAL_H */
@@ -26,24 +26,46 @@
 
 #define _FILE_OFFSET_BITS 64
 #define _POSIX_C_SOURCE 200112L
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#if defined(__linux__)
+#  define _GNU_SOURCE
+#endif
 
 #include <assert.h>
 #include "squash-internal.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+/* A window is mapped once and then handed out in chunks; while a
+ * chunk is being consumed the kernel is asked to read the next one
+ * in, and pages we have moved past are given back, so the resident
+ * size stays small however large the file is. */
+#if !defined(SQUASH_MAPPED_WINDOW_SIZE)
+#  if SIZE_MAX > UINT32_MAX
+#    define SQUASH_MAPPED_WINDOW_SIZE ((size_t) (64 * 1024 * 1024))
+#  else
+#    define SQUASH_MAPPED_WINDOW_SIZE ((size_t) (8 * 1024 * 1024))
+#  endif
+#endif
+
+#if !defined(SQUASH_MAPPED_WINDOW_CHUNK)
+#  define SQUASH_MAPPED_WINDOW_CHUNK SQUASH_FILE_BUF_SIZE
+#endif
+
 bool
 squash_mapped_file_init_full (SquashMappedFile* mapped, FILE* fp, size_t size, bool size_is_suggestion, bool writable) {
   assert (mapped != NULL);
   assert (fp != NULL);
 
   if (mapped->data != MAP_FAILED)
-    munmap (mapped->data - mapped->window_offset, mapped->size + mapped->window_offset);
+    munmap (mapped->data - mapped->window_offset, mapped->map_size);
 
   int fd = fileno (fp);
   if (fd == -1)
@@ -78,18 +100,10 @@ squash_mapped_file_init_full (SquashMappedFile* mapped, FILE* fp, size_t size, b
   }
   mapped->size = size;
 
-  int map_flags = MAP_SHARED;
-
-#if defined(MAP_HUGETLB)
-  size_t page_size = squash_get_huge_page_size ();
-  if (page_size == 0) {
-    page_size = squash_get_page_size ();
-  } else {
-    map_flags |= MAP_HUGETLB;
-  }
-#else
+  /* MAP_HUGETLB only works for files on hugetlbfs; for anything else
+     mmap just fails with EINVAL. */
+  const int map_flags = MAP_SHARED;
   const size_t page_size = squash_get_page_size ();
-#endif
   mapped->window_offset = (size_t) offset % page_size;
   mapped->map_size = size + mapped->window_offset;
 
@@ -113,10 +127,65 @@ squash_mapped_file_init (SquashMappedFile* mapped, FILE* fp, size_t size, bool w
   return squash_mapped_file_init_full (mapped, fp, size, false, writable);
 }
 
+/**
+ * @brief Grow a writable mapping
+ * @private
+ *
+ * Extends the file and the mapping so @a size bytes are available
+ * starting from the same position.  The existing contents are
+ * preserved, but the mapping may move, so pointers into it must be
+ * recomputed from @a mapped->data afterwards.
+ *
+ * @param mapped the mapping
+ * @param size the new size
+ * @return whether the mapping could be grown; on failure the
+ *   mapping is left untouched
+ */
+bool
+squash_mapped_file_grow (SquashMappedFile* mapped, size_t size) {
+  assert (mapped != NULL);
+  assert (mapped->data != MAP_FAILED);
+  assert (mapped->writable);
+
+  const size_t map_size = size + mapped->window_offset;
+  if (map_size <= mapped->map_size)
+    return true;
+
+  /* Nothing has moved the FILE since the mapping was created. */
+  const off_t offset = ftello (mapped->fp);
+  if (offset < 0)
+    return false;
+
+  const int fd = fileno (mapped->fp);
+  if (ftruncate (fd, offset + (off_t) size) == -1)
+    return false;
+
+  uint8_t* base = mapped->data - mapped->window_offset;
+#if defined(__linux__)
+  base = mremap (base, mapped->map_size, map_size, MREMAP_MAYMOVE);
+  if (base == MAP_FAILED)
+    return false;
+#else
+  uint8_t* new_base = mmap (NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset - (off_t) mapped->window_offset);
+  if (new_base == MAP_FAILED)
+    return false;
+  munmap (base, mapped->map_size);
+  base = new_base;
+#endif
+
+  mapped->data = base + mapped->window_offset;
+  mapped->map_size = map_size;
+  mapped->size = size;
+
+  return true;
+}
+
 bool
 squash_mapped_file_destroy (SquashMappedFile* mapped, bool success) {
   if (mapped->data != MAP_FAILED) {
-    munmap (mapped->data - mapped->window_offset, mapped->size + mapped->window_offset);
+    /* The size may have been reduced to the amount of data actually
+       used, but the whole mapping has to go. */
+    munmap (mapped->data - mapped->window_offset, mapped->map_size);
     mapped->data = MAP_FAILED;
 
     if (success) {
@@ -139,3 +208,188 @@ squash_mapped_file_destroy (SquashMappedFile* mapped, bool success) {
 
   return true;
 }
+
+/**
+ * @brief Start reading a file through a sliding memory-mapped window
+ * @private
+ *
+ * Nothing is mapped until the first call to @ref
+ * squash_mapped_window_next.  Fails if @a fp is not a regular file or
+ * is already at (or past) its end, in which case the caller should
+ * simply use stdio.
+ *
+ * @param window the window to initialize
+ * @param fp file to read from, starting at its current position
+ * @return whether the window could be initialized
+ */
+bool
+squash_mapped_window_init (SquashMappedWindow* window, FILE* fp) {
+  assert (window != NULL);
+  assert (fp != NULL);
+
+  *window = squash_mapped_window_empty;
+
+  const int fd = fileno (fp);
+  if (fd == -1)
+    return false;
+
+  struct stat fp_stat;
+  if (fstat (fd, &fp_stat) == -1 || !S_ISREG(fp_stat.st_mode))
+    return false;
+
+  const off_t offset = ftello (fp);
+  if (offset < 0 || fp_stat.st_size <= offset)
+    return false;
+
+  window->fp = fp;
+  window->position = (uint64_t) offset;
+  window->file_size = (uint64_t) fp_stat.st_size;
+
+  return true;
+}
+
+static void
+squash_mapped_window_advise (SquashMappedWindow* window, size_t start, size_t length, int advice) {
+  const size_t page_size = squash_get_page_size ();
+  const size_t misalignment = start % page_size;
+
+  start -= misalignment;
+  length += misalignment;
+  if (length > window->size - start)
+    length = window->size - start;
+
+  if (length != 0)
+    madvise (window->data + start, length, advice);
+}
+
+/**
+ * @brief Get the next chunk of the file
+ * @private
+ *
+ * Calling this function tells the window that the caller is finished
+ * with the chunk returned by the previous call, which is no longer
+ * valid afterwards.
+ *
+ * @param window the window
+ * @param size on input, the maximum size of the chunk; on output,
+ *   its actual size
+ * @return the chunk, or *NULL* (with @a size set to 0) at the end of
+ *   the file or if the next region could not be mapped; use @ref
+ *   squash_mapped_window_eof to tell the two apart
+ */
+const uint8_t*
+squash_mapped_window_next (SquashMappedWindow* window, size_t* size) {
+  assert (window != NULL);
+  assert (window->fp != NULL);
+  assert (size != NULL);
+  assert (*size != 0);
+
+  window->position += window->pending;
+  window->pending = 0;
+
+  if (window->position >= window->file_size) {
+    *size = 0;
+    return NULL;
+  }
+
+  if (window->data == MAP_FAILED || window->position >= window->offset + window->size) {
+    if (window->data != MAP_FAILED) {
+      munmap (window->data, window->size);
+      window->data = MAP_FAILED;
+    }
+
+    const size_t page_size = squash_get_page_size ();
+    const uint64_t offset = window->position - (window->position % page_size);
+    const uint64_t remaining = window->file_size - offset;
+    const size_t map_size = (remaining < SQUASH_MAPPED_WINDOW_SIZE) ? (size_t) remaining : SQUASH_MAPPED_WINDOW_SIZE;
+
+    uint8_t* data = mmap (NULL, map_size, PROT_READ, MAP_SHARED, fileno (window->fp), (off_t) offset);
+    if (HEDLEY_UNLIKELY(data == MAP_FAILED)) {
+      *size = 0;
+      return NULL;
+    }
+
+    window->data = data;
+    window->size = map_size;
+    window->offset = offset;
+    window->released = 0;
+
+#if defined(MADV_SEQUENTIAL)
+    squash_mapped_window_advise (window, 0, window->size, MADV_SEQUENTIAL);
+#endif
+  }
+
+  const size_t start = (size_t) (window->position - window->offset);
+
+#if defined(MADV_DONTNEED)
+  {
+    /* Everything before the page holding the cursor has been
+       consumed.  The mapping is read-only, so this only drops the
+       pages from our address space, not from the page cache. */
+    const size_t consumed = start - (start % squash_get_page_size ());
+    if (consumed > window->released) {
+      squash_mapped_window_advise (window, window->released, consumed - window->released, MADV_DONTNEED);
+      window->released = consumed;
+    }
+  }
+#endif
+
+  size_t avail = window->size - start;
+  if (avail > SQUASH_MAPPED_WINDOW_CHUNK)
+    avail = SQUASH_MAPPED_WINDOW_CHUNK;
+  if (avail > *size)
+    avail = *size;
+
+#if defined(MADV_WILLNEED)
+  if (start + avail < window->size)
+    squash_mapped_window_advise (window, start + avail, SQUASH_MAPPED_WINDOW_CHUNK, MADV_WILLNEED);
+#endif
+
+  window->pending = avail;
+  *size = avail;
+
+  return window->data + start;
+}
+
+/**
+ * @brief Determine whether the whole file has been handed out
+ * @private
+ *
+ * @param window the window
+ * @return whether the end of the file has been reached
+ */
+bool
+squash_mapped_window_eof (SquashMappedWindow* window) {
+  assert (window != NULL);
+
+  return window->position + window->pending >= window->file_size;
+}
+
+/**
+ * @brief Unmap a window
+ * @private
+ *
+ * If @a success is true the file position is moved to the end of the
+ * last chunk handed out, just as if the data had been read with
+ * stdio.
+ *
+ * @param window the window
+ * @param success whether to update the file position
+ * @return whether the file position could be updated
+ */
+bool
+squash_mapped_window_destroy (SquashMappedWindow* window, bool success) {
+  assert (window != NULL);
+
+  bool res = true;
+
+  if (window->data != MAP_FAILED)
+    munmap (window->data, window->size);
+
+  if (success && window->fp != NULL)
+    res = fseeko (window->fp, (off_t) (window->position + window->pending), SEEK_SET) == 0;
+
+  *window = squash_mapped_window_empty;
+
+  return res;
+}
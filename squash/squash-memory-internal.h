@@ -35,7 +35,12 @@
 HEDLEY_BEGIN_C_DECLS
 
 SQUASH_INTERNAL
-void squash_get_memory_functions (SquashMemoryFuncs* memfns);
+void  squash_get_memory_functions (SquashMemoryFuncs* memfns);
+
+SQUASH_INTERNAL
+void* squash_scratch_acquire      (size_t size);
+SQUASH_INTERNAL
+void  squash_scratch_release      (void* ptr);
 
 HEDLEY_END_C_DECLS
 
@@ -48,14 +48,20 @@ HEDLEY_BEGIN_C_DECLS
   SQUASH_POSSIBLY_UNUSED static mtx_t SQUASH_MTX_NAME(name,mtx);                                       \
   static void SQUASH_MTX_NAME(name,init) (void);                                \
     static void SQUASH_MTX_NAME(name,init) (void) {                             \
-    assert (mtx_init (&(SQUASH_MTX_NAME(name,mtx)),mtx_plain) == thrd_success); \
+    SQUASH_POSSIBLY_UNUSED int _squash_mtx_res =                                \
+      mtx_init (&(SQUASH_MTX_NAME(name,mtx)),mtx_plain);                        \
+    assert (_squash_mtx_res == thrd_success);                                   \
   }
 #define SQUASH_MTX_LOCK(name) do{                                               \
     call_once (&(SQUASH_MTX_NAME(name,init_flag)), SQUASH_MTX_NAME(name,init)); \
-    assert (mtx_lock (&(SQUASH_MTX_NAME(name,mtx))) == thrd_success);   \
+    SQUASH_POSSIBLY_UNUSED int _squash_mtx_res =                                \
+      mtx_lock (&(SQUASH_MTX_NAME(name,mtx)));                                  \
+    assert (_squash_mtx_res == thrd_success);                                   \
   } while(0);
 #define SQUASH_MTX_UNLOCK(name) do{                                     \
-    assert (mtx_unlock (&(SQUASH_MTX_NAME(name,mtx))) == thrd_success); \
+    SQUASH_POSSIBLY_UNUSED int _squash_mtx_res =                        \
+      mtx_unlock (&(SQUASH_MTX_NAME(name,mtx)));                        \
+    assert (_squash_mtx_res == thrd_success);                           \
   } while(0);
 
 HEDLEY_END_C_DECLS
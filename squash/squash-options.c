@@ -40,6 +40,27 @@
 #include <strings.h>
 #endif
 
+#include "tinycthread/source/tinycthread.h"
+
+/* Number of distinct option lists ::squash_options_cached_newv will
+   remember, and the space available to serialize each one. */
+#define SQUASH_OPTIONS_CACHE_SIZE 16
+#define SQUASH_OPTIONS_CACHE_KEY_SIZE 128
+
+typedef struct SquashOptionsCacheEntry_ {
+  SquashCodec* codec;
+  size_t key_length;
+  char key[SQUASH_OPTIONS_CACHE_KEY_SIZE];
+  SquashOptions* options;
+} SquashOptionsCacheEntry;
+
+/* The table is append-only: entries are filled in before the length
+   which covers them is published, so lookups don't need the lock.
+   Only adding an entry does. */
+SQUASH_MTX_DEFINE(options_cache)
+static SquashOptionsCacheEntry squash_options_cache[SQUASH_OPTIONS_CACHE_SIZE];
+static volatile unsigned int squash_options_cache_length = 0;
+
 /**
  * @var SquashOptions_::base_object
  * @brief Base object.
@@ -50,6 +71,35 @@
  * @brief Codec.
  */
 
+/**
+ * @var SquashOptions_::buffer_size
+ * @brief Buffer size for I/O performed by Squash, or 0 to choose
+ *   automatically.
+ */
+
+/**
+ * @var SquashOptions_::chunk_size
+ * @brief Size of independently compressed chunks for codecs which
+ *   don't support streaming natively, or 0 to disable chunking.
+ */
+
+/**
+ * @var SquashOptions_::threads
+ * @brief Number of blocks compression streams may compress
+ *   concurrently, or 0 (or 1) to compress on the calling thread.
+ */
+
+/**
+ * @var SquashOptions_::dictionary
+ * @brief Preset dictionary, or *NULL*.
+ */
+
+/**
+ * @var SquashOptions_::frozen
+ * @brief Whether the options are immutable; see
+ *   ::squash_options_freeze.
+ */
+
 /**
  * @defgroup SquashOptions SquashOptions
  * @brief A set of compression/decompression options.
@@ -166,23 +216,7 @@ squash_options_find (SquashOptions* options, SquashCodec* codec, const char* key
     assert (codec != NULL);
   }
 
-  const SquashOptionInfo* info = squash_codec_get_option_info (codec);
-  if (info == NULL)
-    return -1;
-
-  {
-    ptrdiff_t option_n = 0;
-
-    while (info->name != NULL) {
-      if (strcasecmp (key, info->name) == 0)
-        return option_n;
-
-      option_n++;
-      info++;
-    }
-  }
-
-  return -1;
+  return squash_codec_get_option_index (codec, key);
 }
 
 /**
@@ -541,12 +575,16 @@ squash_options_set_size (SquashOptions* options, const char* key, size_t value)
  * @retval SQUASH_OK Option set successfully.
  * @retval SQUASH_BAD_PARAM Invalid @a key
  * @retval SQUASH_BAD_VALUE Invalid @a value
+ * @retval SQUASH_STATE The options are frozen
  */
 SquashStatus
 squash_options_set_string_at (SquashOptions* options, size_t idx, const char* value) {
   assert (options != NULL);
   assert (value != NULL);
 
+  if (HEDLEY_UNLIKELY(options->frozen))
+    return squash_error (SQUASH_STATE);
+
   const SquashOptionInfo* info = squash_codec_get_option_info (options->codec);
   if (info == NULL)
     return squash_error (SQUASH_BAD_PARAM);
@@ -584,11 +622,15 @@ squash_options_set_string_at (SquashOptions* options, size_t idx, const char* va
  * @retval SQUASH_OK Option set successfully.
  * @retval SQUASH_BAD_PARAM Invalid @a key
  * @retval SQUASH_BAD_VALUE Invalid @a value
+ * @retval SQUASH_STATE The options are frozen
  */
 SquashStatus
 squash_options_set_bool_at (SquashOptions* options, size_t idx, bool value) {
   assert (options != NULL);
 
+  if (HEDLEY_UNLIKELY(options->frozen))
+    return squash_error (SQUASH_STATE);
+
   const SquashOptionInfo* info = squash_codec_get_option_info (options->codec);
   if (info == NULL)
     return squash_error (SQUASH_BAD_PARAM);
@@ -618,11 +660,15 @@ squash_options_set_bool_at (SquashOptions* options, size_t idx, bool value) {
  * @retval SQUASH_OK Option set successfully.
  * @retval SQUASH_BAD_PARAM Invalid @a key
  * @retval SQUASH_BAD_VALUE Invalid @a value
+ * @retval SQUASH_STATE The options are frozen
  */
 SquashStatus
 squash_options_set_int_at (SquashOptions* options, size_t idx, int value) {
   assert (options != NULL);
 
+  if (HEDLEY_UNLIKELY(options->frozen))
+    return squash_error (SQUASH_STATE);
+
   const SquashOptionInfo* info = squash_codec_get_option_info (options->codec);
   if (info == NULL)
     return squash_error (SQUASH_BAD_PARAM);
@@ -666,11 +712,15 @@ squash_options_set_int_at (SquashOptions* options, size_t idx, int value) {
  * @retval SQUASH_OK Option set successfully.
  * @retval SQUASH_BAD_PARAM Invalid @a key
  * @retval SQUASH_BAD_VALUE Invalid @a value
+ * @retval SQUASH_STATE The options are frozen
  */
 SquashStatus
 squash_options_set_size_at (SquashOptions* options, size_t idx, size_t value) {
   assert (options != NULL);
 
+  if (HEDLEY_UNLIKELY(options->frozen))
+    return squash_error (SQUASH_STATE);
+
   const SquashOptionInfo* info = squash_codec_get_option_info (options->codec);
   if (info == NULL)
     return squash_error (SQUASH_BAD_PARAM);
@@ -700,6 +750,175 @@ squash_options_set_size_at (SquashOptions* options, size_t idx, size_t value) {
   HEDLEY_UNREACHABLE ();
 }
 
+/**
+ * @brief Set the buffer size used for I/O
+ *
+ * Some operations, such as @ref squash_splice_custom_with_options,
+ * need to move data between callbacks and the codec in pieces.  By
+ * default Squash starts with the codec's preferred block size and
+ * grows the buffers as long as the callbacks keep filling them; this
+ * option overrides that with a fixed size.
+ *
+ * @param options The options context.
+ * @param buffer_size Buffer size in bytes, or 0 to let Squash choose.
+ * @return A status code.
+ */
+SquashStatus
+squash_options_set_buffer_size (SquashOptions* options, size_t buffer_size) {
+  assert (options != NULL);
+
+  if (HEDLEY_UNLIKELY(options->frozen))
+    return squash_error (SQUASH_STATE);
+
+  options->buffer_size = buffer_size;
+
+  return SQUASH_OK;
+}
+
+/**
+ * @brief Get the buffer size used for I/O
+ *
+ * @param options The options context, or *NULL*.
+ * @return The buffer size, or 0 if Squash should choose.
+ */
+size_t
+squash_options_get_buffer_size (SquashOptions* options) {
+  return (options == NULL) ? 0 : options->buffer_size;
+}
+
+/**
+ * @brief Set the chunk size used when streaming with buffer-only codecs
+ *
+ * Codecs which don't support streaming natively are normally
+ * streamed by buffering the entire input and compressing (or
+ * decompressing) it all when the stream is finished.  Setting a
+ * chunk size switches those streams to a framed format instead: the
+ * input is split into chunks of @a chunk_size bytes, each of which is
+ * compressed independently and written out as soon as it is
+ * complete, so memory usage is bounded by roughly two chunks instead
+ * of the size of the input.
+ *
+ * The framed format is not compatible with the codec's native
+ * format, so the option must also be set when decompressing, to at
+ * least the value used for compression; frames larger than the chunk
+ * size are rejected with @ref SQUASH_INVALID_BUFFER.  Codecs which
+ * support streaming natively ignore this option, except that it is
+ * used as the block size for multi-threaded compression (see
+ * ::squash_options_set_threads).
+ *
+ * @param options The options context.
+ * @param chunk_size Chunk size in bytes, or 0 to disable chunking.
+ * @return A status code.
+ */
+SquashStatus
+squash_options_set_chunk_size (SquashOptions* options, size_t chunk_size) {
+  assert (options != NULL);
+
+  if (HEDLEY_UNLIKELY(options->frozen))
+    return squash_error (SQUASH_STATE);
+
+  options->chunk_size = chunk_size;
+
+  return SQUASH_OK;
+}
+
+/**
+ * @brief Get the chunk size used when streaming with buffer-only codecs
+ *
+ * @param options The options context, or *NULL*.
+ * @return The chunk size, or 0 if chunking is disabled.
+ */
+size_t
+squash_options_get_chunk_size (SquashOptions* options) {
+  return (options == NULL) ? 0 : options->chunk_size;
+}
+
+/**
+ * @brief Set the number of threads used by compression streams
+ *
+ * For codecs with the @ref SQUASH_CODEC_INFO_CONCATENABLE flag,
+ * compression streams created with more than one thread buffer the
+ * input into blocks and compress up to @a threads blocks concurrently
+ * on Squash's worker pool.  Each block is compressed independently
+ * and the results are concatenated, in order, so the output can be
+ * decompressed normally.  The block size is the chunk size (see
+ * ::squash_options_set_chunk_size) if one is set, otherwise @ref
+ * SQUASH_THREADED_STREAM_BLOCK_SIZE.
+ *
+ * Independent blocks generally compress slightly worse, and each
+ * block in flight requires its own input and output buffers.  Other
+ * codecs, and decompression streams, ignore this option.
+ *
+ * @param options The options context.
+ * @param threads Number of blocks to compress concurrently, or 0 to
+ *   disable multi-threaded compression.
+ * @return A status code.
+ */
+SquashStatus
+squash_options_set_threads (SquashOptions* options, unsigned int threads) {
+  assert (options != NULL);
+
+  if (HEDLEY_UNLIKELY(options->frozen))
+    return squash_error (SQUASH_STATE);
+
+  options->threads = threads;
+
+  return SQUASH_OK;
+}
+
+/**
+ * @brief Get the number of threads used by compression streams
+ *
+ * @param options The options context, or *NULL*.
+ * @return The number of threads, or 0 if multi-threaded compression
+ *   is disabled.
+ */
+unsigned int
+squash_options_get_threads (SquashOptions* options) {
+  return (options == NULL) ? 0 : options->threads;
+}
+
+/**
+ * @brief Set the preset dictionary
+ *
+ * The same dictionary must be used to decompress data which was
+ * compressed with one.  Only codecs with the @ref
+ * SQUASH_CODEC_INFO_DICTIONARY flag support dictionaries.
+ *
+ * @param options The options context.
+ * @param dictionary The dictionary, or *NULL* to remove it.
+ * @return A status code.
+ * @retval SQUASH_BAD_PARAM The codec doesn't support dictionaries.
+ */
+SquashStatus
+squash_options_set_dictionary (SquashOptions* options, SquashDictionary* dictionary) {
+  assert (options != NULL);
+
+  if (HEDLEY_UNLIKELY(options->frozen))
+    return squash_error (SQUASH_STATE);
+
+  if (dictionary != NULL && (squash_codec_get_info (options->codec) & SQUASH_CODEC_INFO_DICTIONARY) == 0)
+    return squash_error (SQUASH_BAD_PARAM);
+
+  if (dictionary != NULL)
+    squash_object_ref (dictionary);
+  squash_object_unref (options->dictionary);
+  options->dictionary = dictionary;
+
+  return SQUASH_OK;
+}
+
+/**
+ * @brief Get the preset dictionary
+ *
+ * @param options The options context, or *NULL*.
+ * @return The dictionary, or *NULL* if there isn't one.
+ */
+SquashDictionary*
+squash_options_get_dictionary (SquashOptions* options) {
+  return (options == NULL) ? NULL : options->dictionary;
+}
+
 /**
  * @brief Parse a single option.
  *
@@ -974,6 +1193,133 @@ squash_options_newv (SquashCodec* codec, va_list options) {
   return opts;
 }
 
+/* Serialize a list of key/value pairs as consecutive NUL-terminated
+   strings.  Returns false if the list doesn't fit. */
+static bool
+squash_options_cache_key (char key[SQUASH_OPTIONS_CACHE_KEY_SIZE], size_t* key_length, va_list options) {
+  const char* k;
+  size_t length = 0;
+
+  while ( (k = va_arg (options, char*)) != NULL ) {
+    const char* v = va_arg (options, char*);
+    const size_t k_size = strlen (k) + 1;
+    const size_t v_size = strlen (v) + 1;
+
+    if ((SQUASH_OPTIONS_CACHE_KEY_SIZE - length) < (k_size + v_size))
+      return false;
+
+    memcpy (key + length, k, k_size);
+    length += k_size;
+    memcpy (key + length, v, v_size);
+    length += v_size;
+  }
+
+  *key_length = length;
+  return true;
+}
+
+static SquashOptions*
+squash_options_new_from_key (SquashCodec* codec, const char* key, size_t key_length) {
+  SquashOptions* options = squash_options_create (codec);
+
+  for (size_t pos = 0 ; pos < key_length ; ) {
+    const char* k = key + pos;
+    pos += strlen (k) + 1;
+    const char* v = key + pos;
+    pos += strlen (v) + 1;
+
+    squash_options_parse_option (options, k, v);
+  }
+
+  return options;
+}
+
+static SquashOptions*
+squash_options_cache_find (SquashCodec* codec, const char* key, size_t key_length, unsigned int start, unsigned int end) {
+  for (unsigned int i = start ; i < end ; i++) {
+    const SquashOptionsCacheEntry* entry = &(squash_options_cache[i]);
+    if (entry->codec == codec &&
+        entry->key_length == key_length &&
+        memcmp (entry->key, key, key_length) == 0)
+      return entry->options;
+  }
+
+  return NULL;
+}
+
+/* Like squash_options_newv, but for callers which only need the
+   options for the duration of a single operation (such as
+   squash_codec_compress).  An empty list yields a frozen copy of the
+   codec's defaults, and the first SQUASH_OPTIONS_CACHE_SIZE distinct
+   lists are parsed once and frozen, so repeated calls don't allocate
+   anything or take any locks.  Cached options are kept for the life
+   of the process; since frozen options aren't referenced during
+   operations they can never be evicted.  Lists which don't fit in the
+   cache get a new floating group of options, just like
+   squash_options_newv. */
+SquashOptions*
+squash_options_cached_newv (SquashCodec* codec, va_list options) {
+  char key[SQUASH_OPTIONS_CACHE_KEY_SIZE];
+  size_t key_length = 0;
+  va_list options_copy;
+  bool cacheable;
+  SquashOptions* res = NULL;
+
+  assert (codec != NULL);
+
+  if (squash_codec_get_option_info (codec) == NULL)
+    return NULL;
+
+  va_copy (options_copy, options);
+  cacheable = squash_options_cache_key (key, &key_length, options_copy);
+  va_end (options_copy);
+  if (HEDLEY_UNLIKELY(!cacheable))
+    return squash_options_newv (codec, options);
+
+  if (key_length == 0) {
+    res = squash_atomic_load_ptr (&(codec->default_options));
+    if (HEDLEY_UNLIKELY(res == NULL)) {
+      /* If another thread beats us to it, use its copy instead. */
+      SquashOptions* defaults = squash_options_freeze (squash_options_create (codec));
+      res = squash_atomic_cas_ptr (&(codec->default_options), NULL, defaults);
+      if (res == NULL)
+        res = defaults;
+      else
+        squash_object_unref (defaults);
+    }
+    return res;
+  }
+
+  unsigned int cache_length = squash_atomic_load_uint (&squash_options_cache_length);
+  res = squash_options_cache_find (codec, key, key_length, 0, cache_length);
+  if (HEDLEY_LIKELY(res != NULL))
+    return res;
+
+  res = squash_options_new_from_key (codec, key, key_length);
+
+  SQUASH_MTX_LOCK(options_cache);
+  /* Someone else may have added the same list in the meantime. */
+  const unsigned int start = cache_length;
+  cache_length = squash_options_cache_length;
+  SquashOptions* cached = squash_options_cache_find (codec, key, key_length, start, cache_length);
+  if (cached == NULL && cache_length < SQUASH_OPTIONS_CACHE_SIZE) {
+    SquashOptionsCacheEntry* entry = &(squash_options_cache[cache_length]);
+    entry->codec = codec;
+    entry->key_length = key_length;
+    memcpy (entry->key, key, key_length);
+    entry->options = squash_options_freeze (res);
+    squash_atomic_store_uint (&squash_options_cache_length, cache_length + 1);
+  }
+  SQUASH_MTX_UNLOCK(options_cache);
+
+  if (cached != NULL) {
+    squash_object_unref (res);
+    res = cached;
+  }
+
+  return res;
+}
+
 /**
  * @brief Create a new group of options from key and value arrays.
  *
@@ -1000,6 +1346,60 @@ squash_options_newa (SquashCodec* codec, const char* const* keys, const char* co
   return opts;
 }
 
+/**
+ * @brief Make a group of options immutable
+ *
+ * Once frozen, options can no longer be modified (setters return
+ * @ref SQUASH_STATE), and a floating reference is converted into a
+ * regular one which the caller owns.  In exchange, Squash no longer
+ * takes a reference to the options for the duration of each buffer
+ * operation, so many threads can share them without contending on
+ * the reference count.  You must keep your reference until every
+ * operation using the options has returned.
+ *
+ * Options should be frozen before they are shared between threads.
+ *
+ * @param options The options to freeze.
+ * @return @a options
+ */
+SquashOptions*
+squash_options_freeze (SquashOptions* options) {
+  assert (options != NULL);
+
+  if (!options->frozen) {
+    squash_object_ref_sink (options);
+    options->frozen = true;
+  }
+
+  return options;
+}
+
+/**
+ * @brief Check whether a group of options is frozen
+ *
+ * @param options The options context, or *NULL*.
+ * @return Whether @a options has been frozen.
+ */
+bool
+squash_options_is_frozen (SquashOptions* options) {
+  return (options == NULL) ? false : options->frozen;
+}
+
+/* Hold on to the options for the duration of an operation.  This also
+   takes care of floating references; frozen options never float. */
+SquashOptions*
+squash_options_hold (SquashOptions* options) {
+  if (options != NULL && !options->frozen)
+    squash_object_ref (options);
+  return options;
+}
+
+void
+squash_options_release (SquashOptions* options) {
+  if (options != NULL && !options->frozen)
+    squash_object_unref (options);
+}
+
 /**
  * @brief Initialize a new %SquashOptions instance.
  *
@@ -1024,6 +1424,12 @@ squash_options_init (void* options,
 
   squash_object_init (o, true, destroy_notify);
   o->codec = codec;
+  o->values = NULL;
+  o->buffer_size = 0;
+  o->chunk_size = 0;
+  o->threads = 0;
+  o->dictionary = NULL;
+  o->frozen = false;
 
   const SquashOptionInfo* info = squash_codec_get_option_info (codec);
   if (info != NULL) {
@@ -1089,6 +1495,8 @@ squash_options_destroy (void* options) {
     squash_free (values);
   }
 
+  squash_object_unref (o->dictionary);
+
   squash_object_destroy (o);
 }
 
@@ -53,6 +53,12 @@ struct SquashOptions_ {
   SquashCodec* codec;
 
   SquashOptionValue* values;
+
+  size_t buffer_size;
+  size_t chunk_size;
+  unsigned int threads;
+  SquashDictionary* dictionary;
+  bool frozen;
 };
 
 typedef enum {
@@ -163,6 +169,23 @@ SQUASH_API SquashStatus   squash_options_parsea        (SquashOptions* options,
 HEDLEY_NON_NULL(1, 2, 3)
 SQUASH_API SquashStatus   squash_options_parse_option  (SquashOptions* options, const char* key, const char* value);
 
+HEDLEY_NON_NULL(1)
+SQUASH_API SquashStatus   squash_options_set_buffer_size (SquashOptions* options, size_t buffer_size);
+SQUASH_API size_t         squash_options_get_buffer_size (SquashOptions* options);
+HEDLEY_NON_NULL(1)
+SQUASH_API SquashStatus   squash_options_set_chunk_size (SquashOptions* options, size_t chunk_size);
+SQUASH_API size_t         squash_options_get_chunk_size (SquashOptions* options);
+HEDLEY_NON_NULL(1)
+SQUASH_API SquashStatus   squash_options_set_threads   (SquashOptions* options, unsigned int threads);
+SQUASH_API unsigned int   squash_options_get_threads   (SquashOptions* options);
+HEDLEY_NON_NULL(1)
+SQUASH_API SquashStatus   squash_options_set_dictionary (SquashOptions* options, SquashDictionary* dictionary);
+SQUASH_API SquashDictionary* squash_options_get_dictionary (SquashOptions* options);
+
+HEDLEY_NON_NULL(1)
+SQUASH_API SquashOptions* squash_options_freeze        (SquashOptions* options);
+SQUASH_API bool           squash_options_is_frozen     (SquashOptions* options);
+
 HEDLEY_NON_NULL(1, 2)
 SQUASH_API void           squash_options_init          (void* options, SquashCodec* codec, SquashDestroyNotify destroy_notify);
 HEDLEY_NON_NULL(1)
@@ -0,0 +1,363 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The "parallel:<codec>" meta-codec.
+ *
+ * Input is split into fixed-size blocks which are compressed
+ * independently (and therefore concurrently, using the worker pool)
+ * with the wrapped codec.  The format is:
+ *
+ *   varuint64  uncompressed size
+ *   varuint64  block size
+ *   varuint64  compressed size of each block (one per block)
+ *   ...        compressed blocks, in order
+ *
+ * using the same variable-length integers as
+ * SQUASH_CODEC_INFO_WRAP_SIZE.  The number of blocks is implied by the
+ * uncompressed size and block size. */
+
+/**
+ * @brief Default block size for parallel codecs
+ *
+ * The wrapped codec's block size (from its ini file) is used instead
+ * if it is larger.
+ */
+#if !defined(SQUASH_PARALLEL_BLOCK_SIZE)
+#  define SQUASH_PARALLEL_BLOCK_SIZE ((size_t) (1024 * 1024))
+#endif
+
+typedef struct SquashParallelJob_ {
+  SquashCodec* inner;
+  SquashOptions* options;
+
+  size_t block_size;
+  size_t uncompressed_size;
+  uint8_t* uncompressed;
+
+  /* Compressed blocks; for compression each block gets a slot of
+   * max_block_size bytes, for decompression offsets are computed from
+   * the table. */
+  uint8_t* compressed;
+  size_t max_block_size;
+  size_t* block_offsets;
+  size_t* block_sizes;
+  SquashStatus* block_status;
+} SquashParallelJob;
+
+static SquashCodec*
+squash_parallel_inner (SquashCodec* codec) {
+  return squash_codec_get_wrapper_inner (codec);
+}
+
+static size_t
+squash_parallel_block_size (SquashCodec* inner) {
+  const size_t inner_block_size = squash_codec_get_block_size (inner);
+  return (inner_block_size > SQUASH_PARALLEL_BLOCK_SIZE) ? inner_block_size : SQUASH_PARALLEL_BLOCK_SIZE;
+}
+
+static size_t
+squash_parallel_n_blocks (size_t uncompressed_size, size_t block_size) {
+  return (uncompressed_size / block_size) + (((uncompressed_size % block_size) != 0) ? 1 : 0);
+}
+
+static size_t
+squash_parallel_get_max_compressed_size (SquashCodec* codec, size_t uncompressed_size) {
+  SquashCodec* inner = squash_parallel_inner (codec);
+  const size_t block_size = squash_parallel_block_size (inner);
+  const size_t n_blocks = squash_parallel_n_blocks (uncompressed_size, block_size);
+  const size_t max_block_size = squash_codec_get_max_compressed_size (inner, block_size);
+
+  return
+    squash_size_varuint64 (uncompressed_size) +
+    squash_size_varuint64 (block_size) +
+    (n_blocks * (squash_size_varuint64 (max_block_size) + max_block_size));
+}
+
+static size_t
+squash_parallel_get_uncompressed_size (SquashCodec* codec,
+                                       size_t compressed_size,
+                                       const uint8_t compressed[HEDLEY_ARRAY_PARAM(compressed_size)]) {
+  uint64_t v = 0;
+
+  if (HEDLEY_UNLIKELY(squash_read_varuint64 (compressed, compressed_size, &v) == 0))
+    return 0;
+#if SIZE_MAX < UINT64_MAX
+  if (HEDLEY_UNLIKELY(SIZE_MAX < v))
+    return 0;
+#endif
+
+  return (size_t) v;
+}
+
+static void
+squash_parallel_compress_block (size_t block, void* user_data) {
+  SquashParallelJob* job = (SquashParallelJob*) user_data;
+  const size_t offset = block * job->block_size;
+  const size_t remaining = job->uncompressed_size - offset;
+
+  job->block_sizes[block] = job->max_block_size;
+  job->block_status[block] =
+    squash_codec_compress_with_options (job->inner,
+                                        &(job->block_sizes[block]), job->compressed + (block * job->max_block_size),
+                                        (remaining < job->block_size) ? remaining : job->block_size, job->uncompressed + offset,
+                                        job->options);
+}
+
+static void
+squash_parallel_decompress_block (size_t block, void* user_data) {
+  SquashParallelJob* job = (SquashParallelJob*) user_data;
+  const size_t offset = block * job->block_size;
+  const size_t remaining = job->uncompressed_size - offset;
+  const size_t expected = (remaining < job->block_size) ? remaining : job->block_size;
+  size_t decompressed_size = expected;
+
+  SquashStatus res =
+    squash_codec_decompress_with_options (job->inner,
+                                          &decompressed_size, job->uncompressed + offset,
+                                          job->block_sizes[block], job->compressed + job->block_offsets[block],
+                                          job->options);
+  if (HEDLEY_LIKELY(res == SQUASH_OK) && HEDLEY_UNLIKELY(decompressed_size != expected))
+    res = squash_error (SQUASH_INVALID_BUFFER);
+
+  job->block_status[block] = res;
+}
+
+static SquashStatus
+squash_parallel_job_alloc (SquashParallelJob* job, size_t n_blocks) {
+  if (n_blocks == 0)
+    return SQUASH_OK;
+
+  job->block_offsets = squash_malloc (n_blocks * sizeof (size_t));
+  job->block_sizes = squash_malloc (n_blocks * sizeof (size_t));
+  job->block_status = squash_malloc (n_blocks * sizeof (SquashStatus));
+
+  if (HEDLEY_UNLIKELY(job->block_offsets == NULL || job->block_sizes == NULL || job->block_status == NULL))
+    return squash_error (SQUASH_MEMORY);
+
+  return SQUASH_OK;
+}
+
+static void
+squash_parallel_job_free (SquashParallelJob* job) {
+  squash_free (job->block_offsets);
+  squash_free (job->block_sizes);
+  squash_free (job->block_status);
+}
+
+static SquashStatus
+squash_parallel_job_status (SquashParallelJob* job, size_t n_blocks) {
+  for (size_t i = 0 ; i < n_blocks ; i++)
+    if (HEDLEY_UNLIKELY(job->block_status[i] != SQUASH_OK))
+      return job->block_status[i];
+
+  return SQUASH_OK;
+}
+
+static SquashStatus
+squash_parallel_compress_buffer (SquashCodec* codec,
+                                 size_t* compressed_size,
+                                 uint8_t compressed[HEDLEY_ARRAY_PARAM(*compressed_size)],
+                                 size_t uncompressed_size,
+                                 const uint8_t uncompressed[HEDLEY_ARRAY_PARAM(uncompressed_size)],
+                                 SquashOptions* options) {
+  SquashCodec* inner = squash_parallel_inner (codec);
+  const size_t block_size = squash_parallel_block_size (inner);
+  const size_t n_blocks = squash_parallel_n_blocks (uncompressed_size, block_size);
+  const size_t max_block_size = squash_codec_get_max_compressed_size (inner, block_size);
+  SquashStatus res;
+
+  assert (*compressed_size >= squash_parallel_get_max_compressed_size (codec, uncompressed_size));
+
+  /* Compress each block into its own slot after the largest possible
+   * table, then write the table and pack the blocks down behind it. */
+  const size_t header_size =
+    squash_size_varuint64 (uncompressed_size) +
+    squash_size_varuint64 (block_size);
+  const size_t max_table_size = n_blocks * squash_size_varuint64 (max_block_size);
+
+  SquashParallelJob job = {
+    inner,
+    options,
+    block_size,
+    uncompressed_size,
+    (uint8_t*) uncompressed,
+    compressed + header_size + max_table_size,
+    max_block_size,
+    NULL, NULL, NULL
+  };
+
+  res = squash_parallel_job_alloc (&job, n_blocks);
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+    goto cleanup;
+
+  squash_pool_run (n_blocks, squash_parallel_compress_block, &job);
+
+  res = squash_parallel_job_status (&job, n_blocks);
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+    goto cleanup;
+
+  size_t pos = 0;
+  pos += squash_write_varuint64 (compressed + pos, *compressed_size - pos, uncompressed_size);
+  pos += squash_write_varuint64 (compressed + pos, *compressed_size - pos, block_size);
+  for (size_t i = 0 ; i < n_blocks ; i++)
+    pos += squash_write_varuint64 (compressed + pos, *compressed_size - pos, job.block_sizes[i]);
+
+  assert (pos <= header_size + max_table_size);
+
+  for (size_t i = 0 ; i < n_blocks ; i++) {
+    memmove (compressed + pos, job.compressed + (i * max_block_size), job.block_sizes[i]);
+    pos += job.block_sizes[i];
+  }
+
+  *compressed_size = pos;
+
+ cleanup:
+
+  squash_parallel_job_free (&job);
+
+  return res;
+}
+
+static SquashStatus
+squash_parallel_decompress_buffer (SquashCodec* codec,
+                                   size_t* decompressed_size,
+                                   uint8_t decompressed[HEDLEY_ARRAY_PARAM(*decompressed_size)],
+                                   size_t compressed_size,
+                                   const uint8_t compressed[HEDLEY_ARRAY_PARAM(compressed_size)],
+                                   SquashOptions* options) {
+  SquashCodec* inner = squash_parallel_inner (codec);
+  uint64_t uncompressed_size, block_size;
+  size_t pos = 0, l;
+  SquashStatus res;
+
+  l = squash_read_varuint64 (compressed + pos, compressed_size - pos, &uncompressed_size);
+  if (HEDLEY_UNLIKELY(l == 0))
+    return squash_error (SQUASH_BUFFER_EMPTY);
+  pos += l;
+
+  l = squash_read_varuint64 (compressed + pos, compressed_size - pos, &block_size);
+  if (HEDLEY_UNLIKELY(l == 0))
+    return squash_error (SQUASH_BUFFER_EMPTY);
+  pos += l;
+
+#if SIZE_MAX < UINT64_MAX
+  if (HEDLEY_UNLIKELY(SIZE_MAX < uncompressed_size) || HEDLEY_UNLIKELY(SIZE_MAX < block_size))
+    return squash_error (SQUASH_RANGE);
+#endif
+
+  if (HEDLEY_UNLIKELY(block_size == 0))
+    return squash_error (SQUASH_INVALID_BUFFER);
+  if (HEDLEY_UNLIKELY(*decompressed_size < uncompressed_size))
+    return squash_error (SQUASH_BUFFER_FULL);
+
+  const size_t n_blocks = squash_parallel_n_blocks ((size_t) uncompressed_size, (size_t) block_size);
+  if (HEDLEY_UNLIKELY(n_blocks > compressed_size - pos))
+    return squash_error (SQUASH_BUFFER_EMPTY);
+
+  SquashParallelJob job = {
+    inner,
+    options,
+    (size_t) block_size,
+    (size_t) uncompressed_size,
+    decompressed,
+    NULL,
+    0,
+    NULL, NULL, NULL
+  };
+
+  res = squash_parallel_job_alloc (&job, n_blocks);
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+    goto cleanup;
+
+  for (size_t i = 0 ; i < n_blocks ; i++) {
+    uint64_t v;
+    l = squash_read_varuint64 (compressed + pos, compressed_size - pos, &v);
+    if (HEDLEY_UNLIKELY(l == 0)) {
+      res = squash_error (SQUASH_BUFFER_EMPTY);
+      goto cleanup;
+    }
+    pos += l;
+
+    job.block_sizes[i] = (size_t) v;
+  }
+
+  job.compressed = (uint8_t*) compressed + pos;
+  for (size_t i = 0, offset = 0 ; i < n_blocks ; i++) {
+    if (HEDLEY_UNLIKELY(job.block_sizes[i] > (compressed_size - pos) - offset)) {
+      res = squash_error (SQUASH_BUFFER_EMPTY);
+      goto cleanup;
+    }
+
+    job.block_offsets[i] = offset;
+    offset += job.block_sizes[i];
+  }
+
+  squash_pool_run (n_blocks, squash_parallel_decompress_block, &job);
+
+  res = squash_parallel_job_status (&job, n_blocks);
+  if (HEDLEY_LIKELY(res == SQUASH_OK))
+    *decompressed_size = (size_t) uncompressed_size;
+
+ cleanup:
+
+  squash_parallel_job_free (&job);
+
+  return res;
+}
+
+/**
+ * @brief Get the parallel version of a codec
+ * @private
+ *
+ * Parallel codecs are created on demand, and (like regular codecs)
+ * live for the lifetime of the process.  They are normally accessed
+ * by prefixing the name of a codec with "parallel:", e.g.,
+ * "parallel:lz4".
+ *
+ * @param codec The codec to wrap
+ * @return The parallel codec, or *NULL* on failure
+ */
+SquashCodec*
+squash_codec_get_parallel (SquashCodec* codec) {
+  SquashCodecImpl impl = { 0, };
+
+  assert (codec != NULL);
+
+  impl.info = SQUASH_CODEC_INFO_KNOWS_UNCOMPRESSED_SIZE;
+  impl.get_max_compressed_size = squash_parallel_get_max_compressed_size;
+  impl.get_uncompressed_size = squash_parallel_get_uncompressed_size;
+  impl.compress_buffer_unsafe = squash_parallel_compress_buffer;
+  impl.decompress_buffer = squash_parallel_decompress_buffer;
+
+  return squash_codec_get_wrapper (codec, "parallel", &impl, squash_parallel_block_size (codec));
+}
@@ -279,7 +279,7 @@ squash_plugin_init_codec (SquashPlugin* plugin, SquashCodec* codec, SquashCodecI
     }
   }
 
-  if (codec->initialized == 0) {
+  if (squash_atomic_load_uint (&(codec->initialized)) == 0) {
     SquashStatus (*init_codec_func) (SquashCodec*, SquashCodecImpl*);
 
 #if !defined(_WIN32)
@@ -295,13 +295,18 @@ squash_plugin_init_codec (SquashPlugin* plugin, SquashCodec* codec, SquashCodecI
     SQUASH_MTX_LOCK(codec_init);
     if (HEDLEY_LIKELY(codec->initialized == 0)) {
       res = init_codec_func (codec, impl);
-      codec->initialized = (res == SQUASH_OK);
+      squash_codec_index_options (codec);
 
       assert ((codec->impl.info & SQUASH_CODEC_INFO_AUTO_MASK) == 0);
       if (codec->impl.process_stream != NULL)
         codec->impl.info |= (SquashCodecInfo) SQUASH_CODEC_INFO_NATIVE_STREAMING;
       if (codec->impl.get_uncompressed_size != NULL || (codec->impl.info & SQUASH_CODEC_INFO_WRAP_SIZE))
         codec->impl.info |= (SquashCodecInfo) SQUASH_CODEC_INFO_KNOWS_UNCOMPRESSED_SIZE;
+
+      /* squash_codec_get_impl checks this without taking the lock, so
+         it is published with a release store after everything else is
+         in place. */
+      squash_atomic_store_uint (&(codec->initialized), (res == SQUASH_OK) ? 1 : 0);
     }
     SQUASH_MTX_UNLOCK(codec_init);
   }
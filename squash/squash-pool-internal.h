@@ -0,0 +1,70 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+/* IWYU pragma: private, include "squash-internal.h" */
+
+#ifndef SQUASH_POOL_INTERNAL_H
+#define SQUASH_POOL_INTERNAL_H
+
+#if !defined (SQUASH_COMPILATION)
+#error "This is internal API; you cannot use it."
+#endif
+
+HEDLEY_BEGIN_C_DECLS
+
+typedef void (* SquashPoolFunc) (size_t index, void* user_data);
+
+typedef enum {
+  SQUASH_POOL_TASK_IDLE = 0,
+  SQUASH_POOL_TASK_QUEUED,
+  SQUASH_POOL_TASK_RUNNING,
+  SQUASH_POOL_TASK_DONE
+} SquashPoolTaskState;
+
+/* A single asynchronous work item; see squash_pool_task_submit.  The
+   caller owns the memory, which must remain valid until
+   squash_pool_task_wait returns. */
+typedef struct SquashPoolTask_ {
+  SquashPoolFunc func;
+  void* user_data;
+
+  SquashPoolTaskState state;
+  struct SquashPoolTask_* next;
+} SquashPoolTask;
+
+SQUASH_INTERNAL
+unsigned int squash_pool_get_threads (void);
+SQUASH_INTERNAL
+void         squash_pool_run         (size_t n_items, SquashPoolFunc func, void* user_data);
+SQUASH_INTERNAL
+void         squash_pool_task_submit (SquashPoolTask* task, SquashPoolFunc func, void* user_data);
+SQUASH_INTERNAL
+bool         squash_pool_task_done   (SquashPoolTask* task);
+SQUASH_INTERNAL
+void         squash_pool_task_wait   (SquashPoolTask* task);
+
+HEDLEY_END_C_DECLS
+
+#endif /* SQUASH_POOL_INTERNAL_H */
@@ -0,0 +1,360 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "squash/tinycthread/source/tinycthread.h"
+
+/* A process-wide pool of worker threads.
+ *
+ * Work is submitted as a job of n independent items; the submitting
+ * thread always works on its own job too, so a job makes progress
+ * even if every worker is busy (or the job was submitted from a
+ * worker, for example by a codec which itself uses the pool).
+ *
+ * Items are expected to be fairly coarse (compressing a buffer, not a
+ * byte), so a single mutex protects everything. */
+
+#if !defined(SQUASH_POOL_MAX_THREADS)
+#  define SQUASH_POOL_MAX_THREADS 64
+#endif
+
+typedef struct SquashPoolJob_ {
+  SquashPoolFunc func;
+  void* user_data;
+
+  size_t n_items;
+  size_t next_item;
+  size_t completed;
+
+  cnd_t done;
+
+  struct SquashPoolJob_* next;
+} SquashPoolJob;
+
+static once_flag squash_pool_once = ONCE_FLAG_INIT;
+static mtx_t squash_pool_mtx;
+static cnd_t squash_pool_cnd;
+static SquashPoolJob* squash_pool_queue = NULL;
+static SquashPoolTask* squash_pool_tasks = NULL;
+static SquashPoolTask** squash_pool_tasks_tail = &squash_pool_tasks;
+static cnd_t squash_pool_task_cnd;
+static unsigned int squash_pool_workers = 0;
+
+/* Must be called with the lock held; if this claims the last item the
+ * job is removed from the queue. */
+static size_t
+squash_pool_job_claim (SquashPoolJob* job) {
+  const size_t item = job->next_item++;
+
+  if (job->next_item == job->n_items) {
+    SquashPoolJob** p = &squash_pool_queue;
+    while (*p != job) {
+      assert (*p != NULL);
+      p = &((*p)->next);
+    }
+    *p = job->next;
+  }
+
+  return item;
+}
+
+static void
+squash_pool_job_complete (SquashPoolJob* job) {
+  if (++job->completed == job->n_items)
+    cnd_signal (&(job->done));
+}
+
+/* Must be called with the lock held. */
+static void
+squash_pool_task_remove (SquashPoolTask* task) {
+  SquashPoolTask** p = &squash_pool_tasks;
+  while (*p != task) {
+    assert (*p != NULL);
+    p = &((*p)->next);
+  }
+
+  *p = task->next;
+  if (squash_pool_tasks_tail == &(task->next))
+    squash_pool_tasks_tail = p;
+  task->next = NULL;
+}
+
+/* Must be called with the lock held; the lock is released while the
+   task runs. */
+static void
+squash_pool_task_run (SquashPoolTask* task) {
+  squash_pool_task_remove (task);
+  task->state = SQUASH_POOL_TASK_RUNNING;
+
+  mtx_unlock (&squash_pool_mtx);
+  task->func (0, task->user_data);
+  mtx_lock (&squash_pool_mtx);
+
+  task->state = SQUASH_POOL_TASK_DONE;
+  cnd_broadcast (&squash_pool_task_cnd);
+}
+
+static int
+squash_pool_worker (void* user_data) {
+  (void) user_data;
+
+  mtx_lock (&squash_pool_mtx);
+  for (;;) {
+    while (squash_pool_queue == NULL && squash_pool_tasks == NULL)
+      cnd_wait (&squash_pool_cnd, &squash_pool_mtx);
+
+    /* Synchronous jobs have a thread blocked waiting on them, so they
+       take priority over tasks. */
+    if (squash_pool_queue == NULL) {
+      squash_pool_task_run (squash_pool_tasks);
+      continue;
+    }
+
+    SquashPoolJob* job = squash_pool_queue;
+    const size_t item = squash_pool_job_claim (job);
+
+    mtx_unlock (&squash_pool_mtx);
+    job->func (item, job->user_data);
+    mtx_lock (&squash_pool_mtx);
+
+    squash_pool_job_complete (job);
+  }
+
+  return 0;
+}
+
+static void
+squash_pool_init (void) {
+  unsigned int threads = squash_get_cpu_count ();
+
+  const char* ev = getenv ("SQUASH_THREADS");
+  if (ev != NULL) {
+    char* endptr = NULL;
+    const unsigned long t = strtoul (ev, &endptr, 0);
+    if (*endptr == '\0' && t != 0)
+      threads = (unsigned int) t;
+  }
+
+  if (threads > SQUASH_POOL_MAX_THREADS)
+    threads = SQUASH_POOL_MAX_THREADS;
+
+  if (threads < 2)
+    return;
+
+  if (mtx_init (&squash_pool_mtx, mtx_plain) != thrd_success)
+    return;
+  if (cnd_init (&squash_pool_cnd) != thrd_success) {
+    mtx_destroy (&squash_pool_mtx);
+    return;
+  }
+  if (cnd_init (&squash_pool_task_cnd) != thrd_success) {
+    cnd_destroy (&squash_pool_cnd);
+    mtx_destroy (&squash_pool_mtx);
+    return;
+  }
+
+  /* The thread submitting a job also works on it. */
+  for (unsigned int i = 0 ; i < threads - 1 ; i++) {
+    thrd_t thread;
+    if (thrd_create (&thread, squash_pool_worker, NULL) != thrd_success)
+      break;
+    thrd_detach (thread);
+    squash_pool_workers++;
+  }
+}
+
+/**
+ * @brief Get the number of threads which may work on a job
+ * @private
+ *
+ * This includes the thread submitting the job, so it is always at
+ * least 1.  It can be overridden with the `SQUASH_THREADS`
+ * environment variable.
+ *
+ * @return Number of threads
+ */
+unsigned int
+squash_pool_get_threads (void) {
+  call_once (&squash_pool_once, squash_pool_init);
+
+  return squash_pool_workers + 1;
+}
+
+/**
+ * @brief Run a function for each item in parallel
+ * @private
+ *
+ * Invokes @a func once for every index in [0, @a n_items), spread
+ * across the calling thread and the worker pool, and returns once all
+ * invocations have completed.  Items may run in any order.
+ *
+ * @param n_items Number of items
+ * @param func Function to invoke for each item
+ * @param user_data Data to pass to @a func
+ */
+void
+squash_pool_run (size_t n_items, SquashPoolFunc func, void* user_data) {
+  assert (func != NULL);
+
+  call_once (&squash_pool_once, squash_pool_init);
+
+  if (n_items < 2 || squash_pool_workers == 0) {
+    for (size_t i = 0 ; i < n_items ; i++)
+      func (i, user_data);
+    return;
+  }
+
+  SquashPoolJob job = { func, user_data, n_items, 0, 0, };
+  if (HEDLEY_UNLIKELY(cnd_init (&(job.done)) != thrd_success)) {
+    for (size_t i = 0 ; i < n_items ; i++)
+      func (i, user_data);
+    return;
+  }
+
+  mtx_lock (&squash_pool_mtx);
+
+  {
+    SquashPoolJob** p = &squash_pool_queue;
+    while (*p != NULL)
+      p = &((*p)->next);
+    *p = &job;
+  }
+
+  if (n_items - 1 >= squash_pool_workers)
+    cnd_broadcast (&squash_pool_cnd);
+  else
+    for (size_t i = 0 ; i < n_items - 1 ; i++)
+      cnd_signal (&squash_pool_cnd);
+
+  while (job.next_item < job.n_items) {
+    const size_t item = squash_pool_job_claim (&job);
+
+    mtx_unlock (&squash_pool_mtx);
+    func (item, user_data);
+    mtx_lock (&squash_pool_mtx);
+
+    squash_pool_job_complete (&job);
+  }
+
+  while (job.completed < job.n_items)
+    cnd_wait (&(job.done), &squash_pool_mtx);
+
+  mtx_unlock (&squash_pool_mtx);
+
+  cnd_destroy (&(job.done));
+}
+
+/**
+ * @brief Run a function asynchronously
+ * @private
+ *
+ * Queues @a task, which will invoke @a func (with an index of 0) on a
+ * worker thread.  If there are no workers the function is invoked
+ * immediately, on the calling thread.
+ *
+ * The caller must eventually call @ref squash_pool_task_wait, and
+ * must not free @a task before it returns.
+ *
+ * @param task Task storage
+ * @param func Function to invoke
+ * @param user_data Data to pass to @a func
+ */
+void
+squash_pool_task_submit (SquashPoolTask* task, SquashPoolFunc func, void* user_data) {
+  assert (task != NULL);
+  assert (func != NULL);
+
+  call_once (&squash_pool_once, squash_pool_init);
+
+  task->func = func;
+  task->user_data = user_data;
+  task->next = NULL;
+
+  if (squash_pool_workers == 0) {
+    task->state = SQUASH_POOL_TASK_RUNNING;
+    func (0, user_data);
+    task->state = SQUASH_POOL_TASK_DONE;
+    return;
+  }
+
+  mtx_lock (&squash_pool_mtx);
+  task->state = SQUASH_POOL_TASK_QUEUED;
+  *squash_pool_tasks_tail = task;
+  squash_pool_tasks_tail = &(task->next);
+  cnd_signal (&squash_pool_cnd);
+  mtx_unlock (&squash_pool_mtx);
+}
+
+/**
+ * @brief Check whether a task has finished, without blocking
+ * @private
+ *
+ * @param task The task
+ * @return Whether the task's function has returned
+ */
+bool
+squash_pool_task_done (SquashPoolTask* task) {
+  assert (task != NULL);
+
+  if (squash_pool_workers == 0)
+    return task->state == SQUASH_POOL_TASK_DONE;
+
+  mtx_lock (&squash_pool_mtx);
+  const bool done = (task->state == SQUASH_POOL_TASK_DONE);
+  mtx_unlock (&squash_pool_mtx);
+
+  return done;
+}
+
+/**
+ * @brief Wait for a task to finish
+ * @private
+ *
+ * If no worker has started the task yet it is run on the calling
+ * thread instead, so waiting on a task can never deadlock, even from
+ * a worker thread.  Waiting on a task which has already been waited
+ * on (or was never submitted) returns immediately.
+ *
+ * @param task The task
+ */
+void
+squash_pool_task_wait (SquashPoolTask* task) {
+  assert (task != NULL);
+
+  if (squash_pool_workers == 0)
+    return;
+
+  mtx_lock (&squash_pool_mtx);
+  if (task->state == SQUASH_POOL_TASK_QUEUED)
+    squash_pool_task_run (task);
+  while (task->state == SQUASH_POOL_TASK_RUNNING)
+    cnd_wait (&squash_pool_task_cnd, &squash_pool_mtx);
+  mtx_unlock (&squash_pool_mtx);
+}
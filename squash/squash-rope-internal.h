@@ -0,0 +1,87 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+/* IWYU pragma: private, include "squash-internal.h" */
+
+#ifndef SQUASH_ROPE_INTERNAL_H
+#define SQUASH_ROPE_INTERNAL_H
+
+#if !defined (SQUASH_COMPILATION)
+#error "This is internal API; you cannot use it."
+#endif
+
+HEDLEY_BEGIN_C_DECLS
+
+/* Segment sizes are clamped to this range; segments of the maximum
+   size are backed by huge pages where the system supports it. */
+#if !defined(SQUASH_ROPE_SEGMENT_SIZE_MIN)
+#  define SQUASH_ROPE_SEGMENT_SIZE_MIN ((size_t) (64 * 1024))
+#endif
+#if !defined(SQUASH_ROPE_SEGMENT_SIZE_MAX)
+#  define SQUASH_ROPE_SEGMENT_SIZE_MAX ((size_t) (2 * 1024 * 1024))
+#endif
+
+typedef struct SquashRopeSegment_ {
+  struct SquashRopeSegment_* next;
+  uint8_t* data;
+  size_t size;
+  size_t allocated;
+} SquashRopeSegment;
+
+typedef struct SquashRope_ {
+  SquashRopeSegment* head;
+  SquashRopeSegment* tail;
+  /* Bytes already consumed from the head segment */
+  size_t head_pos;
+  size_t n_segments;
+  size_t segment_size;
+  size_t size;
+} SquashRope;
+
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+void         squash_rope_init        (SquashRope* rope, size_t segment_size);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+void         squash_rope_destroy     (SquashRope* rope);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+void         squash_rope_reset       (SquashRope* rope);
+HEDLEY_NON_NULL(1, 2) SQUASH_INTERNAL
+uint8_t*     squash_rope_reserve     (SquashRope* rope, size_t* avail);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+void         squash_rope_commit      (SquashRope* rope, size_t size);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+bool         squash_rope_append      (SquashRope* rope, size_t data_size, const uint8_t data[HEDLEY_ARRAY_PARAM(data_size)]);
+HEDLEY_NON_NULL(1, 4) SQUASH_INTERNAL
+bool         squash_rope_adopt       (SquashRope* rope, size_t data_size, size_t data_allocated, uint8_t data[HEDLEY_ARRAY_PARAM(data_allocated)]);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+size_t       squash_rope_shift       (SquashRope* rope, size_t data_size, uint8_t data[HEDLEY_ARRAY_PARAM(data_size)]);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+uint8_t*     squash_rope_linearize   (SquashRope* rope);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+size_t       squash_rope_get_iov     (const SquashRope* rope, size_t iov_len, SquashIOVec iov[HEDLEY_ARRAY_PARAM(iov_len)]);
+
+HEDLEY_END_C_DECLS
+
+#endif /* SQUASH_ROPE_INTERNAL_H */
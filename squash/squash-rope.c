@@ -0,0 +1,390 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#if !defined(_WIN32)
+#  include <sys/mman.h>
+#endif
+
+/* A rope is a list of fixed-size segments.  Appending never moves
+ * data which has already been written, so growing one costs nothing
+ * but the new segment, and it never has more than one partially
+ * filled segment of slack.  Data can be consumed from the front
+ * (which frees segments as they are emptied), walked as an iovec
+ * list, or linearized into a single allocation when a contiguous
+ * buffer really is required. */
+
+/**
+ * @brief Initialize a rope
+ * @private
+ *
+ * @param rope The rope
+ * @param segment_size Suggested size of each segment, in bytes; it
+ *   will be rounded to a power of two between
+ *   SQUASH_ROPE_SEGMENT_SIZE_MIN and SQUASH_ROPE_SEGMENT_SIZE_MAX.
+ */
+void
+squash_rope_init (SquashRope* rope, size_t segment_size) {
+  assert (rope != NULL);
+
+  if (segment_size <= SQUASH_ROPE_SEGMENT_SIZE_MIN)
+    segment_size = SQUASH_ROPE_SEGMENT_SIZE_MIN;
+  else if (segment_size >= SQUASH_ROPE_SEGMENT_SIZE_MAX)
+    segment_size = SQUASH_ROPE_SEGMENT_SIZE_MAX;
+  else
+    segment_size = squash_npot (segment_size);
+
+  rope->head = NULL;
+  rope->tail = NULL;
+  rope->head_pos = 0;
+  rope->n_segments = 0;
+  rope->segment_size = segment_size;
+  rope->size = 0;
+}
+
+static void
+squash_rope_segment_free (SquashRopeSegment* segment) {
+  squash_free (segment->data);
+  squash_free (segment);
+}
+
+/**
+ * @brief Free all the data in a rope
+ * @private
+ *
+ * The rope is left empty, and may be used again.
+ *
+ * @param rope The rope
+ */
+void
+squash_rope_destroy (SquashRope* rope) {
+  assert (rope != NULL);
+
+  SquashRopeSegment* next;
+  for (SquashRopeSegment* segment = rope->head ; segment != NULL ; segment = next) {
+    next = segment->next;
+    squash_rope_segment_free (segment);
+  }
+
+  rope->head = NULL;
+  rope->tail = NULL;
+  rope->head_pos = 0;
+  rope->n_segments = 0;
+  rope->size = 0;
+}
+
+/**
+ * @brief Empty a rope, but keep its first segment for reuse
+ * @private
+ *
+ * @param rope The rope
+ */
+void
+squash_rope_reset (SquashRope* rope) {
+  assert (rope != NULL);
+
+  SquashRopeSegment* head = rope->head;
+  if (head == NULL)
+    return;
+
+  rope->head = head->next;
+  squash_rope_destroy (rope);
+
+  head->next = NULL;
+  head->size = 0;
+  rope->head = rope->tail = head;
+  rope->n_segments = 1;
+}
+
+static void
+squash_rope_push (SquashRope* rope, SquashRopeSegment* segment) {
+  segment->next = NULL;
+  if (rope->tail == NULL)
+    rope->head = segment;
+  else
+    rope->tail->next = segment;
+  rope->tail = segment;
+  rope->n_segments++;
+  rope->size += segment->size;
+}
+
+static SquashRopeSegment*
+squash_rope_segment_new (size_t allocated) {
+  SquashRopeSegment* segment = squash_malloc (sizeof (SquashRopeSegment));
+  if (HEDLEY_UNLIKELY(segment == NULL))
+    return NULL;
+
+  segment->data = squash_malloc (allocated);
+  if (HEDLEY_UNLIKELY(segment->data == NULL)) {
+    squash_free (segment);
+    return NULL;
+  }
+  segment->size = 0;
+  segment->allocated = allocated;
+
+#if defined(MADV_HUGEPAGE)
+  /* Only the part of the segment which covers whole huge pages can be
+     backed by them. */
+  if (allocated >= SQUASH_ROPE_SEGMENT_SIZE_MAX) {
+    const uintptr_t start = ((uintptr_t) segment->data + (SQUASH_ROPE_SEGMENT_SIZE_MAX - 1)) & ~((uintptr_t) SQUASH_ROPE_SEGMENT_SIZE_MAX - 1);
+    const uintptr_t end = ((uintptr_t) segment->data + allocated) & ~((uintptr_t) SQUASH_ROPE_SEGMENT_SIZE_MAX - 1);
+    if (end > start)
+      madvise ((void*) start, (size_t) (end - start), MADV_HUGEPAGE);
+  }
+#endif
+
+  return segment;
+}
+
+/**
+ * @brief Get space to write to at the end of a rope
+ * @private
+ *
+ * Data written to the returned space does not become part of the rope
+ * until it is committed with @ref squash_rope_commit.
+ *
+ * @param rope The rope
+ * @param[out] avail Number of bytes available
+ * @return Space to write to, or *NULL* if a new segment could not be
+ *   allocated
+ */
+uint8_t*
+squash_rope_reserve (SquashRope* rope, size_t* avail) {
+  assert (rope != NULL);
+  assert (avail != NULL);
+
+  SquashRopeSegment* tail = rope->tail;
+  if (tail == NULL || tail->size == tail->allocated) {
+    tail = squash_rope_segment_new (rope->segment_size);
+    if (HEDLEY_UNLIKELY(tail == NULL)) {
+      *avail = 0;
+      return NULL;
+    }
+    squash_rope_push (rope, tail);
+  }
+
+  *avail = tail->allocated - tail->size;
+  return tail->data + tail->size;
+}
+
+/**
+ * @brief Add data written to reserved space to the rope
+ * @private
+ *
+ * @param rope The rope
+ * @param size Number of bytes written; must not exceed the space
+ *   returned by the last call to @ref squash_rope_reserve
+ */
+void
+squash_rope_commit (SquashRope* rope, size_t size) {
+  assert (rope != NULL);
+  assert (size == 0 || rope->tail != NULL);
+
+  if (size == 0)
+    return;
+
+  assert (size <= rope->tail->allocated - rope->tail->size);
+
+  rope->tail->size += size;
+  rope->size += size;
+}
+
+/**
+ * @brief Copy data to the end of a rope
+ * @private
+ *
+ * @param rope The rope
+ * @param data_size Size of @a data, in bytes
+ * @param data Data to append
+ * @return *true* on success, *false* if memory could not be allocated
+ */
+bool
+squash_rope_append (SquashRope* rope, size_t data_size, const uint8_t data[HEDLEY_ARRAY_PARAM(data_size)]) {
+  assert (rope != NULL);
+
+  while (data_size != 0) {
+    size_t avail;
+    uint8_t* dest = squash_rope_reserve (rope, &avail);
+    if (HEDLEY_UNLIKELY(dest == NULL))
+      return false;
+
+    const size_t cp_size = (data_size < avail) ? data_size : avail;
+    memcpy (dest, data, cp_size);
+    squash_rope_commit (rope, cp_size);
+
+    data += cp_size;
+    data_size -= cp_size;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Append an existing allocation to a rope as a segment
+ * @private
+ *
+ * On success the rope takes ownership of @a data, which must have
+ * been allocated with squash_malloc.
+ *
+ * @param rope The rope
+ * @param data_size Number of bytes of @a data in use
+ * @param data_allocated Size of the @a data allocation
+ * @param data The data
+ * @return *true* on success, *false* if memory could not be allocated
+ */
+bool
+squash_rope_adopt (SquashRope* rope, size_t data_size, size_t data_allocated, uint8_t data[HEDLEY_ARRAY_PARAM(data_allocated)]) {
+  assert (rope != NULL);
+  assert (data != NULL);
+  assert (data_size <= data_allocated);
+
+  SquashRopeSegment* segment = squash_malloc (sizeof (SquashRopeSegment));
+  if (HEDLEY_UNLIKELY(segment == NULL))
+    return false;
+
+  segment->data = data;
+  segment->size = data_size;
+  segment->allocated = data_allocated;
+  squash_rope_push (rope, segment);
+
+  return true;
+}
+
+/**
+ * @brief Remove data from the beginning of a rope
+ * @private
+ *
+ * Segments are freed as soon as they have been emptied.
+ *
+ * @param rope The rope
+ * @param data_size Maximum number of bytes to remove
+ * @param data Location to copy the removed data to
+ * @return Number of bytes removed
+ */
+size_t
+squash_rope_shift (SquashRope* rope, size_t data_size, uint8_t data[HEDLEY_ARRAY_PARAM(data_size)]) {
+  assert (rope != NULL);
+
+  size_t shifted = 0;
+
+  while (shifted != data_size && rope->size != 0) {
+    SquashRopeSegment* head = rope->head;
+    const size_t remaining = head->size - rope->head_pos;
+    const size_t cp_size = (remaining < (data_size - shifted)) ? remaining : (data_size - shifted);
+
+    memcpy (data + shifted, head->data + rope->head_pos, cp_size);
+    shifted += cp_size;
+    rope->head_pos += cp_size;
+    rope->size -= cp_size;
+
+    /* Keep the tail around even when it is empty; it may still have
+       room for more data. */
+    if (rope->head_pos == head->size && (head != rope->tail || head->size == head->allocated)) {
+      rope->head = head->next;
+      if (rope->head == NULL)
+        rope->tail = NULL;
+      rope->head_pos = 0;
+      rope->n_segments--;
+      squash_rope_segment_free (head);
+    }
+  }
+
+  return shifted;
+}
+
+/**
+ * @brief Make the contents of a rope contiguous
+ * @private
+ *
+ * If the rope has more than one segment they are copied into a single
+ * new segment, freeing each one as soon as it has been copied.
+ *
+ * @param rope The rope
+ * @return Pointer to the contents of the rope (which remains owned by
+ *   the rope), or *NULL* if the rope is empty or memory could not be
+ *   allocated
+ */
+uint8_t*
+squash_rope_linearize (SquashRope* rope) {
+  assert (rope != NULL);
+
+  if (rope->size == 0)
+    return NULL;
+
+  if (rope->n_segments != 1) {
+    SquashRopeSegment* linear = squash_rope_segment_new (rope->size);
+    if (HEDLEY_UNLIKELY(linear == NULL))
+      return NULL;
+
+    const size_t size = rope->size;
+    linear->size = squash_rope_shift (rope, size, linear->data);
+    assert (linear->size == size);
+
+    squash_rope_destroy (rope);
+    squash_rope_push (rope, linear);
+  }
+
+  return rope->head->data + rope->head_pos;
+}
+
+
+/**
+ * @brief Describe the contents of a rope as an iovec list
+ * @private
+ *
+ * @param rope The rope
+ * @param iov_len Number of elements in @a iov
+ * @param iov Array to fill in; may be *NULL* if @a iov_len is 0
+ * @return Number of elements required to describe the whole rope,
+ *   which may be larger than @a iov_len
+ */
+size_t
+squash_rope_get_iov (const SquashRope* rope, size_t iov_len, SquashIOVec iov[HEDLEY_ARRAY_PARAM(iov_len)]) {
+  assert (rope != NULL);
+
+  size_t n = 0;
+  for (const SquashRopeSegment* segment = rope->head ; segment != NULL ; segment = segment->next) {
+    const size_t offset = (segment == rope->head) ? rope->head_pos : 0;
+    if (segment->size == offset)
+      continue;
+
+    if (n < iov_len) {
+      iov[n].iov_base = segment->data + offset;
+      iov[n].iov_len = segment->size - offset;
+    }
+    n++;
+  }
+
+  return n;
+}
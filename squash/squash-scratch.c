@@ -0,0 +1,161 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tinycthread/source/tinycthread.h"
+
+/* Each thread keeps one scratch buffer for short-lived allocations on
+   hot paths, such as the worst-case sized buffer needed to compress
+   with codecs which only implement compress_buffer_unsafe.  It grows
+   to the largest size requested and is freed when the thread exits.
+   Requests made while the buffer is already in use fall back to
+   squash_malloc.
+
+   Worker pool threads never exit, so requests larger than
+   SQUASH_SCRATCH_KEEP_SIZE go straight to squash_malloc instead of
+   growing a buffer which would be held for the life of the process.
+   At that size the cost of the allocation is small next to
+   compressing the data anyway. */
+
+#if !defined(SQUASH_SCRATCH_KEEP_SIZE)
+#  define SQUASH_SCRATCH_KEEP_SIZE ((size_t) (1024 * 1024))
+#endif
+
+#if !defined(SQUASH_SCRATCH_MIN_SIZE)
+#  define SQUASH_SCRATCH_MIN_SIZE ((size_t) (64 * 1024))
+#endif
+
+typedef struct SquashScratch_ {
+  uint8_t* data;
+  size_t size;
+  bool in_use;
+} SquashScratch;
+
+static once_flag squash_scratch_once = ONCE_FLAG_INIT;
+static tss_t squash_scratch_key;
+static bool squash_scratch_key_valid = false;
+
+static void
+squash_scratch_destroy (void* data) {
+  SquashScratch* scratch = (SquashScratch*) data;
+
+  if (scratch == NULL)
+    return;
+
+  squash_free (scratch->data);
+  squash_free (scratch);
+}
+
+static void
+squash_scratch_init (void) {
+  squash_scratch_key_valid = (tss_create (&squash_scratch_key, squash_scratch_destroy) == thrd_success);
+}
+
+static SquashScratch*
+squash_scratch_get (void) {
+  call_once (&squash_scratch_once, squash_scratch_init);
+
+  if (HEDLEY_UNLIKELY(!squash_scratch_key_valid))
+    return NULL;
+
+  SquashScratch* scratch = (SquashScratch*) tss_get (squash_scratch_key);
+  if (scratch == NULL) {
+    scratch = squash_calloc (1, sizeof (SquashScratch));
+    if (HEDLEY_UNLIKELY(scratch == NULL))
+      return NULL;
+
+    if (HEDLEY_UNLIKELY(tss_set (squash_scratch_key, scratch) != thrd_success)) {
+      squash_free (scratch);
+      return NULL;
+    }
+  }
+
+  return scratch;
+}
+
+/**
+ * @brief Borrow a temporary buffer
+ * @private
+ *
+ * The buffer must be returned with ::squash_scratch_release, from
+ * the same thread, before the calling function returns.  Its contents
+ * are undefined.
+ *
+ * @param size Minimum size of the buffer, in bytes
+ * @return The buffer, or *NULL* if it could not be allocated
+ */
+void*
+squash_scratch_acquire (size_t size) {
+  if (size <= SQUASH_SCRATCH_KEEP_SIZE) {
+    SquashScratch* scratch = squash_scratch_get ();
+
+    if (HEDLEY_LIKELY(scratch != NULL && !scratch->in_use)) {
+      if (scratch->size < size) {
+        const size_t alloc_size = (size < SQUASH_SCRATCH_MIN_SIZE) ? SQUASH_SCRATCH_MIN_SIZE : size;
+        uint8_t* data = squash_malloc (alloc_size);
+        if (HEDLEY_LIKELY(data != NULL)) {
+          squash_free (scratch->data);
+          scratch->data = data;
+          scratch->size = alloc_size;
+        }
+      }
+
+      if (HEDLEY_LIKELY(scratch->size >= size)) {
+        scratch->in_use = true;
+        return scratch->data;
+      }
+    }
+  }
+
+  return squash_malloc (size);
+}
+
+/**
+ * @brief Return a buffer borrowed with ::squash_scratch_acquire
+ * @private
+ *
+ * @param ptr The buffer, or *NULL*
+ */
+void
+squash_scratch_release (void* ptr) {
+  if (ptr == NULL)
+    return;
+
+  SquashScratch* scratch = squash_scratch_key_valid ?
+    (SquashScratch*) tss_get (squash_scratch_key) : NULL;
+  if (scratch != NULL && scratch->in_use && ptr == scratch->data) {
+    scratch->in_use = false;
+    return;
+  }
+
+  squash_free (ptr);
+}
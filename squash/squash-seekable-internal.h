@@ -0,0 +1,76 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+/* IWYU pragma: private, include "squash-internal.h" */
+
+#ifndef SQUASH_SEEKABLE_INTERNAL_H
+#define SQUASH_SEEKABLE_INTERNAL_H
+
+#if !defined (SQUASH_COMPILATION)
+#error "This is internal API; you cannot use it."
+#endif
+
+HEDLEY_BEGIN_C_DECLS
+
+/* Size of the fixed footer at the very end of seekable data. */
+#define SQUASH_SEEKABLE_FOOTER_SIZE ((size_t) 8)
+
+typedef struct SquashSeekableIndex_ {
+  size_t n_blocks;
+
+  /* Offset of each block's compressed data, relative to the start of
+     the seekable data. */
+  uint64_t* compressed_offsets;
+  size_t* compressed_sizes;
+
+  /* n_blocks + 1 entries; the last is the total uncompressed size. */
+  uint64_t* uncompressed_offsets;
+
+  /* Size of everything before the index (the blocks and the
+     terminator). */
+  uint64_t data_size;
+} SquashSeekableIndex;
+
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+SquashCodec*  squash_codec_get_seekable_inner  (SquashCodec* codec);
+HEDLEY_NON_NULL(1, 2) SQUASH_INTERNAL
+SquashStatus  squash_seekable_read_footer      (const uint8_t footer[HEDLEY_ARRAY_PARAM(SQUASH_SEEKABLE_FOOTER_SIZE)],
+                                                size_t* index_size);
+HEDLEY_NON_NULL(1, 5) SQUASH_INTERNAL
+SquashStatus  squash_seekable_index_init       (SquashSeekableIndex* index,
+                                                size_t block_size,
+                                                uint64_t compressed_size,
+                                                size_t index_size,
+                                                const uint8_t data[HEDLEY_ARRAY_PARAM(index_size)]);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+void          squash_seekable_index_destroy    (SquashSeekableIndex* index);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+size_t        squash_seekable_index_find       (SquashSeekableIndex* index,
+                                                uint64_t offset);
+
+HEDLEY_END_C_DECLS
+
+#endif /* SQUASH_SEEKABLE_INTERNAL_H */
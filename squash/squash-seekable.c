@@ -0,0 +1,809 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The "seekable:<codec>" meta-codec.
+ *
+ * Input is split into blocks which are compressed independently with
+ * the wrapped codec, followed by an index which lets readers find
+ * (and decompress) only the blocks covering the range they are
+ * interested in.  The format is:
+ *
+ *   for each block:
+ *     varuint64  compressed size (never 0)
+ *     varuint64  uncompressed size
+ *     ...        compressed data
+ *   varuint64    0
+ *   index:
+ *     varuint64  number of blocks
+ *     for each block:
+ *       varuint64  compressed size
+ *       varuint64  uncompressed size
+ *   footer:
+ *     uint32     size of the index in bytes, little-endian
+ *     4 bytes    "SQSK"
+ *
+ * using the same variable-length integers as
+ * SQUASH_CODEC_INFO_WRAP_SIZE.  Blocks are normally the codec's block
+ * size, but flushing a stream ends the current block early.  Since
+ * the sizes are repeated in front of each block the data can also be
+ * decoded front to back without looking at the index. */
+
+/**
+ * @brief Default block size for seekable codecs
+ *
+ * This is the granularity of random access; the wrapped codec's block
+ * size (from its ini file) is used instead if it is larger.
+ */
+#if !defined(SQUASH_SEEKABLE_BLOCK_SIZE)
+#  define SQUASH_SEEKABLE_BLOCK_SIZE ((size_t) (256 * 1024))
+#endif
+
+/* Largest possible size of the two varuint64s in front of a block. */
+#define SQUASH_SEEKABLE_BLOCK_HEADER_MAX ((size_t) 18)
+
+#ifndef MIN
+#  define MIN(a,b) (((a) < (b)) ? (a) : (b))
+#endif
+
+static const uint8_t squash_seekable_magic[4] = { 'S', 'Q', 'S', 'K' };
+
+typedef enum {
+  SQUASH_SEEKABLE_STATE_BLOCK_COMPRESSED_SIZE,
+  SQUASH_SEEKABLE_STATE_BLOCK_UNCOMPRESSED_SIZE,
+  SQUASH_SEEKABLE_STATE_BLOCK_DATA,
+  SQUASH_SEEKABLE_STATE_INDEX_COUNT,
+  SQUASH_SEEKABLE_STATE_INDEX,
+  SQUASH_SEEKABLE_STATE_FOOTER,
+  SQUASH_SEEKABLE_STATE_FINISHED
+} SquashSeekableState;
+
+typedef struct SquashSeekableStream_ {
+  SquashStream base_object;
+
+  size_t block_size;
+
+  /* Uncompressed data for the current block when compressing,
+     compressed data for the current block when decompressing. */
+  SquashBuffer* input;
+
+  /* Data waiting to be copied to next_out. */
+  SquashBuffer* output;
+  size_t output_pos;
+
+  /* Encoded index entries (compression only). */
+  SquashBuffer* index;
+  uint64_t n_blocks;
+
+  SquashSeekableState state;
+
+  /* Partial varuint64 (or footer) read from the input. */
+  uint8_t pending[9];
+  size_t pending_size;
+
+  uint64_t block_compressed_size;
+  uint64_t block_uncompressed_size;
+
+  /* Number of varuint64s left in the index. */
+  uint64_t remaining;
+} SquashSeekableStream;
+
+static SquashCodec*
+squash_seekable_inner (SquashCodec* codec) {
+  return squash_codec_get_wrapper_inner (codec);
+}
+
+static size_t
+squash_seekable_block_size (SquashCodec* inner) {
+  const size_t inner_block_size = squash_codec_get_block_size (inner);
+  return (inner_block_size > SQUASH_SEEKABLE_BLOCK_SIZE) ? inner_block_size : SQUASH_SEEKABLE_BLOCK_SIZE;
+}
+
+static size_t
+squash_seekable_get_max_compressed_size (SquashCodec* codec, size_t uncompressed_size) {
+  SquashCodec* inner = squash_seekable_inner (codec);
+  const size_t block_size = squash_seekable_block_size (inner);
+  const size_t n_blocks = (uncompressed_size / block_size) + (((uncompressed_size % block_size) != 0) ? 1 : 0);
+  const size_t max_block_size = squash_codec_get_max_compressed_size (inner, MIN(uncompressed_size, block_size));
+
+  /* Each block's sizes appear both in front of it and in the index. */
+  return
+    (n_blocks * ((2 * SQUASH_SEEKABLE_BLOCK_HEADER_MAX) + max_block_size)) +
+    1 +
+    squash_size_varuint64 (n_blocks) +
+    SQUASH_SEEKABLE_FOOTER_SIZE;
+}
+
+/**
+ * @brief Parse the footer of seekable data
+ * @private
+ *
+ * @param footer The last @ref SQUASH_SEEKABLE_FOOTER_SIZE bytes of
+ *   the data
+ * @param[out] index_size Size of the index, which immediately
+ *   precedes the footer
+ * @return @ref SQUASH_OK, or @ref SQUASH_INVALID_BUFFER if @a footer
+ *   is not a valid footer
+ */
+SquashStatus
+squash_seekable_read_footer (const uint8_t footer[HEDLEY_ARRAY_PARAM(SQUASH_SEEKABLE_FOOTER_SIZE)],
+                             size_t* index_size) {
+  assert (footer != NULL);
+  assert (index_size != NULL);
+
+  if (HEDLEY_UNLIKELY(memcmp (footer + 4, squash_seekable_magic, sizeof (squash_seekable_magic)) != 0))
+    return squash_error (SQUASH_INVALID_BUFFER);
+
+  *index_size =
+    ((size_t) footer[0]) |
+    ((size_t) footer[1] <<  8) |
+    ((size_t) footer[2] << 16) |
+    ((size_t) footer[3] << 24);
+
+  return SQUASH_OK;
+}
+
+/**
+ * @brief Parse the index of seekable data
+ * @private
+ *
+ * On success the index must be released with @ref
+ * squash_seekable_index_destroy.
+ *
+ * @param index The index to initialize
+ * @param block_size Block size of the seekable codec; no block may be
+ *   larger
+ * @param compressed_size Number of bytes available in front of the
+ *   index for the blocks it describes
+ * @param index_size Size of the index, from @ref
+ *   squash_seekable_read_footer
+ * @param data The index
+ * @return A status code
+ */
+SquashStatus
+squash_seekable_index_init (SquashSeekableIndex* index,
+                            size_t block_size,
+                            uint64_t compressed_size,
+                            size_t index_size,
+                            const uint8_t data[HEDLEY_ARRAY_PARAM(index_size)]) {
+  uint64_t n_blocks;
+  size_t pos = 0, l;
+
+  assert (index != NULL);
+  assert (data != NULL);
+
+  index->n_blocks = 0;
+  index->compressed_offsets = NULL;
+  index->compressed_sizes = NULL;
+  index->uncompressed_offsets = NULL;
+  index->data_size = 0;
+
+  l = squash_read_varuint64 (data, index_size, &n_blocks);
+  if (HEDLEY_UNLIKELY(l == 0))
+    return squash_error (SQUASH_INVALID_BUFFER);
+  pos += l;
+
+  /* Every entry takes at least two bytes. */
+  if (HEDLEY_UNLIKELY(n_blocks > (index_size - pos) / 2))
+    return squash_error (SQUASH_INVALID_BUFFER);
+
+  index->n_blocks = (size_t) n_blocks;
+  index->compressed_offsets = squash_malloc (index->n_blocks * sizeof (uint64_t));
+  index->compressed_sizes = squash_malloc (index->n_blocks * sizeof (size_t));
+  index->uncompressed_offsets = squash_malloc ((index->n_blocks + 1) * sizeof (uint64_t));
+  if (HEDLEY_UNLIKELY(index->compressed_offsets == NULL || index->compressed_sizes == NULL || index->uncompressed_offsets == NULL)) {
+    squash_seekable_index_destroy (index);
+    return squash_error (SQUASH_MEMORY);
+  }
+
+  /* The blocks are followed by a terminating 0. */
+  if (HEDLEY_UNLIKELY(compressed_size == 0)) {
+    squash_seekable_index_destroy (index);
+    return squash_error (SQUASH_INVALID_BUFFER);
+  }
+  const uint64_t blocks_size = compressed_size - 1;
+
+  uint64_t compressed_offset = 0, uncompressed_offset = 0;
+  size_t i;
+  for (i = 0 ; i < index->n_blocks ; i++) {
+    uint64_t block_compressed_size, block_uncompressed_size;
+
+    l = squash_read_varuint64 (data + pos, index_size - pos, &block_compressed_size);
+    if (HEDLEY_UNLIKELY(l == 0))
+      break;
+    pos += l;
+
+    l = squash_read_varuint64 (data + pos, index_size - pos, &block_uncompressed_size);
+    if (HEDLEY_UNLIKELY(l == 0))
+      break;
+    pos += l;
+
+    if (HEDLEY_UNLIKELY(block_compressed_size == 0 || block_compressed_size > SIZE_MAX ||
+                        block_uncompressed_size == 0 || block_uncompressed_size > block_size))
+      break;
+
+    /* Every block has to fit in front of the index, and none of the
+       offsets may overflow. */
+    const uint64_t header_size = squash_size_varuint64 (block_compressed_size) + squash_size_varuint64 (block_uncompressed_size);
+    if (HEDLEY_UNLIKELY(header_size > blocks_size - compressed_offset))
+      break;
+    compressed_offset += header_size;
+    if (HEDLEY_UNLIKELY(block_compressed_size > blocks_size - compressed_offset))
+      break;
+    if (HEDLEY_UNLIKELY(block_uncompressed_size > UINT64_MAX - uncompressed_offset))
+      break;
+
+    index->compressed_offsets[i] = compressed_offset;
+    index->compressed_sizes[i] = (size_t) block_compressed_size;
+    index->uncompressed_offsets[i] = uncompressed_offset;
+
+    compressed_offset += block_compressed_size;
+    uncompressed_offset += block_uncompressed_size;
+  }
+
+  if (HEDLEY_UNLIKELY(i != index->n_blocks || pos != index_size)) {
+    squash_seekable_index_destroy (index);
+    return squash_error (SQUASH_INVALID_BUFFER);
+  }
+
+  index->uncompressed_offsets[index->n_blocks] = uncompressed_offset;
+  index->data_size = compressed_offset + 1;
+
+  return SQUASH_OK;
+}
+
+/**
+ * @brief Release the memory used by an index
+ * @private
+ *
+ * @param index The index
+ */
+void
+squash_seekable_index_destroy (SquashSeekableIndex* index) {
+  assert (index != NULL);
+
+  squash_free (index->compressed_offsets);
+  squash_free (index->compressed_sizes);
+  squash_free (index->uncompressed_offsets);
+
+  index->n_blocks = 0;
+  index->compressed_offsets = NULL;
+  index->compressed_sizes = NULL;
+  index->uncompressed_offsets = NULL;
+}
+
+/**
+ * @brief Find the block containing an uncompressed offset
+ * @private
+ *
+ * @param index The index
+ * @param offset Offset in the uncompressed data
+ * @return Index of the block, or the number of blocks if @a offset is
+ *   past the end of the data
+ */
+size_t
+squash_seekable_index_find (SquashSeekableIndex* index, uint64_t offset) {
+  assert (index != NULL);
+
+  if (offset >= index->uncompressed_offsets[index->n_blocks])
+    return index->n_blocks;
+
+  size_t lo = 0, hi = index->n_blocks - 1;
+  while (lo < hi) {
+    const size_t mid = lo + ((hi - lo + 1) / 2);
+    if (index->uncompressed_offsets[mid] <= offset)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  return lo;
+}
+
+static size_t
+squash_seekable_get_uncompressed_size (SquashCodec* codec,
+                                       size_t compressed_size,
+                                       const uint8_t compressed[HEDLEY_ARRAY_PARAM(compressed_size)]) {
+  SquashSeekableIndex index;
+  size_t index_size;
+
+  if (HEDLEY_UNLIKELY(compressed_size < SQUASH_SEEKABLE_FOOTER_SIZE))
+    return 0;
+  if (HEDLEY_UNLIKELY(squash_seekable_read_footer (compressed + (compressed_size - SQUASH_SEEKABLE_FOOTER_SIZE), &index_size) != SQUASH_OK))
+    return 0;
+  if (HEDLEY_UNLIKELY(index_size > compressed_size - SQUASH_SEEKABLE_FOOTER_SIZE))
+    return 0;
+  if (HEDLEY_UNLIKELY(squash_seekable_index_init (&index, squash_codec_get_block_size (codec), compressed_size - SQUASH_SEEKABLE_FOOTER_SIZE - index_size, index_size, compressed + (compressed_size - SQUASH_SEEKABLE_FOOTER_SIZE - index_size)) != SQUASH_OK))
+    return 0;
+
+  const uint64_t uncompressed_size = index.uncompressed_offsets[index.n_blocks];
+  squash_seekable_index_destroy (&index);
+
+#if SIZE_MAX < UINT64_MAX
+  if (HEDLEY_UNLIKELY(SIZE_MAX < uncompressed_size))
+    return 0;
+#endif
+
+  return (size_t) uncompressed_size;
+}
+
+static void
+squash_seekable_stream_reset_state (SquashSeekableStream* stream) {
+  if (stream->input != NULL)
+    stream->input->size = 0;
+  if (stream->output != NULL)
+    stream->output->size = 0;
+  if (stream->index != NULL)
+    stream->index->size = 0;
+
+  stream->output_pos = 0;
+  stream->n_blocks = 0;
+  stream->state = SQUASH_SEEKABLE_STATE_BLOCK_COMPRESSED_SIZE;
+  stream->pending_size = 0;
+  stream->block_compressed_size = 0;
+  stream->block_uncompressed_size = 0;
+  stream->remaining = 0;
+}
+
+static void
+squash_seekable_stream_destroy (void* stream) {
+  SquashSeekableStream* s = (SquashSeekableStream*) stream;
+
+  squash_buffer_free (s->input);
+  squash_buffer_free (s->output);
+  squash_buffer_free (s->index);
+
+  squash_stream_destroy (stream);
+}
+
+static SquashStream*
+squash_seekable_create_stream (SquashCodec* codec, SquashStreamType stream_type, SquashOptions* options) {
+  SquashSeekableStream* stream = squash_malloc (sizeof (SquashSeekableStream));
+  if (HEDLEY_UNLIKELY(stream == NULL))
+    return NULL;
+
+  squash_stream_init (stream, codec, stream_type, options, squash_seekable_stream_destroy);
+
+  stream->block_size = squash_seekable_block_size (squash_seekable_inner (codec));
+  stream->input = squash_buffer_new (0);
+  stream->output = squash_buffer_new (0);
+  stream->index = squash_buffer_new (0);
+  squash_seekable_stream_reset_state (stream);
+
+  if (HEDLEY_UNLIKELY(stream->input == NULL || stream->output == NULL || stream->index == NULL))
+    return squash_object_unref (stream);
+
+  return (SquashStream*) stream;
+}
+
+static SquashStatus
+squash_seekable_reset_stream (SquashStream* stream) {
+  squash_seekable_stream_reset_state ((SquashSeekableStream*) stream);
+
+  return SQUASH_OK;
+}
+
+/* Copy pending output to next_out; returns true once all of it has
+   been written. */
+static bool
+squash_seekable_stream_drain (SquashSeekableStream* stream) {
+  SquashStream* s = (SquashStream*) stream;
+
+  const size_t cp_size = MIN(stream->output->size - stream->output_pos, s->avail_out);
+  if (cp_size != 0) {
+    memcpy (s->next_out, stream->output->data + stream->output_pos, cp_size);
+    s->next_out += cp_size;
+    s->avail_out -= cp_size;
+    stream->output_pos += cp_size;
+  }
+
+  if (stream->output_pos != stream->output->size)
+    return false;
+
+  stream->output->size = 0;
+  stream->output_pos = 0;
+  return true;
+}
+
+static SquashStatus
+squash_seekable_stream_compress_block (SquashSeekableStream* stream, size_t size, const uint8_t data[HEDLEY_ARRAY_PARAM(size)]) {
+  SquashStream* s = (SquashStream*) stream;
+  SquashCodec* inner = squash_seekable_inner (s->codec);
+
+  assert (stream->output->size == 0);
+
+  /* Compress after room for the largest possible header, then move
+     the data down once we know how large the header actually is. */
+  size_t compressed_size = squash_codec_get_max_compressed_size (inner, size);
+  if (HEDLEY_UNLIKELY(!squash_buffer_set_size (stream->output, SQUASH_SEEKABLE_BLOCK_HEADER_MAX + compressed_size)))
+    return squash_error (SQUASH_MEMORY);
+
+  SquashStatus res =
+    squash_codec_compress_with_options (inner,
+                                        &compressed_size, stream->output->data + SQUASH_SEEKABLE_BLOCK_HEADER_MAX,
+                                        size, data,
+                                        s->options);
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK)) {
+    stream->output->size = 0;
+    return res;
+  }
+  if (HEDLEY_UNLIKELY(compressed_size == 0)) {
+    stream->output->size = 0;
+    return squash_error (SQUASH_FAILED);
+  }
+
+  uint8_t header[SQUASH_SEEKABLE_BLOCK_HEADER_MAX];
+  size_t header_size = 0;
+  header_size += squash_write_varuint64 (header + header_size, sizeof (header) - header_size, compressed_size);
+  header_size += squash_write_varuint64 (header + header_size, sizeof (header) - header_size, size);
+
+  memmove (stream->output->data + header_size, stream->output->data + SQUASH_SEEKABLE_BLOCK_HEADER_MAX, compressed_size);
+  memcpy (stream->output->data, header, header_size);
+  stream->output->size = header_size + compressed_size;
+
+  if (HEDLEY_UNLIKELY(!squash_buffer_append (stream->index, header_size, header)))
+    return squash_error (SQUASH_MEMORY);
+  stream->n_blocks++;
+
+  return SQUASH_OK;
+}
+
+static SquashStatus
+squash_seekable_stream_compress_pending (SquashSeekableStream* stream) {
+  if (stream->input->size == 0)
+    return SQUASH_OK;
+
+  const SquashStatus res = squash_seekable_stream_compress_block (stream, stream->input->size, stream->input->data);
+  stream->input->size = 0;
+  return res;
+}
+
+static SquashStatus
+squash_seekable_stream_write_trailer (SquashSeekableStream* stream) {
+  const size_t index_size = squash_size_varuint64 (stream->n_blocks) + stream->index->size;
+  if (HEDLEY_UNLIKELY(index_size > UINT32_MAX))
+    return squash_error (SQUASH_RANGE);
+
+  const size_t trailer_size = 1 + index_size + SQUASH_SEEKABLE_FOOTER_SIZE;
+  if (HEDLEY_UNLIKELY(!squash_buffer_set_size (stream->output, trailer_size)))
+    return squash_error (SQUASH_MEMORY);
+
+  uint8_t* p = stream->output->data;
+  size_t pos = 0;
+
+  p[pos++] = 0;
+  pos += squash_write_varuint64 (p + pos, trailer_size - pos, stream->n_blocks);
+  memcpy (p + pos, stream->index->data, stream->index->size);
+  pos += stream->index->size;
+
+  p[pos++] = (uint8_t) (index_size      );
+  p[pos++] = (uint8_t) (index_size >>  8);
+  p[pos++] = (uint8_t) (index_size >> 16);
+  p[pos++] = (uint8_t) (index_size >> 24);
+  memcpy (p + pos, squash_seekable_magic, sizeof (squash_seekable_magic));
+  pos += sizeof (squash_seekable_magic);
+
+  assert (pos == trailer_size);
+
+  return SQUASH_OK;
+}
+
+static SquashStatus
+squash_seekable_compress_stream (SquashSeekableStream* stream, SquashOperation operation) {
+  SquashStream* s = (SquashStream*) stream;
+  SquashStatus res;
+
+  if (!squash_seekable_stream_drain (stream))
+    return SQUASH_PROCESSING;
+
+  switch (operation) {
+    case SQUASH_OPERATION_PROCESS:
+      while (s->avail_in != 0) {
+        if (stream->input->size == 0 && s->avail_in >= stream->block_size) {
+          /* Compress directly from the caller's buffer. */
+          res = squash_seekable_stream_compress_block (stream, stream->block_size, s->next_in);
+          s->next_in += stream->block_size;
+          s->avail_in -= stream->block_size;
+        } else {
+          const size_t cp_size = MIN(stream->block_size - stream->input->size, s->avail_in);
+          if (HEDLEY_UNLIKELY(!squash_buffer_append (stream->input, cp_size, s->next_in)))
+            return squash_error (SQUASH_MEMORY);
+          s->next_in += cp_size;
+          s->avail_in -= cp_size;
+
+          if (stream->input->size != stream->block_size)
+            break;
+
+          res = squash_seekable_stream_compress_pending (stream);
+        }
+
+        if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+          return res;
+        if (!squash_seekable_stream_drain (stream))
+          return SQUASH_PROCESSING;
+      }
+      return SQUASH_OK;
+    case SQUASH_OPERATION_FLUSH:
+    case SQUASH_OPERATION_FINISH:
+      res = squash_seekable_stream_compress_pending (stream);
+      if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+        return res;
+      if (!squash_seekable_stream_drain (stream))
+        return SQUASH_PROCESSING;
+
+      if (operation == SQUASH_OPERATION_FINISH && stream->state != SQUASH_SEEKABLE_STATE_FINISHED) {
+        res = squash_seekable_stream_write_trailer (stream);
+        if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+          return res;
+        stream->state = SQUASH_SEEKABLE_STATE_FINISHED;
+
+        if (!squash_seekable_stream_drain (stream))
+          return SQUASH_PROCESSING;
+      }
+      return SQUASH_OK;
+    case SQUASH_OPERATION_TERMINATE:
+      HEDLEY_UNREACHABLE ();
+      break;
+  }
+
+  HEDLEY_UNREACHABLE ();
+}
+
+/* Read a varuint64 a byte at a time, since it may be split across
+   calls.  Returns true once the whole value has been read. */
+static bool
+squash_seekable_stream_read_varuint (SquashSeekableStream* stream, uint64_t* value) {
+  SquashStream* s = (SquashStream*) stream;
+
+  while (s->avail_in != 0) {
+    assert (stream->pending_size < sizeof (stream->pending));
+
+    stream->pending[stream->pending_size++] = *(s->next_in);
+    s->next_in++;
+    s->avail_in--;
+
+    if (squash_read_varuint64 (stream->pending, stream->pending_size, value) != 0) {
+      stream->pending_size = 0;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static SquashStatus
+squash_seekable_stream_decompress_block (SquashSeekableStream* stream, const uint8_t* compressed) {
+  SquashStream* s = (SquashStream*) stream;
+  SquashCodec* inner = squash_seekable_inner (s->codec);
+  const size_t size = (size_t) stream->block_uncompressed_size;
+
+  /* Decompress directly to the caller's buffer if it's large enough. */
+  const bool direct = (s->avail_out >= size);
+  uint8_t* decompressed;
+  if (direct) {
+    decompressed = s->next_out;
+  } else {
+    if (HEDLEY_UNLIKELY(!squash_buffer_set_size (stream->output, size)))
+      return squash_error (SQUASH_MEMORY);
+    decompressed = stream->output->data;
+  }
+
+  size_t decompressed_size = size;
+  SquashStatus res =
+    squash_codec_decompress_with_options (inner,
+                                          &decompressed_size, decompressed,
+                                          (size_t) stream->block_compressed_size, compressed,
+                                          s->options);
+  if (HEDLEY_LIKELY(res == SQUASH_OK) && HEDLEY_UNLIKELY(decompressed_size != size))
+    res = squash_error (SQUASH_INVALID_BUFFER);
+
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK)) {
+    stream->output->size = 0;
+    return res;
+  }
+
+  if (direct) {
+    s->next_out += size;
+    s->avail_out -= size;
+  }
+
+  return SQUASH_OK;
+}
+
+static SquashStatus
+squash_seekable_decompress_stream (SquashSeekableStream* stream, SquashOperation operation) {
+  SquashStream* s = (SquashStream*) stream;
+  SquashStatus res;
+  uint64_t v;
+
+  for (;;) {
+    if (!squash_seekable_stream_drain (stream))
+      return SQUASH_PROCESSING;
+
+    switch (stream->state) {
+      case SQUASH_SEEKABLE_STATE_BLOCK_COMPRESSED_SIZE:
+        if (!squash_seekable_stream_read_varuint (stream, &v))
+          goto need_input;
+
+        if (v == 0) {
+          stream->state = SQUASH_SEEKABLE_STATE_INDEX_COUNT;
+        } else {
+          if (HEDLEY_UNLIKELY(v > SIZE_MAX))
+            return squash_error (SQUASH_RANGE);
+          stream->block_compressed_size = v;
+          stream->state = SQUASH_SEEKABLE_STATE_BLOCK_UNCOMPRESSED_SIZE;
+        }
+        break;
+      case SQUASH_SEEKABLE_STATE_BLOCK_UNCOMPRESSED_SIZE:
+        if (!squash_seekable_stream_read_varuint (stream, &v))
+          goto need_input;
+
+        /* The encoder never writes a block larger than block_size, so
+           don't let corrupt data make us allocate more than that. */
+        if (HEDLEY_UNLIKELY(v == 0 || v > stream->block_size))
+          return squash_error (SQUASH_INVALID_BUFFER);
+        if (HEDLEY_UNLIKELY(stream->block_compressed_size > squash_codec_get_max_compressed_size (squash_seekable_inner (s->codec), (size_t) v)))
+          return squash_error (SQUASH_INVALID_BUFFER);
+        stream->block_uncompressed_size = v;
+        stream->state = SQUASH_SEEKABLE_STATE_BLOCK_DATA;
+        break;
+      case SQUASH_SEEKABLE_STATE_BLOCK_DATA: {
+        const size_t compressed_size = (size_t) stream->block_compressed_size;
+
+        if (stream->input->size == 0 && s->avail_in >= compressed_size) {
+          /* The whole block is available; no need to copy it. */
+          res = squash_seekable_stream_decompress_block (stream, s->next_in);
+          s->next_in += compressed_size;
+          s->avail_in -= compressed_size;
+        } else {
+          const size_t cp_size = MIN(compressed_size - stream->input->size, s->avail_in);
+          if (HEDLEY_UNLIKELY(!squash_buffer_append (stream->input, cp_size, s->next_in)))
+            return squash_error (SQUASH_MEMORY);
+          s->next_in += cp_size;
+          s->avail_in -= cp_size;
+
+          if (stream->input->size != compressed_size)
+            goto need_input;
+
+          res = squash_seekable_stream_decompress_block (stream, stream->input->data);
+          stream->input->size = 0;
+        }
+
+        if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+          return res;
+        stream->state = SQUASH_SEEKABLE_STATE_BLOCK_COMPRESSED_SIZE;
+      }
+        break;
+      case SQUASH_SEEKABLE_STATE_INDEX_COUNT:
+        if (!squash_seekable_stream_read_varuint (stream, &v))
+          goto need_input;
+
+        if (HEDLEY_UNLIKELY(v > (UINT64_MAX / 2)))
+          return squash_error (SQUASH_INVALID_BUFFER);
+        stream->remaining = v * 2;
+        stream->state = SQUASH_SEEKABLE_STATE_INDEX;
+        break;
+      case SQUASH_SEEKABLE_STATE_INDEX:
+        /* The index is only needed for random access. */
+        if (stream->remaining == 0) {
+          stream->state = SQUASH_SEEKABLE_STATE_FOOTER;
+          break;
+        }
+
+        if (!squash_seekable_stream_read_varuint (stream, &v))
+          goto need_input;
+        stream->remaining--;
+        break;
+      case SQUASH_SEEKABLE_STATE_FOOTER:
+        while (stream->pending_size < SQUASH_SEEKABLE_FOOTER_SIZE) {
+          if (s->avail_in == 0)
+            goto need_input;
+
+          stream->pending[stream->pending_size++] = *(s->next_in);
+          s->next_in++;
+          s->avail_in--;
+        }
+
+        if (HEDLEY_UNLIKELY(memcmp (stream->pending + 4, squash_seekable_magic, sizeof (squash_seekable_magic)) != 0))
+          return squash_error (SQUASH_INVALID_BUFFER);
+
+        stream->pending_size = 0;
+        stream->state = SQUASH_SEEKABLE_STATE_FINISHED;
+        break;
+      case SQUASH_SEEKABLE_STATE_FINISHED:
+        return SQUASH_END_OF_STREAM;
+    }
+  }
+
+ need_input:
+
+  assert (s->avail_in == 0);
+
+  if (operation == SQUASH_OPERATION_FINISH)
+    return squash_error (SQUASH_BUFFER_EMPTY);
+
+  return SQUASH_OK;
+}
+
+static SquashStatus
+squash_seekable_process_stream (SquashStream* stream, SquashOperation operation) {
+  if (stream->stream_type == SQUASH_STREAM_COMPRESS)
+    return squash_seekable_compress_stream ((SquashSeekableStream*) stream, operation);
+  else
+    return squash_seekable_decompress_stream ((SquashSeekableStream*) stream, operation);
+}
+
+/**
+ * @brief Get the seekable version of a codec
+ * @private
+ *
+ * Seekable codecs are created on demand, and (like regular codecs)
+ * live for the lifetime of the process.  They are normally accessed
+ * by prefixing the name of a codec with "seekable:", e.g.,
+ * "seekable:zstd".
+ *
+ * @param codec The codec to wrap
+ * @return The seekable codec, or *NULL* on failure
+ */
+SquashCodec*
+squash_codec_get_seekable (SquashCodec* codec) {
+  SquashCodecImpl impl = { 0, };
+
+  assert (codec != NULL);
+
+  impl.info = SQUASH_CODEC_INFO_CAN_FLUSH | SQUASH_CODEC_INFO_KNOWS_UNCOMPRESSED_SIZE;
+  impl.create_stream = squash_seekable_create_stream;
+  impl.process_stream = squash_seekable_process_stream;
+  impl.reset_stream = squash_seekable_reset_stream;
+  impl.get_max_compressed_size = squash_seekable_get_max_compressed_size;
+  impl.get_uncompressed_size = squash_seekable_get_uncompressed_size;
+
+  return squash_codec_get_wrapper (codec, "seekable", &impl, squash_seekable_block_size (codec));
+}
+
+/**
+ * @brief Get the codec wrapped by a seekable codec
+ * @private
+ *
+ * @param codec A codec
+ * @return The codec wrapped by @a codec, or *NULL* if @a codec is not
+ *   a seekable codec
+ */
+SquashCodec*
+squash_codec_get_seekable_inner (SquashCodec* codec) {
+  assert (codec != NULL);
+
+  if (codec->impl.create_stream != squash_seekable_create_stream)
+    return NULL;
+
+  return squash_seekable_inner (codec);
+}
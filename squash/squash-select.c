@@ -0,0 +1,486 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <float.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#  include <windows.h>
+#endif
+
+#include "tinycthread/source/tinycthread.h"
+
+/* Samples up to SQUASH_SELECT_SLICES * SQUASH_SELECT_SLICE_SIZE bytes
+   are used in full; larger ones are cut down to that many evenly
+   spaced slices. */
+#define SQUASH_SELECT_SLICE_SIZE ((size_t) (16 * 1024))
+#define SQUASH_SELECT_SLICES 4
+
+/* Each candidate is timed for at least this long (or until it has
+   compressed the slices SQUASH_SELECT_MAX_REPEATS times) so that
+   fast codecs aren't lost in the clock's resolution. */
+#define SQUASH_SELECT_MIN_TIME 0.002
+#define SQUASH_SELECT_MAX_REPEATS 16
+
+#define SQUASH_SELECT_MAX_LEVELS 3
+#define SQUASH_SELECT_CACHE_SIZE 32
+
+/**
+ * @enum SquashSelectTarget
+ * @brief What ::squash_select_codec should optimize for
+ */
+
+/**
+ * @var SquashSelectTarget::SQUASH_SELECT_TARGET_SPEED
+ * @brief Pick the best ratio among codecs which compress at least
+ *   this many megabytes (10^6 bytes) of input per second.
+ */
+
+/**
+ * @var SquashSelectTarget::SQUASH_SELECT_TARGET_RATIO
+ * @brief Pick the fastest codec which achieves at least this
+ *   compression ratio (uncompressed size / compressed size).
+ */
+
+typedef struct SquashSelectSlices_ {
+  size_t n_slices;
+  size_t slice_size;
+  size_t offsets[SQUASH_SELECT_SLICES];
+} SquashSelectSlices;
+
+typedef struct SquashSelectCandidate_ {
+  SquashCodec* codec;
+  bool has_level;
+  int level;
+  double speed;
+  double ratio;
+} SquashSelectCandidate;
+
+typedef struct SquashSelectCacheEntry_ {
+  uint64_t fingerprint;
+  SquashSelectTarget target;
+  double value;
+  SquashCodec* codec;
+  bool has_level;
+  int level;
+} SquashSelectCacheEntry;
+
+typedef struct SquashSelectData_ {
+  SquashSelectTarget target;
+  double value;
+  const uint8_t* sample;
+  const SquashSelectSlices* slices;
+  uint8_t* scratch;
+  size_t scratch_size;
+  uint8_t* decompressed;
+  SquashSelectCandidate best;
+} SquashSelectData;
+
+SQUASH_MTX_DEFINE(select_cache)
+static SquashSelectCacheEntry squash_select_cache[SQUASH_SELECT_CACHE_SIZE];
+static size_t squash_select_cache_length = 0;
+static size_t squash_select_cache_next = 0;
+
+static void
+squash_select_slices_init (SquashSelectSlices* slices, size_t sample_size) {
+  if (sample_size <= SQUASH_SELECT_SLICES * SQUASH_SELECT_SLICE_SIZE) {
+    slices->n_slices = 1;
+    slices->slice_size = sample_size;
+    slices->offsets[0] = 0;
+  } else {
+    slices->n_slices = SQUASH_SELECT_SLICES;
+    slices->slice_size = SQUASH_SELECT_SLICE_SIZE;
+    for (size_t i = 0 ; i < SQUASH_SELECT_SLICES ; i++)
+      slices->offsets[i] = i * ((sample_size - SQUASH_SELECT_SLICE_SIZE) / (SQUASH_SELECT_SLICES - 1));
+  }
+}
+
+/* The fingerprint is deliberately coarse so that samples of the same
+   kind of data share a cache entry: the size class, the estimated
+   compressibility and the four most common byte values. */
+static uint64_t
+squash_select_fingerprint (size_t sample_size,
+                           const uint8_t sample[HEDLEY_ARRAY_PARAM(sample_size)],
+                           const SquashSelectSlices* slices) {
+  uint32_t histogram[256] = { 0, };
+  for (size_t i = 0 ; i < slices->n_slices ; i++) {
+    const uint8_t* slice = sample + slices->offsets[i];
+    for (size_t j = 0 ; j < slices->slice_size ; j++)
+      histogram[slice[j]]++;
+  }
+
+  uint64_t fingerprint = 0;
+  for (unsigned int rank = 0 ; rank < 4 ; rank++) {
+    unsigned int top = 0;
+    for (unsigned int b = 1 ; b < 256 ; b++)
+      if (histogram[b] > histogram[top])
+        top = b;
+    histogram[top] = 0;
+    fingerprint = (fingerprint << 8) | top;
+  }
+
+  const double estimate = squash_probe_compressibility (sample_size, sample);
+  fingerprint = (fingerprint << 8) | (uint64_t) (estimate * 32.0);
+
+  unsigned int size_class = 0;
+  for (size_t s = sample_size ; s != 0 ; s >>= 1)
+    size_class++;
+  fingerprint = (fingerprint << 8) | size_class;
+
+  return fingerprint;
+}
+
+/* Seconds since some arbitrary point.  Where possible this comes from
+   a monotonic clock, so the wall clock being adjusted during a trial
+   can't make a codec look faster or slower than it is. */
+static double
+squash_select_now (void) {
+#if defined(_WIN32)
+  LARGE_INTEGER frequency, counter;
+  if (HEDLEY_UNLIKELY(!QueryPerformanceFrequency (&frequency) || !QueryPerformanceCounter (&counter)))
+    return 0.0;
+  return (double) counter.QuadPart / (double) frequency.QuadPart;
+#elif defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  if (HEDLEY_UNLIKELY(clock_gettime (CLOCK_MONOTONIC, &ts) != 0))
+    return 0.0;
+  return (double) ts.tv_sec + ((double) ts.tv_nsec / 1000000000.0);
+#else
+  struct timespec ts;
+  if (HEDLEY_UNLIKELY(timespec_get (&ts, TIME_UTC) == 0))
+    return 0.0;
+  return (double) ts.tv_sec + ((double) ts.tv_nsec / 1000000000.0);
+#endif
+}
+
+static SquashOptions*
+squash_select_options_new (SquashCodec* codec, bool has_level, int level) {
+  SquashOptions* options = squash_options_new (codec, NULL);
+  if (options != NULL && has_level) {
+    if (HEDLEY_UNLIKELY(squash_options_set_int (options, "level", level) != SQUASH_OK)) {
+      squash_object_unref (options);
+      return NULL;
+    }
+  }
+  return options;
+}
+
+/* Fill in the candidate's speed and ratio.  Returns false if the
+   codec can't compress the sample with these options, or can't
+   decompress the result back to the original. */
+static bool
+squash_select_trial (SquashSelectData* data, SquashSelectCandidate* candidate) {
+  const SquashSelectSlices* slices = data->slices;
+
+  SquashOptions* options = NULL;
+  if (candidate->has_level) {
+    options = squash_select_options_new (candidate->codec, true, candidate->level);
+    if (HEDLEY_UNLIKELY(options == NULL))
+      return false;
+    squash_object_ref (options);
+  }
+
+  const size_t max_compressed_size = squash_codec_get_max_compressed_size (candidate->codec, slices->slice_size);
+  if (max_compressed_size > data->scratch_size) {
+    uint8_t* scratch = squash_realloc (data->scratch, max_compressed_size);
+    if (HEDLEY_UNLIKELY(scratch == NULL)) {
+      squash_object_unref (options);
+      return false;
+    }
+    data->scratch = scratch;
+    data->scratch_size = max_compressed_size;
+  }
+
+  /* Make sure each slice survives a round trip before timing
+     anything; this also warms up the codec for the timed runs. */
+  bool ok = true;
+  size_t total_compressed = 0;
+  for (size_t i = 0 ; ok && i < slices->n_slices ; i++) {
+    const uint8_t* slice = data->sample + slices->offsets[i];
+    size_t compressed_size = data->scratch_size;
+    size_t decompressed_size = slices->slice_size;
+
+    ok =
+      squash_codec_compress_with_options (candidate->codec,
+                                          &compressed_size, data->scratch,
+                                          slices->slice_size, slice,
+                                          options) == SQUASH_OK &&
+      squash_codec_decompress_with_options (candidate->codec,
+                                            &decompressed_size, data->decompressed,
+                                            compressed_size, data->scratch,
+                                            options) == SQUASH_OK &&
+      decompressed_size == slices->slice_size &&
+      memcmp (data->decompressed, slice, decompressed_size) == 0;
+
+    total_compressed += compressed_size;
+  }
+
+  unsigned int repeats = 0;
+  double elapsed = 0.0;
+  const double start = squash_select_now ();
+  while (ok && elapsed < SQUASH_SELECT_MIN_TIME && repeats < SQUASH_SELECT_MAX_REPEATS) {
+    for (size_t i = 0 ; ok && i < slices->n_slices ; i++) {
+      size_t compressed_size = data->scratch_size;
+      ok = squash_codec_compress_with_options (candidate->codec,
+                                               &compressed_size, data->scratch,
+                                               slices->slice_size, data->sample + slices->offsets[i],
+                                               options) == SQUASH_OK;
+    }
+    repeats++;
+    elapsed = squash_select_now () - start;
+  }
+
+  squash_object_unref (options);
+
+  if (HEDLEY_UNLIKELY(!ok || total_compressed == 0))
+    return false;
+
+  const double total_uncompressed = (double) (slices->n_slices * slices->slice_size);
+  candidate->ratio = total_uncompressed / (double) total_compressed;
+  /* A clock which doesn't advance means the codec is faster than we
+     can measure, which meets any speed target. */
+  candidate->speed = (elapsed > 0.0) ?
+    ((total_uncompressed * repeats) / elapsed) / 1000000.0 :
+    DBL_MAX;
+
+  return true;
+}
+
+static bool
+squash_select_meets_target (const SquashSelectCandidate* candidate, SquashSelectTarget target, double value) {
+  return (target == SQUASH_SELECT_TARGET_SPEED) ?
+    (candidate->speed >= value) :
+    (candidate->ratio >= value);
+}
+
+/* Is a better than b?  Candidates which meet the target beat those
+   which don't; among those which do, the secondary measure decides,
+   and among those which don't, whoever came closest. */
+static bool
+squash_select_is_better (const SquashSelectCandidate* a, const SquashSelectCandidate* b, SquashSelectTarget target, double value) {
+  if (b->codec == NULL)
+    return true;
+
+  const bool a_meets = squash_select_meets_target (a, target, value);
+  const bool b_meets = squash_select_meets_target (b, target, value);
+  if (a_meets != b_meets)
+    return a_meets;
+
+  const bool by_speed = (target == SQUASH_SELECT_TARGET_SPEED) != a_meets;
+  if (by_speed)
+    return (a->speed != b->speed) ? (a->speed > b->speed) : (a->ratio > b->ratio);
+  else
+    return (a->ratio != b->ratio) ? (a->ratio > b->ratio) : (a->speed > b->speed);
+}
+
+/* Pick up to SQUASH_SELECT_MAX_LEVELS levels to try, in ascending
+   order: the lowest, the default and the highest. */
+static size_t
+squash_select_get_levels (SquashCodec* codec, int levels[SQUASH_SELECT_MAX_LEVELS]) {
+  const SquashOptionInfo* info = squash_codec_get_option_info (codec);
+  if (info == NULL)
+    return 0;
+
+  for (; info->name != NULL ; info++) {
+    if (strcmp (info->name, "level") != 0)
+      continue;
+
+    int min, max;
+    switch ((int) info->type) {
+      case SQUASH_OPTION_TYPE_RANGE_INT:
+        min = info->info.range_int.min;
+        max = info->info.range_int.max;
+        break;
+      case SQUASH_OPTION_TYPE_ENUM_INT:
+        if (info->info.enum_int.values_length == 0)
+          return 0;
+        min = info->info.enum_int.values[0];
+        max = info->info.enum_int.values[info->info.enum_int.values_length - 1];
+        break;
+      default:
+        return 0;
+    }
+
+    size_t n_levels = 0;
+    levels[n_levels++] = min;
+    if (info->default_value.int_value > min && info->default_value.int_value < max)
+      levels[n_levels++] = info->default_value.int_value;
+    if (max > min)
+      levels[n_levels++] = max;
+    return n_levels;
+  }
+
+  return 0;
+}
+
+static void
+squash_select_try_codec (SquashCodec* codec, void* user_data) {
+  SquashSelectData* data = (SquashSelectData*) user_data;
+
+  if (squash_codec_get_impl (codec) == NULL)
+    return;
+
+  int levels[SQUASH_SELECT_MAX_LEVELS];
+  const size_t n_levels = squash_select_get_levels (codec, levels);
+
+  SquashSelectCandidate candidate = { codec, false, 0, 0.0, 0.0 };
+  if (n_levels == 0) {
+    if (squash_select_trial (data, &candidate) &&
+        squash_select_is_better (&candidate, &(data->best), data->target, data->value))
+      data->best = candidate;
+    return;
+  }
+
+  candidate.has_level = true;
+  for (size_t i = 0 ; i < n_levels ; i++) {
+    candidate.level = levels[i];
+    if (!squash_select_trial (data, &candidate))
+      continue;
+
+    if (squash_select_is_better (&candidate, &(data->best), data->target, data->value))
+      data->best = candidate;
+
+    /* Higher levels are slower, so once one level misses a speed
+       target the rest will too. */
+    if (data->target == SQUASH_SELECT_TARGET_SPEED && candidate.speed < data->value)
+      break;
+  }
+}
+
+static bool
+squash_select_cache_lookup (uint64_t fingerprint, SquashSelectTarget target, double value, SquashSelectCandidate* result) {
+  bool found = false;
+
+  SQUASH_MTX_LOCK(select_cache);
+  for (size_t i = 0 ; i < squash_select_cache_length ; i++) {
+    const SquashSelectCacheEntry* entry = &(squash_select_cache[i]);
+    if (entry->fingerprint == fingerprint && entry->target == target && entry->value == value) {
+      result->codec = entry->codec;
+      result->has_level = entry->has_level;
+      result->level = entry->level;
+      found = true;
+      break;
+    }
+  }
+  SQUASH_MTX_UNLOCK(select_cache);
+
+  return found;
+}
+
+static void
+squash_select_cache_insert (uint64_t fingerprint, SquashSelectTarget target, double value, const SquashSelectCandidate* result) {
+  SQUASH_MTX_LOCK(select_cache);
+  SquashSelectCacheEntry* entry = &(squash_select_cache[squash_select_cache_next]);
+  entry->fingerprint = fingerprint;
+  entry->target = target;
+  entry->value = value;
+  entry->codec = result->codec;
+  entry->has_level = result->has_level;
+  entry->level = result->level;
+  squash_select_cache_next = (squash_select_cache_next + 1) % SQUASH_SELECT_CACHE_SIZE;
+  if (squash_select_cache_length < SQUASH_SELECT_CACHE_SIZE)
+    squash_select_cache_length++;
+  SQUASH_MTX_UNLOCK(select_cache);
+}
+
+/**
+ * @brief Choose a codec and options for a kind of data
+ *
+ * Trial-compresses slices of @a sample with every installed codec (at
+ * its lowest, default and highest level, if it has one) and returns
+ * the one which best meets the target.  If none of them meet it, the
+ * one which comes closest is returned.  Codecs which can't decompress
+ * what they compressed back to the original are never chosen.
+ *
+ * This is expensive, so results are cached.  The cache is keyed on a
+ * coarse fingerprint of the sample (its size class, estimated
+ * compressibility and most common bytes) rather than its exact
+ * contents, so other samples of the same kind of data will usually
+ * get the cached result.
+ *
+ * @param sample_size Size of the sample, in bytes
+ * @param sample Data representative of what will be compressed
+ * @param target What to optimize for
+ * @param value Minimum speed (in MB/s) or ratio, depending on @a target
+ * @param options Location to store the options for the returned
+ *   codec (a floating reference, possibly *NULL*), or *NULL*
+ * @return The selected codec, or *NULL* on failure
+ */
+SquashCodec*
+squash_select_codec (size_t sample_size,
+                     const uint8_t sample[HEDLEY_ARRAY_PARAM(sample_size)],
+                     SquashSelectTarget target,
+                     double value,
+                     SquashOptions** options) {
+  assert (sample != NULL);
+
+  if (options != NULL)
+    *options = NULL;
+
+  if (HEDLEY_UNLIKELY(sample_size == 0))
+    return (squash_error (SQUASH_BAD_VALUE), NULL);
+  if (HEDLEY_UNLIKELY(target != SQUASH_SELECT_TARGET_SPEED && target != SQUASH_SELECT_TARGET_RATIO))
+    return (squash_error (SQUASH_BAD_PARAM), NULL);
+
+  SquashSelectSlices slices;
+  squash_select_slices_init (&slices, sample_size);
+  const uint64_t fingerprint = squash_select_fingerprint (sample_size, sample, &slices);
+
+  SquashSelectCandidate result = { NULL, false, 0, 0.0, 0.0 };
+  if (!squash_select_cache_lookup (fingerprint, target, value, &result)) {
+    SquashSelectData data = { target, value, sample, &slices, NULL, 0, NULL, { NULL, false, 0, 0.0, 0.0 } };
+    data.decompressed = squash_malloc (slices.slice_size);
+    if (HEDLEY_UNLIKELY(data.decompressed == NULL))
+      return (squash_error (SQUASH_MEMORY), NULL);
+
+    squash_foreach_codec (squash_select_try_codec, &data);
+    squash_free (data.scratch);
+    squash_free (data.decompressed);
+
+    if (HEDLEY_UNLIKELY(data.best.codec == NULL))
+      return (squash_error (SQUASH_UNABLE_TO_LOAD), NULL);
+
+    result = data.best;
+    squash_select_cache_insert (fingerprint, target, value, &result);
+  }
+
+  if (options != NULL) {
+    *options = squash_select_options_new (result.codec, result.has_level, result.level);
+    if (HEDLEY_UNLIKELY(*options == NULL && result.has_level))
+      return (squash_error (SQUASH_FAILED), NULL);
+  }
+
+  return result.codec;
+}
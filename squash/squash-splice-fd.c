@@ -0,0 +1,387 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#if defined(__linux__)
+#  include <fcntl.h>
+#  include <sys/sendfile.h>
+#  include <sys/syscall.h>
+#endif
+
+/* Splicing between file descriptors.
+ *
+ * When the codec doesn't change the data (SQUASH_CODEC_INFO_PASSTHROUGH)
+ * there is no reason for it to pass through user space at all, so we
+ * ask the kernel to move it: copy_file_range between regular files,
+ * splice if either end is a pipe, or sendfile from a regular file to
+ * anything else.  If the kernel refuses (old kernels, file systems or
+ * descriptor types which aren't supported, etc.) we move on to the next
+ * method, with plain read/write as the last resort.  Since every
+ * method uses (and updates) the descriptors' own offsets, switching
+ * part way through is harmless.
+ *
+ * Everything else uses the custom splice API with read/write
+ * callbacks, which at least avoids the extra copy through stdio's
+ * buffers. */
+
+/* Linux won't move more than this in a single call anyway. */
+#define SQUASH_SPLICE_FD_MAX_TRANSFER ((size_t) 0x7ffff000)
+
+typedef enum {
+  SQUASH_SPLICE_FD_COPY_FILE_RANGE,
+  SQUASH_SPLICE_FD_SPLICE,
+  SQUASH_SPLICE_FD_SENDFILE,
+  SQUASH_SPLICE_FD_READ_WRITE
+} SquashSpliceFdMethod;
+
+static bool
+squash_splice_fd_method_usable (SquashSpliceFdMethod method, const struct stat* st_out, const struct stat* st_in) {
+  switch (method) {
+#if defined(__linux__)
+#if defined(SYS_copy_file_range)
+    case SQUASH_SPLICE_FD_COPY_FILE_RANGE:
+      return S_ISREG(st_in->st_mode) && S_ISREG(st_out->st_mode);
+#endif
+    case SQUASH_SPLICE_FD_SPLICE:
+      return S_ISFIFO(st_in->st_mode) || S_ISFIFO(st_out->st_mode);
+    case SQUASH_SPLICE_FD_SENDFILE:
+      return S_ISREG(st_in->st_mode);
+#endif
+    case SQUASH_SPLICE_FD_READ_WRITE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static SquashSpliceFdMethod
+squash_splice_fd_next_method (SquashSpliceFdMethod method, const struct stat* st_out, const struct stat* st_in) {
+  while (!squash_splice_fd_method_usable (method, st_out, st_in))
+    method = (SquashSpliceFdMethod) (method + 1);
+
+  return method;
+}
+
+/* Whether an error from a zero-copy method just means "not here". */
+static bool
+squash_splice_fd_unsupported (int err) {
+  switch (err) {
+    case EINVAL:
+    case ENOSYS:
+    case EXDEV:
+    case EBADF:
+#if defined(EOPNOTSUPP)
+    case EOPNOTSUPP:
+#endif
+#if defined(ENOTSUP) && (!defined(EOPNOTSUPP) || ENOTSUP != EOPNOTSUPP)
+    case ENOTSUP:
+#endif
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool
+squash_splice_fd_write_all (int fd, const uint8_t* data, size_t size) {
+  while (size != 0) {
+    const ssize_t written = write (fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+
+    data += written;
+    size -= (size_t) written;
+  }
+
+  return true;
+}
+
+static ssize_t
+squash_splice_fd_read (int fd, uint8_t* data, size_t size) {
+  ssize_t res;
+
+  do {
+    res = read (fd, data, size);
+  } while (res < 0 && errno == EINTR);
+
+  return res;
+}
+
+/* Returns the number of bytes moved, 0 at the end of the input, or -1
+   (with errno set) on failure. */
+static ssize_t
+squash_splice_fd_transfer (SquashSpliceFdMethod method, int fd_out, int fd_in, size_t size) {
+  switch (method) {
+#if defined(__linux__)
+#if defined(SYS_copy_file_range)
+    case SQUASH_SPLICE_FD_COPY_FILE_RANGE:
+      return (ssize_t) syscall (SYS_copy_file_range, fd_in, NULL, fd_out, NULL, size, 0U);
+#endif
+    case SQUASH_SPLICE_FD_SPLICE:
+      return splice (fd_in, NULL, fd_out, NULL, size, SPLICE_F_MOVE);
+    case SQUASH_SPLICE_FD_SENDFILE:
+      return sendfile (fd_out, fd_in, NULL, size);
+#endif
+    case SQUASH_SPLICE_FD_READ_WRITE:
+    default:
+      HEDLEY_UNREACHABLE ();
+      break;
+  }
+
+  errno = ENOSYS;
+  return -1;
+}
+
+static SquashStatus
+squash_splice_fd_passthrough (int fd_out, int fd_in, size_t size) {
+  SquashStatus res = SQUASH_OK;
+  uint8_t* buf = NULL;
+  size_t remaining = size;
+  bool moved = false;
+
+  struct stat st_out, st_in;
+  if (HEDLEY_UNLIKELY(fstat (fd_out, &st_out) != 0 || fstat (fd_in, &st_in) != 0))
+    return squash_error (SQUASH_IO);
+
+  SquashSpliceFdMethod method = squash_splice_fd_next_method (SQUASH_SPLICE_FD_COPY_FILE_RANGE, &st_out, &st_in);
+
+  while (size == 0 || remaining != 0) {
+    const size_t req_size = (size == 0 || remaining > SQUASH_SPLICE_FD_MAX_TRANSFER) ? SQUASH_SPLICE_FD_MAX_TRANSFER : remaining;
+    ssize_t transferred;
+
+    if (method == SQUASH_SPLICE_FD_READ_WRITE) {
+      if (buf == NULL) {
+        buf = squash_malloc (SQUASH_FILE_BUF_SIZE);
+        if (HEDLEY_UNLIKELY(buf == NULL)) {
+          res = squash_error (SQUASH_MEMORY);
+          break;
+        }
+      }
+
+      transferred = squash_splice_fd_read (fd_in, buf, (req_size < SQUASH_FILE_BUF_SIZE) ? req_size : SQUASH_FILE_BUF_SIZE);
+      if (transferred > 0 && HEDLEY_UNLIKELY(!squash_splice_fd_write_all (fd_out, buf, (size_t) transferred))) {
+        res = squash_error (SQUASH_IO);
+        break;
+      }
+    } else {
+      transferred = squash_splice_fd_transfer (method, fd_out, fd_in, req_size);
+
+      /* copy_file_range quietly copies nothing from some special
+         files (procfs, for example), so don't take its word for the
+         end of the input until it has actually copied something. */
+      if (transferred == 0 && method == SQUASH_SPLICE_FD_COPY_FILE_RANGE && !moved) {
+        method = squash_splice_fd_next_method ((SquashSpliceFdMethod) (method + 1), &st_out, &st_in);
+        continue;
+      }
+    }
+
+    if (transferred < 0) {
+      if (errno == EINTR) {
+        continue;
+      } else if (method != SQUASH_SPLICE_FD_READ_WRITE && squash_splice_fd_unsupported (errno)) {
+        method = squash_splice_fd_next_method ((SquashSpliceFdMethod) (method + 1), &st_out, &st_in);
+        continue;
+      }
+
+      res = squash_error (SQUASH_IO);
+      break;
+    } else if (transferred == 0) {
+      break;
+    }
+
+    moved = true;
+    if (size != 0) {
+      assert ((size_t) transferred <= remaining);
+      remaining -= (size_t) transferred;
+    }
+  }
+
+  squash_free (buf);
+
+  return res;
+}
+
+struct SquashSpliceFdData {
+  int fd_in;
+  int fd_out;
+  size_t size;
+  size_t pos;
+  SquashStreamType stream_type;
+};
+
+static SquashStatus
+squash_splice_fd_read_cb (size_t* data_size,
+                          uint8_t data[HEDLEY_ARRAY_PARAM(*data_size)],
+                          void* user_data) {
+  struct SquashSpliceFdData* ctx = (struct SquashSpliceFdData*) user_data;
+
+  size_t requested;
+
+  if (ctx->stream_type == SQUASH_STREAM_COMPRESS && ctx->size != 0) {
+    const size_t remaining = ctx->size - ctx->pos;
+
+    if (remaining == 0) {
+      *data_size = 0;
+      return SQUASH_END_OF_STREAM;
+    }
+
+    requested = (*data_size < remaining) ? *data_size : remaining;
+  } else {
+    requested = *data_size;
+    assert (requested != 0);
+  }
+
+  const ssize_t bytes_read = squash_splice_fd_read (ctx->fd_in, data, requested);
+  if (HEDLEY_UNLIKELY(bytes_read < 0)) {
+    *data_size = 0;
+    return squash_error (SQUASH_IO);
+  }
+
+  *data_size = (size_t) bytes_read;
+  ctx->pos += (size_t) bytes_read;
+
+  return (bytes_read == 0) ? SQUASH_END_OF_STREAM : SQUASH_OK;
+}
+
+static SquashStatus
+squash_splice_fd_write_cb (size_t* data_size,
+                           const uint8_t data[HEDLEY_ARRAY_PARAM(*data_size)],
+                           void* user_data) {
+  struct SquashSpliceFdData* ctx = (struct SquashSpliceFdData*) user_data;
+
+  if (HEDLEY_UNLIKELY(!squash_splice_fd_write_all (ctx->fd_out, data, *data_size))) {
+    *data_size = 0;
+    return squash_error (SQUASH_IO);
+  }
+
+  return SQUASH_OK;
+}
+
+/**
+ * @addtogroup Splicing
+ * @{
+ */
+
+/**
+ * @brief compress or decompress the contents of one file descriptor
+ *   to another
+ *
+ * @param codec the codec to use
+ * @param stream_type whether to compress or decompress the data
+ * @param fd_out the output file descriptor
+ * @param fd_in the input file descriptor
+ * @param size number of bytes (uncompressed) to transfer from @a
+ *   fd_in to @a fd_out, or 0 to transfer the entire file
+ * @param ... list of options (with a *NULL* sentinel)
+ * @returns @ref SQUASH_OK on success, or a negative error code on
+ *   failure
+ * @see squash_splice_fd_with_options
+ */
+SquashStatus
+squash_splice_fd (SquashCodec* codec, SquashStreamType stream_type, int fd_out, int fd_in, size_t size, ...) {
+  assert (codec != NULL);
+
+  SquashOptions* options = NULL;
+  va_list ap;
+  va_start (ap, size);
+  options = squash_options_newv (codec, ap);
+  va_end (ap);
+
+  return squash_splice_fd_with_options (codec, stream_type, fd_out, fd_in, size, options);
+}
+
+/**
+ * @brief compress or decompress the contents of one file descriptor
+ *   to another
+ *
+ * This is like @ref squash_splice_with_options, but works directly on
+ * file descriptors instead of going through stdio.  The descriptors
+ * may refer to files, pipes, or sockets, but must be in blocking
+ * mode.
+ *
+ * If @a codec has the @ref SQUASH_CODEC_INFO_PASSTHROUGH flag (such
+ * as the "copy" codec) the data never has to be copied into user
+ * space; where possible Squash will have the kernel move it with
+ * copy_file_range, splice, or sendfile.
+ *
+ * @param codec the codec to use
+ * @param stream_type whether to compress or decompress the data
+ * @param fd_out the output file descriptor
+ * @param fd_in the input file descriptor
+ * @param size number of bytes (uncompressed) to transfer from @a
+ *   fd_in to @a fd_out, or 0 to transfer the entire file
+ * @param options options to pass to the codec
+ * @returns @ref SQUASH_OK on success, or a negative error code on
+ *   failure
+ */
+SquashStatus
+squash_splice_fd_with_options (SquashCodec* codec,
+                               SquashStreamType stream_type,
+                               int fd_out,
+                               int fd_in,
+                               size_t size,
+                               SquashOptions* options) {
+  assert (codec != NULL);
+  assert (stream_type == SQUASH_STREAM_COMPRESS || stream_type == SQUASH_STREAM_DECOMPRESS);
+
+  if (HEDLEY_UNLIKELY(fd_out < 0 || fd_in < 0))
+    return squash_error (SQUASH_BAD_PARAM);
+
+  SquashStatus res;
+
+  squash_options_hold (options);
+
+  if ((squash_codec_get_info (codec) & SQUASH_CODEC_INFO_PASSTHROUGH) != 0) {
+    res = squash_splice_fd_passthrough (fd_out, fd_in, size);
+  } else {
+    struct SquashSpliceFdData data = { fd_in, fd_out, size, 0, stream_type };
+    res = squash_splice_custom_with_options (codec, stream_type, squash_splice_fd_write_cb, squash_splice_fd_read_cb, &data, size, options);
+  }
+
+  squash_options_release (options);
+
+  return res;
+}
+
+/**
+ * @}
+ */
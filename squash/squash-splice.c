@@ -94,6 +94,184 @@ squash_splice (SquashCodec* codec, SquashStreamType stream_type, FILE* fp_out, F
 }
 
 #if !defined(_WIN32)
+/* Compressing a mapped file on several threads.
+ *
+ * For codecs whose output can be concatenated, the input is split
+ * into chunks which are compressed concurrently on the worker pool,
+ * each into its own slot (sized for the worst case) in the output
+ * mapping.  Once every chunk is done the slots are packed down, in
+ * order, and the file is truncated to the final size; since the
+ * output file is sparse until it is written to, the unused parts of
+ * the slots never hit the disk.
+ *
+ * The result is perfectly normal compressed data, but it can only be
+ * decompressed on one thread.  The "parallel:" codecs use the same
+ * approach (see squash-parallel.c) with a framed format which
+ * decompresses in parallel, too. */
+
+typedef struct SquashSpliceMapJob_ {
+  SquashCodec* codec;
+  SquashOptions* options;
+  const uint8_t* input;
+  size_t input_size;
+  size_t chunk_size;
+  uint8_t* output;
+  size_t slot_size;
+  size_t* sizes;
+  SquashStatus* status;
+} SquashSpliceMapJob;
+
+static size_t
+squash_splice_map_chunk_size (SquashCodec* codec, SquashOptions* options) {
+  /* Like threaded streams, this depends only on the options (not on
+     how many CPUs there are), so the output doesn't either. */
+  if ((squash_codec_get_info (codec) & SQUASH_CODEC_INFO_CONCATENABLE) == 0 ||
+      squash_options_get_threads (options) < 2)
+    return 0;
+
+  const size_t chunk_size = squash_options_get_chunk_size (options);
+  return (chunk_size != 0) ? chunk_size : SQUASH_THREADED_STREAM_BLOCK_SIZE;
+}
+
+static void
+squash_splice_map_compress_chunk (size_t chunk, void* user_data) {
+  SquashSpliceMapJob* job = (SquashSpliceMapJob*) user_data;
+  const size_t offset = chunk * job->chunk_size;
+  const size_t remaining = job->input_size - offset;
+
+  job->sizes[chunk] = job->slot_size;
+  job->status[chunk] =
+    squash_codec_compress_with_options (job->codec,
+                                        &(job->sizes[chunk]), job->output + (chunk * job->slot_size),
+                                        (remaining < job->chunk_size) ? remaining : job->chunk_size, job->input + offset,
+                                        job->options);
+}
+
+static SquashStatus
+squash_splice_map_parallel (SquashMappedFile* mapped_out, FILE* fp_out, SquashMappedFile* mapped_in, size_t chunk_size, SquashCodec* codec, SquashOptions* options) {
+  const size_t n_chunks = (mapped_in->size / chunk_size) + (((mapped_in->size % chunk_size) != 0) ? 1 : 0);
+  const size_t slot_size = squash_codec_get_max_compressed_size (codec, chunk_size);
+  SquashStatus res = SQUASH_OK;
+
+  if (HEDLEY_UNLIKELY(slot_size == 0 || n_chunks > (SIZE_MAX / slot_size)))
+    return SQUASH_MMAP_FAILED;
+
+  if (!squash_mapped_file_init (mapped_out, fp_out, n_chunks * slot_size, true))
+    return SQUASH_MMAP_FAILED;
+
+  SquashSpliceMapJob job = {
+    codec,
+    options,
+    mapped_in->data,
+    mapped_in->size,
+    chunk_size,
+    mapped_out->data,
+    slot_size,
+    squash_malloc (n_chunks * sizeof (size_t)),
+    squash_malloc (n_chunks * sizeof (SquashStatus))
+  };
+
+  if (HEDLEY_UNLIKELY(job.sizes == NULL || job.status == NULL)) {
+    res = squash_error (SQUASH_MEMORY);
+    goto cleanup;
+  }
+
+  squash_pool_run (n_chunks, squash_splice_map_compress_chunk, &job);
+
+  size_t pos = 0;
+  for (size_t i = 0 ; i < n_chunks ; i++) {
+    if (HEDLEY_UNLIKELY(job.status[i] != SQUASH_OK)) {
+      res = job.status[i];
+      goto cleanup;
+    }
+
+    if (pos != i * slot_size)
+      memmove (mapped_out->data + pos, mapped_out->data + (i * slot_size), job.sizes[i]);
+    pos += job.sizes[i];
+  }
+
+  mapped_out->size = pos;
+
+ cleanup:
+
+  squash_free (job.sizes);
+  squash_free (job.status);
+
+  return res;
+}
+
+/* Decompress into an output mapping which grows (doubling each time)
+ * as the stream needs more room, so the cost is linear no matter how
+ * well the data compressed.  Stops after @a size bytes if @a size is
+ * non-zero. */
+static SquashStatus
+squash_splice_map_decompress_stream (SquashMappedFile* mapped_out, FILE* fp_out, SquashMappedFile* mapped_in, size_t size, SquashCodec* codec, SquashOptions* options) {
+  size_t capacity = squash_npot (mapped_in->size) << 3;
+  if (size != 0 && capacity > size)
+    capacity = size;
+
+  if (!squash_mapped_file_init (mapped_out, fp_out, capacity, true))
+    return SQUASH_MMAP_FAILED;
+
+  SquashStream* stream = squash_codec_create_stream_with_options (codec, SQUASH_STREAM_DECOMPRESS, options);
+  if (HEDLEY_UNLIKELY(stream == NULL))
+    return squash_error (SQUASH_FAILED);
+
+  SquashStatus res;
+
+  stream->next_in = mapped_in->data;
+  stream->avail_in = mapped_in->size;
+  stream->next_out = mapped_out->data;
+  stream->avail_out = capacity;
+
+  for (;;) {
+    const size_t total_out = stream->total_out;
+    const size_t avail_in = stream->avail_in;
+
+    res = squash_stream_finish (stream);
+    if (res == SQUASH_END_OF_STREAM)
+      res = SQUASH_OK;
+    if (res != SQUASH_PROCESSING)
+      break;
+
+    /* Some codecs (such as zstd) can return before the output is
+       full, so only give up if nothing at all happened. */
+    if (stream->avail_out != 0) {
+      if (HEDLEY_UNLIKELY(stream->total_out == total_out && stream->avail_in == avail_in)) {
+        res = squash_error (SQUASH_FAILED);
+        break;
+      }
+      continue;
+    }
+
+    if (size != 0 && stream->total_out == size) {
+      res = SQUASH_OK;
+      break;
+    }
+
+    size_t new_capacity = (capacity > (SIZE_MAX >> 1)) ? SIZE_MAX : (capacity << 1);
+    if (size != 0 && new_capacity > size)
+      new_capacity = size;
+
+    if (HEDLEY_UNLIKELY(new_capacity == capacity) ||
+        HEDLEY_UNLIKELY(!squash_mapped_file_grow (mapped_out, new_capacity))) {
+      res = squash_error (SQUASH_MEMORY);
+      break;
+    }
+
+    stream->next_out = mapped_out->data + stream->total_out;
+    stream->avail_out = new_capacity - stream->total_out;
+    capacity = new_capacity;
+  }
+
+  if (res == SQUASH_OK)
+    mapped_out->size = stream->total_out;
+
+  squash_object_unref (stream);
+
+  return res;
+}
+
 static SquashStatus
 squash_splice_map (FILE* fp_in, FILE* fp_out, size_t size, SquashStreamType stream_type, SquashCodec* codec, SquashOptions* options) {
   SquashStatus res = SQUASH_MMAP_FAILED;
@@ -104,11 +282,16 @@ squash_splice_map (FILE* fp_in, FILE* fp_out, size_t size, SquashStreamType stre
     if (!squash_mapped_file_init (&mapped_in, fp_in, size, false))
       goto cleanup;
 
-    const size_t max_output_size = squash_codec_get_max_compressed_size(codec, mapped_in.size);
-    if (!squash_mapped_file_init (&mapped_out, fp_out, max_output_size, true))
-      goto cleanup;
+    const size_t chunk_size = squash_splice_map_chunk_size (codec, options);
+    if (chunk_size != 0 && mapped_in.size > chunk_size) {
+      res = squash_splice_map_parallel (&mapped_out, fp_out, &mapped_in, chunk_size, codec, options);
+    } else {
+      const size_t max_output_size = squash_codec_get_max_compressed_size(codec, mapped_in.size);
+      if (!squash_mapped_file_init (&mapped_out, fp_out, max_output_size, true))
+        goto cleanup;
 
-    res = squash_codec_compress_with_options (codec, &mapped_out.size, mapped_out.data, mapped_in.size, mapped_in.data, options);
+      res = squash_codec_compress_with_options (codec, &mapped_out.size, mapped_out.data, mapped_in.size, mapped_in.data, options);
+    }
     if (res != SQUASH_OK)
       goto cleanup;
 
@@ -121,24 +304,46 @@ squash_splice_map (FILE* fp_in, FILE* fp_out, size_t size, SquashStreamType stre
     const SquashCodecInfo codec_info = squash_codec_get_info (codec);
     const bool knows_uncompressed = ((codec_info & SQUASH_CODEC_INFO_KNOWS_UNCOMPRESSED_SIZE) == SQUASH_CODEC_INFO_KNOWS_UNCOMPRESSED_SIZE);
 
-    size_t max_output_size = knows_uncompressed ?
-      squash_codec_get_uncompressed_size(codec, mapped_in.size, mapped_in.data) :
-      squash_npot (mapped_in.size) << 3;
+    /* Streams don't always record their size (zstd frames written by
+       a stream, for example), in which case it is unknown here too. */
+    const size_t uncompressed_size = knows_uncompressed ?
+      squash_codec_get_uncompressed_size(codec, mapped_in.size, mapped_in.data) : 0;
 
-    do {
-      if (!squash_mapped_file_init (&mapped_out, fp_out, max_output_size, true)) {
-        res = SQUASH_MMAP_FAILED;
+    if (uncompressed_size == 0 && (codec_info & SQUASH_CODEC_INFO_NATIVE_STREAMING) != 0) {
+      res = squash_splice_map_decompress_stream (&mapped_out, fp_out, &mapped_in, size, codec, options);
+    } else {
+      /* Codecs which can only decompress all at once have to be
+         retried with more room until it fits, but at least the
+         mapping can grow in place. */
+      size_t max_output_size = (uncompressed_size != 0) ?
+        uncompressed_size :
+        squash_npot (mapped_in.size) << 3;
+
+      if (!squash_mapped_file_init (&mapped_out, fp_out, max_output_size, true))
         goto cleanup;
-      }
 
-      res = squash_codec_decompress_with_options (codec, &mapped_out.size, mapped_out.data, mapped_in.size, mapped_in.data, options);
-      if (res == SQUASH_OK) {
-        squash_mapped_file_destroy (&mapped_in, true);
-        squash_mapped_file_destroy (&mapped_out, true);
-      } else {
+      for (;;) {
+        mapped_out.size = max_output_size;
+        res = squash_codec_decompress_with_options (codec, &mapped_out.size, mapped_out.data, mapped_in.size, mapped_in.data, options);
+        if (uncompressed_size != 0 || res != SQUASH_BUFFER_FULL)
+          break;
+
+        if (HEDLEY_UNLIKELY(max_output_size > (SIZE_MAX >> 1)) ||
+            HEDLEY_UNLIKELY(!squash_mapped_file_grow (&mapped_out, max_output_size << 1))) {
+          res = squash_error (SQUASH_MEMORY);
+          break;
+        }
         max_output_size <<= 1;
       }
-    } while (!knows_uncompressed && res == SQUASH_BUFFER_FULL);
+    }
+    if (res != SQUASH_OK)
+      goto cleanup;
+
+    if (size != 0 && mapped_out.size > size)
+      mapped_out.size = size;
+
+    squash_mapped_file_destroy (&mapped_in, true);
+    squash_mapped_file_destroy (&mapped_out, true);
   }
 
  cleanup:
@@ -150,6 +355,23 @@ squash_splice_map (FILE* fp_in, FILE* fp_out, size_t size, SquashStreamType stre
 }
 #endif /* !defined(_WIN32) */
 
+static once_flag squash_splice_detect_once = ONCE_FLAG_INIT;
+static int squash_splice_try_mmap = 0;
+
+static void
+squash_splice_detect_enable (void) {
+  char* ev = getenv ("SQUASH_MAP_SPLICE");
+
+  if (ev == NULL || strcmp (ev, "yes") == 0)
+    squash_splice_try_mmap = 2;
+  else if (strcmp (ev, "always") == 0)
+    squash_splice_try_mmap = 3;
+  else if (strcmp (ev, "no") == 0)
+    squash_splice_try_mmap = 1;
+  else
+    squash_splice_try_mmap = 2;
+}
+
 static SquashStatus
 squash_splice_stream (FILE* fp_in,
                       FILE* fp_out,
@@ -162,67 +384,9 @@ squash_splice_stream (FILE* fp_in,
   size_t remaining = size;
   uint8_t* data = NULL;
   size_t data_size = 0;
-#if defined(SQUASH_MMAP_IO)
-  bool first_block = true;
-  SquashMappedFile map = squash_mapped_file_empty;
-
-  if (stream_type == SQUASH_STREAM_COMPRESS) {
-    file = squash_file_steal_with_options (fp_out, codec, options);
-    assert (file != NULL);
-
-    while (size == 0 || remaining != 0) {
-      const size_t req_size = (size == 0 || remaining > SQUASH_FILE_BUF_SIZE) ? SQUASH_FILE_BUF_SIZE : remaining;
-      if (!squash_mapped_file_init_full(&map, fp_in, req_size, true, false)) {
-        if (first_block)
-          goto nomap;
-        else {
-          break;
-        }
-      } else {
-        first_block = false;
-      }
-
-      res = squash_file_write (file, map.size, map.data);
-      if (res != SQUASH_OK)
-        goto cleanup;
-
-      if (size != 0)
-        remaining -= map.size;
-      squash_mapped_file_destroy (&map, true);
-    }
-  } else { /* stream_type == SQUASH_STREAM_DECOMPRESS */
-    file = squash_file_steal_with_options (fp_in, codec, options);
-    assert (file != NULL);
-
-    while (size == 0 || remaining > 0) {
-      const size_t req_size = (size == 0 || remaining > SQUASH_FILE_BUF_SIZE) ? SQUASH_FILE_BUF_SIZE : remaining;
-      if (!squash_mapped_file_init_full(&map, fp_out, req_size, true, true)) {
-        if (first_block)
-          goto nomap;
-        else {
-          break;
-        }
-      } else {
-        first_block = false;
-      }
-
-      res = squash_file_read (file, &map.size, map.data);
-      if (res < 0)
-        goto cleanup;
-
-      if (res == SQUASH_END_OF_STREAM) {
-        assert (map.size == 0);
-        res = SQUASH_OK;
-        squash_mapped_file_destroy (&map, true);
-        goto cleanup;
-      }
-
-      squash_mapped_file_destroy (&map, true);
-    }
-  }
-
- nomap:
-#endif /* defined(SQUASH_MMAP_IO) */
+#if !defined(_WIN32)
+  SquashMappedWindow map = squash_mapped_window_empty;
+#endif
 
   file = squash_file_steal_with_options (codec, (stream_type == SQUASH_STREAM_COMPRESS ? fp_out : fp_in), options);
   if (HEDLEY_UNLIKELY(file == NULL)) {
@@ -230,6 +394,17 @@ squash_splice_stream (FILE* fp_in,
     goto cleanup;
   }
 
+#if !defined(_WIN32)
+  /* Map the input rather than copying it through a buffer; anything
+     which can't be mapped is read with stdio. */
+  if (squash_splice_try_mmap != 1) {
+    if (stream_type == SQUASH_STREAM_COMPRESS)
+      squash_mapped_window_init (&map, fp_in);
+    else
+      squash_file_set_mmap (file, true);
+  }
+#endif
+
   data = squash_malloc (SQUASH_FILE_BUF_SIZE);
   if (HEDLEY_UNLIKELY(data == NULL)) {
     res = squash_error (SQUASH_MEMORY);
@@ -239,14 +414,35 @@ squash_splice_stream (FILE* fp_in,
   if (stream_type == SQUASH_STREAM_COMPRESS) {
     while (size == 0 || remaining != 0) {
       const size_t req_size = (size == 0 || remaining > SQUASH_FILE_BUF_SIZE) ? SQUASH_FILE_BUF_SIZE : remaining;
+      const uint8_t* in = data;
 
-      data_size = SQUASH_FREAD_UNLOCKED(data, 1, req_size, fp_in);
-      if (data_size == 0) {
-        res = HEDLEY_LIKELY(feof (fp_in)) ? SQUASH_OK : squash_error (SQUASH_IO);
-        goto cleanup;
+#if !defined(_WIN32)
+      if (map.fp != NULL) {
+        data_size = req_size;
+        in = squash_mapped_window_next (&map, &data_size);
+        if (data_size == 0) {
+          if (squash_mapped_window_eof (&map)) {
+            res = SQUASH_OK;
+            goto cleanup;
+          } else if (HEDLEY_UNLIKELY(!squash_mapped_window_destroy (&map, true))) {
+            res = squash_error (SQUASH_IO);
+            goto cleanup;
+          }
+        }
+      }
+
+      if (map.fp == NULL)
+#endif
+      {
+        in = data;
+        data_size = SQUASH_FREAD_UNLOCKED(data, 1, req_size, fp_in);
+        if (data_size == 0) {
+          res = HEDLEY_LIKELY(feof (fp_in)) ? SQUASH_OK : squash_error (SQUASH_IO);
+          goto cleanup;
+        }
       }
 
-      res = squash_file_write (file, data_size, data);
+      res = squash_file_write (file, data_size, in);
       if (res != SQUASH_OK)
         goto cleanup;
 
@@ -289,31 +485,15 @@ squash_splice_stream (FILE* fp_in,
  cleanup:
 
   squash_file_free (file, NULL);
-#if defined(SQUASH_MMAP_IO)
-  squash_mapped_file_destroy (&map, false);
+#if !defined(_WIN32)
+  if (HEDLEY_UNLIKELY(!squash_mapped_window_destroy (&map, true)) && res == SQUASH_OK)
+    res = squash_error (SQUASH_IO);
 #endif
   squash_free (data);
 
   return res;
 }
 
-static once_flag squash_splice_detect_once = ONCE_FLAG_INIT;
-static int squash_splice_try_mmap = 0;
-
-static void
-squash_splice_detect_enable (void) {
-  char* ev = getenv ("SQUASH_MAP_SPLICE");
-
-  if (ev == NULL || strcmp (ev, "yes") == 0)
-    squash_splice_try_mmap = 2;
-  else if (strcmp (ev, "always") == 0)
-    squash_splice_try_mmap = 3;
-  else if (strcmp (ev, "no") == 0)
-    squash_splice_try_mmap = 1;
-  else
-    squash_splice_try_mmap = 2;
-}
-
 struct SquashFileSpliceData {
   FILE* fp_in;
   FILE* fp_out;
@@ -416,7 +596,7 @@ squash_splice_with_options (SquashCodec* codec,
 
   call_once (&squash_splice_detect_once, squash_splice_detect_enable);
 
-  squash_object_ref (options);
+  squash_options_hold (options);
 
   SQUASH_FLOCKFILE(fp_in);
   SQUASH_FLOCKFILE(fp_out);
@@ -425,7 +605,16 @@ squash_splice_with_options (SquashCodec* codec,
     res = squash_file_splice (fp_in, fp_out, size, stream_type, codec, options);
   } else {
 #if !defined(_WIN32)
-    if (squash_splice_try_mmap == 3 || (squash_splice_try_mmap == 2 && codec->impl.create_stream == NULL)) {
+    /* Mapping compresses everything at once, which would bypass the
+       framed format used by buffer streams with a chunk size. */
+    const bool framed = codec->impl.process_stream == NULL && squash_options_get_chunk_size (options) != 0;
+    /* Compressing mapped files on several threads beats a
+       multi-threaded stream, even for codecs which can stream. */
+    const bool threaded = stream_type == SQUASH_STREAM_COMPRESS && squash_splice_map_chunk_size (codec, options) != 0;
+    /* Decompressing straight into a growing output mapping saves
+       copying everything through the stream's buffers. */
+    const bool native_decompress = stream_type == SQUASH_STREAM_DECOMPRESS && (squash_codec_get_info (codec) & SQUASH_CODEC_INFO_NATIVE_STREAMING) != 0;
+    if (!framed && (squash_splice_try_mmap == 3 || (squash_splice_try_mmap == 2 && (codec->impl.create_stream == NULL || threaded || native_decompress)))) {
       res = squash_splice_map (fp_in, fp_out, size, stream_type, codec, options);
     }
 #endif
@@ -437,17 +626,104 @@ squash_splice_with_options (SquashCodec* codec,
   SQUASH_FUNLOCKFILE(fp_in);
   SQUASH_FUNLOCKFILE(fp_out);
 
-  squash_object_unref (options);
+  squash_options_release (options);
 
   return res;
 }
 
-#define SQUASH_SPLICE_BUF_SIZE ((size_t) 512)
-
+/* Initial buffer size for codecs which don't declare a preferred
+   block size. */
 #if !defined(SQUASH_SPLICE_BUF_SIZE)
-#define SQUASH_SPLICE_BUF_SIZE SQUASH_FILE_BUF_SIZE
+#define SQUASH_SPLICE_BUF_SIZE ((size_t) (64 * 1024))
+#endif
+
+/* Buffers are doubled (up to this size) whenever a callback or the
+   codec fills them completely. */
+#if !defined(SQUASH_SPLICE_BUF_SIZE_MAX)
+#define SQUASH_SPLICE_BUF_SIZE_MAX ((size_t) SQUASH_FILE_BUF_SIZE)
 #endif
 
+static size_t
+squash_splice_initial_buf_size (SquashCodec* codec, SquashOptions* options, bool* adaptive) {
+  size_t res = squash_options_get_buffer_size (options);
+
+  if (res != 0) {
+    *adaptive = false;
+    return res;
+  }
+
+  *adaptive = true;
+
+  res = squash_codec_get_block_size (codec);
+  if (res == 0)
+    res = SQUASH_SPLICE_BUF_SIZE;
+  else if (res > SQUASH_SPLICE_BUF_SIZE_MAX)
+    res = SQUASH_SPLICE_BUF_SIZE_MAX;
+
+  return res;
+}
+
+static bool
+squash_splice_grow_buf (uint8_t** buf, size_t* buf_size) {
+  if (*buf_size >= SQUASH_SPLICE_BUF_SIZE_MAX)
+    return true;
+
+  size_t new_size = *buf_size << 1;
+  if (new_size > SQUASH_SPLICE_BUF_SIZE_MAX)
+    new_size = SQUASH_SPLICE_BUF_SIZE_MAX;
+
+  uint8_t* new_buf = squash_realloc (*buf, new_size);
+  if (HEDLEY_UNLIKELY(new_buf == NULL))
+    return false;
+
+  *buf = new_buf;
+  *buf_size = new_size;
+
+  return true;
+}
+
+static SquashStatus
+squash_splice_write_all (SquashWriteFunc write_cb, void* user_data, size_t data_size, const uint8_t* data) {
+  SquashStatus res;
+  size_t bytes_written = 0;
+
+  do {
+    size_t wlen = data_size - bytes_written;
+    res = write_cb (&wlen, data + bytes_written, user_data);
+    if (res != SQUASH_OK)
+      break;
+    bytes_written += wlen;
+  } while (bytes_written != data_size);
+
+  return res;
+}
+
+/* Write out (up to limit bytes of) a rope one segment at a time, so
+   it never has to be put back together into a single buffer. */
+static SquashStatus
+squash_splice_write_rope (SquashWriteFunc write_cb, void* user_data, SquashRope* rope, size_t limit) {
+  SquashStatus res = SQUASH_OK;
+
+  const size_t iov_len = squash_rope_get_iov (rope, 0, NULL);
+  if (iov_len == 0)
+    return SQUASH_OK;
+
+  SquashIOVec* iov = squash_malloc (iov_len * sizeof (SquashIOVec));
+  if (HEDLEY_UNLIKELY(iov == NULL))
+    return squash_error (SQUASH_MEMORY);
+  squash_rope_get_iov (rope, iov_len, iov);
+
+  for (size_t i = 0 ; i < iov_len && limit != 0 && res == SQUASH_OK ; i++) {
+    const size_t segment_size = (iov[i].iov_len < limit) ? iov[i].iov_len : limit;
+    res = squash_splice_write_all (write_cb, user_data, segment_size, (const uint8_t*) iov[i].iov_base);
+    limit -= segment_size;
+  }
+
+  squash_free (iov);
+
+  return res;
+}
+
 struct SquashSpliceLimitedData {
   SquashWriteFunc write_func;
   SquashReadFunc read_func;
@@ -514,6 +790,147 @@ squash_splice_custom_limited_read (size_t* data_size, uint8_t data[HEDLEY_ARRAY_
   return res;
 }
 
+/* Borrowed callbacks
+ *
+ * squash_splice_custom_borrowed_with_options wraps the caller's
+ * borrowed callbacks in regular ones so codecs which don't know about
+ * borrowing keep working.  Codecs (and our own stream code) which do
+ * know about them can get the original callbacks back with
+ * squash_splice_get_read_borrow and squash_splice_get_write_borrow,
+ * skipping the copy into and out of their own buffers. */
+
+struct SquashSpliceBorrowedData {
+  SquashWriteBorrowFunc write_cb;
+  SquashReadBorrowFunc read_cb;
+  void* user_data;
+};
+
+static SquashStatus
+squash_splice_borrowed_read (size_t* data_size, uint8_t data[HEDLEY_ARRAY_PARAM(*data_size)], void* user_data) {
+  struct SquashSpliceBorrowedData* ctx = (struct SquashSpliceBorrowedData*) user_data;
+  const size_t requested = *data_size;
+  SquashStatus res = SQUASH_OK;
+
+  *data_size = 0;
+  while (*data_size < requested) {
+    const uint8_t* borrowed_data = NULL;
+    size_t borrowed_size = requested - *data_size;
+
+    res = ctx->read_cb (&borrowed_size, &borrowed_data, ctx->user_data);
+    if (HEDLEY_UNLIKELY(res < 0))
+      return res;
+
+    assert (borrowed_size <= requested - *data_size);
+    if (borrowed_size != 0)
+      memcpy (data + *data_size, borrowed_data, borrowed_size);
+    *data_size += borrowed_size;
+
+    if (res == SQUASH_END_OF_STREAM || borrowed_size == 0)
+      break;
+  }
+
+  return (*data_size != 0) ? SQUASH_OK : SQUASH_END_OF_STREAM;
+}
+
+static SquashStatus
+squash_splice_borrowed_write (size_t* data_size, const uint8_t data[HEDLEY_ARRAY_PARAM(*data_size)], void* user_data) {
+  struct SquashSpliceBorrowedData* ctx = (struct SquashSpliceBorrowedData*) user_data;
+  size_t remaining = *data_size;
+  SquashStatus res;
+
+  while (remaining != 0) {
+    uint8_t* borrowed_data = NULL;
+    size_t borrowed_size = remaining;
+
+    res = ctx->write_cb (0, &borrowed_size, &borrowed_data, ctx->user_data);
+    if (HEDLEY_UNLIKELY(res < 0))
+      return res;
+    else if (HEDLEY_UNLIKELY(borrowed_size == 0))
+      return squash_error (SQUASH_BUFFER_FULL);
+
+    if (borrowed_size > remaining)
+      borrowed_size = remaining;
+    memcpy (borrowed_data, data + (*data_size - remaining), borrowed_size);
+
+    res = ctx->write_cb (borrowed_size, NULL, NULL, ctx->user_data);
+    if (HEDLEY_UNLIKELY(res < 0))
+      return res;
+
+    remaining -= borrowed_size;
+  }
+
+  return SQUASH_OK;
+}
+
+static SquashStatus
+squash_splice_borrowed_read_borrow (size_t* data_size, const uint8_t** data, void* user_data) {
+  struct SquashSpliceBorrowedData* ctx = (struct SquashSpliceBorrowedData*) user_data;
+
+  return ctx->read_cb (data_size, data, ctx->user_data);
+}
+
+static SquashStatus
+squash_splice_borrowed_write_borrow (size_t written, size_t* data_size, uint8_t** data, void* user_data) {
+  struct SquashSpliceBorrowedData* ctx = (struct SquashSpliceBorrowedData*) user_data;
+
+  return ctx->write_cb (written, data_size, data, ctx->user_data);
+}
+
+/**
+ * @brief Get the borrowing version of a read callback
+ *
+ * Plugins which implement @ref SquashCodecImpl_::splice can use this
+ * to find out whether the @a read_cb they were passed can lend them
+ * its data instead of copying it into a buffer they provide.  If so,
+ * the returned callback should be invoked with the same user data as
+ * @a read_cb; data it returns remains valid until the next call to
+ * the read callback.
+ *
+ * @param read_cb The read callback passed to the plugin
+ * @return The borrowing callback, or *NULL* if @a read_cb doesn't
+ *   support borrowing
+ */
+SquashReadBorrowFunc
+squash_splice_get_read_borrow (SquashReadFunc read_cb) {
+  if (read_cb == squash_splice_borrowed_read)
+    return squash_splice_borrowed_read_borrow;
+
+  SquashReadBorrowFunc res = squash_stream_get_read_borrow (read_cb);
+  if (res == NULL)
+    res = squash_buffer_splice_get_read_borrow (read_cb);
+
+  return res;
+}
+
+/**
+ * @brief Get the borrowing version of a write callback
+ *
+ * Like @ref squash_splice_get_read_borrow, but for output.  The
+ * returned callback first commits the first @a written bytes of the
+ * buffer returned by the previous call (pass 0 on the first call),
+ * then, if @a data_size is not *NULL*, lends the plugin a new buffer
+ * of *@a data_size bytes to write into.  On input @a data_size is the
+ * number of bytes the plugin would like, but the buffer may be
+ * smaller.  The buffer is only valid until the next call to either
+ * callback, so plugins must commit before reading more input and
+ * before returning.
+ *
+ * @param write_cb The write callback passed to the plugin
+ * @return The borrowing callback, or *NULL* if @a write_cb doesn't
+ *   support borrowing
+ */
+SquashWriteBorrowFunc
+squash_splice_get_write_borrow (SquashWriteFunc write_cb) {
+  if (write_cb == squash_splice_borrowed_write)
+    return squash_splice_borrowed_write_borrow;
+
+  SquashWriteBorrowFunc res = squash_stream_get_write_borrow (write_cb);
+  if (res == NULL)
+    res = squash_buffer_splice_get_write_borrow (write_cb);
+
+  return res;
+}
+
 SquashStatus
 squash_splice_custom_with_options (SquashCodec* codec,
                                    SquashStreamType stream_type,
@@ -526,11 +943,11 @@ squash_splice_custom_with_options (SquashCodec* codec,
   const bool limit_input = (stream_type == SQUASH_STREAM_COMPRESS && size != 0);
   const bool limit_output = (stream_type == SQUASH_STREAM_DECOMPRESS && size != 0);
 
-  squash_object_ref (options);
+  squash_options_hold (options);
 
   if (codec->impl.splice != NULL) {
     if (size == 0) {
-      res = codec->impl.splice (codec, options, stream_type, squash_file_splice_read, squash_file_splice_write, user_data);
+      res = codec->impl.splice (codec, options, stream_type, read_cb, write_cb, user_data);
     } else {
       /* We need to limit the amount of data input (for compression)
          and output (for decompression), so we some wrapper
@@ -549,40 +966,74 @@ squash_splice_custom_with_options (SquashCodec* codec,
         res = SQUASH_OK;
       }
     }
-  } else if (codec->impl.process_stream) {
+  } else if (codec->impl.process_stream || squash_options_get_chunk_size (options) != 0) {
+    /* Buffer-only codecs in framed mode go through a buffer stream
+       so the input doesn't have to be read all at once. */
     SquashStream* stream = squash_stream_new_with_options(codec, stream_type, options);
     if (HEDLEY_UNLIKELY(stream == NULL))
       return squash_error (SQUASH_FAILED);
 
-    uint8_t* const in_buf = squash_malloc (SQUASH_SPLICE_BUF_SIZE);
-    uint8_t* const out_buf = squash_malloc (SQUASH_SPLICE_BUF_SIZE);
-
-    if (HEDLEY_UNLIKELY(in_buf == NULL) || HEDLEY_UNLIKELY(out_buf == NULL)) {
+    /* If the caller lent us its buffers (see
+       squash_splice_custom_borrowed_with_options) the stream can
+       read from and write to them directly instead of going through
+       our own buffers. */
+    struct SquashSpliceBorrowedData* borrowed_in =
+      (read_cb == squash_splice_borrowed_read) ? (struct SquashSpliceBorrowedData*) user_data : NULL;
+    struct SquashSpliceBorrowedData* borrowed_out =
+      (write_cb == squash_splice_borrowed_write) ? (struct SquashSpliceBorrowedData*) user_data : NULL;
+
+    bool adaptive;
+    size_t in_buf_size = squash_splice_initial_buf_size (codec, options, &adaptive);
+    size_t out_buf_size = in_buf_size;
+    uint8_t* in_buf = (borrowed_in == NULL) ? squash_malloc (in_buf_size) : NULL;
+    uint8_t* out_buf = (borrowed_out == NULL) ? squash_malloc (out_buf_size) : NULL;
+
+    if (HEDLEY_UNLIKELY(borrowed_in == NULL && in_buf == NULL) || HEDLEY_UNLIKELY(borrowed_out == NULL && out_buf == NULL)) {
       res = squash_error (SQUASH_MEMORY);
       goto cleanup_stream;
     }
 
+    if (borrowed_in != NULL)
+      in_buf_size = SQUASH_SPLICE_BUF_SIZE_MAX;
+
     bool eof = false;
 
     do {
-      stream->next_in = in_buf;
-      if (limit_input) {
-        stream->avail_in = size - stream->total_in;
-        if (stream->avail_in > SQUASH_SPLICE_BUF_SIZE)
-          stream->avail_in = SQUASH_SPLICE_BUF_SIZE;
+      size_t read_request = in_buf_size;
+      if (limit_input && read_request > size - stream->total_in)
+        read_request = size - stream->total_in;
+
+      stream->avail_in = read_request;
+      if (borrowed_in != NULL) {
+        const uint8_t* borrowed_data = NULL;
+        res = borrowed_in->read_cb (&(stream->avail_in), &borrowed_data, borrowed_in->user_data);
+        stream->next_in = borrowed_data;
       } else {
-        stream->avail_in = SQUASH_SPLICE_BUF_SIZE;
+        stream->next_in = in_buf;
+        res = read_cb (&(stream->avail_in), in_buf, user_data);
       }
-      res = read_cb (&(stream->avail_in), in_buf, user_data);
 
       if (res < 0)
         break;
       else if (res == SQUASH_END_OF_STREAM)
         eof = true;
 
+      /* The callback had more data than we could take; ask for more
+         next time. */
+      const bool grow_in = adaptive && !eof && borrowed_in == NULL && stream->avail_in == in_buf_size;
+      size_t out_passes = 0;
+
       do {
-        stream->next_out = out_buf;
-        stream->avail_out = SQUASH_SPLICE_BUF_SIZE;
+        size_t out_size = out_buf_size;
+        if (borrowed_out != NULL) {
+          res = borrowed_out->write_cb (0, &out_size, &(stream->next_out), borrowed_out->user_data);
+          if (res < 0)
+            break;
+        } else {
+          stream->next_out = out_buf;
+        }
+        stream->avail_out = out_size;
+        uint8_t* const out_start = stream->next_out;
 
         if (eof) {
           res = squash_stream_finish (stream);
@@ -593,26 +1044,52 @@ squash_splice_custom_with_options (SquashCodec* codec,
         if (res < 0)
           break;
 
-        size_t write_remaining = SQUASH_SPLICE_BUF_SIZE - stream->avail_out;
+        out_passes++;
+
+        size_t write_remaining = out_size - stream->avail_out;
         if (limit_output && stream->total_out > size) {
           const size_t overrun = stream->total_out - size;
-          assert (overrun <= SQUASH_SPLICE_BUF_SIZE);
+          assert (overrun <= out_size);
           write_remaining -= overrun;
           res = SQUASH_OK;
           eof = true;
         }
 
+        if (borrowed_out != NULL) {
+          SquashStatus res2 = borrowed_out->write_cb (write_remaining, NULL, NULL, borrowed_out->user_data);
+          if (res2 < 0)
+            res = res2;
+          continue;
+        }
+
+        const uint8_t* write_pos = out_start;
         while (write_remaining != 0) {
           size_t written = write_remaining;
-          SquashStatus res2 = write_cb (&written, out_buf, user_data);
-          if (res2 < 0)
+          SquashStatus res2 = write_cb (&written, write_pos, user_data);
+          if (res2 < 0) {
+            res = res2;
             break;
+          }
 
           assert (write_remaining >= written);
           write_remaining -= written;
+          write_pos += written;
         }
 
+        if (res == SQUASH_PROCESSING && adaptive && out_passes == 1) {
+          /* Output didn't fit in a single buffer; it's safe to
+             resize between passes since next_out is reset above. */
+          if (HEDLEY_UNLIKELY(!squash_splice_grow_buf (&out_buf, &out_buf_size))) {
+            res = squash_error (SQUASH_MEMORY);
+            break;
+          }
+        }
       } while (res == SQUASH_PROCESSING);
+
+      if (res == SQUASH_OK && grow_in) {
+        if (HEDLEY_UNLIKELY(!squash_splice_grow_buf (&in_buf, &in_buf_size)))
+          res = squash_error (SQUASH_MEMORY);
+      }
     } while (res == SQUASH_OK && !eof);
 
     if (res == SQUASH_END_OF_STREAM)
@@ -627,11 +1104,13 @@ squash_splice_custom_with_options (SquashCodec* codec,
     bool eof = false;
     uint8_t* out_data = NULL;
     size_t out_data_size = 0;
+    bool adaptive;
+    size_t chunk_size = squash_splice_initial_buf_size (codec, options, &adaptive);
 
     /* Read all data into `buffer'. */
     do {
       const size_t old_size = buffer->size;
-      const size_t read_request = limit_input ? (size - old_size): SQUASH_SPLICE_BUF_SIZE;
+      const size_t read_request = limit_input ? (size - old_size): chunk_size;
 
       if (HEDLEY_UNLIKELY(!squash_buffer_set_size (buffer, old_size + read_request))) {
         res = squash_error (SQUASH_MEMORY);
@@ -650,6 +1129,8 @@ squash_splice_custom_with_options (SquashCodec* codec,
 
       if (res == SQUASH_END_OF_STREAM || (limit_input && buffer->size == size))
         eof = true;
+      else if (adaptive && bytes_read == read_request && chunk_size < SQUASH_SPLICE_BUF_SIZE_MAX)
+        chunk_size <<= 1;
     } while (!eof);
 
     /* Process (compress or decompress) the data. */
@@ -686,41 +1167,87 @@ squash_splice_custom_with_options (SquashCodec* codec,
           goto cleanup_buffer;
         }
       } else {
-        SquashBuffer* decompressed_buffer = squash_buffer_new (0);
-        res = squash_codec_decompress_to_buffer (codec, decompressed_buffer, buffer->size, buffer->data, options);
-        if (HEDLEY_UNLIKELY(res != SQUASH_OK)) {
-          squash_buffer_free (decompressed_buffer);
-          goto cleanup_buffer;
-        }
-        out_data = squash_buffer_release (decompressed_buffer, &out_data_size);
+        SquashRope decompressed;
+        squash_rope_init (&decompressed, squash_npot (buffer->size) << 3);
+        res = squash_codec_decompress_to_rope (codec, &decompressed, buffer->size, buffer->data, options);
+        if (HEDLEY_LIKELY(res == SQUASH_OK))
+          res = squash_splice_write_rope (write_cb, user_data, &decompressed, limit_output ? size : SIZE_MAX);
+        squash_rope_destroy (&decompressed);
+        goto cleanup_buffer;
       }
     }
 
-    {
-      size_t bytes_written = 0;
-      if (limit_output && out_data_size > size)
-        out_data_size = size;
-
-      do {
-        size_t wlen = out_data_size - bytes_written;
-        res = write_cb (&wlen, out_data + bytes_written, user_data);
-        if (res != SQUASH_OK) {
-          break;
-        }
-        bytes_written += wlen;
-      } while (bytes_written != out_data_size);
-    }
+    if (limit_output && out_data_size > size)
+      out_data_size = size;
+    res = squash_splice_write_all (write_cb, user_data, out_data_size, out_data);
 
   cleanup_buffer:
     squash_buffer_free (buffer);
     squash_free (out_data);
   }
 
-  squash_object_unref (options);
+  squash_options_release (options);
 
   return res;
 }
 
+/**
+ * @brief Compress or decompress using borrowed buffers
+ *
+ * This is like @ref squash_splice_custom_with_options, except that
+ * instead of copying data into buffers provided by Squash, @a read_cb
+ * lends Squash a pointer to its own data, and @a write_cb lends
+ * Squash a buffer to write output into.  Codecs which know how to use
+ * borrowed buffers, and codecs which support streaming, can then
+ * work directly on the caller's memory.
+ *
+ * @a read_cb is called with the maximum number of bytes wanted in
+ * *@a data_size; it should set *@a data to its data and *@a data_size
+ * to the number of bytes available, and return
+ * @ref SQUASH_END_OF_STREAM once there is no more input.  The data
+ * must remain valid until the next call to @a read_cb.
+ *
+ * @a write_cb is called with the number of bytes which were written
+ * to the buffer it returned last time (0 on the first call), which it
+ * should consider written.  If @a data_size is not *NULL* it should
+ * then set *@a data to a buffer of at least one byte and *@a data_size
+ * to its size; on input *@a data_size is the amount of space Squash
+ * would like.  The buffer must remain valid until the next call to
+ * @a write_cb.
+ *
+ * @param codec The codec to use
+ * @param stream_type Whether to compress or decompress
+ * @param write_cb Callback which lends output buffers
+ * @param read_cb Callback which lends input data
+ * @param user_data Data to pass to the callbacks
+ * @param size Number of bytes to read (for compression) or write
+ *   (for decompression), or 0 for no limit
+ * @param options Options to use
+ * @return A status code
+ */
+SquashStatus
+squash_splice_custom_borrowed_with_options (SquashCodec* codec,
+                                            SquashStreamType stream_type,
+                                            SquashWriteBorrowFunc write_cb,
+                                            SquashReadBorrowFunc read_cb,
+                                            void* user_data,
+                                            size_t size,
+                                            SquashOptions* options) {
+  assert (codec != NULL);
+  assert (write_cb != NULL);
+  assert (read_cb != NULL);
+
+  struct SquashSpliceBorrowedData ctx = {
+    write_cb,
+    read_cb,
+    user_data
+  };
+
+  return squash_splice_custom_with_options (codec, stream_type,
+                                            squash_splice_borrowed_write, squash_splice_borrowed_read, &ctx,
+                                            size, options);
+}
+
 SquashStatus squash_splice_custom (SquashCodec* codec,
                                    SquashStreamType stream_type,
                                    SquashWriteFunc write_cb,
@@ -53,6 +53,23 @@ SQUASH_API SquashStatus squash_splice_with_options        (SquashCodec* codec,
                                                            FILE* fp_in,
                                                            size_t size,
                                                            SquashOptions* options);
+#if !defined(_WIN32)
+HEDLEY_SENTINEL(0)
+HEDLEY_NON_NULL(1)
+SQUASH_API SquashStatus squash_splice_fd                  (SquashCodec* codec,
+                                                           SquashStreamType stream_type,
+                                                           int fd_out,
+                                                           int fd_in,
+                                                           size_t size,
+                                                           ...);
+HEDLEY_NON_NULL(1)
+SQUASH_API SquashStatus squash_splice_fd_with_options     (SquashCodec* codec,
+                                                           SquashStreamType stream_type,
+                                                           int fd_out,
+                                                           int fd_in,
+                                                           size_t size,
+                                                           SquashOptions* options);
+#endif
 HEDLEY_SENTINEL(0)
 HEDLEY_NON_NULL(1, 3, 4)
 SQUASH_API SquashStatus squash_splice_custom              (SquashCodec* codec,
@@ -70,6 +87,17 @@ SQUASH_API SquashStatus squash_splice_custom_with_options (SquashCodec* codec,
                                                            void* user_data,
                                                            size_t size,
                                                            SquashOptions* options);
+HEDLEY_NON_NULL(1, 3, 4)
+SQUASH_API SquashStatus squash_splice_custom_borrowed_with_options (SquashCodec* codec,
+                                                                    SquashStreamType stream_type,
+                                                                    SquashWriteBorrowFunc write_cb,
+                                                                    SquashReadBorrowFunc read_cb,
+                                                                    void* user_data,
+                                                                    size_t size,
+                                                                    SquashOptions* options);
+
+SQUASH_API SquashReadBorrowFunc  squash_splice_get_read_borrow  (SquashReadFunc read_cb);
+SQUASH_API SquashWriteBorrowFunc squash_splice_get_write_borrow (SquashWriteFunc write_cb);
 
 HEDLEY_END_C_DECLS
 
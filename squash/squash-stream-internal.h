@@ -38,6 +38,10 @@ struct SquashStreamPrivate_ {
   thrd_t thread;
   bool finished;
 
+  /* Set by squash_stream_destroy before it asks the plugin to stop;
+     from then on the callbacks fail instead of waiting for more. */
+  bool terminating;
+
   mtx_t io_mtx;
 
   SquashOperation request;
@@ -45,11 +49,27 @@ struct SquashStreamPrivate_ {
 
   SquashStatus result;
   cnd_t result_cnd;
+
+  /* Non-NULL if the splice is running in a coroutine on the caller's
+     thread instead of in a separate thread (see squash-stream.c). */
+  struct SquashStreamCoroutine_* coroutine;
+
+  /* Input lent to the plugin (through squash_splice_get_read_borrow)
+     which will be consumed on the next read, and whether next_out
+     has been lent (squash_splice_get_write_borrow) but not yet
+     committed. */
+  size_t input_lent;
+  bool output_lent;
 };
 
 #define SQUASH_OPERATION_INVALID ((SquashOperation) 0)
 #define SQUASH_STATUS_INVALID ((SquashStatus) 0)
 
+SQUASH_INTERNAL
+SquashReadBorrowFunc  squash_stream_get_read_borrow  (SquashReadFunc read_cb);
+SQUASH_INTERNAL
+SquashWriteBorrowFunc squash_stream_get_write_borrow (SquashWriteFunc write_cb);
+
 HEDLEY_END_C_DECLS
 
 #endif /* !defined(SQUASH_STREAM_INTERNAL_H) */
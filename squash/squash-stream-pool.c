@@ -0,0 +1,223 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <string.h>
+
+#include "squash/tinycthread/source/tinycthread.h"
+
+/**
+ * @defgroup SquashStreamPool SquashStreamPool
+ * @brief A pool of reusable streams
+ *
+ * Creating a stream often means allocating (and initializing) a
+ * significant amount of state in the underlying library.  For
+ * applications which process many small streams this setup can
+ * easily cost more than the actual compression.
+ *
+ * A stream pool keeps streams which are no longer in use around and
+ * hands them back out, after resetting them with @ref
+ * squash_stream_reset, when a stream with the same codec, stream type
+ * and options is requested.  Options are compared by identity, so in
+ * order to benefit from the pool you should create the @ref
+ * SquashOptions once and pass the same instance every time.
+ *
+ * Pools are thread-safe; streams themselves are not, but a stream
+ * acquired from a pool belongs exclusively to the caller until it is
+ * released.
+ *
+ * @{
+ */
+
+/**
+ * @struct SquashStreamPool_
+ * @brief A pool of reusable streams
+ *
+ * This is an opaque type; use @ref squash_stream_pool_new to create
+ * one and @ref squash_stream_pool_free to free it.
+ */
+struct SquashStreamPool_ {
+  mtx_t mtx;
+
+  /* Least recently released first. */
+  SquashStream** idle;
+  size_t length;
+  size_t max_idle;
+};
+
+/**
+ * @brief Create a new stream pool
+ *
+ * @param max_idle Maximum number of idle streams the pool will keep;
+ *   once the limit is reached the least recently released streams
+ *   are destroyed
+ * @return A new pool, or *NULL* on failure
+ */
+SquashStreamPool*
+squash_stream_pool_new (size_t max_idle) {
+  SquashStreamPool* pool = squash_malloc (sizeof (SquashStreamPool));
+  if (HEDLEY_UNLIKELY(pool == NULL))
+    return NULL;
+
+  pool->idle = NULL;
+  if (max_idle != 0) {
+    pool->idle = squash_calloc (max_idle, sizeof (SquashStream*));
+    if (HEDLEY_UNLIKELY(pool->idle == NULL)) {
+      squash_free (pool);
+      return NULL;
+    }
+  }
+
+  if (HEDLEY_UNLIKELY(mtx_init (&(pool->mtx), mtx_plain) != thrd_success)) {
+    squash_free (pool->idle);
+    squash_free (pool);
+    return NULL;
+  }
+
+  pool->length = 0;
+  pool->max_idle = max_idle;
+
+  return pool;
+}
+
+/**
+ * @brief Free a stream pool
+ *
+ * All idle streams are destroyed.  Streams which have been acquired
+ * but not yet released remain valid; the caller should simply unref
+ * them instead of releasing them to the pool.
+ *
+ * @param pool The pool; *NULL* is ignored
+ */
+void
+squash_stream_pool_free (SquashStreamPool* pool) {
+  if (pool == NULL)
+    return;
+
+  for (size_t i = 0 ; i < pool->length ; i++)
+    squash_object_unref (pool->idle[i]);
+
+  mtx_destroy (&(pool->mtx));
+  squash_free (pool->idle);
+  squash_free (pool);
+}
+
+/**
+ * @brief Acquire a stream from the pool
+ *
+ * If the pool holds an idle stream for @a codec, @a stream_type and
+ * @a options it is returned, otherwise a new stream is created with
+ * @ref squash_stream_new_with_options.
+ *
+ * The caller owns the returned reference; once finished with the
+ * stream it should pass it to @ref squash_stream_pool_release (or
+ * simply unref it).
+ *
+ * @param pool The pool
+ * @param codec The codec
+ * @param stream_type Stream type
+ * @param options Options, or *NULL* to use the defaults
+ * @return A stream in its initial state, or *NULL* on failure
+ */
+SquashStream*
+squash_stream_pool_acquire (SquashStreamPool* pool,
+                            SquashCodec* codec,
+                            SquashStreamType stream_type,
+                            SquashOptions* options) {
+  assert (pool != NULL);
+  assert (codec != NULL);
+
+  SquashStream* stream = NULL;
+
+  mtx_lock (&(pool->mtx));
+  for (size_t i = pool->length ; i > 0 ; i--) {
+    SquashStream* s = pool->idle[i - 1];
+    if (s->codec == codec && s->stream_type == stream_type && s->options == options) {
+      stream = s;
+      pool->length--;
+      memmove (&(pool->idle[i - 1]), &(pool->idle[i]), (pool->length - (i - 1)) * sizeof (SquashStream*));
+      break;
+    }
+  }
+  mtx_unlock (&(pool->mtx));
+
+  if (stream != NULL)
+    return stream;
+
+  return squash_stream_new_with_options (codec, stream_type, options);
+}
+
+/**
+ * @brief Return a stream to the pool
+ *
+ * The stream is reset with @ref squash_stream_reset and kept for a
+ * later call to @ref squash_stream_pool_acquire.  If the stream can
+ * not be reset, is still referenced elsewhere, or the pool is full,
+ * the reference is dropped instead.  Any user data attached to the
+ * stream is destroyed.
+ *
+ * @param pool The pool
+ * @param stream The stream; the pool takes ownership of the caller's
+ *   reference.  *NULL* is ignored.
+ */
+void
+squash_stream_pool_release (SquashStreamPool* pool,
+                            SquashStream* stream) {
+  assert (pool != NULL);
+
+  if (stream == NULL)
+    return;
+
+  if (pool->max_idle == 0 ||
+      squash_object_get_ref_count (stream) != 1 ||
+      squash_stream_reset (stream) != SQUASH_OK) {
+    squash_object_unref (stream);
+    return;
+  }
+
+  if (stream->destroy_user_data != NULL && stream->user_data != NULL)
+    stream->destroy_user_data (stream->user_data);
+  stream->user_data = NULL;
+  stream->destroy_user_data = NULL;
+
+  SquashStream* evicted = NULL;
+
+  mtx_lock (&(pool->mtx));
+  if (pool->length == pool->max_idle) {
+    evicted = pool->idle[0];
+    pool->length--;
+    memmove (&(pool->idle[0]), &(pool->idle[1]), pool->length * sizeof (SquashStream*));
+  }
+  pool->idle[pool->length++] = stream;
+  mtx_unlock (&(pool->mtx));
+
+  squash_object_unref (evicted);
+}
+
+/**
+ * @}
+ */
@@ -24,6 +24,16 @@
  *   Evan Nemerson <evan@nemerson.com>
  */
 
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+
+#if defined(__APPLE__)
+/* The (deprecated) ucontext functions are hidden unless we ask for
+   them, and asking hides MAP_ANON unless we ask for that, too. */
+#  define _XOPEN_SOURCE 600
+#  define _DARWIN_C_SOURCE
+#endif
+
 #include <assert.h>
 #include "squash-internal.h"
 #include <stdarg.h>
@@ -35,6 +45,11 @@
 
 #include "squash/tinycthread/source/tinycthread.h"
 
+#if defined(HAVE_UCONTEXT)
+#  include <ucontext.h>
+#  include <sys/mman.h>
+#endif
+
 /**
  * @var SquashStream_::base_object
  * @brief Base object.
@@ -193,6 +208,158 @@
  * plugins.
  */
 
+#if defined(HAVE_UCONTEXT)
+
+/* Plugins which only implement the splice API expect to be able to
+ * block in their read and write callbacks, so to expose them as a
+ * stream we need a second stack to run them on.  By default that
+ * stack belongs to a coroutine running on the caller's thread, which
+ * makes creating a stream and switching between the stream and the
+ * plugin about as cheap as a function call.  If coroutines are
+ * unavailable (or disabled by setting the SQUASH_STREAM_COROUTINES
+ * environment variable to "no") we fall back on a thread for each
+ * stream. */
+
+/* Plugins were written to run on an ordinary thread, so give them as
+ * much stack as one usually gets (glibc defaults to 8 MiB).  Only the
+ * pages which are actually touched use any memory; the rest is just
+ * address space. */
+#if !defined(SQUASH_STREAM_COROUTINE_STACK_SIZE)
+#  define SQUASH_STREAM_COROUTINE_STACK_SIZE ((size_t) (8 * 1024 * 1024))
+#endif
+
+/* Number of unused stacks to keep around for new streams. */
+#if !defined(SQUASH_STREAM_COROUTINE_STACK_CACHE)
+#  define SQUASH_STREAM_COROUTINE_STACK_CACHE 8
+#endif
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#  define MAP_ANONYMOUS MAP_ANON
+#endif
+#if !defined(MAP_NORESERVE)
+#  define MAP_NORESERVE 0
+#endif
+#if !defined(MAP_STACK)
+#  define MAP_STACK 0
+#endif
+
+struct SquashStreamCoroutine_ {
+  ucontext_t caller;
+  ucontext_t callee;
+  uint8_t* stack;
+};
+
+static once_flag squash_stream_coroutine_detect_once = ONCE_FLAG_INIT;
+static bool squash_stream_use_coroutines = true;
+
+static void
+squash_stream_coroutine_detect_enable (void) {
+  const char* ev = getenv ("SQUASH_STREAM_COROUTINES");
+
+  squash_stream_use_coroutines = (ev == NULL || strcmp (ev, "no") != 0);
+}
+
+SQUASH_MTX_DEFINE(coroutine_stacks)
+static uint8_t* squash_stream_coroutine_stacks[SQUASH_STREAM_COROUTINE_STACK_CACHE];
+static size_t squash_stream_coroutine_stacks_length = 0;
+
+static uint8_t*
+squash_stream_coroutine_stack_acquire (void) {
+  uint8_t* stack = NULL;
+
+  SQUASH_MTX_LOCK(coroutine_stacks);
+  if (squash_stream_coroutine_stacks_length != 0)
+    stack = squash_stream_coroutine_stacks[--squash_stream_coroutine_stacks_length];
+  SQUASH_MTX_UNLOCK(coroutine_stacks);
+
+  if (stack == NULL) {
+    void* map = mmap (NULL, SQUASH_STREAM_COROUTINE_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (HEDLEY_UNLIKELY(map == MAP_FAILED))
+      return NULL;
+
+    stack = (uint8_t*) map;
+
+    /* Guard page so an overflow crashes instead of silently
+       corrupting whatever is mapped below the stack. */
+    if (HEDLEY_UNLIKELY(mprotect (stack, squash_get_page_size (), PROT_NONE) != 0)) {
+      munmap (stack, SQUASH_STREAM_COROUTINE_STACK_SIZE);
+      return NULL;
+    }
+  }
+
+  return stack;
+}
+
+static void
+squash_stream_coroutine_stack_release (uint8_t* stack) {
+  SQUASH_MTX_LOCK(coroutine_stacks);
+  if (squash_stream_coroutine_stacks_length < SQUASH_STREAM_COROUTINE_STACK_CACHE) {
+    squash_stream_coroutine_stacks[squash_stream_coroutine_stacks_length++] = stack;
+    stack = NULL;
+  }
+  SQUASH_MTX_UNLOCK(coroutine_stacks);
+
+  if (stack != NULL)
+    munmap (stack, SQUASH_STREAM_COROUTINE_STACK_SIZE);
+}
+
+/* makecontext can only portably pass int arguments, so the stream is
+   handed to a new coroutine through this variable instead. */
+static SQUASH_THREAD_LOCAL SquashStream* squash_stream_coroutine_starting = NULL;
+
+static SquashStatus squash_stream_splice (SquashStream* stream);
+
+static void
+squash_stream_coroutine_func (void) {
+  SquashStream* stream = squash_stream_coroutine_starting;
+  squash_stream_coroutine_starting = NULL;
+
+  assert (stream != NULL);
+  SquashStreamPrivate* priv = stream->priv;
+
+  priv->result = squash_stream_splice (stream);
+  priv->finished = true;
+
+  /* Returning resumes priv->coroutine->caller (via uc_link). */
+}
+
+static struct SquashStreamCoroutine_*
+squash_stream_coroutine_new (void) {
+  struct SquashStreamCoroutine_* coroutine = squash_malloc (sizeof (struct SquashStreamCoroutine_));
+  if (HEDLEY_UNLIKELY(coroutine == NULL))
+    return NULL;
+
+  coroutine->stack = squash_stream_coroutine_stack_acquire ();
+  if (HEDLEY_UNLIKELY(coroutine->stack == NULL))
+    goto fail;
+
+  if (HEDLEY_UNLIKELY(getcontext (&(coroutine->callee)) != 0))
+    goto fail;
+
+  const size_t page_size = squash_get_page_size ();
+  coroutine->callee.uc_stack.ss_sp = coroutine->stack + page_size;
+  coroutine->callee.uc_stack.ss_size = SQUASH_STREAM_COROUTINE_STACK_SIZE - page_size;
+  coroutine->callee.uc_link = &(coroutine->caller);
+  makecontext (&(coroutine->callee), squash_stream_coroutine_func, 0);
+
+  return coroutine;
+
+ fail:
+  if (coroutine->stack != NULL)
+    squash_stream_coroutine_stack_release (coroutine->stack);
+  squash_free (coroutine);
+  return NULL;
+}
+
+static void
+squash_stream_coroutine_free (struct SquashStreamCoroutine_* coroutine) {
+  if (coroutine->stack != NULL)
+    squash_stream_coroutine_stack_release (coroutine->stack);
+  squash_free (coroutine);
+}
+
+#endif /* defined(HAVE_UCONTEXT) */
+
 /**
  * @brief Yield execution back to the main thread
  * @protected
@@ -212,9 +379,25 @@ squash_stream_yield (SquashStream* stream, SquashStatus status) {
   SquashStreamPrivate* priv = stream->priv;
   assert (priv != NULL);
 
+  /* Nobody will resume us once the stream is being destroyed. */
+  if (HEDLEY_UNLIKELY(priv->terminating))
+    return SQUASH_OPERATION_TERMINATE;
+
   priv->request = SQUASH_OPERATION_INVALID;
   priv->result = status;
 
+  /* The caller may hand us a different output buffer when we
+     resume, so anything lent out is no longer valid. */
+  priv->output_lent = false;
+
+#if defined(HAVE_UCONTEXT)
+  if (priv->coroutine != NULL) {
+    assert (status >= 0);
+    swapcontext (&(priv->coroutine->callee), &(priv->coroutine->caller));
+    return priv->request;
+  }
+#endif
+
   cnd_signal (&(priv->result_cnd));
   mtx_unlock (&(priv->io_mtx));
   if (status < 0)
@@ -305,16 +488,150 @@ squash_stream_write_cb (size_t* data_size,
   return (*data_size != 0) ? SQUASH_OK : SQUASH_FAILED;
 }
 
+/* Borrowing versions of the callbacks above, which lend the plugin
+   next_in and next_out directly instead of copying.
+ *
+ * Lent input isn't consumed until the next read, so if we have to
+ * yield for more output space in the meantime the caller still
+ * considers it unconsumed and keeps it around.  Lent output, on the
+ * other hand, must be committed before the next read since reading
+ * may yield, after which the caller is free to provide a different
+ * output buffer. */
+
+static void
+squash_stream_consume_lent_input (SquashStream* s) {
+  SquashStreamPrivate* priv = s->priv;
+
+  /* The input may have been withdrawn in the meantime (which is what
+     happens when a stream is destroyed before it is finished). */
+  if (HEDLEY_LIKELY(priv->input_lent <= s->avail_in)) {
+    s->next_in += priv->input_lent;
+    s->avail_in -= priv->input_lent;
+  }
+  priv->input_lent = 0;
+}
+
+static SquashStatus
+squash_stream_read_borrow_cb (size_t* data_size,
+                              const uint8_t** data,
+                              void* user_data) {
+  assert (user_data != NULL);
+  assert (data_size != NULL);
+  assert (data != NULL);
+
+  SquashStream* s = (SquashStream*) user_data;
+  assert (s->priv != NULL);
+  SquashOperation operation = s->priv->request;
+
+  squash_stream_consume_lent_input (s);
+
+  while (s->avail_in == 0 && *data_size != 0) {
+    if (operation == SQUASH_OPERATION_FINISH || operation == SQUASH_OPERATION_TERMINATE) {
+      *data_size = 0;
+      return SQUASH_END_OF_STREAM;
+    }
+
+    operation = squash_stream_yield (s, SQUASH_OK);
+  }
+
+  if (*data_size > s->avail_in)
+    *data_size = s->avail_in;
+
+  *data = s->next_in;
+  s->priv->input_lent = *data_size;
+
+  return SQUASH_OK;
+}
+
+static SquashStatus
+squash_stream_write_borrow_cb (size_t written,
+                               size_t* data_size,
+                               uint8_t** data,
+                               void* user_data) {
+  assert (user_data != NULL);
+
+  SquashStream* s = (SquashStream*) user_data;
+  SquashStreamPrivate* priv = s->priv;
+  assert (priv != NULL);
+
+  if (written != 0) {
+    /* The buffer has to be committed before we yield (i.e., before
+       the plugin reads more input). */
+    if (HEDLEY_UNLIKELY(!priv->output_lent || written > s->avail_out))
+      return squash_error (SQUASH_STATE);
+
+    s->next_out += written;
+    s->avail_out -= written;
+  }
+  priv->output_lent = false;
+
+  if (data_size == NULL)
+    return SQUASH_OK;
+
+  assert (data != NULL);
+
+  SquashOperation operation = priv->request;
+  while (s->avail_out == 0) {
+    if (operation == SQUASH_OPERATION_TERMINATE)
+      return SQUASH_FAILED;
+
+    operation = squash_stream_yield (s, SQUASH_PROCESSING);
+  }
+
+  *data = s->next_out;
+  *data_size = s->avail_out;
+  priv->output_lent = true;
+
+  return SQUASH_OK;
+}
+
+/**
+ * @brief Get the borrowing version of a stream read callback
+ * @private
+ *
+ * @param read_cb Read callback
+ * @return The borrowing version of @a read_cb, or *NULL* if it isn't
+ *   the callback used for splice-based streams
+ */
+SquashReadBorrowFunc
+squash_stream_get_read_borrow (SquashReadFunc read_cb) {
+  return (read_cb == squash_stream_read_cb) ? squash_stream_read_borrow_cb : NULL;
+}
+
+/**
+ * @brief Get the borrowing version of a stream write callback
+ * @private
+ *
+ * @param write_cb Write callback
+ * @return The borrowing version of @a write_cb, or *NULL* if it
+ *   isn't the callback used for splice-based streams
+ */
+SquashWriteBorrowFunc
+squash_stream_get_write_borrow (SquashWriteFunc write_cb) {
+  return (write_cb == squash_stream_write_cb) ? squash_stream_write_borrow_cb : NULL;
+}
+
+static SquashStatus
+squash_stream_splice (SquashStream* stream) {
+  SquashCodec* codec = stream->codec;
+
+  assert (codec != NULL);
+  assert (codec->impl.splice != NULL);
+
+  SquashStatus res = codec->impl.splice (codec, stream->options, stream->stream_type, squash_stream_read_cb, squash_stream_write_cb, stream);
+  squash_stream_consume_lent_input (stream);
+
+  return (res == SQUASH_OK) ? SQUASH_END_OF_STREAM : res;
+}
+
 static int
 squash_stream_thread_func (SquashStream* stream) {
   assert (stream != NULL);
 
   SquashStreamPrivate* priv = stream->priv;
   SquashOperation operation;
-  SquashCodec* codec = stream->codec;
 
   assert (priv != NULL);
-  assert (codec != NULL);
 
   mtx_lock (&(priv->io_mtx));
   priv->result = SQUASH_OK;
@@ -325,11 +642,7 @@ squash_stream_thread_func (SquashStream* stream) {
   }
   priv->request = SQUASH_OPERATION_INVALID;
 
-  assert (codec->impl.splice != NULL);
-
-  priv->result = codec->impl.splice (codec, stream->options, stream->stream_type, squash_stream_read_cb, squash_stream_write_cb, stream);
-  if (priv->result == SQUASH_OK)
-    priv->result = SQUASH_END_OF_STREAM;
+  priv->result = squash_stream_splice (stream);
 
   priv->finished = true;
   cnd_signal (&(priv->result_cnd));
@@ -343,6 +656,29 @@ squash_stream_send_to_thread (SquashStream* stream, SquashOperation operation) {
   SquashStreamPrivate* priv = stream->priv;
   SquashStatus result;
 
+#if defined(HAVE_UCONTEXT)
+  if (priv->coroutine != NULL) {
+    struct SquashStreamCoroutine_* coroutine = priv->coroutine;
+
+    priv->request = operation;
+    squash_stream_coroutine_starting = stream;
+    swapcontext (&(coroutine->caller), &(coroutine->callee));
+    squash_stream_coroutine_starting = NULL;
+
+    result = priv->result;
+    priv->result = SQUASH_STATUS_INVALID;
+
+    if (priv->finished && coroutine->stack != NULL) {
+      /* Nothing will run on the stack again; let another stream
+         have it. */
+      squash_stream_coroutine_stack_release (coroutine->stack);
+      coroutine->stack = NULL;
+    }
+
+    return result;
+  }
+#endif
+
   priv->request = operation;
   cnd_signal (&(priv->request_cnd));
   mtx_unlock (&(priv->io_mtx));
@@ -410,6 +746,25 @@ squash_stream_init (void* stream,
 
   if (codec->impl.create_stream == NULL && codec->impl.splice != NULL) {
     s->priv = squash_malloc (sizeof (SquashStreamPrivate));
+    s->priv->coroutine = NULL;
+    s->priv->input_lent = 0;
+    s->priv->output_lent = false;
+    s->priv->terminating = false;
+
+#if defined(HAVE_UCONTEXT)
+    call_once (&squash_stream_coroutine_detect_once, squash_stream_coroutine_detect_enable);
+
+    if (squash_stream_use_coroutines) {
+      s->priv->coroutine = squash_stream_coroutine_new ();
+
+      if (HEDLEY_LIKELY(s->priv->coroutine != NULL)) {
+        s->priv->request = SQUASH_OPERATION_INVALID;
+        s->priv->result = SQUASH_STATUS_INVALID;
+        s->priv->finished = false;
+        return;
+      }
+    }
+#endif
 
     mtx_init (&(s->priv->io_mtx), mtx_plain);
     mtx_lock (&(s->priv->io_mtx));
@@ -463,12 +818,30 @@ squash_stream_destroy (void* stream) {
   if (HEDLEY_UNLIKELY(s->priv != NULL)) {
     SquashStreamPrivate* priv = (SquashStreamPrivate*) s->priv;
 
-    if (!priv->finished) {
+    /* The caller's buffers may already be gone; make sure the
+       plugin can't touch them while it winds down. */
+    s->next_in = NULL;
+    s->avail_in = 0;
+    s->next_out = NULL;
+    s->avail_out = 0;
+
+    /* Every callback fails once terminating is set, so the plugin
+       can't yield again and a single request is enough. */
+    priv->terminating = true;
+    if (!priv->finished)
       squash_stream_send_to_thread (s, SQUASH_OPERATION_TERMINATE);
+    assert (priv->finished);
+
+#if defined(HAVE_UCONTEXT)
+    if (priv->coroutine != NULL) {
+      squash_stream_coroutine_free (priv->coroutine);
+    } else
+#endif
+    {
+      cnd_destroy (&(priv->request_cnd));
+      cnd_destroy (&(priv->result_cnd));
+      mtx_destroy (&(priv->io_mtx));
     }
-    cnd_destroy (&(priv->request_cnd));
-    cnd_destroy (&(priv->result_cnd));
-    mtx_destroy (&(priv->io_mtx));
 
     squash_free (s->priv);
   }
@@ -581,9 +954,13 @@ squash_stream_process_internal (SquashStream* stream, SquashOperation operation)
   impl = squash_codec_get_impl (codec);
   assert (impl != NULL);
 
+  /* Multi-threaded streams are made of independent blocks, so they
+     can always be flushed. */
+  const bool threaded = squash_stream_is_threaded (stream);
+
   /* Flush is optional, so return an error if it doesn't exist but
      flushing was requested. */
-  if (HEDLEY_UNLIKELY(operation == SQUASH_OPERATION_FLUSH && ((impl->info & SQUASH_CODEC_INFO_CAN_FLUSH) == 0))) {
+  if (HEDLEY_UNLIKELY(operation == SQUASH_OPERATION_FLUSH && !threaded && ((impl->info & SQUASH_CODEC_INFO_CAN_FLUSH) == 0))) {
     return squash_error (SQUASH_INVALID_OPERATION);
   }
 
@@ -673,7 +1050,9 @@ squash_stream_process_internal (SquashStream* stream, SquashOperation operation)
       } else {
         stream->state = SQUASH_STREAM_STATE_RUNNING;
 
-        if (impl->process_stream != NULL) {
+        if (threaded) {
+          res = squash_threaded_stream_process ((SquashThreadedStream*) stream, current_operation);
+        } else if (impl->process_stream != NULL) {
           res = impl->process_stream (stream, current_operation);
         } else if (impl->splice != NULL) {
           res = squash_stream_send_to_thread (stream, current_operation);
@@ -699,7 +1078,9 @@ squash_stream_process_internal (SquashStream* stream, SquashOperation operation)
       stream->state = SQUASH_STREAM_STATE_FLUSHING;
 
       if (current_operation == operation) {
-        if ((impl->info & SQUASH_CODEC_INFO_CAN_FLUSH) == SQUASH_CODEC_INFO_CAN_FLUSH) {
+        if (threaded) {
+          res = squash_threaded_stream_process ((SquashThreadedStream*) stream, current_operation);
+        } else if ((impl->info & SQUASH_CODEC_INFO_CAN_FLUSH) == SQUASH_CODEC_INFO_CAN_FLUSH) {
           assert (impl->process_stream != NULL);
 
           res = impl->process_stream (stream, current_operation);
@@ -729,7 +1110,9 @@ squash_stream_process_internal (SquashStream* stream, SquashOperation operation)
     } else if (current_operation == SQUASH_OPERATION_FINISH) {
       stream->state = SQUASH_STREAM_STATE_FINISHING;
 
-      if (impl->process_stream != NULL) {
+      if (threaded) {
+        res = squash_threaded_stream_process ((SquashThreadedStream*) stream, current_operation);
+      } else if (impl->process_stream != NULL) {
         res = impl->process_stream (stream, current_operation);
       } else if (impl->splice) {
         res = squash_stream_send_to_thread (stream, current_operation);
@@ -835,6 +1218,66 @@ squash_stream_finish (SquashStream* stream) {
   return squash_stream_process_internal (stream, SQUASH_OPERATION_FINISH);
 }
 
+/**
+ * @brief Reset a stream to its initial state
+ *
+ * Once a stream has been finished (or if the caller wants to abandon
+ * the current stream) it can be reset and reused to compress or
+ * decompress another stream with the same codec, stream type, and
+ * options.  Unlike destroying the stream and creating a new one, this
+ * allows the codec to keep any state it has allocated, which can be
+ * significantly faster when processing many small streams.
+ *
+ * The input and output fields of the stream are cleared, and the
+ * totals are set back to zero.  The user data is left intact.
+ *
+ * @param stream The stream
+ * @return A status code
+ * @retval SQUASH_OK The stream was reset
+ * @retval SQUASH_INVALID_OPERATION The codec does not support
+ *   resetting streams; the stream should be destroyed instead
+ *
+ * @see SquashStreamPool
+ */
+SquashStatus
+squash_stream_reset (SquashStream* stream) {
+  SquashCodecImpl* impl;
+  SquashStatus res = SQUASH_OK;
+
+  assert (stream != NULL);
+  assert (stream->codec != NULL);
+  impl = squash_codec_get_impl (stream->codec);
+  assert (impl != NULL);
+
+  if (squash_stream_is_threaded (stream)) {
+    squash_threaded_stream_reset ((SquashThreadedStream*) stream);
+  } else if (impl->reset_stream != NULL) {
+    res = impl->reset_stream (stream);
+  } else if (impl->process_stream == NULL && impl->splice == NULL) {
+    squash_buffer_stream_reset ((SquashBufferStream*) stream);
+  } else {
+    /* Streams bridging to a splice implementation would have to
+       restart the thread or coroutine, which is what destroying the
+       stream does anyways. */
+    return squash_error (SQUASH_INVALID_OPERATION);
+  }
+
+  if (HEDLEY_UNLIKELY(res != SQUASH_OK))
+    return res;
+
+  stream->next_in = NULL;
+  stream->avail_in = 0;
+  stream->total_in = 0;
+
+  stream->next_out = NULL;
+  stream->avail_out = 0;
+  stream->total_out = 0;
+
+  stream->state = SQUASH_STREAM_STATE_IDLE;
+
+  return res;
+}
+
 /**
  * @}
  */
@@ -106,6 +106,8 @@ HEDLEY_NON_NULL(1)
 SQUASH_API SquashStatus    squash_stream_flush                  (SquashStream* stream);
 HEDLEY_NON_NULL(1)
 SQUASH_API SquashStatus    squash_stream_finish                 (SquashStream* stream);
+HEDLEY_NON_NULL(1)
+SQUASH_API SquashStatus    squash_stream_reset                  (SquashStream* stream);
 
 HEDLEY_NON_NULL(1, 2)
 SQUASH_API void            squash_stream_init                   (void* stream,
@@ -116,6 +118,17 @@ SQUASH_API void            squash_stream_init                   (void* stream,
 HEDLEY_NON_NULL(1)
 SQUASH_API void            squash_stream_destroy                (void* stream);
 
+SQUASH_API SquashStreamPool* squash_stream_pool_new             (size_t max_idle);
+SQUASH_API void            squash_stream_pool_free              (SquashStreamPool* pool);
+HEDLEY_NON_NULL(1, 2)
+SQUASH_API SquashStream*   squash_stream_pool_acquire           (SquashStreamPool* pool,
+                                                                 SquashCodec* codec,
+                                                                 SquashStreamType stream_type,
+                                                                 SquashOptions* options);
+HEDLEY_NON_NULL(1)
+SQUASH_API void            squash_stream_pool_release           (SquashStreamPool* pool,
+                                                                 SquashStream* stream);
+
 HEDLEY_END_C_DECLS
 
 #endif /* SQUASH_STREAM_H */
@@ -0,0 +1,86 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+/* IWYU pragma: private, include "squash-internal.h" */
+
+#ifndef SQUASH_THREADED_STREAM_INTERNAL_H
+#define SQUASH_THREADED_STREAM_INTERNAL_H
+
+#if !defined (SQUASH_COMPILATION)
+#error "This is internal API; you cannot use it."
+#endif
+
+HEDLEY_BEGIN_C_DECLS
+
+/**
+ * @brief Default block size for multi-threaded compression
+ *
+ * Also used when splicing memory-mapped files with multiple threads.
+ */
+#if !defined(SQUASH_THREADED_STREAM_BLOCK_SIZE)
+#  define SQUASH_THREADED_STREAM_BLOCK_SIZE ((size_t) (1024 * 1024))
+#endif
+
+typedef struct SquashThreadedStream_ SquashThreadedStream;
+
+typedef struct SquashThreadedStreamBlock_ {
+  SquashPoolTask task;
+  SquashThreadedStream* stream;
+
+  SquashBuffer* input;
+  SquashBuffer* output;
+  size_t output_pos;
+  SquashStatus status;
+} SquashThreadedStreamBlock;
+
+struct SquashThreadedStream_ {
+  SquashStream base_object;
+
+  size_t block_size;
+
+  /* Ring of blocks.  The submitted blocks start at head; the block
+     after the last submitted one (if any) is being filled. */
+  SquashThreadedStreamBlock* blocks;
+  size_t n_blocks;
+  size_t head;
+  size_t submitted;
+
+  /* Whether any block has been submitted, so finishing an empty
+     stream still produces (empty) compressed data. */
+  bool started;
+};
+
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+SquashThreadedStream* squash_threaded_stream_new     (SquashCodec* codec, SquashOptions* options);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+bool                  squash_stream_is_threaded      (SquashStream* stream);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+SquashStatus          squash_threaded_stream_process (SquashThreadedStream* stream, SquashOperation operation);
+HEDLEY_NON_NULL(1) SQUASH_INTERNAL
+void                  squash_threaded_stream_reset   (SquashThreadedStream* stream);
+
+HEDLEY_END_C_DECLS
+
+#endif /* SQUASH_THREADED_STREAM_INTERNAL_H */
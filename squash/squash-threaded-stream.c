@@ -0,0 +1,304 @@
+/* Copyright (c) 2013-2016 The Squash Authors
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *   Evan Nemerson <evan@nemerson.com>
+ */
+
+#include <assert.h>
+#include "squash-internal.h"
+#include <stdbool.h>
+#include <string.h>
+
+/* Multi-threaded compression streams
+ *
+ * For codecs whose compressed data can simply be concatenated
+ * (SQUASH_CODEC_INFO_CONCATENABLE), a compression stream can split
+ * the input into blocks, compress each block independently with the
+ * buffer API on the worker pool, and write the results out in order.
+ *
+ * Blocks live in a ring twice as large as the number of threads, so
+ * the caller can fill the next few blocks while earlier ones are
+ * being compressed.  Output is only ever copied from the oldest
+ * block, which keeps it in order; the caller only blocks when the
+ * ring is full, or when flushing or finishing. */
+
+#ifndef MIN
+#  define MIN(a,b) (((a) < (b)) ? (a) : (b))
+#endif
+
+static void
+squash_threaded_stream_compress_block (size_t index, void* user_data) {
+  SquashThreadedStreamBlock* block = (SquashThreadedStreamBlock*) user_data;
+  SquashStream* s = (SquashStream*) block->stream;
+
+  (void) index;
+
+  size_t compressed_size = squash_codec_get_max_compressed_size (s->codec, block->input->size);
+  if (HEDLEY_UNLIKELY(!squash_buffer_set_size (block->output, compressed_size))) {
+    block->status = squash_error (SQUASH_MEMORY);
+    return;
+  }
+
+  block->status = squash_codec_compress_with_options (s->codec,
+                                                      &compressed_size, block->output->data,
+                                                      block->input->size, block->input->data,
+                                                      s->options);
+  block->output->size = (block->status == SQUASH_OK) ? compressed_size : 0;
+}
+
+static void
+squash_threaded_stream_wait_all (SquashThreadedStream* stream) {
+  for (size_t i = 0 ; i < stream->submitted ; i++)
+    squash_pool_task_wait (&(stream->blocks[(stream->head + i) % stream->n_blocks].task));
+}
+
+static void
+squash_threaded_stream_destroy (void* stream) {
+  SquashThreadedStream* s = (SquashThreadedStream*) stream;
+
+  if (s->blocks != NULL) {
+    squash_threaded_stream_wait_all (s);
+
+    for (size_t i = 0 ; i < s->n_blocks ; i++) {
+      squash_buffer_free (s->blocks[i].input);
+      squash_buffer_free (s->blocks[i].output);
+    }
+    squash_free (s->blocks);
+  }
+
+  squash_stream_destroy (stream);
+}
+
+/**
+ * @brief Create a multi-threaded compression stream
+ * @private
+ *
+ * @param codec The codec; must have the @ref
+ *   SQUASH_CODEC_INFO_CONCATENABLE flag
+ * @param options Options; the number of threads is taken from
+ *   ::squash_options_get_threads
+ * @return A new stream, or *NULL* on failure
+ */
+SquashThreadedStream*
+squash_threaded_stream_new (SquashCodec* codec, SquashOptions* options) {
+  assert (codec != NULL);
+  assert ((squash_codec_get_info (codec) & SQUASH_CODEC_INFO_CONCATENABLE) != 0);
+
+  SquashThreadedStream* stream = squash_malloc (sizeof (SquashThreadedStream));
+  if (HEDLEY_UNLIKELY(stream == NULL))
+    return NULL;
+
+  squash_stream_init (stream, codec, SQUASH_STREAM_COMPRESS, options, squash_threaded_stream_destroy);
+
+  const unsigned int threads = squash_options_get_threads (options);
+  assert (threads > 1);
+
+  const size_t chunk_size = squash_options_get_chunk_size (options);
+  stream->block_size = (chunk_size != 0) ? chunk_size : SQUASH_THREADED_STREAM_BLOCK_SIZE;
+  stream->n_blocks = ((size_t) threads) * 2;
+  stream->head = 0;
+  stream->submitted = 0;
+  stream->started = false;
+
+  stream->blocks = squash_calloc (stream->n_blocks, sizeof (SquashThreadedStreamBlock));
+  if (HEDLEY_UNLIKELY(stream->blocks == NULL))
+    return squash_object_unref (stream);
+
+  for (size_t i = 0 ; i < stream->n_blocks ; i++) {
+    SquashThreadedStreamBlock* block = &(stream->blocks[i]);
+
+    block->stream = stream;
+    block->task.state = SQUASH_POOL_TASK_IDLE;
+    block->input = squash_buffer_new (0);
+    block->output = squash_buffer_new (0);
+    if (HEDLEY_UNLIKELY(block->input == NULL || block->output == NULL))
+      return squash_object_unref (stream);
+    block->output_pos = 0;
+    block->status = SQUASH_OK;
+  }
+
+  return stream;
+}
+
+/**
+ * @brief Determine whether a stream is a multi-threaded compression
+ *   stream
+ * @private
+ *
+ * @param stream The stream
+ * @return Whether @a stream was created by @ref
+ *   squash_threaded_stream_new
+ */
+bool
+squash_stream_is_threaded (SquashStream* stream) {
+  return ((SquashObject*) stream)->destroy_notify == squash_threaded_stream_destroy;
+}
+
+static void
+squash_threaded_stream_submit (SquashThreadedStream* stream) {
+  assert (stream->submitted < stream->n_blocks);
+
+  SquashThreadedStreamBlock* block = &(stream->blocks[(stream->head + stream->submitted) % stream->n_blocks]);
+
+  stream->submitted++;
+  stream->started = true;
+
+  squash_pool_task_submit (&(block->task), squash_threaded_stream_compress_block, block);
+}
+
+/* Copy compressed data from the oldest blocks to next_out, waiting for
+   them to be compressed if @a wait is true.  Returns SQUASH_OK if
+   everything which is ready has been written, SQUASH_PROCESSING if
+   there isn't enough room in the output buffer, or an error. */
+static SquashStatus
+squash_threaded_stream_drain (SquashThreadedStream* stream, bool wait) {
+  SquashStream* s = (SquashStream*) stream;
+
+  while (stream->submitted != 0) {
+    SquashThreadedStreamBlock* block = &(stream->blocks[stream->head]);
+
+    if (wait)
+      squash_pool_task_wait (&(block->task));
+    else if (!squash_pool_task_done (&(block->task)))
+      return SQUASH_OK;
+
+    if (HEDLEY_UNLIKELY(block->status != SQUASH_OK))
+      return block->status;
+
+    const size_t cp_size = MIN(block->output->size - block->output_pos, s->avail_out);
+    if (cp_size != 0) {
+      memcpy (s->next_out, block->output->data + block->output_pos, cp_size);
+      s->next_out += cp_size;
+      s->avail_out -= cp_size;
+      block->output_pos += cp_size;
+    }
+
+    if (block->output_pos != block->output->size)
+      return SQUASH_PROCESSING;
+
+    block->input->size = 0;
+    block->output->size = 0;
+    block->output_pos = 0;
+
+    stream->head = (stream->head + 1) % stream->n_blocks;
+    stream->submitted--;
+  }
+
+  return SQUASH_OK;
+}
+
+static SquashStatus
+squash_threaded_stream_process_input (SquashThreadedStream* stream) {
+  SquashStream* s = (SquashStream*) stream;
+  SquashStatus res;
+
+  for (;;) {
+    res = squash_threaded_stream_drain (stream, false);
+    if (HEDLEY_UNLIKELY(res < 0))
+      return res;
+
+    if (s->avail_in == 0)
+      return SQUASH_OK;
+
+    if (stream->submitted == stream->n_blocks) {
+      /* Every block is in use; we have to wait for the oldest one. */
+      res = squash_threaded_stream_drain (stream, true);
+      if (res != SQUASH_OK)
+        return res;
+    }
+
+    SquashBuffer* input = stream->blocks[(stream->head + stream->submitted) % stream->n_blocks].input;
+    const size_t cp_size = MIN(stream->block_size - input->size, s->avail_in);
+    if (HEDLEY_UNLIKELY(!squash_buffer_append (input, cp_size, s->next_in)))
+      return squash_error (SQUASH_MEMORY);
+    s->next_in += cp_size;
+    s->avail_in -= cp_size;
+
+    if (input->size == stream->block_size)
+      squash_threaded_stream_submit (stream);
+  }
+}
+
+/**
+ * @brief Process a multi-threaded compression stream
+ * @private
+ *
+ * Flushing and finishing both compress any partial block and write
+ * out every pending block; since the blocks are independent there is
+ * nothing else to do.
+ *
+ * @param stream The stream
+ * @param operation The operation to perform
+ * @return A status code
+ */
+SquashStatus
+squash_threaded_stream_process (SquashThreadedStream* stream, SquashOperation operation) {
+  SquashStream* s = (SquashStream*) stream;
+
+  switch (operation) {
+    case SQUASH_OPERATION_PROCESS:
+      return squash_threaded_stream_process_input (stream);
+    case SQUASH_OPERATION_FLUSH:
+    case SQUASH_OPERATION_FINISH: {
+      assert (s->avail_in == 0);
+
+      if (stream->submitted < stream->n_blocks) {
+        SquashBuffer* input = stream->blocks[(stream->head + stream->submitted) % stream->n_blocks].input;
+        if (input->size != 0 || (operation == SQUASH_OPERATION_FINISH && !stream->started))
+          squash_threaded_stream_submit (stream);
+      }
+
+      return squash_threaded_stream_drain (stream, true);
+    }
+    case SQUASH_OPERATION_TERMINATE:
+      HEDLEY_UNREACHABLE ();
+      break;
+  }
+
+  HEDLEY_UNREACHABLE ();
+}
+
+/**
+ * @brief Reset a multi-threaded compression stream
+ * @private
+ *
+ * Waits for any blocks still being compressed and discards all
+ * pending data.
+ *
+ * @param stream The stream
+ */
+void
+squash_threaded_stream_reset (SquashThreadedStream* stream) {
+  squash_threaded_stream_wait_all (stream);
+
+  for (size_t i = 0 ; i < stream->n_blocks ; i++) {
+    stream->blocks[i].input->size = 0;
+    stream->blocks[i].output->size = 0;
+    stream->blocks[i].output_pos = 0;
+    stream->blocks[i].status = SQUASH_OK;
+  }
+
+  stream->head = 0;
+  stream->submitted = 0;
+  stream->started = false;
+}
@@ -66,16 +66,31 @@ struct SquashPlugin_ {
   SQUASH_TREE_ENTRY(SquashPlugin_) tree;
 };
 
+#define SQUASH_CODEC_OPTION_SLOTS 64
+
 struct SquashCodec_ {
   SquashPlugin* plugin;
 
   char* name;
   int priority;
   char* extension;
+  size_t block_size;
 
-  bool initialized;
+  /* Set once impl is ready; see squash_plugin_init_codec. */
+  volatile unsigned int initialized;
   SquashCodecImpl impl;
 
+  /* Open-addressed hash table of option names; each slot holds an
+     index into impl.options plus one, or 0 if it is empty.  See
+     squash_codec_index_options. */
+  bool options_indexed;
+  uint8_t option_slots[SQUASH_CODEC_OPTION_SLOTS];
+
+  /* Frozen default options, created on demand by
+     squash_options_cached_newv and published with a compare-and-swap
+     so readers never need a lock. */
+  SquashOptions* default_options;
+
   SQUASH_TREE_ENTRY(SquashCodec_) tree;
 };
 
@@ -39,11 +39,13 @@ HEDLEY_BEGIN_C_DECLS
 typedef struct SquashObject_     SquashObject;
 typedef struct SquashOptions_    SquashOptions;
 typedef struct SquashStream_     SquashStream;
+typedef struct SquashStreamPool_ SquashStreamPool;
 typedef struct SquashContext_    SquashContext;
 typedef struct SquashCodec_      SquashCodec;
 typedef struct SquashCodecImpl_  SquashCodecImpl;
 typedef struct SquashPlugin_     SquashPlugin;
 typedef struct SquashFile_       SquashFile;
+typedef struct SquashDictionary_ SquashDictionary;
 
 HEDLEY_END_C_DECLS
 
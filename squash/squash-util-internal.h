@@ -40,6 +40,39 @@ SQUASH_INTERNAL
 size_t squash_npot               (size_t v);
 SQUASH_INTERNAL
 size_t squash_get_huge_page_size (void);
+SQUASH_INTERNAL
+unsigned int squash_get_cpu_count (void);
+
+/* Loads have acquire semantics and stores have release semantics, so
+   a value published with squash_atomic_store_uint or
+   squash_atomic_cas_ptr can be read without a lock along with
+   everything written before it. */
+#if defined(__ATOMIC_ACQUIRE)
+#  define squash_atomic_load_uint(var) __atomic_load_n(var, __ATOMIC_ACQUIRE)
+#  define squash_atomic_store_uint(var, val) __atomic_store_n(var, val, __ATOMIC_RELEASE)
+#  define squash_atomic_load_ptr(var) __atomic_load_n(var, __ATOMIC_ACQUIRE)
+#  define squash_atomic_cas_ptr(var, orig, val) __sync_val_compare_and_swap(var, orig, val)
+#elif defined(_WIN32)
+#  define squash_atomic_load_uint(var) ((unsigned int) InterlockedCompareExchange((volatile LONG*) (var), 0, 0))
+#  define squash_atomic_store_uint(var, val) InterlockedExchange((volatile LONG*) (var), (LONG) (val))
+#  define squash_atomic_load_ptr(var) InterlockedCompareExchangePointer((PVOID volatile*) (var), NULL, NULL)
+#  define squash_atomic_cas_ptr(var, orig, val) InterlockedCompareExchangePointer((PVOID volatile*) (var), val, orig)
+#else
+HEDLEY_NON_NULL(1)
+SQUASH_INTERNAL
+unsigned int squash_atomic_locked_load_uint  (volatile unsigned int* var);
+HEDLEY_NON_NULL(1)
+SQUASH_INTERNAL
+void         squash_atomic_locked_store_uint (volatile unsigned int* var, unsigned int val);
+HEDLEY_NON_NULL(1)
+SQUASH_INTERNAL
+void*        squash_atomic_locked_cas_ptr    (void** var, void* orig, void* val);
+
+#  define squash_atomic_load_uint(var) squash_atomic_locked_load_uint(var)
+#  define squash_atomic_store_uint(var, val) squash_atomic_locked_store_uint(var, val)
+#  define squash_atomic_load_ptr(var) squash_atomic_locked_cas_ptr((void**) (var), NULL, NULL)
+#  define squash_atomic_cas_ptr(var, orig, val) squash_atomic_locked_cas_ptr((void**) (var), orig, val)
+#endif
 
 HEDLEY_END_C_DECLS
 
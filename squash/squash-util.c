@@ -24,6 +24,7 @@
  *   Evan Nemerson <evan@nemerson.com>
  */
 
+#include <assert.h>
 #include "squash-internal.h"
 #include <stddef.h>
 #include <stdint.h>
@@ -66,6 +67,25 @@ squash_get_page_size (void) {
   return page_size;
 }
 
+unsigned int
+squash_get_cpu_count (void) {
+  static unsigned int cpu_count = 0;
+
+  if (HEDLEY_UNLIKELY(cpu_count == 0)) {
+    long c = 0;
+#if defined(_WIN32)
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    c = (long) si.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    c = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+    cpu_count = (c < 1) ? 1 : ((unsigned int) c);
+  }
+
+  return cpu_count;
+}
+
 size_t squash_huge_page_size = 0;
 once_flag squash_huge_page_size_once = ONCE_FLAG_INIT;
 
@@ -137,3 +157,32 @@ squash_npot (size_t v) {
   v++;
   return v;
 }
+
+#if !defined(__ATOMIC_ACQUIRE) && !defined(_WIN32)
+SQUASH_MTX_DEFINE(atomic)
+
+unsigned int
+squash_atomic_locked_load_uint (volatile unsigned int* var) {
+  SQUASH_MTX_LOCK(atomic);
+  const unsigned int res = *var;
+  SQUASH_MTX_UNLOCK(atomic);
+  return res;
+}
+
+void
+squash_atomic_locked_store_uint (volatile unsigned int* var, unsigned int val) {
+  SQUASH_MTX_LOCK(atomic);
+  *var = val;
+  SQUASH_MTX_UNLOCK(atomic);
+}
+
+void*
+squash_atomic_locked_cas_ptr (void** var, void* orig, void* val) {
+  SQUASH_MTX_LOCK(atomic);
+  void* res = *var;
+  if (res == orig)
+    *var = val;
+  SQUASH_MTX_UNLOCK(atomic);
+  return res;
+}
+#endif
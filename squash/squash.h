@@ -80,6 +80,7 @@
 #include <squash/squash-object.h>
 #include <squash/squash-options.h>
 #include <squash/squash-stream.h>
+#include <squash/squash-dictionary.h>
 #include <squash/squash-file.h>
 #include <squash/squash-license.h>
 #include <squash/squash-codec.h>
@@ -1,5 +1,7 @@
 #include "test-squash.h"
 
+#include <stdio.h>
+
 struct BoundsInfo {
   SquashCodec* codec;
   uint8_t* compressed;
@@ -179,6 +181,85 @@ squash_test_bounds_encode_tiny(MUNIT_UNUSED const MunitParameter params[], void*
   return MUNIT_OK;
 }
 
+static MunitResult
+squash_test_bounds_encode_scratch(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  struct BoundsInfo* info = (struct BoundsInfo*) user_data;
+  munit_assert_not_null (info);
+
+  uint8_t decompressed[LOREM_IPSUM_LENGTH];
+  size_t decompressed_length;
+  size_t compressed_length;
+  uint8_t* compressed = munit_malloc (info->compressed_length);
+  SquashStatus res;
+
+  /* Anything smaller than the maximum compressed size makes codecs
+     which only have an unsafe compression function go through the
+     thread's scratch buffer, so alternate between sizes which do and
+     don't fit to make sure it is reused correctly. */
+  for (int i = 0 ; i < 4 ; i++) {
+    compressed_length = info->compressed_length - (size_t) (i & 1);
+    res = squash_codec_compress (info->codec,
+                                 &compressed_length, compressed,
+                                 LOREM_IPSUM_LENGTH, LOREM_IPSUM, NULL);
+    if ((i & 1) != 0) {
+      munit_assert_int(res, <, 0);
+    } else if (res == SQUASH_OK) {
+      decompressed_length = LOREM_IPSUM_LENGTH;
+      SQUASH_ASSERT_OK(squash_codec_decompress (info->codec,
+                                                &decompressed_length, decompressed,
+                                                compressed_length, compressed, NULL));
+      munit_assert_size(decompressed_length, ==, LOREM_IPSUM_LENGTH);
+      munit_assert_memory_equal(LOREM_IPSUM_LENGTH, decompressed, LOREM_IPSUM);
+    }
+  }
+
+  free (compressed);
+
+  /* parallel: only has an unsafe compression function, and with a
+     single block it runs on this thread while holding the scratch
+     buffer.  adaptive: hands the codec less room than the maximum, so
+     if it is unsafe too it has to fall back on a new allocation.  The
+     input has to be large enough for adaptive: to bother. */
+  char name[256];
+  snprintf (name, sizeof (name), "parallel:adaptive:%s", squash_codec_get_name (info->codec));
+  SquashCodec* nested = squash_get_codec (name);
+  munit_assert_not_null(nested);
+
+  const size_t uncompressed_length = 64 * 1024;
+  uint8_t* uncompressed = squash_test_lorem_ipsum_new (uncompressed_length);
+  uint8_t* nested_decompressed = munit_malloc (uncompressed_length);
+
+  compressed_length = squash_codec_get_max_compressed_size (nested, uncompressed_length);
+  compressed = munit_malloc (compressed_length);
+  SQUASH_ASSERT_OK(squash_codec_compress (nested,
+                                          &compressed_length, compressed,
+                                          uncompressed_length, uncompressed, NULL));
+
+  res = squash_codec_compress (nested,
+                               &compressed_length, compressed,
+                               uncompressed_length, uncompressed, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  decompressed_length = uncompressed_length;
+  SQUASH_ASSERT_OK(squash_codec_decompress (nested,
+                                            &decompressed_length, nested_decompressed,
+                                            compressed_length, compressed, NULL));
+  munit_assert_size(decompressed_length, ==, uncompressed_length);
+  munit_assert_memory_equal(uncompressed_length, nested_decompressed, uncompressed);
+
+  compressed_length--;
+  res = squash_codec_compress (nested,
+                               &compressed_length, compressed,
+                               uncompressed_length, uncompressed, NULL);
+  munit_assert_int(res, <, 0);
+
+  free (compressed);
+  free (nested_decompressed);
+  free (uncompressed);
+
+  return MUNIT_OK;
+}
+
 MunitTest squash_bounds_tests[] = {
   { (char*) "/decode/exact", squash_test_bounds_decode_exact, squash_test_bounds_setup, squash_test_bounds_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { (char*) "/decode/small", squash_test_bounds_decode_small, squash_test_bounds_setup, squash_test_bounds_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
@@ -187,6 +268,7 @@ MunitTest squash_bounds_tests[] = {
   { (char*) "/encode/exact", squash_test_bounds_encode_exact, squash_test_bounds_setup, squash_test_bounds_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { (char*) "/encode/small", squash_test_bounds_encode_small, squash_test_bounds_setup, squash_test_bounds_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { (char*) "/encode/tiny", squash_test_bounds_encode_tiny, squash_test_bounds_setup, squash_test_bounds_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/encode/scratch", squash_test_bounds_encode_scratch, squash_test_bounds_setup, squash_test_bounds_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
 
@@ -1,5 +1,6 @@
 #include "test-squash.h"
 
+#include <ctype.h>
 #include <stdio.h>
 
 static MunitResult
@@ -66,6 +67,630 @@ squash_test_single_byte(MUNIT_UNUSED const MunitParameter params[], void* user_d
   return MUNIT_OK;
 }
 
+static MunitResult
+squash_test_repeated(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  const size_t max_compressed_length = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH);
+  uint8_t* compressed = (uint8_t*) munit_malloc (max_compressed_length);
+  uint8_t* decompressed = (uint8_t*) munit_malloc (LOREM_IPSUM_LENGTH);
+
+  /* Codecs may reuse contexts between calls; make sure no state leaks
+     from one call to the next. */
+  for (size_t i = 0 ; i < 8 ; i++) {
+    const size_t uncompressed_length = LOREM_IPSUM_LENGTH - (i * 64);
+    size_t compressed_length = max_compressed_length;
+    size_t decompressed_length = uncompressed_length;
+
+    SquashStatus res = squash_codec_compress (codec, &compressed_length, compressed, uncompressed_length, (uint8_t*) LOREM_IPSUM, NULL);
+    SQUASH_ASSERT_OK(res);
+
+    res = squash_codec_decompress (codec, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+    SQUASH_ASSERT_OK(res);
+    munit_assert_size(uncompressed_length, ==, decompressed_length);
+    munit_assert_memory_equal(uncompressed_length, decompressed, LOREM_IPSUM);
+  }
+
+  free (compressed);
+  free (decompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_batch(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  const size_t n_items = 16;
+  const size_t max_compressed_length = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH);
+  SquashBatchItem* items = munit_newa (SquashBatchItem, n_items);
+
+  for (size_t i = 0 ; i < n_items ; i++) {
+    items[i].input_size = LOREM_IPSUM_LENGTH - (i * 16);
+    items[i].input = (const uint8_t*) LOREM_IPSUM;
+    items[i].output_size = max_compressed_length;
+    items[i].output = munit_malloc (max_compressed_length);
+    items[i].status = SQUASH_FAILED;
+  }
+
+  SquashStatus res = squash_codec_compress_batch (codec, n_items, items, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  SquashBatchItem* decompressed = munit_newa (SquashBatchItem, n_items);
+  for (size_t i = 0 ; i < n_items ; i++) {
+    SQUASH_ASSERT_OK(items[i].status);
+
+    decompressed[i].input_size = items[i].output_size;
+    decompressed[i].input = items[i].output;
+    decompressed[i].output_size = items[i].input_size;
+    decompressed[i].output = munit_malloc (items[i].input_size);
+    decompressed[i].status = SQUASH_FAILED;
+  }
+
+  res = squash_codec_decompress_batch (codec, n_items, decompressed, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  for (size_t i = 0 ; i < n_items ; i++) {
+    SQUASH_ASSERT_OK(decompressed[i].status);
+    munit_assert_size(decompressed[i].output_size, ==, items[i].input_size);
+    munit_assert_memory_equal(items[i].input_size, decompressed[i].output, LOREM_IPSUM);
+
+    free (items[i].output);
+    free (decompressed[i].output);
+  }
+
+  free (items);
+  free (decompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_iov(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  /* Uneven segments, including an empty one. */
+  const size_t splits[] = { 0, 1, 1, 100, 1000, 1001, LOREM_IPSUM_LENGTH };
+  const size_t n_splits = (sizeof (splits) / sizeof (splits[0])) - 1;
+  SquashIOVec uncompressed_iov[sizeof (splits) / sizeof (splits[0])];
+  for (size_t i = 0 ; i < n_splits ; i++) {
+    uncompressed_iov[i].iov_base = (void*) (LOREM_IPSUM + splits[i]);
+    uncompressed_iov[i].iov_len = splits[i + 1] - splits[i];
+  }
+
+  const size_t max_compressed_length = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH);
+  uint8_t* compressed = munit_malloc (max_compressed_length);
+  const size_t third = (max_compressed_length / 3) + 1;
+  SquashIOVec compressed_iov[3];
+  for (size_t i = 0 ; i < 3 ; i++) {
+    compressed_iov[i].iov_base = compressed + (third * i);
+    compressed_iov[i].iov_len = (i == 2) ? (max_compressed_length - (third * 2)) : third;
+  }
+
+  size_t compressed_length = 0;
+  SquashStatus res = squash_codec_compress_iov (codec, &compressed_length, 3, compressed_iov, n_splits, uncompressed_iov, NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size(compressed_length, <=, max_compressed_length);
+
+  uint8_t* decompressed = munit_malloc (LOREM_IPSUM_LENGTH);
+  size_t decompressed_length = LOREM_IPSUM_LENGTH;
+  res = squash_codec_decompress (codec, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size(decompressed_length, ==, LOREM_IPSUM_LENGTH);
+  munit_assert_memory_equal(LOREM_IPSUM_LENGTH, decompressed, LOREM_IPSUM);
+
+  /* Now scatter the compressed data, and decompress it into the same
+     segments the input came from. */
+  SquashIOVec input_iov[2] = {
+    { compressed, compressed_length / 2 },
+    { compressed + (compressed_length / 2), compressed_length - (compressed_length / 2) }
+  };
+  SquashIOVec output_iov[sizeof (splits) / sizeof (splits[0])];
+  for (size_t i = 0 ; i < n_splits ; i++) {
+    output_iov[i].iov_base = decompressed + splits[i];
+    output_iov[i].iov_len = uncompressed_iov[i].iov_len;
+  }
+
+  memset (decompressed, 0, LOREM_IPSUM_LENGTH);
+  decompressed_length = 0;
+  res = squash_codec_decompress_iov (codec, &decompressed_length, n_splits, output_iov, 2, input_iov, NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size(decompressed_length, ==, LOREM_IPSUM_LENGTH);
+  munit_assert_memory_equal(LOREM_IPSUM_LENGTH, decompressed, LOREM_IPSUM);
+
+  /* No room at all for the output */
+  decompressed_length = 0;
+  res = squash_codec_decompress_iov (codec, &decompressed_length, 0, NULL, 2, input_iov, NULL);
+  munit_assert_int(res, ==, SQUASH_BUFFER_FULL);
+
+  free (compressed);
+  free (decompressed);
+
+  return MUNIT_OK;
+}
+
+static size_t
+squash_test_dictionary_stream (SquashCodec* codec, SquashStreamType stream_type, SquashOptions* options,
+                               size_t output_size, uint8_t* output, size_t input_size, const uint8_t* input) {
+  SquashStream* stream = squash_stream_new_with_options (codec, stream_type, options);
+  munit_assert_not_null(stream);
+
+  stream->next_in = input;
+  stream->avail_in = input_size;
+  stream->next_out = output;
+  stream->avail_out = output_size;
+
+  SquashStatus res;
+  do {
+    res = squash_stream_finish (stream);
+  } while (res == SQUASH_PROCESSING);
+  SQUASH_ASSERT_OK(res);
+
+  const size_t total_out = stream->total_out;
+  squash_object_unref (stream);
+
+  return total_out;
+}
+
+static MunitResult
+squash_test_dictionary(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  if ((squash_codec_get_info (codec) & SQUASH_CODEC_INFO_DICTIONARY) == 0)
+    return MUNIT_SKIP;
+
+  /* The input is a prefix of the dictionary, so a codec which actually
+     uses the dictionary should do much better than without it. */
+  const size_t input_length = LOREM_IPSUM_LENGTH / 2;
+  SquashDictionary* dictionary = squash_dictionary_new (LOREM_IPSUM_LENGTH, LOREM_IPSUM);
+  munit_assert_not_null(dictionary);
+  munit_assert_size(squash_dictionary_get_size (dictionary), ==, LOREM_IPSUM_LENGTH);
+
+  SquashOptions* options = squash_options_new (codec, NULL);
+  munit_assert_not_null(options);
+  squash_object_ref (options);
+  SQUASH_ASSERT_OK(squash_options_set_dictionary (options, dictionary));
+  munit_assert_ptr_equal(squash_options_get_dictionary (options), dictionary);
+
+  const size_t max_compressed_length = squash_codec_get_max_compressed_size (codec, input_length);
+  uint8_t* compressed = munit_malloc (max_compressed_length);
+  uint8_t* plain = munit_malloc (max_compressed_length);
+  uint8_t* decompressed = munit_malloc (input_length);
+
+  size_t plain_length = max_compressed_length;
+  SQUASH_ASSERT_OK(squash_codec_compress (codec, &plain_length, plain, input_length, LOREM_IPSUM, NULL));
+
+  /* Buffer API */
+  size_t compressed_length = max_compressed_length;
+  SQUASH_ASSERT_OK(squash_codec_compress_with_options (codec, &compressed_length, compressed, input_length, LOREM_IPSUM, options));
+  munit_assert_size(compressed_length, <, plain_length);
+
+  size_t decompressed_length = input_length;
+  SQUASH_ASSERT_OK(squash_codec_decompress_with_options (codec, &decompressed_length, decompressed, compressed_length, compressed, options));
+  munit_assert_size(decompressed_length, ==, input_length);
+  munit_assert_memory_equal(input_length, decompressed, LOREM_IPSUM);
+
+  /* Without the dictionary the data must not come back intact. */
+  decompressed_length = input_length;
+  SquashStatus res = squash_codec_decompress (codec, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+  if (res == SQUASH_OK && decompressed_length == input_length)
+    munit_assert_memory_not_equal(input_length, decompressed, LOREM_IPSUM);
+
+  /* Streaming API, which reuses the digest cached above */
+  compressed_length = squash_test_dictionary_stream (codec, SQUASH_STREAM_COMPRESS, options,
+                                                     max_compressed_length, compressed, input_length, LOREM_IPSUM);
+  memset (decompressed, 0, input_length);
+  decompressed_length = squash_test_dictionary_stream (codec, SQUASH_STREAM_DECOMPRESS, options,
+                                                       input_length, decompressed, compressed_length, compressed);
+  munit_assert_size(decompressed_length, ==, input_length);
+  munit_assert_memory_equal(input_length, decompressed, LOREM_IPSUM);
+
+  squash_object_unref (options);
+  free (compressed);
+  free (plain);
+  free (decompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_dictionary_train(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  /* Train on the first half of the text, and check the dictionary
+     helps with a slice of the second half, which it has never seen
+     but which uses the same vocabulary. */
+  const size_t training_length = LOREM_IPSUM_LENGTH / 2;
+  const uint8_t* samples[64];
+  size_t sample_sizes[64];
+  for (size_t i = 0 ; i < 64 ; i++) {
+    samples[i] = LOREM_IPSUM + ((i * 37) % (training_length - 128));
+    sample_sizes[i] = 128;
+  }
+
+  SquashDictionary* dictionary = squash_dictionary_train (codec, 1024, 64, samples, sample_sizes, NULL);
+  if ((squash_codec_get_info (codec) & SQUASH_CODEC_INFO_DICTIONARY) == 0) {
+    munit_assert_null(dictionary);
+    return MUNIT_SKIP;
+  }
+  munit_assert_not_null(dictionary);
+  munit_assert_size(squash_dictionary_get_size (dictionary), >, 0);
+  munit_assert_size(squash_dictionary_get_size (dictionary), <=, 1024);
+
+  SquashOptions* options = squash_options_new (codec, NULL);
+  munit_assert_not_null(options);
+  squash_object_ref (options);
+  SQUASH_ASSERT_OK(squash_options_set_dictionary (options, dictionary));
+
+  const uint8_t* held_out = LOREM_IPSUM + LOREM_IPSUM_LENGTH - 512;
+  const size_t held_out_length = 256;
+  munit_assert_size(LOREM_IPSUM_LENGTH - 512, >=, training_length);
+
+  const size_t max_compressed_length = squash_codec_get_max_compressed_size (codec, held_out_length);
+  uint8_t* compressed = munit_malloc (max_compressed_length);
+  uint8_t* decompressed = munit_malloc (held_out_length);
+
+  size_t plain_length = max_compressed_length;
+  SQUASH_ASSERT_OK(squash_codec_compress (codec, &plain_length, compressed, held_out_length, held_out, NULL));
+
+  size_t compressed_length = max_compressed_length;
+  SQUASH_ASSERT_OK(squash_codec_compress_with_options (codec, &compressed_length, compressed, held_out_length, held_out, options));
+  munit_assert_size(compressed_length, <, plain_length);
+
+  size_t decompressed_length = held_out_length;
+  SQUASH_ASSERT_OK(squash_codec_decompress_with_options (codec, &decompressed_length, decompressed, compressed_length, compressed, options));
+  munit_assert_size(decompressed_length, ==, held_out_length);
+  munit_assert_memory_equal(held_out_length, decompressed, held_out);
+
+  squash_object_unref (options);
+  free (compressed);
+  free (decompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_parallel(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* inner = (SquashCodec*) user_data;
+
+  char name[256];
+  snprintf (name, sizeof (name), "parallel:%s", squash_codec_get_name (inner));
+  SquashCodec* codec = squash_get_codec (name);
+  munit_assert_not_null(codec);
+  munit_assert_ptr_equal(codec, squash_get_codec (name));
+
+  /* A few blocks, the last one partial. */
+  const size_t uncompressed_length = (5 * 1024 * 1024) / 2;
+  uint8_t* uncompressed = squash_test_lorem_ipsum_new (uncompressed_length);
+
+  size_t compressed_length = squash_codec_get_max_compressed_size (codec, uncompressed_length);
+  uint8_t* compressed = munit_malloc (compressed_length);
+  size_t decompressed_length = uncompressed_length;
+  uint8_t* decompressed = munit_malloc (decompressed_length);
+
+  SquashStatus res = squash_codec_compress (codec, &compressed_length, compressed, uncompressed_length, uncompressed, NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size(squash_codec_get_uncompressed_size (codec, compressed_length, compressed), ==, uncompressed_length);
+
+  res = squash_codec_decompress (codec, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size(decompressed_length, ==, uncompressed_length);
+  munit_assert_memory_equal(uncompressed_length, decompressed, uncompressed);
+
+  decompressed_length = uncompressed_length - 1;
+  res = squash_codec_decompress (codec, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+  munit_assert_int (res, ==, SQUASH_BUFFER_FULL);
+
+  free (uncompressed);
+  free (compressed);
+  free (decompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_adaptive(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* inner = (SquashCodec*) user_data;
+
+  char name[256];
+  snprintf (name, sizeof (name), "adaptive:%s", squash_codec_get_name (inner));
+  SquashCodec* codec = squash_get_codec (name);
+  munit_assert_not_null(codec);
+  munit_assert_ptr_equal(codec, squash_get_codec (name));
+
+  const size_t uncompressed_length = 65536;
+  uint8_t* text = squash_test_lorem_ipsum_new (uncompressed_length);
+  uint8_t* noise = munit_malloc (uncompressed_length);
+  munit_rand_memory (uncompressed_length, noise);
+
+  munit_assert_double(squash_probe_compressibility (uncompressed_length, text), <, 0.8);
+  munit_assert_double(squash_probe_compressibility (uncompressed_length, noise), >, 0.95);
+
+  const size_t max_compressed_length = squash_codec_get_max_compressed_size (codec, uncompressed_length);
+  uint8_t* compressed = munit_malloc (max_compressed_length);
+  uint8_t* decompressed = munit_malloc (uncompressed_length);
+
+  for (int i = 0 ; i < 2 ; i++) {
+    const uint8_t* uncompressed = (i == 0) ? text : noise;
+
+    size_t compressed_length = max_compressed_length;
+    SQUASH_ASSERT_OK(squash_codec_compress (codec, &compressed_length, compressed, uncompressed_length, uncompressed, NULL));
+    munit_assert_size(compressed_length, <=, uncompressed_length + 1);
+
+    /* Random data is never worth compressing */
+    if (uncompressed == noise)
+      munit_assert_size(compressed_length, ==, uncompressed_length + 1);
+
+    size_t decompressed_length = uncompressed_length;
+    SQUASH_ASSERT_OK(squash_codec_decompress (codec, &decompressed_length, decompressed, compressed_length, compressed, NULL));
+    munit_assert_size(decompressed_length, ==, uncompressed_length);
+    munit_assert_memory_equal(uncompressed_length, decompressed, uncompressed);
+  }
+
+  /* Too short for the wrapped codec to shrink once its framing is
+     counted, even though the probe thinks it is worth trying.  Some
+     codecs report running out of room as a generic failure, which
+     must still end up stored raw. */
+  const size_t short_length = 8;
+  munit_assert_double(squash_probe_compressibility (short_length, text), <, 0.95);
+  const size_t available[] = { short_length + 1, squash_codec_get_max_compressed_size (codec, short_length) };
+  for (size_t i = 0 ; i < sizeof (available) / sizeof (available[0]) ; i++) {
+    size_t compressed_length = available[i];
+    SQUASH_ASSERT_OK(squash_codec_compress (codec, &compressed_length, compressed, short_length, text, NULL));
+    munit_assert_size(compressed_length, <=, short_length + 1);
+
+    size_t decompressed_length = short_length;
+    SQUASH_ASSERT_OK(squash_codec_decompress (codec, &decompressed_length, decompressed, compressed_length, compressed, NULL));
+    munit_assert_size(decompressed_length, ==, short_length);
+    munit_assert_memory_equal(short_length, decompressed, text);
+  }
+
+  free (text);
+  free (noise);
+  free (compressed);
+  free (decompressed);
+
+  return MUNIT_OK;
+}
+
+static size_t
+squash_test_seekable_tail (uint8_t* p, uint64_t compressed_size, uint64_t uncompressed_size) {
+  size_t pos = 0;
+
+  p[pos++] = 0x00;
+
+  const size_t index_pos = pos;
+  pos += squash_test_write_varuint (p + pos, 1);
+  pos += squash_test_write_varuint (p + pos, compressed_size);
+  pos += squash_test_write_varuint (p + pos, uncompressed_size);
+  const size_t index_size = pos - index_pos;
+
+  p[pos++] = (uint8_t) index_size;
+  p[pos++] = 0;
+  p[pos++] = 0;
+  p[pos++] = 0;
+  memcpy (p + pos, "SQSK", 4);
+  pos += 4;
+
+  return pos;
+}
+
+static MunitResult
+squash_test_seekable_corrupt(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* inner = (SquashCodec*) user_data;
+
+  char name[256];
+  snprintf (name, sizeof (name), "seekable:%s", squash_codec_get_name (inner));
+  SquashCodec* codec = squash_get_codec (name);
+  munit_assert_not_null(codec);
+
+  const size_t block_size = squash_codec_get_block_size (codec);
+  uint8_t data[128] = { 0, };
+  uint8_t decompressed[64];
+  size_t data_length, decompressed_length;
+
+  /* A block claiming to be larger than the block size. */
+  data_length = squash_test_write_varuint (data, 16);
+  data_length += squash_test_write_varuint (data + data_length, (uint64_t) block_size + 1);
+  data_length += 16;
+  data_length += squash_test_seekable_tail (data + data_length, 16, (uint64_t) block_size + 1);
+
+  decompressed_length = sizeof (decompressed);
+  munit_assert_int(squash_codec_decompress (codec, &decompressed_length, decompressed, data_length, data, NULL), ==, SQUASH_INVALID_BUFFER);
+  munit_assert_size(squash_codec_get_uncompressed_size (codec, data_length, data), ==, 0);
+
+  /* An index describing more data than precedes it. */
+  data_length = squash_test_seekable_tail (data, UINT64_C(1) << 40, 5);
+  munit_assert_size(squash_codec_get_uncompressed_size (codec, data_length, data), ==, 0);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_frozen_options(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  const SquashOptionInfo* info = squash_codec_get_option_info (codec);
+  if (info == NULL)
+    return MUNIT_SKIP;
+
+  /* Names are looked up case-insensitively through the index */
+  for (ptrdiff_t i = 0 ; info[i].name != NULL ; i++) {
+    char upper[128];
+    size_t l;
+    for (l = 0 ; info[i].name[l] != '\0' && l < sizeof (upper) - 1 ; l++)
+      upper[l] = (char) toupper ((unsigned char) info[i].name[l]);
+    upper[l] = '\0';
+    munit_assert_int64(squash_codec_get_option_index (codec, info[i].name), ==, i);
+    munit_assert_int64(squash_codec_get_option_index (codec, upper), ==, i);
+  }
+  munit_assert_int64(squash_codec_get_option_index (codec, "no-such-option"), ==, -1);
+
+  SquashOptions* options = squash_options_new (codec, NULL);
+  munit_assert_not_null(options);
+  munit_assert_false(squash_options_is_frozen (options));
+  munit_assert_ptr_equal(squash_options_freeze (options), options);
+  munit_assert_true(squash_options_is_frozen (options));
+  munit_assert_uint(squash_object_get_ref_count (options), ==, 1);
+
+  munit_assert_int(squash_options_set_threads (options, 2), ==, SQUASH_STATE);
+  munit_assert_int(squash_options_parse_option (options, info[0].name, "1"), ==, SQUASH_STATE);
+
+  const size_t max_compressed_length = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH);
+  uint8_t* compressed = munit_malloc (max_compressed_length);
+  uint8_t decompressed[LOREM_IPSUM_LENGTH];
+
+  size_t compressed_length = max_compressed_length;
+  SQUASH_ASSERT_OK(squash_codec_compress_with_options (codec, &compressed_length, compressed, LOREM_IPSUM_LENGTH, LOREM_IPSUM, options));
+  size_t decompressed_length = LOREM_IPSUM_LENGTH;
+  SQUASH_ASSERT_OK(squash_codec_decompress_with_options (codec, &decompressed_length, decompressed, compressed_length, compressed, options));
+  munit_assert_size(decompressed_length, ==, LOREM_IPSUM_LENGTH);
+  munit_assert_memory_equal(LOREM_IPSUM_LENGTH, decompressed, LOREM_IPSUM);
+
+  /* Frozen options aren't consumed like floating ones */
+  munit_assert_uint(squash_object_get_ref_count (options), ==, 1);
+
+  squash_object_unref (options);
+  free (compressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_cached_options(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  const size_t max_compressed_length = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH);
+  uint8_t* compressed = munit_malloc (max_compressed_length);
+  uint8_t* expected = munit_malloc (max_compressed_length);
+  uint8_t decompressed[LOREM_IPSUM_LENGTH];
+  size_t compressed_length, expected_length, decompressed_length;
+
+  /* The level is the option most likely to be passed to the varargs
+     API; use the lowest one so the results differ from the defaults. */
+  char level[16] = "";
+  const ptrdiff_t level_n = squash_codec_get_option_index (codec, "level");
+  if (level_n >= 0) {
+    const SquashOptionInfo* info = squash_codec_get_option_info (codec) + level_n;
+    if (info->type == SQUASH_OPTION_TYPE_RANGE_INT)
+      snprintf (level, sizeof (level), "%d", info->info.range_int.min);
+    else if (info->type == SQUASH_OPTION_TYPE_ENUM_INT && info->info.enum_int.values_length > 0)
+      snprintf (level, sizeof (level), "%d", info->info.enum_int.values[0]);
+  }
+
+  /* Repeated calls reuse the same cached options, which must behave
+     exactly like a freshly parsed group. */
+  for (int i = 0 ; i < 3 ; i++) {
+    expected_length = max_compressed_length;
+    SQUASH_ASSERT_OK(squash_codec_compress_with_options (codec, &expected_length, expected, LOREM_IPSUM_LENGTH, LOREM_IPSUM, squash_options_new (codec, NULL)));
+    compressed_length = max_compressed_length;
+    SQUASH_ASSERT_OK(squash_codec_compress (codec, &compressed_length, compressed, LOREM_IPSUM_LENGTH, LOREM_IPSUM, NULL));
+    munit_assert_size(compressed_length, ==, expected_length);
+    munit_assert_memory_equal(compressed_length, compressed, expected);
+
+    decompressed_length = LOREM_IPSUM_LENGTH;
+    SQUASH_ASSERT_OK(squash_codec_decompress (codec, &decompressed_length, decompressed, compressed_length, compressed, NULL));
+    munit_assert_size(decompressed_length, ==, LOREM_IPSUM_LENGTH);
+    munit_assert_memory_equal(LOREM_IPSUM_LENGTH, decompressed, LOREM_IPSUM);
+
+    if (level[0] == '\0')
+      continue;
+
+    expected_length = max_compressed_length;
+    SQUASH_ASSERT_OK(squash_codec_compress_with_options (codec, &expected_length, expected, LOREM_IPSUM_LENGTH, LOREM_IPSUM, squash_options_new (codec, "level", level, NULL)));
+    compressed_length = max_compressed_length;
+    SQUASH_ASSERT_OK(squash_codec_compress (codec, &compressed_length, compressed, LOREM_IPSUM_LENGTH, LOREM_IPSUM, "level", level, NULL));
+    munit_assert_size(compressed_length, ==, expected_length);
+    munit_assert_memory_equal(compressed_length, compressed, expected);
+
+    decompressed_length = LOREM_IPSUM_LENGTH;
+    SQUASH_ASSERT_OK(squash_codec_decompress (codec, &decompressed_length, decompressed, compressed_length, compressed, "level", level, NULL));
+    munit_assert_size(decompressed_length, ==, LOREM_IPSUM_LENGTH);
+    munit_assert_memory_equal(LOREM_IPSUM_LENGTH, decompressed, LOREM_IPSUM);
+  }
+
+  /* Now that the lists have been seen, passing them again must not
+     allocate anything beyond what compressing with a group of options
+     the caller already parsed does. */
+  SquashOptions* options = (level[0] == '\0') ?
+    squash_options_new (codec, NULL) :
+    squash_options_new (codec, "level", level, NULL);
+  squash_object_ref_sink (options);
+
+  size_t allocations = squash_test_get_allocations ();
+  expected_length = max_compressed_length;
+  SQUASH_ASSERT_OK(squash_codec_compress_with_options (codec, &expected_length, expected, LOREM_IPSUM_LENGTH, LOREM_IPSUM, options));
+  const size_t expected_allocations = squash_test_get_allocations () - allocations;
+
+  allocations = squash_test_get_allocations ();
+  compressed_length = max_compressed_length;
+  if (level[0] == '\0')
+    SQUASH_ASSERT_OK(squash_codec_compress (codec, &compressed_length, compressed, LOREM_IPSUM_LENGTH, LOREM_IPSUM, NULL));
+  else
+    SQUASH_ASSERT_OK(squash_codec_compress (codec, &compressed_length, compressed, LOREM_IPSUM_LENGTH, LOREM_IPSUM, "level", level, NULL));
+  munit_assert_size(squash_test_get_allocations () - allocations, <=, expected_allocations);
+  munit_assert_size(compressed_length, ==, expected_length);
+  munit_assert_memory_equal(compressed_length, compressed, expected);
+
+  squash_object_unref (options);
+  free (expected);
+  free (compressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_select(MUNIT_UNUSED const MunitParameter params[], MUNIT_UNUSED void* user_data) {
+  const size_t uncompressed_length = 65536;
+  uint8_t* uncompressed = squash_test_lorem_ipsum_new (uncompressed_length);
+
+  SquashOptions* options = NULL;
+  SquashCodec* codec = squash_select_codec (uncompressed_length, uncompressed, SQUASH_SELECT_TARGET_SPEED, 0.0, &options);
+  munit_assert_not_null(codec);
+  squash_object_ref (options);
+
+  const size_t max_compressed_length = squash_codec_get_max_compressed_size (codec, uncompressed_length);
+  uint8_t* compressed = munit_malloc (max_compressed_length);
+  uint8_t* decompressed = munit_malloc (uncompressed_length);
+
+  size_t compressed_length = max_compressed_length;
+  SQUASH_ASSERT_OK(squash_codec_compress_with_options (codec, &compressed_length, compressed, uncompressed_length, uncompressed, options));
+  /* Every codec meets a speed target of 0, so the best ratio wins. */
+  munit_assert_size(compressed_length, <, uncompressed_length);
+
+  size_t decompressed_length = uncompressed_length;
+  SQUASH_ASSERT_OK(squash_codec_decompress_with_options (codec, &decompressed_length, decompressed, compressed_length, compressed, options));
+  munit_assert_size(decompressed_length, ==, uncompressed_length);
+  munit_assert_memory_equal(uncompressed_length, decompressed, uncompressed);
+
+  /* The second time around the result comes from the cache */
+  SquashOptions* cached_options = NULL;
+  munit_assert_ptr_equal(codec, squash_select_codec (uncompressed_length, uncompressed, SQUASH_SELECT_TARGET_SPEED, 0.0, &cached_options));
+  squash_object_unref (squash_object_ref (cached_options));
+
+  /* An unreachable target still gets the closest codec */
+  munit_assert_not_null(squash_select_codec (uncompressed_length, uncompressed, SQUASH_SELECT_TARGET_RATIO, 1e9, NULL));
+
+  munit_assert_null(squash_select_codec (0, uncompressed, SQUASH_SELECT_TARGET_SPEED, 0.0, NULL));
+
+  squash_object_unref (options);
+  free (uncompressed);
+  free (compressed);
+  free (decompressed);
+
+  return MUNIT_OK;
+}
+
 #if defined(SQUASH_TEST_DATA_DIR)
 
 static MunitResult
@@ -125,6 +750,17 @@ squash_test_endianness_le(MUNIT_UNUSED const MunitParameter params[], void* user
 MunitTest squash_buffer_tests[] = {
   { (char*) "/basic", squash_test_basic, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { (char*) "/single-byte", squash_test_single_byte, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/repeated", squash_test_repeated, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/batch", squash_test_batch, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/iov", squash_test_iov, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/dictionary", squash_test_dictionary, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/dictionary/train", squash_test_dictionary_train, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/parallel", squash_test_parallel, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/adaptive", squash_test_adaptive, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/seekable/corrupt", squash_test_seekable_corrupt, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/options/frozen", squash_test_frozen_options, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/options/cached", squash_test_cached_options, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/select", squash_test_select, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL },
 #if defined(SQUASH_TEST_DATA_DIR)
   { (char*) "/endianness", squash_test_endianness_le, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   /* { (char*) "/endianness/be", squash_test_endianness_be, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER }, */
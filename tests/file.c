@@ -104,6 +104,288 @@ squash_test_io(const MunitParameter params[], void* user_data) {
   return MUNIT_OK;
 }
 
+static MunitResult
+squash_test_io_async(const MunitParameter params[], void* user_data) {
+  struct Single* data = (struct Single*) user_data;
+  munit_assert_not_null (data);
+
+  /* lz4-raw can't tell a short output buffer from corrupt input, so it
+     can't decompress highly compressible data without knowing the
+     size. */
+  if (strcmp (squash_codec_get_name (data->codec), "density") == 0 ||
+      strcmp (squash_codec_get_name (data->codec), "lz4-raw") == 0)
+    return MUNIT_SKIP;
+
+  /* Large enough that the reader has to cycle through its buffers a
+     few times. */
+  const size_t uncompressed_size = (size_t) (1024 * 1024 * 5) / 2;
+  uint8_t* uncompressed = squash_test_lorem_ipsum_new (uncompressed_size);
+
+  SquashFile* file = squash_file_steal (data->codec, data->file, NULL);
+  munit_assert_not_null (file);
+  SquashStatus res = squash_file_write (file, uncompressed_size, uncompressed);
+  SQUASH_ASSERT_OK(res);
+  squash_file_free (file, NULL);
+
+  fflush (data->file);
+  rewind (data->file);
+
+  file = squash_file_steal (data->codec, data->file, NULL);
+  munit_assert_not_null (file);
+  res = squash_file_set_async (file, true);
+  SQUASH_ASSERT_OK(res);
+
+  uint8_t* decompressed = munit_malloc (uncompressed_size);
+  size_t total_read = 0;
+  do {
+    size_t bytes_read = (size_t) munit_rand_int_range (1, 128 * 1024);
+    if (bytes_read > uncompressed_size - total_read)
+      bytes_read = uncompressed_size - total_read + 1;
+    res = squash_file_read (file, &bytes_read, decompressed + total_read);
+    SQUASH_ASSERT_NO_ERROR(res);
+    total_read += bytes_read;
+    munit_assert_size (total_read, <=, uncompressed_size);
+  } while (!squash_file_eof (file));
+
+  munit_assert_size (total_read, ==, uncompressed_size);
+  munit_assert_memory_equal(uncompressed_size, decompressed, uncompressed);
+
+  size_t bytes_read = 1;
+  res = squash_file_read (file, &bytes_read, decompressed);
+  SQUASH_ASSERT_STATUS(res, SQUASH_END_OF_STREAM);
+  munit_assert_size (bytes_read, ==, 0);
+
+  squash_file_free (file, NULL);
+
+  free (decompressed);
+  free (uncompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_io_mmap(const MunitParameter params[], void* user_data) {
+  struct Single* data = (struct Single*) user_data;
+  munit_assert_not_null (data);
+
+  /* Random data, so the compressed file spans several chunks. */
+  const size_t uncompressed_size = (size_t) (1024 * 1024 * 5) / 2;
+  uint8_t* uncompressed = munit_malloc (uncompressed_size);
+  munit_rand_memory (uncompressed_size, uncompressed);
+
+  SquashFile* file = squash_file_steal (data->codec, data->file, NULL);
+  munit_assert_not_null (file);
+  SquashStatus res = squash_file_write (file, uncompressed_size, uncompressed);
+  SQUASH_ASSERT_OK(res);
+  squash_file_free (file, NULL);
+
+  fflush (data->file);
+  const off_t compressed_size = ftello (data->file);
+  rewind (data->file);
+
+  file = squash_file_steal (data->codec, data->file, NULL);
+  munit_assert_not_null (file);
+  res = squash_file_set_mmap (file, true);
+  SQUASH_ASSERT_OK(res);
+
+  uint8_t* decompressed = munit_malloc (uncompressed_size);
+  size_t total_read = 0;
+  do {
+    size_t bytes_read = (size_t) munit_rand_int_range (1, 128 * 1024);
+    if (bytes_read > uncompressed_size - total_read)
+      bytes_read = uncompressed_size - total_read + 1;
+    res = squash_file_read (file, &bytes_read, decompressed + total_read);
+    SQUASH_ASSERT_NO_ERROR(res);
+    total_read += bytes_read;
+    munit_assert_size (total_read, <=, uncompressed_size);
+
+#if !defined(_WIN32)
+    /* Mapped input is never read through the FILE, so its position
+       doesn't move until the SquashFile is freed; with stdio it
+       would already be somewhere past the start. */
+    munit_assert_int64 ((int64_t) ftello (data->file), ==, 0);
+#endif
+  } while (!squash_file_eof (file));
+
+  munit_assert_size (total_read, ==, uncompressed_size);
+  munit_assert_memory_equal(uncompressed_size, decompressed, uncompressed);
+
+  res = squash_file_set_mmap (file, false);
+  SQUASH_ASSERT_STATUS(res, SQUASH_INVALID_OPERATION);
+
+  squash_file_free (file, NULL);
+
+  /* The FILE should be left where stdio would have left it. */
+  munit_assert_int64 ((int64_t) ftello (data->file), ==, (int64_t) compressed_size);
+
+  free (decompressed);
+  free (uncompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_write_async(const MunitParameter params[], void* user_data) {
+  struct Single* data = (struct Single*) user_data;
+  munit_assert_not_null (data);
+
+  const size_t uncompressed_size = (size_t) (1024 * 1024 * 5) / 2;
+  uint8_t* uncompressed = squash_test_lorem_ipsum_new (uncompressed_size);
+
+  SquashFile* file = squash_file_steal (data->codec, data->file, NULL);
+  munit_assert_not_null (file);
+  SquashStatus res = squash_file_set_async (file, true);
+  SQUASH_ASSERT_OK(res);
+
+  const bool can_flush = (squash_codec_get_info (data->codec) & SQUASH_CODEC_INFO_CAN_FLUSH) == SQUASH_CODEC_INFO_CAN_FLUSH;
+  size_t total_written = 0;
+  while (total_written < uncompressed_size) {
+    size_t bytes = (size_t) munit_rand_int_range (1, 256 * 1024);
+    if (bytes > uncompressed_size - total_written)
+      bytes = uncompressed_size - total_written;
+    res = squash_file_write (file, bytes, uncompressed + total_written);
+    SQUASH_ASSERT_OK(res);
+    total_written += bytes;
+
+    if (can_flush && munit_rand_int_range (0, 7) == 0) {
+      res = squash_file_flush (file);
+      SQUASH_ASSERT_OK(res);
+    }
+  }
+  res = squash_file_free (file, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  fflush (data->file);
+  rewind (data->file);
+
+  file = squash_file_steal (data->codec, data->file, NULL);
+  munit_assert_not_null (file);
+
+  uint8_t* decompressed = munit_malloc (uncompressed_size);
+  size_t total_read = 0;
+  do {
+    size_t bytes_read = uncompressed_size - total_read + 1;
+    res = squash_file_read (file, &bytes_read, decompressed + total_read);
+    SQUASH_ASSERT_NO_ERROR(res);
+    total_read += bytes_read;
+    munit_assert_size (total_read, <=, uncompressed_size);
+  } while (!squash_file_eof (file));
+
+  munit_assert_size (total_read, ==, uncompressed_size);
+  munit_assert_memory_equal(uncompressed_size, decompressed, uncompressed);
+
+  squash_file_free (file, NULL);
+
+  free (decompressed);
+  free (uncompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_seek(const MunitParameter params[], void* user_data) {
+  struct Single* data = (struct Single*) user_data;
+  munit_assert_not_null (data);
+
+  char codec_name[128];
+  snprintf (codec_name, sizeof (codec_name), "seekable:%s", squash_codec_get_name (data->codec));
+  SquashCodec* codec = squash_get_codec (codec_name);
+  munit_assert_not_null (codec);
+
+  /* A few blocks, with a partial one at the end. */
+  const size_t uncompressed_size = (size_t) (1024 * 1024) - 4321;
+  uint8_t* uncompressed = munit_malloc (uncompressed_size);
+  for (size_t i = 0 ; i < uncompressed_size ; i++)
+    uncompressed[i] = (uint8_t) ((i * 7) + (i >> 11));
+
+  /* The seekable data doesn't have to start at the beginning of the
+     file. */
+  const size_t offset = (size_t) munit_rand_int_range (0, 64);
+  const uint8_t filler[64] = { 0, };
+  munit_assert_size (fwrite (filler, 1, offset, data->file), ==, offset);
+
+  SquashFile* file = squash_file_steal (codec, data->file, NULL);
+  munit_assert_not_null (file);
+  SquashStatus res = squash_file_write (file, uncompressed_size, uncompressed);
+  SQUASH_ASSERT_OK(res);
+  squash_file_free (file, NULL);
+
+  fflush (data->file);
+  munit_assert_int (fseek (data->file, (long) offset, SEEK_SET), ==, 0);
+
+  file = squash_file_steal (codec, data->file, NULL);
+  munit_assert_not_null (file);
+
+  uint8_t* decompressed = munit_malloc (uncompressed_size);
+
+  /* Reading sequentially still works, and isn't disturbed by pread. */
+  size_t bytes_read = 4096;
+  res = squash_file_read (file, &bytes_read, decompressed);
+  SQUASH_ASSERT_NO_ERROR(res);
+  munit_assert_size (bytes_read, ==, 4096);
+  munit_assert_memory_equal (bytes_read, decompressed, uncompressed);
+
+  for (int i = 0 ; i < 16 ; i++) {
+    const size_t pos = (size_t) munit_rand_int_range (0, (int) uncompressed_size - 1);
+    size_t length = (size_t) munit_rand_int_range (1, 512 * 1024);
+    const size_t expected = (length < uncompressed_size - pos) ? length : uncompressed_size - pos;
+
+    res = squash_file_pread (file, &length, decompressed, pos);
+    SQUASH_ASSERT_OK(res);
+    munit_assert_size (length, ==, expected);
+    munit_assert_memory_equal (length, decompressed, uncompressed + pos);
+  }
+
+  bytes_read = 4096;
+  res = squash_file_read (file, &bytes_read, decompressed);
+  SQUASH_ASSERT_NO_ERROR(res);
+  munit_assert_size (bytes_read, ==, 4096);
+  munit_assert_memory_equal (bytes_read, decompressed, uncompressed + 4096);
+
+  bytes_read = 1;
+  res = squash_file_pread (file, &bytes_read, decompressed, uncompressed_size);
+  SQUASH_ASSERT_STATUS(res, SQUASH_END_OF_STREAM);
+  munit_assert_size (bytes_read, ==, 0);
+
+  /* After seeking, reads come from the new position. */
+  res = squash_file_seek (file, 100, SEEK_CUR);
+  SQUASH_ASSERT_OK(res);
+  bytes_read = 1000;
+  res = squash_file_read (file, &bytes_read, decompressed);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size (bytes_read, ==, 1000);
+  munit_assert_memory_equal (bytes_read, decompressed, uncompressed + 8192 + 100);
+
+  res = squash_file_seek (file, -100, SEEK_END);
+  SQUASH_ASSERT_OK(res);
+  bytes_read = 1000;
+  res = squash_file_read (file, &bytes_read, decompressed);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size (bytes_read, ==, 100);
+  munit_assert_memory_equal (bytes_read, decompressed, uncompressed + uncompressed_size - 100);
+  munit_assert_true (squash_file_eof (file));
+
+  res = squash_file_seek (file, -1, SEEK_SET);
+  SQUASH_ASSERT_STATUS(res, SQUASH_RANGE);
+
+  squash_file_free (file, NULL);
+
+  /* Only seekable codecs can seek. */
+  if (strncmp (squash_codec_get_name (data->codec), "seekable:", 9) != 0) {
+    rewind (data->file);
+    file = squash_file_steal (data->codec, data->file, NULL);
+    munit_assert_not_null (file);
+    res = squash_file_seek (file, 0, SEEK_SET);
+    SQUASH_ASSERT_STATUS(res, SQUASH_INVALID_OPERATION);
+    squash_file_free (file, NULL);
+  }
+
+  free (decompressed);
+  free (uncompressed);
+
+  return MUNIT_OK;
+}
+
 static MunitResult
 squash_test_splice_full(const MunitParameter params[], void* user_data) {
   struct Triple* data = (struct Triple*) user_data;
@@ -154,6 +436,156 @@ squash_test_splice_full(const MunitParameter params[], void* user_data) {
   return MUNIT_OK;
 }
 
+static MunitResult
+squash_test_splice_threads(const MunitParameter params[], void* user_data) {
+  struct Triple* data = (struct Triple*) user_data;
+  munit_assert_not_null (data);
+
+  SquashOptions* options = squash_test_threaded_options_new (data->codec, 64 * 1024);
+  if (options == NULL)
+    return MUNIT_SKIP;
+
+  /* Several chunks worth */
+  const size_t uncompressed_size = (size_t) (1024 * 1024);
+  uint8_t* uncompressed_data = squash_test_threaded_data_new (uncompressed_size);
+
+  FILE* uncompressed = data->file[0];
+  FILE* compressed   = data->file[1];
+  FILE* decompressed = data->file[2];
+
+  munit_assert_size (fwrite (uncompressed_data, 1, uncompressed_size, uncompressed), ==, uncompressed_size);
+  fflush (uncompressed);
+  rewind (uncompressed);
+
+  SquashStatus res = squash_splice_with_options (data->codec, SQUASH_STREAM_COMPRESS, compressed, uncompressed, 0, options);
+  SQUASH_ASSERT_OK(res);
+  rewind (compressed);
+
+  res = squash_splice (data->codec, SQUASH_STREAM_DECOMPRESS, decompressed, compressed, 0, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  munit_assert_int64 ((int64_t) ftello (decompressed), ==, (int64_t) uncompressed_size);
+  rewind (decompressed);
+  {
+    uint8_t* decompressed_data = munit_malloc (uncompressed_size);
+
+    munit_assert_size (fread (decompressed_data, 1, uncompressed_size, decompressed), ==, uncompressed_size);
+    munit_assert_memory_equal(uncompressed_size, decompressed_data, uncompressed_data);
+
+    free (decompressed_data);
+  }
+
+  free (uncompressed_data);
+  squash_object_unref (options);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_splice_high_ratio(const MunitParameter params[], void* user_data) {
+  struct Triple* data = (struct Triple*) user_data;
+  munit_assert_not_null (data);
+
+  /* Without the decompressed size the splice has to grow its output
+     whenever the codec runs out of room, but lz4-raw reports that as
+     corrupt input, which at this ratio it always runs into. */
+  if (strcmp (squash_codec_get_name (data->codec), "lz4-raw") == 0)
+    return MUNIT_SKIP;
+
+  /* Compresses well enough that the output mapping has to grow
+     several times while decompressing. */
+  const size_t uncompressed_size = (size_t) (1024 * 1024 * 8);
+  uint8_t* uncompressed_data = munit_calloc (1, uncompressed_size);
+  for (size_t i = 0 ; i < uncompressed_size ; i += 64 * 1024)
+    uncompressed_data[i] = (uint8_t) (i >> 16);
+
+  FILE* uncompressed = data->file[0];
+  FILE* compressed   = data->file[1];
+  FILE* decompressed = data->file[2];
+
+  munit_assert_size (fwrite (uncompressed_data, 1, uncompressed_size, uncompressed), ==, uncompressed_size);
+  fflush (uncompressed);
+  rewind (uncompressed);
+
+  SquashStatus res = squash_splice (data->codec, SQUASH_STREAM_COMPRESS, compressed, uncompressed, 0, NULL);
+  SQUASH_ASSERT_OK(res);
+  rewind (compressed);
+
+  res = squash_splice (data->codec, SQUASH_STREAM_DECOMPRESS, decompressed, compressed, 0, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  munit_assert_int64 ((int64_t) ftello (decompressed), ==, (int64_t) uncompressed_size);
+  rewind (decompressed);
+  uint8_t* decompressed_data = munit_malloc (uncompressed_size);
+  munit_assert_size (fread (decompressed_data, 1, uncompressed_size, decompressed), ==, uncompressed_size);
+  munit_assert_memory_equal(uncompressed_size, decompressed_data, uncompressed_data);
+
+  /* Stopping part of the way through */
+  const size_t partial_size = (size_t) munit_rand_int_range (1024 * 1024, (int) uncompressed_size - 1);
+  rewind (compressed);
+  munit_assert_int (fseek (decompressed, 0, SEEK_SET), ==, 0);
+  res = squash_splice (data->codec, SQUASH_STREAM_DECOMPRESS, decompressed, compressed, partial_size, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  munit_assert_int64 ((int64_t) ftello (decompressed), ==, (int64_t) partial_size);
+  rewind (decompressed);
+  munit_assert_size (fread (decompressed_data, 1, partial_size, decompressed), ==, partial_size);
+  munit_assert_memory_equal(partial_size, decompressed_data, uncompressed_data);
+
+  free (decompressed_data);
+  free (uncompressed_data);
+
+  return MUNIT_OK;
+}
+
+#if !defined(_WIN32)
+static MunitResult
+squash_test_splice_fd(const MunitParameter params[], void* user_data) {
+  struct Triple* data = (struct Triple*) user_data;
+  munit_assert_not_null (data);
+  uint8_t decompressed_data[LOREM_IPSUM_LENGTH];
+  int pipe_fds[2];
+
+  const int uncompressed = fileno (data->file[0]);
+  const int compressed   = fileno (data->file[1]);
+  const int decompressed = fileno (data->file[2]);
+
+  munit_assert_int64 ((int64_t) write (uncompressed, LOREM_IPSUM, LOREM_IPSUM_LENGTH), ==, (int64_t) LOREM_IPSUM_LENGTH);
+  munit_assert_int64 ((int64_t) lseek (uncompressed, 0, SEEK_SET), ==, 0);
+
+  SquashStatus res = squash_splice_fd (data->codec, SQUASH_STREAM_COMPRESS, compressed, uncompressed, 0, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  /* File to file */
+  munit_assert_int64 ((int64_t) lseek (compressed, 0, SEEK_SET), ==, 0);
+  res = squash_splice_fd (data->codec, SQUASH_STREAM_DECOMPRESS, decompressed, compressed, 0, NULL);
+  SQUASH_ASSERT_OK(res);
+
+  munit_assert_int64 ((int64_t) lseek (decompressed, 0, SEEK_CUR), ==, (int64_t) LOREM_IPSUM_LENGTH);
+  munit_assert_int64 ((int64_t) lseek (decompressed, 0, SEEK_SET), ==, 0);
+  munit_assert_int64 ((int64_t) read (decompressed, decompressed_data, LOREM_IPSUM_LENGTH), ==, (int64_t) LOREM_IPSUM_LENGTH);
+  munit_assert_memory_equal(LOREM_IPSUM_LENGTH, decompressed_data, LOREM_IPSUM);
+
+  /* File to pipe; everything fits in the pipe's buffer. */
+  munit_assert_int64 ((int64_t) lseek (compressed, 0, SEEK_SET), ==, 0);
+  munit_assert_int (pipe (pipe_fds), ==, 0);
+  res = squash_splice_fd (data->codec, SQUASH_STREAM_DECOMPRESS, pipe_fds[1], compressed, 0, NULL);
+  SQUASH_ASSERT_OK(res);
+  close (pipe_fds[1]);
+
+  size_t total_read = 0;
+  ssize_t bytes_read;
+  while ((bytes_read = read (pipe_fds[0], decompressed_data + total_read, LOREM_IPSUM_LENGTH - total_read)) > 0)
+    total_read += (size_t) bytes_read;
+  close (pipe_fds[0]);
+
+  munit_assert_size (total_read, ==, LOREM_IPSUM_LENGTH);
+  munit_assert_memory_equal(LOREM_IPSUM_LENGTH, decompressed_data, LOREM_IPSUM);
+
+  return MUNIT_OK;
+}
+#endif
+
 static MunitResult
 squash_test_splice_partial(const MunitParameter params[], void* user_data) {
   struct Triple* data = (struct Triple*) user_data;
@@ -248,8 +680,17 @@ squash_test_printf(const MunitParameter params[], void* user_data) {
 
 MunitTest squash_file_tests[] = {
   { (char*) "/io", squash_test_io, squash_test_single_setup, squash_test_single_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/io/async", squash_test_io_async, squash_test_single_setup, squash_test_single_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/io/mmap", squash_test_io_mmap, squash_test_single_setup, squash_test_single_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/write/async", squash_test_write_async, squash_test_single_setup, squash_test_single_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/seek", squash_test_seek, squash_test_single_setup, squash_test_single_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { (char*) "/splice/full", squash_test_splice_full, squash_test_triple_setup, squash_test_triple_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { (char*) "/splice/partial", squash_test_splice_partial, squash_test_triple_setup, squash_test_triple_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/splice/threads", squash_test_splice_threads, squash_test_triple_setup, squash_test_triple_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/splice/high-ratio", squash_test_splice_high_ratio, squash_test_triple_setup, squash_test_triple_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+#if !defined(_WIN32)
+  { (char*) "/splice/fd", squash_test_splice_fd, squash_test_triple_setup, squash_test_triple_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+#endif
   { (char*) "/printf", squash_test_printf, squash_test_single_setup, squash_test_single_tear_down, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
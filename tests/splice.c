@@ -113,8 +113,155 @@ squash_test_custom(MUNIT_UNUSED const MunitParameter params[], void* user_data)
   return MUNIT_OK;
 }
 
+static MunitResult
+squash_test_custom_large(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  /* lz4-raw can't tell a short output buffer from corrupt input, so
+     decompressing without knowing the size only works for data which
+     doesn't compress too well. */
+  if (strcmp (squash_codec_get_name (codec), "density") == 0 ||
+      strcmp (squash_codec_get_name (codec), "lz4-raw") == 0)
+    return MUNIT_SKIP;
+
+  /* Larger than the initial splice buffer, so the buffers have to
+     grow along the way. */
+  const size_t uncompressed_length = (size_t) munit_rand_int_range (256 * 1024, 512 * 1024);
+  uint8_t* uncompressed = squash_test_lorem_ipsum_new (uncompressed_length);
+
+  const size_t max_compressed_length = squash_codec_get_max_compressed_size (codec, uncompressed_length);
+  struct SpliceBuffers data = {
+    SQUASH_STREAM_COMPRESS,
+    uncompressed,
+    uncompressed_length,
+    0,
+    munit_malloc (max_compressed_length),
+    max_compressed_length,
+    0
+  };
+
+  SquashStatus res = squash_splice_custom (codec, SQUASH_STREAM_COMPRESS, write_cb, read_cb, &data, uncompressed_length, NULL);
+  SQUASH_ASSERT_OK (res);
+  munit_assert_size (data.input_pos, ==, uncompressed_length);
+
+  data.stream_type = SQUASH_STREAM_DECOMPRESS;
+  data.input = data.output;
+  data.input_length = data.output_pos;
+  data.input_pos = 0;
+  data.output = munit_malloc (uncompressed_length);
+  data.output_length = uncompressed_length;
+  data.output_pos = 0;
+
+  res = squash_splice_custom (codec, SQUASH_STREAM_DECOMPRESS, write_cb, read_cb, &data, uncompressed_length, NULL);
+  SQUASH_ASSERT_OK (res);
+  munit_assert_size (data.output_pos, ==, uncompressed_length);
+  munit_assert_memory_equal (uncompressed_length, data.output, uncompressed);
+
+  /* Again without a limit on the output, so codecs without a known
+     decompressed size write out everything they decoded. */
+  data.input_pos = 0;
+  data.output_pos = 0;
+  memset (data.output, 0, uncompressed_length);
+
+  res = squash_splice_custom (codec, SQUASH_STREAM_DECOMPRESS, write_cb, read_cb, &data, 0, NULL);
+  SQUASH_ASSERT_OK (res);
+  munit_assert_size (data.output_pos, ==, uncompressed_length);
+  munit_assert_memory_equal (uncompressed_length, data.output, uncompressed);
+
+  free (data.input);
+  free (data.output);
+  free (uncompressed);
+
+  return MUNIT_OK;
+}
+
+static SquashStatus
+write_borrow_cb (size_t written, size_t* length, uint8_t** buffer, void* user_data) {
+  struct SpliceBuffers* data = (struct SpliceBuffers*) user_data;
+
+  data->output_pos += written;
+  munit_assert_size (data->output_pos, <=, data->output_length);
+
+  if (length == NULL)
+    return SQUASH_OK;
+
+  const size_t remaining = data->output_length - data->output_pos;
+  munit_assert_size (remaining, !=, 0);
+
+  const size_t max_length = (size_t) munit_rand_int_range (1, 1024);
+  *length = (remaining < max_length) ? remaining : max_length;
+  *buffer = data->output + data->output_pos;
+
+  return SQUASH_OK;
+}
+
+static SquashStatus
+read_borrow_cb (size_t* length, const uint8_t** buffer, void* user_data) {
+  struct SpliceBuffers* data = (struct SpliceBuffers*) user_data;
+
+  const size_t remaining = data->input_length - data->input_pos;
+  const size_t max_length = (size_t) munit_rand_int_range (1, 1024);
+
+  if (*length > remaining)
+    *length = remaining;
+  if (*length > max_length)
+    *length = max_length;
+
+  *buffer = data->input + data->input_pos;
+  data->input_pos += *length;
+
+  return (*length != 0) ? SQUASH_OK : SQUASH_END_OF_STREAM;
+}
+
+static MunitResult
+squash_test_custom_borrowed(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  if (strcmp (squash_codec_get_name (codec), "density") == 0)
+    return MUNIT_SKIP;
+
+  /* Leave some slack at the end of the buffers; codecs may ask for
+     output space they don't end up using. */
+  const size_t compressed_length = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH) + 1024;
+  struct SpliceBuffers data = {
+    SQUASH_STREAM_COMPRESS,
+    (uint8_t*) LOREM_IPSUM,
+    LOREM_IPSUM_LENGTH,
+    0,
+    munit_malloc (compressed_length),
+    compressed_length,
+    0
+  };
+
+  SquashStatus res = squash_splice_custom_borrowed_with_options (codec, SQUASH_STREAM_COMPRESS, write_borrow_cb, read_borrow_cb, &data, 0, NULL);
+  SQUASH_ASSERT_OK (res);
+  munit_assert_size (data.input_pos, ==, LOREM_IPSUM_LENGTH);
+
+  data.stream_type = SQUASH_STREAM_DECOMPRESS;
+  data.input = data.output;
+  data.input_length = data.output_pos;
+  data.input_pos = 0;
+  data.output_length = LOREM_IPSUM_LENGTH + 1024;
+  data.output = munit_malloc (data.output_length);
+  data.output_pos = 0;
+
+  res = squash_splice_custom_borrowed_with_options (codec, SQUASH_STREAM_DECOMPRESS, write_borrow_cb, read_borrow_cb, &data, 0, NULL);
+  SQUASH_ASSERT_OK (res);
+  munit_assert_size (data.output_pos, ==, LOREM_IPSUM_LENGTH);
+  munit_assert_memory_equal (LOREM_IPSUM_LENGTH, data.output, LOREM_IPSUM);
+
+  free (data.input);
+  free (data.output);
+
+  return MUNIT_OK;
+}
+
 MunitTest squash_splice_tests[] = {
   { (char*) "/custom", squash_test_custom, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/custom/large", squash_test_custom_large, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/custom/borrowed", squash_test_custom_borrowed, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
 
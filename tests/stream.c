@@ -1,5 +1,13 @@
 #include "test-squash.h"
 
+/* MIN evaluates its arguments twice, so the random step has to be
+   drawn before it is clamped. */
+static size_t
+random_step (size_t remaining, int max) {
+  const size_t step = (size_t) munit_rand_int_range (1, max);
+  return MIN(remaining, step);
+}
+
 static SquashStatus
 buffer_to_buffer_compress_with_stream (SquashCodec* codec,
                                        size_t* compressed_length,
@@ -223,10 +231,440 @@ squash_test_stream_single_byte(MUNIT_UNUSED const MunitParameter params[], void*
   return MUNIT_OK;
 }
 
+#define SQUASH_TEST_STREAM_INTERLEAVED 4
+
+/* Feed each stream a few bytes at a time, taking turns, until they
+   have all finished.  Plugins which only implement the splice API run
+   on a stack of their own (a coroutine, or a thread if
+   SQUASH_STREAM_COROUTINES=no), so this makes sure switching between
+   several of them on the same thread works. */
+static void
+squash_test_stream_interleave (size_t n_streams,
+                               SquashStream* streams[HEDLEY_ARRAY_PARAM(n_streams)],
+                               const size_t input_sizes[HEDLEY_ARRAY_PARAM(n_streams)],
+                               size_t output_size) {
+  bool done[SQUASH_TEST_STREAM_INTERLEAVED] = { false, };
+  size_t remaining = n_streams;
+  SquashStatus res;
+
+  munit_assert_size (n_streams, <=, SQUASH_TEST_STREAM_INTERLEAVED);
+
+  while (remaining != 0) {
+    for (size_t i = 0 ; i < n_streams ; i++) {
+      SquashStream* stream = streams[i];
+      if (done[i])
+        continue;
+
+      munit_assert_size (stream->total_out, <, output_size);
+      /* Input which hasn't been consumed yet must be left alone;
+         the plugin may still be holding on to it. */
+      if (stream->avail_in == 0)
+        stream->avail_in = random_step (input_sizes[i] - stream->total_in, 64);
+      stream->avail_out = random_step (output_size - stream->total_out, 64);
+
+      const bool finishing = (stream->total_in == input_sizes[i]);
+      if (finishing)
+        res = squash_stream_finish (stream);
+      else
+        res = squash_stream_process (stream);
+      SQUASH_ASSERT_NO_ERROR(res);
+
+      if (res == SQUASH_END_OF_STREAM || (finishing && res == SQUASH_OK)) {
+        done[i] = true;
+        remaining--;
+      }
+    }
+  }
+}
+
+static MunitResult
+squash_test_stream_interleaved(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  const size_t input_size = LOREM_IPSUM_LENGTH - (SQUASH_TEST_STREAM_INTERLEAVED * 64);
+  const size_t max_compressed_size = squash_codec_get_max_compressed_size (codec, input_size);
+  SquashStream* streams[SQUASH_TEST_STREAM_INTERLEAVED];
+  size_t input_sizes[SQUASH_TEST_STREAM_INTERLEAVED];
+  uint8_t* compressed[SQUASH_TEST_STREAM_INTERLEAVED];
+  uint8_t* decompressed[SQUASH_TEST_STREAM_INTERLEAVED];
+
+  for (size_t i = 0 ; i < SQUASH_TEST_STREAM_INTERLEAVED ; i++) {
+    /* One spare byte each, so a stream which has written all of its
+       output still has room to be finished. */
+    compressed[i] = munit_malloc (max_compressed_size + 1);
+    decompressed[i] = munit_malloc (input_size + 1);
+
+    streams[i] = squash_codec_create_stream (codec, SQUASH_STREAM_COMPRESS, NULL);
+    munit_assert_not_null (streams[i]);
+    streams[i]->next_in = LOREM_IPSUM + (i * 64);
+    streams[i]->next_out = compressed[i];
+    input_sizes[i] = input_size;
+  }
+
+  squash_test_stream_interleave (SQUASH_TEST_STREAM_INTERLEAVED, streams, input_sizes, max_compressed_size + 1);
+
+  for (size_t i = 0 ; i < SQUASH_TEST_STREAM_INTERLEAVED ; i++) {
+    input_sizes[i] = streams[i]->total_out;
+    squash_object_unref (streams[i]);
+
+    streams[i] = squash_codec_create_stream (codec, SQUASH_STREAM_DECOMPRESS, NULL);
+    munit_assert_not_null (streams[i]);
+    streams[i]->next_in = compressed[i];
+    streams[i]->next_out = decompressed[i];
+  }
+
+  squash_test_stream_interleave (SQUASH_TEST_STREAM_INTERLEAVED, streams, input_sizes, input_size + 1);
+
+  for (size_t i = 0 ; i < SQUASH_TEST_STREAM_INTERLEAVED ; i++) {
+    munit_assert_size (streams[i]->total_out, ==, input_size);
+    munit_assert_memory_equal (input_size, decompressed[i], LOREM_IPSUM + (i * 64));
+
+    squash_object_unref (streams[i]);
+    free (compressed[i]);
+    free (decompressed[i]);
+  }
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_stream_chunked(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  const size_t chunk_size = 4096;
+  const size_t uncompressed_length = LOREM_IPSUM_LENGTH * 16;
+  uint8_t* uncompressed = munit_malloc (uncompressed_length);
+  for (size_t i = 0 ; i < 16 ; i++)
+    memcpy (uncompressed + (i * LOREM_IPSUM_LENGTH), LOREM_IPSUM, LOREM_IPSUM_LENGTH);
+
+  SquashOptions* options = squash_options_new (codec, NULL);
+  if (options == NULL) {
+    free (uncompressed);
+    return MUNIT_SKIP;
+  }
+  squash_object_ref (options);
+  SQUASH_ASSERT_OK(squash_options_set_chunk_size (options, chunk_size));
+
+  const size_t compressed_capacity = squash_codec_get_max_compressed_size (codec, uncompressed_length) + 4096;
+  uint8_t* compressed = munit_malloc (compressed_capacity);
+  uint8_t* decompressed = munit_malloc (uncompressed_length);
+  SquashStatus res;
+
+  SquashStream* stream = squash_codec_create_stream_with_options (codec, SQUASH_STREAM_COMPRESS, options);
+  munit_assert_not_null (stream);
+  stream->next_in = uncompressed;
+  stream->next_out = compressed;
+  while (stream->total_in < uncompressed_length) {
+    stream->avail_in = random_step (uncompressed_length - stream->total_in, 1024);
+    do {
+      stream->avail_out = random_step (compressed_capacity - stream->total_out, 1024);
+      res = squash_stream_process (stream);
+    } while (res == SQUASH_PROCESSING);
+    SQUASH_ASSERT_OK(res);
+  }
+
+  do {
+    stream->avail_out = random_step (compressed_capacity - stream->total_out, 1024);
+    res = squash_stream_finish (stream);
+  } while (res == SQUASH_PROCESSING);
+  SQUASH_ASSERT_OK(res);
+
+  const size_t compressed_length = stream->total_out;
+  squash_object_unref (stream);
+
+  stream = squash_codec_create_stream_with_options (codec, SQUASH_STREAM_DECOMPRESS, options);
+  munit_assert_not_null (stream);
+  stream->next_in = compressed;
+  stream->next_out = decompressed;
+  while (stream->total_in < compressed_length) {
+    stream->avail_in = random_step (compressed_length - stream->total_in, 1024);
+    do {
+      stream->avail_out = random_step (uncompressed_length - stream->total_out, 1024);
+      res = squash_stream_process (stream);
+    } while (res == SQUASH_PROCESSING);
+    if (res == SQUASH_END_OF_STREAM)
+      break;
+    SQUASH_ASSERT_OK(res);
+  }
+
+  if (res != SQUASH_END_OF_STREAM) {
+    do {
+      stream->avail_out = random_step (uncompressed_length - stream->total_out, 1024);
+      res = squash_stream_finish (stream);
+    } while (res == SQUASH_PROCESSING);
+    SQUASH_ASSERT_OK(res);
+  }
+
+  munit_assert_size (stream->total_out, ==, uncompressed_length);
+  munit_assert_memory_equal (uncompressed_length, decompressed, uncompressed);
+  squash_object_unref (stream);
+
+  squash_object_unref (options);
+  free (compressed);
+  free (decompressed);
+  free (uncompressed);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_stream_chunked_corrupt(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  const size_t chunk_size = 4096;
+  SquashOptions* options = squash_options_new (codec, NULL);
+  if (options == NULL)
+    return MUNIT_SKIP;
+  squash_object_ref (options);
+  SQUASH_ASSERT_OK(squash_options_set_chunk_size (options, chunk_size));
+
+  /* Only codecs which are streamed by buffering use the framed
+     format; a single short chunk is easy to recognize. */
+  {
+    const size_t framed_capacity = squash_codec_get_max_compressed_size (codec, 100) + 32;
+    uint8_t* framed = munit_malloc (framed_capacity);
+    SquashStream* stream = squash_codec_create_stream_with_options (codec, SQUASH_STREAM_COMPRESS, options);
+    munit_assert_not_null (stream);
+    stream->next_in = LOREM_IPSUM;
+    stream->avail_in = 100;
+    stream->next_out = framed;
+    stream->avail_out = framed_capacity;
+    SquashStatus res;
+    do {
+      res = squash_stream_finish (stream);
+    } while (res == SQUASH_PROCESSING);
+    SQUASH_ASSERT_OK(res);
+
+    uint64_t frame_compressed_size = 0;
+    size_t pos = 1;
+    while (pos < stream->total_out && (framed[pos] & 0x80) != 0)
+      frame_compressed_size = (frame_compressed_size << 7) | (framed[pos++] & 0x7F);
+    frame_compressed_size = (frame_compressed_size << 7) | framed[pos++];
+    const bool is_framed = framed[0] == 100 && (pos + frame_compressed_size) == stream->total_out;
+
+    squash_object_unref (stream);
+    free (framed);
+
+    if (!is_framed) {
+      squash_object_unref (options);
+      return MUNIT_SKIP;
+    }
+  }
+
+  /* A frame claiming to be larger than a chunk, and one which is
+     bigger than any chunk could compress to. */
+  const uint64_t sizes[2][2] = {
+    { (uint64_t) chunk_size * 1024 * 1024, 16 },
+    { chunk_size, (uint64_t) squash_codec_get_max_compressed_size (codec, chunk_size) + 1 }
+  };
+
+  for (size_t i = 0 ; i < 2 ; i++) {
+    uint8_t frame[64] = { 0, };
+    size_t frame_size = squash_test_write_varuint (frame, sizes[i][0]);
+    frame_size += squash_test_write_varuint (frame + frame_size, sizes[i][1]);
+    frame_size += 16;
+
+    uint8_t decompressed[256];
+    SquashStream* stream = squash_codec_create_stream_with_options (codec, SQUASH_STREAM_DECOMPRESS, options);
+    munit_assert_not_null (stream);
+    stream->next_in = frame;
+    stream->avail_in = frame_size;
+    stream->next_out = decompressed;
+    stream->avail_out = sizeof (decompressed);
+
+    SquashStatus res;
+    do {
+      res = squash_stream_process (stream);
+    } while (res == SQUASH_PROCESSING);
+    munit_assert_int(res, ==, SQUASH_INVALID_BUFFER);
+
+    squash_object_unref (stream);
+  }
+
+  squash_object_unref (options);
+
+  return MUNIT_OK;
+}
+
+static MunitResult
+squash_test_stream_threaded(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  SquashOptions* options = squash_test_threaded_options_new (codec, 4096);
+  if (options == NULL)
+    return MUNIT_SKIP;
+
+  const size_t uncompressed_length = LOREM_IPSUM_LENGTH * 16;
+  uint8_t* uncompressed = squash_test_threaded_data_new (uncompressed_length);
+
+  const size_t compressed_capacity = squash_codec_get_max_compressed_size (codec, uncompressed_length) * 2;
+  uint8_t* compressed = munit_malloc (compressed_capacity);
+  uint8_t* decompressed = munit_malloc (uncompressed_length);
+  SquashStatus res;
+
+  SquashStream* stream = squash_codec_create_stream_with_options (codec, SQUASH_STREAM_COMPRESS, options);
+  munit_assert_not_null (stream);
+  stream->next_in = uncompressed;
+  stream->next_out = compressed;
+  while (stream->total_in < uncompressed_length) {
+    stream->avail_in = random_step (uncompressed_length - stream->total_in, 4096);
+    do {
+      stream->avail_out = random_step (compressed_capacity - stream->total_out, 1024);
+      res = squash_stream_process (stream);
+    } while (res == SQUASH_PROCESSING);
+    SQUASH_ASSERT_OK(res);
+
+    /* Flushing must write out everything consumed so far. */
+    if (stream->total_in > (uncompressed_length / 2) && stream->state == SQUASH_STREAM_STATE_IDLE) {
+      do {
+        stream->avail_out = random_step (compressed_capacity - stream->total_out, 1024);
+        res = squash_stream_flush (stream);
+      } while (res == SQUASH_PROCESSING);
+      SQUASH_ASSERT_OK(res);
+
+      size_t flushed_length = stream->total_in;
+      res = squash_codec_decompress (codec, &flushed_length, decompressed, stream->total_out, compressed, NULL);
+      SQUASH_ASSERT_OK(res);
+      munit_assert_size (flushed_length, ==, stream->total_in);
+      munit_assert_memory_equal (flushed_length, decompressed, uncompressed);
+    }
+  }
+
+  do {
+    stream->avail_out = random_step (compressed_capacity - stream->total_out, 1024);
+    res = squash_stream_finish (stream);
+  } while (res == SQUASH_PROCESSING);
+  SQUASH_ASSERT_OK(res);
+
+  const size_t compressed_length = stream->total_out;
+  squash_object_unref (stream);
+
+  size_t decompressed_length = uncompressed_length;
+  res = squash_codec_decompress (codec, &decompressed_length, decompressed, compressed_length, compressed, NULL);
+  SQUASH_ASSERT_OK(res);
+  munit_assert_size (decompressed_length, ==, uncompressed_length);
+  munit_assert_memory_equal (uncompressed_length, decompressed, uncompressed);
+
+  squash_object_unref (options);
+  free (compressed);
+  free (decompressed);
+  free (uncompressed);
+
+  return MUNIT_OK;
+}
+
+static SquashStatus
+stream_process_all (SquashStream* stream,
+                    size_t* output_length,
+                    uint8_t output[HEDLEY_ARRAY_PARAM(*output_length)],
+                    size_t input_length,
+                    const uint8_t input[HEDLEY_ARRAY_PARAM(input_length)]) {
+  SquashStatus res;
+
+  munit_assert_size (stream->total_in, ==, 0);
+  munit_assert_size (stream->total_out, ==, 0);
+  munit_assert_int (stream->state, ==, SQUASH_STREAM_STATE_IDLE);
+
+  stream->next_in = input;
+  stream->avail_in = input_length;
+  stream->next_out = output;
+  stream->avail_out = *output_length;
+
+  do {
+    res = squash_stream_process (stream);
+  } while (res == SQUASH_PROCESSING);
+
+  if (res == SQUASH_OK) {
+    do {
+      res = squash_stream_finish (stream);
+    } while (res == SQUASH_PROCESSING);
+  } else if (res == SQUASH_END_OF_STREAM) {
+    res = SQUASH_OK;
+  }
+
+  if (res == SQUASH_OK)
+    *output_length = stream->total_out;
+
+  return res;
+}
+
+static MunitResult
+squash_test_stream_pool(MUNIT_UNUSED const MunitParameter params[], void* user_data) {
+  munit_assert_not_null(user_data);
+  SquashCodec* codec = (SquashCodec*) user_data;
+
+  const size_t compressed_capacity = squash_codec_get_max_compressed_size (codec, LOREM_IPSUM_LENGTH);
+  uint8_t* expected = munit_malloc (compressed_capacity);
+  uint8_t* compressed = munit_malloc (compressed_capacity);
+  uint8_t* decompressed = munit_malloc (LOREM_IPSUM_LENGTH);
+  size_t expected_length = 0;
+  SquashStatus res;
+
+  SquashStreamPool* pool = squash_stream_pool_new (2);
+  munit_assert_not_null (pool);
+
+  for (int i = 0 ; i < 3 ; i++) {
+    SquashStream* stream = squash_stream_pool_acquire (pool, codec, SQUASH_STREAM_COMPRESS, NULL);
+    munit_assert_not_null (stream);
+
+    size_t compressed_length = compressed_capacity;
+    res = stream_process_all (stream, &compressed_length, compressed, LOREM_IPSUM_LENGTH, (const uint8_t*) LOREM_IPSUM);
+    SQUASH_ASSERT_OK(res);
+
+    /* A reused stream must produce exactly what a new one did. */
+    if (i == 0) {
+      memcpy (expected, compressed, compressed_length);
+      expected_length = compressed_length;
+    } else {
+      munit_assert_memory_equal (expected_length, compressed, expected);
+      munit_assert_size (compressed_length, ==, expected_length);
+    }
+
+    const bool resettable = (squash_stream_reset (stream) == SQUASH_OK);
+    squash_stream_pool_release (pool, stream);
+
+    if (resettable) {
+      SquashStream* reused = squash_stream_pool_acquire (pool, codec, SQUASH_STREAM_COMPRESS, NULL);
+      munit_assert_ptr_equal (reused, stream);
+      squash_stream_pool_release (pool, reused);
+    }
+  }
+
+  for (int i = 0 ; i < 3 ; i++) {
+    SquashStream* stream = squash_stream_pool_acquire (pool, codec, SQUASH_STREAM_DECOMPRESS, NULL);
+    munit_assert_not_null (stream);
+
+    size_t decompressed_length = LOREM_IPSUM_LENGTH;
+    res = stream_process_all (stream, &decompressed_length, decompressed, expected_length, expected);
+    SQUASH_ASSERT_OK(res);
+    munit_assert_size (decompressed_length, ==, LOREM_IPSUM_LENGTH);
+    munit_assert_memory_equal (LOREM_IPSUM_LENGTH, decompressed, LOREM_IPSUM);
+
+    squash_stream_pool_release (pool, stream);
+  }
+
+  squash_stream_pool_free (pool);
+
+  free (expected);
+  free (compressed);
+  free (decompressed);
+
+  return MUNIT_OK;
+}
+
 MunitTest squash_stream_tests[] = {
   { (char*) "/compress", squash_test_stream_compress, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { (char*) "/decompress", squash_test_stream_decompress, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { (char*) "/single-byte", squash_test_stream_single_byte, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/interleaved", squash_test_stream_interleaved, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/chunked", squash_test_stream_chunked, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/chunked/corrupt", squash_test_stream_chunked_corrupt, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/threaded", squash_test_stream_threaded, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
+  { (char*) "/pool", squash_test_stream_pool, squash_test_get_codec, NULL, MUNIT_TEST_OPTION_NONE, SQUASH_CODEC_PARAMETER },
   { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }
 };
 
@@ -6,6 +6,14 @@
 #include "munit/munit.h"
 
 void* squash_test_get_codec(MUNIT_UNUSED const MunitParameter params[], void* user_data);
+size_t squash_test_write_varuint(uint8_t* p, uint64_t v);
+uint8_t* squash_test_lorem_ipsum_new(size_t size);
+SquashOptions* squash_test_threaded_options_new(SquashCodec* codec, size_t chunk_size);
+uint8_t* squash_test_threaded_data_new(size_t size);
+size_t squash_test_get_allocations(void);
+
+/* Number of threads requested by tests of multi-threaded compression */
+#define SQUASH_TEST_THREADS 4
 
 #define SQUASH_CODEC_PARAMETER ((MunitParameterEnum*)(uintptr_t) 0xdeadbeef)
 
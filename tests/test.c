@@ -12,13 +12,24 @@
 #endif
 #define SQUASH_PTR_TEST_INT INT64_C(0xBADC0FFEE0DDF00D)
 
+/* Allocations made by the current thread, so tests can check that
+   an operation doesn't allocate. */
+static SQUASH_THREAD_LOCAL size_t squash_test_allocations = 0;
+
+size_t
+squash_test_get_allocations(void) {
+  return squash_test_allocations;
+}
+
 static void* squash_test_malloc (size_t size) {
+  squash_test_allocations++;
   uint64_t* ptr = malloc (size + sizeof(uint64_t));
   *ptr = SQUASH_PTR_TEST_INT;
   return (void*) (ptr + 1);
 }
 
 static void* squash_test_calloc (size_t nmemb, size_t size) {
+  squash_test_allocations++;
   uint64_t* ptr = calloc (1, (nmemb * size) + sizeof(uint64_t));
   *ptr = SQUASH_PTR_TEST_INT;
   return (void*) (ptr + 1);
@@ -30,6 +41,7 @@ static void* squash_test_realloc (void* ptr, size_t size) {
   } else {
     uint64_t* rptr = ((uint64_t*) ptr) - 1;
     munit_assert_uint64 (*rptr, ==, SQUASH_PTR_TEST_INT);
+    squash_test_allocations++;
     rptr = realloc (rptr, size + sizeof(uint64_t));
     return (void*) (rptr + 1);
   }
@@ -49,6 +61,66 @@ squash_test_get_codec(MUNIT_UNUSED const MunitParameter params[], void* user_dat
   return squash_get_codec (munit_parameters_get (params, "codec"));
 }
 
+/* Encode a variable-length integer the same way Squash does (for
+   values below 2^56), for tests which need to craft headers. */
+size_t
+squash_test_write_varuint(uint8_t* p, uint64_t v) {
+  uint8_t buf[8];
+  size_t n = 0;
+
+  do {
+    buf[n++] = (uint8_t) (v & 0x7F);
+    v >>= 7;
+  } while (v != 0);
+
+  for (size_t i = 0 ; i < n ; i++)
+    p[i] = (uint8_t) (buf[n - 1 - i] | ((i == n - 1) ? 0 : 0x80));
+
+  return n;
+}
+
+/* Options asking for multi-threaded compression with the given chunk
+   size, or NULL if the codec doesn't support it.  The caller owns a
+   reference. */
+SquashOptions*
+squash_test_threaded_options_new(SquashCodec* codec, size_t chunk_size) {
+  if ((squash_codec_get_info (codec) & SQUASH_CODEC_INFO_CONCATENABLE) == 0)
+    return NULL;
+
+  SquashOptions* options = squash_options_new (codec, NULL);
+  if (options == NULL)
+    return NULL;
+  squash_object_ref (options);
+
+  SQUASH_ASSERT_OK(squash_options_set_threads (options, SQUASH_TEST_THREADS));
+  SQUASH_ASSERT_OK(squash_options_set_chunk_size (options, chunk_size));
+  munit_assert_uint (squash_options_get_threads (options), >, 1);
+
+  return options;
+}
+
+/* Back-to-back copies of LOREM_IPSUM, the last one truncated, for
+   tests which need more text than it provides. */
+uint8_t*
+squash_test_lorem_ipsum_new(size_t size) {
+  uint8_t* data = munit_malloc (size);
+  for (size_t pos = 0 ; pos < size ; pos += LOREM_IPSUM_LENGTH) {
+    const size_t l = size - pos;
+    memcpy (data + pos, LOREM_IPSUM, (l < LOREM_IPSUM_LENGTH) ? l : LOREM_IPSUM_LENGTH);
+  }
+  return data;
+}
+
+/* Somewhat compressible data, for tests which need it to span many
+   chunks. */
+uint8_t*
+squash_test_threaded_data_new(size_t size) {
+  uint8_t* data = munit_malloc (size);
+  for (size_t i = 0 ; i < size ; i++)
+    data[i] = ((const uint8_t*) LOREM_IPSUM)[munit_rand_int_range (0, 31)];
+  return data;
+}
+
 static size_t codec_list_l = 0;
 
 MunitParameterEnum* squash_codec_parameter = (MunitParameterEnum[]) {
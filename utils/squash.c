@@ -47,6 +47,7 @@ __attribute__((__noreturn__))
 static void
 print_help_and_exit (int argc, char** argv, int exit_code) {
   fprintf (stderr, "Usage: %s [OPTION]... INPUT [OUTPUT]\n", argv[0]);
+  fprintf (stderr, "       %s --train-dict -c CODEC [OPTION]... DICTIONARY SAMPLE...\n", argv[0]);
   fprintf (stderr, "Compress and decompress files.\n");
   fprintf (stderr, "\n");
   fprintf (stderr, "Options:\n");
@@ -60,6 +61,9 @@ print_help_and_exit (int argc, char** argv, int exit_code) {
   fprintf (stderr, "\t-P, --list-plugins      List available plugins and exit\n");
   fprintf (stderr, "\t-f, --force             Overwrite the output file if it exists.\n");
   fprintf (stderr, "\t-d, --decompress        Decompress\n");
+  fprintf (stderr, "\t    --dictionary file   Use the dictionary in file.\n");
+  fprintf (stderr, "\t    --train-dict        Train a dictionary from sample files.\n");
+  fprintf (stderr, "\t    --dict-size bytes   Maximum size of a trained dictionary.\n");
   fprintf (stderr, "\t-V, --version           Print version number and exit\n");
   fprintf (stderr, "\t-h, --help              Print this help screen and exit.\n");
 
@@ -143,6 +147,116 @@ list_plugins_and_codecs_foreach_cb (SquashPlugin* plugin, void* data) {
   free (prefix);
 }
 
+static uint8_t*
+read_file (const char* filename, size_t* size) {
+  FILE* fp = fopen (filename, "rb");
+  if (fp == NULL)
+    return NULL;
+
+  uint8_t* data = NULL;
+  size_t allocated = 0;
+  *size = 0;
+
+  for (;;) {
+    if (*size == allocated) {
+      allocated = (allocated == 0) ? 65536 : allocated * 2;
+      uint8_t* tmp = (uint8_t*) realloc (data, allocated);
+      if (tmp == NULL) {
+        free (data);
+        fclose (fp);
+        return NULL;
+      }
+      data = tmp;
+    }
+
+    const size_t bytes_read = fread (data + *size, 1, allocated - *size, fp);
+    *size += bytes_read;
+    if (bytes_read == 0)
+      break;
+  }
+
+  if (ferror (fp)) {
+    free (data);
+    data = NULL;
+  }
+
+  fclose (fp);
+
+  return data;
+}
+
+static FILE*
+open_output (const char* filename, bool force) {
+  int fd = open (filename,
+#if !defined(_WIN32)
+                 O_RDWR | O_CREAT | (force ? O_TRUNC : O_EXCL),
+                 S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH
+#else
+                 O_RDWR | O_CREAT | (force ? O_TRUNC : O_EXCL) | O_BINARY,
+                 S_IREAD | S_IWRITE
+#endif
+    );
+  if (fd < 0)
+    return NULL;
+
+  return fdopen (fd, "wb");
+}
+
+static int
+train_dictionary (SquashCodec* codec, SquashOptions* options, size_t dictionary_size,
+                  const char* output_name, bool force,
+                  int n_samples, char** sample_names) {
+  int retval = EXIT_SUCCESS;
+  const uint8_t** samples = (const uint8_t**) calloc ((size_t) n_samples, sizeof (uint8_t*));
+  size_t* sample_sizes = (size_t*) calloc ((size_t) n_samples, sizeof (size_t));
+  SquashDictionary* dictionary = NULL;
+  FILE* output = NULL;
+
+  for (int i = 0 ; i < n_samples ; i++) {
+    samples[i] = read_file (sample_names[i], &(sample_sizes[i]));
+    if (samples[i] == NULL) {
+      perror ("Unable to read sample file");
+      retval = exit_failure ();
+      goto cleanup;
+    }
+  }
+
+  dictionary = squash_dictionary_train (codec, dictionary_size, (size_t) n_samples, samples, sample_sizes, options);
+  if (dictionary == NULL) {
+    fprintf (stderr, "Failed to train dictionary\n");
+    retval = exit_failure ();
+    goto cleanup;
+  }
+  squash_object_ref (dictionary);
+
+  output = (strcmp (output_name, "-") == 0) ? stdout : open_output (output_name, force);
+  if (output == NULL) {
+    perror ("Unable to open output file");
+    retval = exit_failure ();
+    goto cleanup;
+  }
+
+  if (fwrite (squash_dictionary_get_data (dictionary), 1, squash_dictionary_get_size (dictionary), output) != squash_dictionary_get_size (dictionary)) {
+    perror ("Unable to write dictionary");
+    retval = exit_failure ();
+    goto cleanup;
+  }
+
+ cleanup:
+
+  if (output != NULL && output != stdout)
+    fclose (output);
+
+  squash_object_unref (dictionary);
+
+  for (int i = 0 ; i < n_samples ; i++)
+    free ((uint8_t*) samples[i]);
+  free (samples);
+  free (sample_sizes);
+
+  return retval;
+}
+
 #if !defined(_WIN32)
 #define squash_strndup(s,n) strndup(s,n)
 #else
@@ -175,6 +289,9 @@ int main (int argc, char** argv) {
   char** option_values = NULL;
   bool keep = false;
   bool force = false;
+  bool train_dict = false;
+  size_t dictionary_size = 112640;
+  const char* dictionary_name = NULL;
   int opt;
   int optc = 0;
   char* tmp_string;
@@ -189,6 +306,9 @@ int main (int argc, char** argv) {
     {"list-plugins", PARG_NOARG, NULL, 'P'},
     {"force", PARG_NOARG, NULL, 'f'},
     {"decompress", PARG_NOARG, NULL, 'd'},
+    {"dictionary", PARG_REQARG, NULL, 'D'},
+    {"train-dict", PARG_NOARG, NULL, 'T'},
+    {"dict-size", PARG_REQARG, NULL, 'S'},
     {"version", PARG_NOARG, NULL, 'V'},
     {"help", PARG_NOARG, NULL, 'h'},
     {NULL, 0, NULL, 0}
@@ -251,6 +371,20 @@ int main (int argc, char** argv) {
       case 'V':
         print_version_and_exit (argc, argv, EXIT_SUCCESS);
         break;
+      case 'D':
+        dictionary_name = ps.optarg;
+        break;
+      case 'T':
+        train_dict = true;
+        break;
+      case 'S':
+        dictionary_size = (size_t) strtoull (ps.optarg, &tmp_string, 0);
+        if (*tmp_string != '\0' || dictionary_size == 0) {
+          fprintf (stderr, "Invalid dictionary size '%s'\n", ps.optarg);
+          retval = exit_failure ();
+          goto cleanup;
+        }
+        break;
     }
 
     optc++;
@@ -268,6 +402,32 @@ int main (int argc, char** argv) {
     goto cleanup;
   }
 
+  if (train_dict) {
+    if (codec == NULL) {
+      fprintf (stderr, "You must specify a codec (with -c) to train a dictionary for.\n");
+      retval = exit_failure ();
+      goto cleanup;
+    }
+
+    if ((squash_codec_get_info (codec) & SQUASH_CODEC_INFO_DICTIONARY) == 0) {
+      fprintf (stderr, "The %s codec does not support dictionaries.\n", squash_codec_get_name (codec));
+      retval = exit_failure ();
+      goto cleanup;
+    }
+
+    if (argc - ps.optind < 2) {
+      fprintf (stderr, "You must provide a dictionary file name and at least one sample file.\n");
+      retval = exit_failure ();
+      goto cleanup;
+    }
+
+    options = squash_options_newa (codec, (const char * const*) option_keys, (const char * const*) option_values);
+    retval = train_dictionary (codec, options, dictionary_size, argv[ps.optind], force,
+                               argc - (ps.optind + 1), argv + ps.optind + 1);
+    squash_object_unref (options);
+    goto cleanup;
+  }
+
   if ( ps.optind < argc ) {
     input_name = argv[ps.optind++];
 
@@ -348,29 +508,42 @@ int main (int argc, char** argv) {
   if ( strcmp (output_name, "-") == 0 ) {
     output = stdout;
   } else {
-    int output_fd = open (output_name,
-#if !defined(_WIN32)
-                          O_RDWR | O_CREAT | (force ? O_TRUNC : O_EXCL),
-                          S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH
-#else
-                          O_RDWR | O_CREAT | (force ? O_TRUNC : O_EXCL) | O_BINARY,
-                          S_IREAD | S_IWRITE
-#endif
-    );
-    if ( output_fd < 0 ) {
+    output = open_output (output_name, force);
+    if ( output == NULL ) {
       perror ("Unable to open output file");
       retval = exit_failure ();
       goto cleanup;
     }
-    output = fdopen (output_fd, "wb");
-    if ( output == NULL ) {
-      perror ("Unable to open output");
+  }
+
+  options = squash_options_newa (codec, (const char * const*) option_keys, (const char * const*) option_values);
+
+  if ( dictionary_name != NULL ) {
+    size_t dictionary_data_size;
+    uint8_t* dictionary_data = read_file (dictionary_name, &dictionary_data_size);
+    if ( dictionary_data == NULL ) {
+      perror ("Unable to read dictionary");
       retval = exit_failure ();
       goto cleanup;
     }
-  }
 
-  options = squash_options_newa (codec, (const char * const*) option_keys, (const char * const*) option_values);
+    SquashDictionary* dictionary = (dictionary_data_size == 0) ? NULL : squash_dictionary_new (dictionary_data_size, dictionary_data);
+    free (dictionary_data);
+
+    if ( options == NULL || dictionary == NULL ) {
+      res = SQUASH_BAD_PARAM;
+    } else {
+      squash_object_ref (dictionary);
+      res = squash_options_set_dictionary (options, dictionary);
+    }
+    squash_object_unref (dictionary);
+
+    if ( res != SQUASH_OK ) {
+      fprintf (stderr, "Unable to use dictionary: %s\n", squash_status_to_string (res));
+      retval = exit_failure ();
+      goto cleanup;
+    }
+  }
 
   res = squash_splice_with_options (codec, direction, output, input, 0, options);
 